@@ -4,6 +4,11 @@
  * @author Tony Chiodo (http://dodecaplex.net)
  */
 
+/* Pipelines need fopencookie, which glibc and musl declare for GNU sources. */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
@@ -11,6 +16,381 @@
 
 #include "beflux.h"
 
+#ifndef BFX_NO_THREADS
+#define BFX_THREADS
+#include <pthread.h>
+#endif
+
+/* Pipeline stages pass bytes through stdio streams over in-memory rings. */
+#if defined(BFX_THREADS) && defined(__linux__) && defined(__GNUC__)
+#define BFX_PIPES
+#endif
+
+#ifndef LIBBEFLUX
+#include <dirent.h>
+#include <sys/stat.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+/* The daemon mode relies on epoll and Unix sockets. */
+#if defined(__linux__) && defined(BFX_THREADS)
+#define BFX_SERVE
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#endif
+
+/* Saves rewrite files in place where they can check them with stat. */
+#if defined(__unix__) || defined(__APPLE__)
+#define BFX_SAVE_INCREMENTAL
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Hot reload watches source files with inotify. */
+#if defined(__linux__) && defined(__GNUC__)
+#define BFX_WATCH
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/* The sampling profiler raises SIGPROF from a timer on the CPU clock. */
+#if defined(__linux__) && defined(__GNUC__)
+#define BFX_PROFILE
+#endif
+
+/* Hardware counters come from perf events. */
+#if defined(__linux__) && defined(__GNUC__)
+#define BFX_PERF
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* Input statistics only time reads that find the stream's buffer empty,
+ * where the C library lets us look. Elsewhere every byte is timed. */
+#if defined(__GLIBC__)
+#define BFX_BUFFERED(f) ((f)->_IO_read_ptr < (f)->_IO_read_end)
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+#define BFX_BUFFERED(f) ((f)->_r > 0)
+#else
+#define BFX_BUFFERED(f) 0
+#endif
+
+/* Ensembles use AVX2 for 8-bit lanes on processors that have it. */
+#if BFX_WORD_BITS == 8 && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BFX_LANES_AVX2
+#include <immintrin.h>
+#endif
+
+/* Worker threads share program memory, which the tile cache does not allow. */
+#if defined(BFX_THREADS) && !defined(BFX_SPARSE)
+#define BFX_PARALLEL_IPS
+#endif
+
+/* Index wrapping; for 8-bit words every index wraps with the word itself. */
+#if BFX_WORD_BITS == 8
+#define BFX_STACK_INDEX(i)    ((bfx_word) (i))
+#define BFX_FRAME_INDEX(i)    ((bfx_word) (i))
+#define BFX_PROGRAM_INDEX(i)  ((bfx_word) (i))
+#define BFX_REGISTER_INDEX(i) ((bfx_word) (i))
+#define BFX_BANK_VALID(i)     1
+#define BFX_CELL(prog, row, col) \
+  ((col) + BFX_PROGRAM_WIDTH * (row) + BFX_PROGRAM_SIZE * (size_t) (prog))
+#else
+#define BFX_STACK_INDEX(i)    ((i) & (BFX_STACK_SIZE - 1))
+#define BFX_FRAME_INDEX(i)    ((i) & (BFX_BANK_SIZE - 1))
+#define BFX_PROGRAM_INDEX(i)  ((i) & (BFX_PROGRAM_COUNT - 1))
+#define BFX_REGISTER_INDEX(i) ((i) & (BFX_REGISTER_COUNT - 1))
+#define BFX_BANK_VALID(i)     ((i) < BFX_BANK_SIZE)
+#define BFX_CELL(prog, row, col) \
+  (((col) & (BFX_PROGRAM_WIDTH - 1)) + \
+   BFX_PROGRAM_WIDTH * (size_t) ((row) & (BFX_PROGRAM_HEIGHT - 1)) + \
+   BFX_PROGRAM_SIZE  * (size_t) ((prog) & (BFX_PROGRAM_COUNT - 1)))
+#endif
+
+#define BFX_TILE_MASK  (BFX_TILE_SIZE - 1)
+
+/*
+ * Tiled dense programs: each program is a grid of BFX_TILE_SIZE square
+ * tiles stored one after another, so an IP moving North or South touches
+ * the same few cache lines as one moving East or West. Rows and columns are
+ * padded to a whole number of tiles, which makes the 256th row and column
+ * of an 8-bit build real cells, as in sparse builds.
+ */
+#if defined(BFX_TILED) && !defined(BFX_SPARSE)
+#if BFX_WORD_BITS == 8
+#define BFX_TILED_WIDTH   ((size_t) BFX_WORD_MAX + 1)
+#define BFX_TILED_HEIGHT  ((size_t) BFX_WORD_MAX + 1)
+#else
+#define BFX_TILED_WIDTH   ((size_t) BFX_PROGRAM_WIDTH)
+#define BFX_TILED_HEIGHT  ((size_t) BFX_PROGRAM_HEIGHT)
+#if BFX_PROGRAM_WIDTH < BFX_TILE_SIZE || BFX_PROGRAM_HEIGHT < BFX_TILE_SIZE
+#error "BFX_TILED needs programs at least one tile wide and high"
+#endif
+#endif
+#define BFX_PROGRAM_CELLS (BFX_TILED_WIDTH * BFX_TILED_HEIGHT)
+#define BFX_TILED_INDEX(row, col) \
+  ((((row) >> BFX_TILE_BITS) * (BFX_TILED_WIDTH >> BFX_TILE_BITS) + \
+    ((col) >> BFX_TILE_BITS)) << (2 * BFX_TILE_BITS) | \
+   ((row) & BFX_TILE_MASK) << BFX_TILE_BITS | ((col) & BFX_TILE_MASK))
+#undef BFX_CELL
+#define BFX_CELL(prog, row, col) \
+  (BFX_TILED_INDEX( \
+     (size_t) (row) & (BFX_TILED_HEIGHT - 1), \
+     (size_t) (col) & (BFX_TILED_WIDTH - 1)) + \
+   BFX_PROGRAM_CELLS * (size_t) BFX_PROGRAM_INDEX(prog))
+#else
+#define BFX_PROGRAM_CELLS BFX_PROGRAM_SIZE
+#endif
+
+/* Extent of a row and of a whole program, as seen by the IP. */
+#if BFX_WORD_BITS == 8 || defined(BFX_SPARSE)
+#define BFX_EDGE_E(col)       ((col) == BFX_WORD_MAX)
+#define BFX_EDGE_W(col)       ((col) == 0x00)
+#else
+#define BFX_EDGE_E(col)       (((col) & (BFX_PROGRAM_WIDTH - 1)) == BFX_PROGRAM_WIDTH - 1)
+#define BFX_EDGE_W(col)       (((col) & (BFX_PROGRAM_WIDTH - 1)) == 0x00)
+#endif
+
+#ifdef BFX_SPARSE
+#define BFX_ROW_LIMIT  ((size_t) BFX_WORD_MAX + 1)
+#define BFX_GRID_LIMIT \
+  (BFX_WORD_BITS < 32 ? BFX_ROW_LIMIT * BFX_ROW_LIMIT : (size_t) -1)
+#else
+#define BFX_ROW_LIMIT  BFX_PROGRAM_WIDTH
+#define BFX_GRID_LIMIT BFX_PROGRAM_SIZE
+#endif
+
+/*
+ * Dirty rows: every program row has a flag byte with a bit for each consumer
+ * of changes. Writes to a row set all of them, and each consumer clears only
+ * its own, so bfx_save and callers of bfx_program_clean don't hide changes
+ * from each other. Sparse tiles keep flags for their own rows.
+ */
+#define BFX_DIRTY_SAVE 0x01 /* Rows bfx_save has yet to write */
+#define BFX_DIRTY_USER 0x02 /* Rows reported by bfx_program_dirty */
+#define BFX_DIRTY_ALL  (BFX_DIRTY_SAVE | BFX_DIRTY_USER)
+
+#if BFX_WORD_BITS == 8
+#define BFX_DIRTY_ROWS     ((size_t) BFX_WORD_MAX + 1)
+#define BFX_DIRTY_ROW(row) ((size_t) (row))
+#else
+#define BFX_DIRTY_ROWS     ((size_t) BFX_PROGRAM_HEIGHT)
+#define BFX_DIRTY_ROW(row) ((size_t) ((row) & (BFX_PROGRAM_HEIGHT - 1)))
+#endif
+#define BFX_DIRTY_FLAGS(bfx, prog) \
+  ((bfx)->dirty + (size_t) BFX_PROGRAM_INDEX(prog) * BFX_DIRTY_ROWS)
+
+/* Rows of source text that bfx_load reads into a program. */
+#ifdef BFX_SPARSE
+#define BFX_SOURCE_HEIGHT BFX_ROW_LIMIT
+#else
+#define BFX_SOURCE_HEIGHT BFX_PROGRAM_HEIGHT
+#endif
+
+#define BFX_OP_NAME(op) (BFX_BANK_VALID(op) ? bfx_opnames[op] : "OP??")
+
+/* Built-in ops that ITER may repeat without returning to the main loop.
+ * None of them move the IP, change the mode or switch programs, so the op
+ * under the IP stays the same for every iteration. */
+#define BFX_ITER_SAFE "!$%&'()*+,-./0123456789:=DEGKLMNTUYZ\\`abcdefgilnoprstu~\x7f"
+
+#if defined(__GNUC__)
+#define BFX_ATOMIC_LOAD(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define BFX_ATOMIC_STORE(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define BFX_ATOMIC_EXCHANGE(p, v) __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+
+/* Program cells and registers may be shared with worker threads. */
+#define BFX_RELAXED_LOAD(p)        __atomic_load_n((p), __ATOMIC_RELAXED)
+#define BFX_RELAXED_STORE(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define BFX_RELAXED_EXCHANGE(p, v) __atomic_exchange_n((p), (v), __ATOMIC_RELAXED)
+#define BFX_RELAXED_ADD(p, v)      __atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+#define BFX_RELAXED_FETCH_ADD(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define BFX_RELAXED_AND(p, v)      __atomic_and_fetch((p), (v), __ATOMIC_RELAXED)
+#else
+#define BFX_RELAXED_LOAD(p)        (*(p))
+#define BFX_RELAXED_STORE(p, v)    (*(p) = (v))
+#define BFX_RELAXED_EXCHANGE(p, v) bfx_relaxed_exchange((p), (v))
+#define BFX_RELAXED_ADD(p, v)      (*(p) += (v))
+#define BFX_RELAXED_FETCH_ADD(p, v) ((*(p) += (v)) - (v))
+#define BFX_RELAXED_AND(p, v)      (*(p) &= (v))
+static bfx_word bfx_relaxed_exchange(bfx_word *p, bfx_word v) {
+  bfx_word old = *p;
+  *p = v;
+  return old;
+}
+
+#define BFX_ATOMIC_LOAD(p)        (*(p))
+#define BFX_ATOMIC_STORE(p, v)    (*(p) = (v))
+#define BFX_ATOMIC_EXCHANGE(p, v) bfx_exchange((p), (v))
+static sig_atomic_t bfx_exchange(volatile sig_atomic_t *p, sig_atomic_t v) {
+  sig_atomic_t old = *p;
+  *p = v;
+  return old;
+}
+#endif
+
+/*******************************************************************************
+ * Memory
+ */
+#define BFX_ARENA_ALIGN 16
+
+static void *bfx_default_alloc(void *ctx, size_t size) {
+  (void) ctx;
+  return calloc(1, size);
+}
+
+static void *bfx_default_resize(void *ctx, void *ptr, size_t old_size, size_t size) {
+  (void) ctx; (void) old_size;
+  return realloc(ptr, size);
+}
+
+static void bfx_default_release(void *ctx, void *ptr, size_t size) {
+  (void) ctx; (void) size;
+  free(ptr);
+}
+
+const bfx_allocator bfx_default_allocator = {
+  bfx_default_alloc, bfx_default_resize, bfx_default_release, NULL
+};
+
+/**
+ * \brief Records a change in the memory held by an interpreter. Workers
+ *        share their root's counts.
+ */
+static void bfx_alloc_count(beflux *root, size_t old_size, size_t size) {
+  bfx_alloc_stats *s = &root->alloc_stats;
+  size_t bytes = BFX_RELAXED_ADD(&s->bytes, size - old_size);
+  if (bytes > BFX_RELAXED_LOAD(&s->peak))
+    BFX_RELAXED_STORE(&s->peak, bytes);
+}
+
+/**
+ * \brief Allocates zeroed memory through the interpreter's allocator.
+ * \return The memory, or NULL if the allocator failed.
+ */
+static void *bfx_alloc(beflux *bfx, size_t size) {
+  beflux *root = bfx->root;
+  void *p = root->allocator.alloc(root->allocator.ctx, size);
+
+  if (p == NULL) {
+    BFX_RELAXED_ADD(&root->alloc_stats.failures, 1);
+    return NULL;
+  }
+  BFX_RELAXED_ADD(&root->alloc_stats.allocs, 1);
+  bfx_alloc_count(root, 0, size);
+  return p;
+}
+
+/**
+ * \brief Releases memory allocated through the interpreter's allocator.
+ * \param size The size it was allocated or last resized with.
+ */
+static void bfx_dealloc(beflux *bfx, void *ptr, size_t size) {
+  beflux *root = bfx->root;
+  bfx_allocator a = root->allocator; /* ptr may be the root itself */
+
+  if (ptr == NULL)
+    return;
+  BFX_RELAXED_ADD(&root->alloc_stats.releases, 1);
+  bfx_alloc_count(root, size, 0);
+  if (a.release != NULL)
+    a.release(a.ctx, ptr, size);
+}
+
+/**
+ * \brief Resizes memory allocated through the interpreter's allocator.
+ *        Words past the old size are not cleared.
+ * \return The memory, or NULL if the allocator failed, in which case ptr
+ *         is left as it was.
+ */
+static void *bfx_resize(beflux *bfx, void *ptr, size_t old_size, size_t size) {
+  beflux *root = bfx->root;
+  void *p;
+
+  if (ptr == NULL)
+    return bfx_alloc(bfx, size);
+
+  if (root->allocator.resize != NULL) {
+    p = root->allocator.resize(root->allocator.ctx, ptr, old_size, size);
+    if (p == NULL) {
+      BFX_RELAXED_ADD(&root->alloc_stats.failures, 1);
+      return NULL;
+    }
+    BFX_RELAXED_ADD(&root->alloc_stats.allocs, 1);
+    bfx_alloc_count(root, old_size, size);
+    return p;
+  }
+
+  p = bfx_alloc(bfx, size);
+  if (p != NULL) {
+    memcpy(p, ptr, old_size < size ? old_size : size);
+    bfx_dealloc(bfx, ptr, old_size);
+  }
+  return p;
+}
+
+/**
+ * \brief Copies the allocation counts of an interpreter and its workers.
+ */
+void bfx_alloc_stats_get(beflux *bfx, bfx_alloc_stats *stats) {
+  bfx_alloc_stats *s = &bfx->root->alloc_stats;
+  stats->allocs = BFX_RELAXED_LOAD(&s->allocs);
+  stats->releases = BFX_RELAXED_LOAD(&s->releases);
+  stats->failures = BFX_RELAXED_LOAD(&s->failures);
+  stats->bytes = BFX_RELAXED_LOAD(&s->bytes);
+  stats->peak = BFX_RELAXED_LOAD(&s->peak);
+}
+
+/* Arenas */
+static void *bfx_arena_alloc(void *ctx, size_t size) {
+  bfx_arena *arena = ctx;
+  size_t aligned = (size + BFX_ARENA_ALIGN - 1) & ~(size_t) (BFX_ARENA_ALIGN - 1);
+  size_t offset = BFX_RELAXED_FETCH_ADD(&arena->used, aligned);
+
+  if (offset > arena->size || arena->size - offset < aligned)
+    return NULL;
+  return arena->base + offset;
+}
+
+/**
+ * \brief Prepares a block of memory to hold one or more interpreters. The
+ *        block is cleared here, so its pages are touched by the calling
+ *        thread, and is never cleared again: to reuse it, delete or
+ *        discard every interpreter in it and initialize it again.
+ * \param base The block, aligned to at least 16 bytes.
+ * \param size The size of the block in bytes.
+ */
+void bfx_arena_init(bfx_arena *arena, void *base, size_t size) {
+  arena->base = base;
+  arena->size = size;
+  arena->used = 0;
+  memset(base, 0, size);
+}
+
+/**
+ * \brief Makes an allocator that bumps through an arena and never frees.
+ *        Once the arena is full, allocations fail. Deleting the
+ *        interpreters is optional; discarding the block releases them,
+ *        provided none of them is running or has workers.
+ */
+bfx_allocator bfx_arena_allocator(bfx_arena *arena) {
+  bfx_allocator a;
+  a.alloc = bfx_arena_alloc;
+  a.resize = NULL;
+  a.release = NULL;
+  a.ctx = arena;
+  return a;
+}
+
+
 /*******************************************************************************
  * bfx_stack Functions
  */
@@ -19,7 +399,7 @@
  * \brief Prepares a Beflux Stack for use.
  */
 void bfx_stack_init(bfx_stack *s) {
-  memset(s->data, 0, BFX_BANK_SIZE);
+  memset(s->data, 0, sizeof(s->data));
   s->size = 0;
 }
 
@@ -27,15 +407,18 @@ void bfx_stack_init(bfx_stack *s) {
  * \brief Pushes a word onto the stack.
  */
 void bfx_stack_push(bfx_stack *s, bfx_word value) {
-  s->data[s->size++] = value;
+  s->data[s->size] = value;
+  s->size = BFX_STACK_INDEX(s->size + 1);
 }
 
 /**
  * \brief Pops a word from the stack.
  */
 bfx_word bfx_stack_pop(bfx_stack *s) {
-  bfx_word result = s->data[s->size - 1];
-  s->data[s->size-- - 1] = 0;
+  bfx_word top = BFX_STACK_INDEX(s->size - 1);
+  bfx_word result = s->data[top];
+  s->data[top] = 0;
+  s->size = top;
   return result;
 }
 
@@ -43,7 +426,7 @@ bfx_word bfx_stack_pop(bfx_stack *s) {
  * \brief Reads a word from the top of the stack without popping it.
  */
 bfx_word bfx_stack_top(bfx_stack *s) {
-  return s->data[s->size - 1];
+  return s->data[BFX_STACK_INDEX(s->size - 1)];
 }
 
 /**
@@ -54,18 +437,377 @@ void bfx_stack_clear(bfx_stack *s) {
     bfx_stack_pop(s);
 }
 
+/**
+ * \brief Pushes a run of words onto the stack, as if by bfx_stack_push in
+ *        order, copying as much at a time as the stack allows before it
+ *        wraps.
+ */
+void bfx_stack_push_span(bfx_stack *s, const bfx_word *src, size_t count) {
+  while (count) {
+    size_t run = BFX_STACK_SIZE - s->size;
+    if (run > count)
+      run = count;
+    memcpy(s->data + s->size, src, run * sizeof(bfx_word));
+    s->size = BFX_STACK_INDEX(s->size + run);
+    src += run;
+    count -= run;
+  }
+}
+
+/**
+ * \brief Pops a run of words from the stack, as if by bfx_stack_pop, into
+ *        dst in stack order, so that the old top ends up last.
+ * \param dst Destination array, or NULL to drop the words.
+ */
+void bfx_stack_pop_span(bfx_stack *s, bfx_word *dst, size_t count) {
+  while (count) {
+    size_t run = s->size ? s->size : BFX_STACK_SIZE;
+    if (run > count)
+      run = count;
+    s->size = BFX_STACK_INDEX(s->size - run);
+    count -= run;
+    if (dst != NULL)
+      memcpy(dst + count, s->data + s->size, run * sizeof(bfx_word));
+    memset(s->data + s->size, 0, run * sizeof(bfx_word));
+  }
+}
+
+
+/**
+ * \brief Sets a run of words to a single value.
+ */
+static void bfx_fill(bfx_word *dst, bfx_word value, size_t count) {
+#if BFX_WORD_BITS == 8
+  memset(dst, value, count);
+#else
+  while (count--)
+    *dst++ = value;
+#endif
+}
+
+
+/**
+ * \brief Marks a program row as changed for every consumer. Checks first so
+ *        that rows which are already dirty are not written again.
+ */
+static inline void bfx_dirty_mark(uint8_t *flags) {
+  if (BFX_RELAXED_LOAD(flags) != BFX_DIRTY_ALL)
+    BFX_RELAXED_STORE(flags, BFX_DIRTY_ALL);
+}
+
+
+#ifdef BFX_SPARSE
+/*******************************************************************************
+ * bfx_grid Functions
+ */
+#define BFX_TILE_CELLS (BFX_TILE_SIZE * BFX_TILE_SIZE)
+
+typedef struct bfx_tile {
+  bfx_word prog;
+  bfx_word row;
+  bfx_word col;
+  uint8_t dirty[BFX_TILE_SIZE]; /* Per row, as BFX_DIRTY_* */
+  bfx_word cells[BFX_TILE_CELLS];
+} bfx_tile;
+
+struct bfx_grid {
+  beflux *owner; /* Allocates the table and tiles */
+  bfx_tile **tiles;
+  size_t capacity;
+  size_t count;
+
+  struct {
+    bfx_word prog;
+    bfx_word row;
+    bfx_word col;
+    bfx_word valid;
+    bfx_tile *tile;
+  } cache[BFX_TILE_CACHE_SIZE];
+
+  /* Rows that held freed tiles, dirty for each consumer until it cleans */
+  size_t cleared[BFX_PROGRAM_COUNT][2];
+};
+
+/**
+ * \brief Hashes tile coordinates into the grid's tile table.
+ */
+static size_t bfx_grid_hash(bfx_word prog, bfx_word row, bfx_word col) {
+  size_t h = (size_t) prog * 0x9E3779B1u;
+  h ^= (size_t) row * 0x85EBCA77u + (h << 6) + (h >> 2);
+  h ^= (size_t) col * 0xC2B2AE3Du + (h << 6) + (h >> 2);
+  return h;
+}
+
+/**
+ * \brief Creates an empty grid.
+ * \return The grid, or NULL if it could not be allocated.
+ */
+static bfx_grid *bfx_grid_new(beflux *bfx) {
+  bfx_grid *g = bfx_alloc(bfx, sizeof(bfx_grid));
+  if (g == NULL)
+    return NULL;
+  g->owner = bfx;
+  g->capacity = 64;
+  g->tiles = bfx_alloc(bfx, g->capacity * sizeof(bfx_tile *));
+  if (g->tiles == NULL) {
+    bfx_dealloc(bfx, g, sizeof(bfx_grid));
+    return NULL;
+  }
+  return g;
+}
+
+/**
+ * \brief Frees a grid and all of its tiles.
+ */
+static void bfx_grid_del(bfx_grid *g) {
+  size_t i;
+  if (g == NULL)
+    return;
+  for (i = 0; i < g->capacity; ++i) {
+    bfx_dealloc(g->owner, g->tiles[i], sizeof(bfx_tile));
+  }
+  bfx_dealloc(g->owner, g->tiles, g->capacity * sizeof(bfx_tile *));
+  bfx_dealloc(g->owner, g, sizeof(bfx_grid));
+}
+
+/**
+ * \brief Marks the rows a freed tile covered as dirty.
+ */
+static void bfx_grid_cleared(bfx_grid *g, const bfx_tile *t) {
+  size_t *cleared = g->cleared[BFX_PROGRAM_INDEX(t->prog)];
+  size_t rows = ((size_t) t->row + 1) * BFX_TILE_SIZE;
+  if (cleared[0] < rows)
+    cleared[0] = rows;
+  if (cleared[1] < rows)
+    cleared[1] = rows;
+}
+
+/**
+ * \brief Frees every tile, keeping the table.
+ */
+static void bfx_grid_empty(bfx_grid *g) {
+  size_t i;
+  for (i = 0; i < g->capacity; ++i) {
+    if (g->tiles[i] != NULL)
+      bfx_grid_cleared(g, g->tiles[i]);
+    bfx_dealloc(g->owner, g->tiles[i], sizeof(bfx_tile));
+    g->tiles[i] = NULL;
+  }
+  g->count = 0;
+  memset(g->cache, 0, sizeof(g->cache));
+}
+
+/**
+ * \brief Inserts a tile into the tile table without growing it.
+ */
+static void bfx_grid_insert(bfx_grid *g, bfx_tile *t) {
+  size_t mask = g->capacity - 1;
+  size_t i = bfx_grid_hash(t->prog, t->row, t->col) & mask;
+  while (g->tiles[i] != NULL) {
+    i = (i + 1) & mask;
+  }
+  g->tiles[i] = t;
+  ++g->count;
+}
+
+/**
+ * \brief Rebuilds the tile table with a new capacity.
+ * \return Zero if the new table could not be allocated, leaving the old one.
+ */
+static int bfx_grid_rehash(bfx_grid *g, size_t capacity) {
+  bfx_tile **old = g->tiles;
+  size_t old_capacity = g->capacity;
+  size_t i;
+
+  g->tiles = bfx_alloc(g->owner, capacity * sizeof(bfx_tile *));
+  if (g->tiles == NULL) {
+    g->tiles = old;
+    return 0;
+  }
+  g->capacity = capacity;
+  g->count = 0;
+  for (i = 0; i < old_capacity; ++i) {
+    if (old[i] != NULL)
+      bfx_grid_insert(g, old[i]);
+  }
+  bfx_dealloc(g->owner, old, old_capacity * sizeof(bfx_tile *));
+  memset(g->cache, 0, sizeof(g->cache));
+  return 1;
+}
+
+/**
+ * \brief Finds the tile holding a cell, checking the tile cache first.
+ * \param create Allocates a blank tile if none exists yet.
+ * \return The tile, or NULL if it does not exist and create is zero.
+ */
+static bfx_tile *bfx_grid_tile(
+  bfx_grid *g,
+  bfx_word prog,
+  bfx_word row,
+  bfx_word col,
+  int create
+) {
+  size_t slot = ((size_t) row * 8 + col + prog * 7) & (BFX_TILE_CACHE_SIZE - 1);
+  size_t mask = g->capacity - 1;
+  size_t i;
+  bfx_tile *t;
+
+  if (
+    g->cache[slot].valid &&
+    g->cache[slot].prog == prog &&
+    g->cache[slot].row == row &&
+    g->cache[slot].col == col &&
+    (g->cache[slot].tile != NULL || !create)
+  ) return g->cache[slot].tile;
+
+  for (i = bfx_grid_hash(prog, row, col) & mask; (t = g->tiles[i]); i = (i + 1) & mask) {
+    if (t->prog == prog && t->row == row && t->col == col)
+      break;
+  }
+
+  if (t == NULL && create) {
+    if (
+      2 * (g->count + 1) > g->capacity &&
+      !bfx_grid_rehash(g, 2 * g->capacity) &&
+      g->count + 1 == g->capacity
+    ) return NULL; /* Keep one slot free to end probes */
+    t = bfx_alloc(g->owner, sizeof(bfx_tile));
+    if (t == NULL)
+      return NULL;
+    t->prog = prog;
+    t->row = row;
+    t->col = col;
+    bfx_fill(t->cells, ' ', BFX_TILE_CELLS);
+    bfx_grid_insert(g, t);
+  }
+
+  g->cache[slot].prog = prog;
+  g->cache[slot].row = row;
+  g->cache[slot].col = col;
+  g->cache[slot].valid = 1;
+  g->cache[slot].tile = t;
+  return t;
+}
+
+/**
+ * \brief Frees every tile belonging to a program.
+ */
+static void bfx_grid_clear(bfx_grid *g, bfx_word prog) {
+  size_t i;
+  for (i = 0; i < g->capacity; ++i) {
+    if (g->tiles[i] != NULL && g->tiles[i]->prog == prog) {
+      bfx_grid_cleared(g, g->tiles[i]);
+      bfx_dealloc(g->owner, g->tiles[i], sizeof(bfx_tile));
+      g->tiles[i] = NULL;
+      --g->count;
+    }
+  }
+  if (!bfx_grid_rehash(g, g->capacity)) {
+    int moved;
+    /* Reinsert in place until no tile moves, closing the gaps. */
+    do {
+      moved = 0;
+      for (i = 0; i < g->capacity; ++i) {
+        bfx_tile *t = g->tiles[i];
+        if (t != NULL) {
+          g->tiles[i] = NULL;
+          --g->count;
+          bfx_grid_insert(g, t);
+          moved |= g->tiles[i] != t;
+        }
+      }
+    } while (moved);
+    memset(g->cache, 0, sizeof(g->cache));
+  }
+}
+
+/**
+ * \brief Finds the number of rows and columns spanned by a program's tiles.
+ */
+static void bfx_grid_extent(bfx_grid *g, bfx_word prog, size_t *rows, size_t *cols) {
+  size_t i;
+  *rows = *cols = 0;
+  for (i = 0; i < g->capacity; ++i) {
+    bfx_tile *t = g->tiles[i];
+    if (t != NULL && t->prog == prog) {
+      if (((size_t) t->row + 1) * BFX_TILE_SIZE > *rows)
+        *rows = ((size_t) t->row + 1) * BFX_TILE_SIZE;
+      if (((size_t) t->col + 1) * BFX_TILE_SIZE > *cols)
+        *cols = ((size_t) t->col + 1) * BFX_TILE_SIZE;
+    }
+  }
+}
+#endif
+
+
+static void bfx_workers_del(beflux *bfx);
+static void bfx_trace_del(beflux *bfx);
+static void bfx_trace_invalidate(beflux *bfx);
+static void bfx_trace_clear(beflux *bfx);
+static void bfx_trace_patched(beflux *bfx, bfx_word prog, bfx_word row);
+static inline void bfx_flight_note(beflux *bfx, bfx_word op, size_t tick);
+static inline void bfx_flight_extend(beflux *bfx, long ticks);
+static void bfx_flight_crash(beflux *bfx);
+static void bfx_program_store(
+  beflux *bfx, bfx_word prog, bfx_word row, bfx_word col, bfx_word value
+);
+static void bfx_watcher_add(beflux *bfx, bfx_word prog, const char *path);
+static void bfx_watcher_forget(beflux *bfx, int all, bfx_word prog);
+static void bfx_reload_apply(beflux *bfx);
+static int bfx_dirty_range(
+  beflux *bfx, uint8_t consumer, bfx_word prog, size_t *first, size_t *end
+);
+static void bfx_dirty_clean(beflux *bfx, uint8_t consumer, bfx_word prog);
+static void bfx_saved_del(beflux *bfx);
+
 
 /*******************************************************************************
  * Beflux Functions
  */
 
+static void bfx_init_with_allocator(beflux *bfx, const bfx_allocator *allocator);
+
 /**
  * \brief Creates and initializes a new Beflux interpreter.
  * \return A pointer to the newly created interpreter.
  */
 beflux *bfx_new(void) {
-  beflux *bfx = (beflux *) malloc(sizeof(beflux));
-  bfx_init(bfx);
+  return bfx_new_with_allocator(NULL);
+}
+
+/**
+ * \brief Creates and initializes a new Beflux interpreter whose memory,
+ *        including the interpreter itself, all comes from one allocator.
+ *        bfx_del releases it through the same allocator.
+ * \param allocator The allocator to copy, or NULL for malloc and free.
+ * \return A pointer to the newly created interpreter, or NULL if any of
+ *         its memory could not be allocated.
+ */
+beflux *bfx_new_with_allocator(const bfx_allocator *allocator) {
+  beflux *bfx;
+
+  if (allocator == NULL)
+    allocator = &bfx_default_allocator;
+  bfx = allocator->alloc(allocator->ctx, sizeof(beflux));
+  if (bfx == NULL)
+    return NULL;
+
+  bfx_init_with_allocator(bfx, allocator);
+  ++bfx->alloc_stats.allocs; /* The interpreter itself */
+  bfx_alloc_count(bfx, 0, sizeof(beflux));
+
+  if (
+#ifdef BFX_SPARSE
+    bfx->grid == NULL ||
+#else
+    bfx->programs == NULL || bfx->programs_used == NULL || bfx->dirty == NULL ||
+#endif
+    bfx->registers == NULL ||
+    bfx->f_bindings == NULL || bfx->async_bindings == NULL
+  ) {
+    bfx_del(bfx);
+    return NULL;
+  }
   return bfx;
 }
 
@@ -73,17 +815,45 @@ beflux *bfx_new(void) {
  * \brief Allocates memory for the interpreter, and initializes its members.
  */
 void bfx_init(beflux *bfx) {
+  bfx_init_with_allocator(bfx, &bfx_default_allocator);
+}
+
+/**
+ * \brief Initializes the interpreter's members, allocating through the
+ *        given allocator.
+ */
+static void bfx_init_with_allocator(beflux *bfx, const bfx_allocator *allocator) {
   size_t i;
 
-  bfx->programs = calloc(BFX_BANK_SIZE, BFX_PROGRAM_SIZE * sizeof(bfx_word));
-  bfx->registers = calloc(BFX_BANK_SIZE, sizeof(bfx_word));
+  bfx->root = bfx;
+  bfx->allocator = *allocator;
+  memset(&bfx->alloc_stats, 0, sizeof(bfx->alloc_stats));
+  memset(&bfx->stats, 0, sizeof(bfx->stats));
+  bfx->run_clock = 0;
+
+#ifdef BFX_SPARSE
+  bfx->programs = NULL;
+  bfx->programs_used = NULL;
+  bfx->dirty = NULL;
+  bfx->grid = bfx_grid_new(bfx);
+#else
+  bfx->programs = bfx_alloc(bfx, BFX_PROGRAM_COUNT * BFX_PROGRAM_CELLS * sizeof(bfx_word));
+  bfx->programs_used = bfx_alloc(bfx, BFX_PROGRAM_COUNT * sizeof(uint8_t));
+  bfx->dirty = bfx_alloc(bfx, BFX_PROGRAM_COUNT * BFX_DIRTY_ROWS);
+  bfx->grid = NULL;
+#endif
+  bfx->registers = bfx_alloc(bfx, BFX_REGISTER_COUNT * sizeof(bfx_word));
 
   bfx->op_bindings = bfx_default_op_bindings,
-  bfx->f_bindings = calloc(BFX_BANK_SIZE, sizeof(bfx_func *));
+  bfx->f_bindings = bfx_alloc(bfx, BFX_BANK_SIZE * sizeof(bfx_func *));
+  bfx->async_bindings = bfx_alloc(bfx, BFX_BANK_SIZE * sizeof(bfx_async_func *));
 
   bfx->pre_update = NULL;
   bfx->post_update = NULL;
+  bfx->on_interrupt = NULL;
+  bfx->run_batch = NULL;
 
+  bfx->frames = bfx->frame_bank;
   for (i = 0; i < BFX_BANK_SIZE; ++i) {
     bfx_stack_init(bfx->frames + i);
   }
@@ -108,7 +878,17 @@ void bfx_init(beflux *bfx) {
   time(&bfx->pre_timer);
   time(&bfx->post_timer);
   bfx->timeout = 0;
+  bfx->fuel = 0;
   bfx->sleep = 0;
+  bfx->checked = 0;
+  bfx->verified = 0;
+  bfx->run_batch_checks = 0;
+
+  bfx->interrupt = BFX_INTERRUPT_NONE;
+  bfx->interrupt_reason = BFX_INTERRUPT_NONE;
+  bfx->resume_mode = BFX_MODE_NORMAL;
+  bfx->batch = 0;
+  bfx->pending = 0;
 
   bfx->in = stdin;
   bfx->out = stdout;
@@ -116,6 +896,22 @@ void bfx_init(beflux *bfx) {
 
   bfx_ip_reset(bfx);
 
+  bfx->ips = NULL;
+  bfx->ip_count = 1;
+  bfx->ip_index = 0;
+  bfx->ip_capacity = 0;
+  bfx->ip_dead = 0;
+
+  bfx->max_workers = 0;
+  bfx->workers = NULL;
+
+  bfx->trace = NULL;
+  bfx->flight = NULL;
+
+  bfx->watcher = NULL;
+  bfx->reloads = NULL;
+  bfx->saved = NULL;
+
   srand(time(NULL));
 }
 
@@ -123,12 +919,33 @@ void bfx_init(beflux *bfx) {
  * \brief Frees the interpreters members, but not the interpreter itself.
  */
 void bfx_free(beflux *bfx) {
-  free(bfx->programs);
+  bfx_workers_del(bfx);
+  bfx_trace_del(bfx);
+  bfx_flight_stop(bfx);
+  bfx_watcher_forget(bfx, 1, 0);
+  bfx_reload_apply(bfx); /* Frees patches that arrived too late */
+  bfx_dealloc(bfx, bfx->ips, bfx->ip_capacity * sizeof(bfx_ip_state));
+  bfx->ips = NULL;
+  bfx->ip_count = 1;
+  bfx->ip_capacity = 0;
+#ifdef BFX_SPARSE
+  bfx_grid_del(bfx->grid);
+#else
+  bfx_dealloc(bfx, bfx->programs, BFX_PROGRAM_COUNT * BFX_PROGRAM_CELLS * sizeof(bfx_word));
+  bfx_dealloc(bfx, bfx->programs_used, BFX_PROGRAM_COUNT * sizeof(uint8_t));
+  bfx_dealloc(bfx, bfx->dirty, BFX_PROGRAM_COUNT * BFX_DIRTY_ROWS);
+#endif
+  bfx_saved_del(bfx);
   bfx->programs = NULL;
-  free(bfx->registers);
+  bfx->programs_used = NULL;
+  bfx->dirty = NULL;
+  bfx->grid = NULL;
+  bfx_dealloc(bfx, bfx->registers, BFX_REGISTER_COUNT * sizeof(bfx_word));
   bfx->registers = NULL;
-  free(bfx->f_bindings);
+  bfx_dealloc(bfx, bfx->f_bindings, BFX_BANK_SIZE * sizeof(bfx_func *));
   bfx->f_bindings = NULL;
+  bfx_dealloc(bfx, bfx->async_bindings, BFX_BANK_SIZE * sizeof(bfx_async_func *));
+  bfx->async_bindings = NULL;
   bfx->mode = BFX_MODE_FREED;
 }
 
@@ -137,7 +954,70 @@ void bfx_free(beflux *bfx) {
  */
 void bfx_del(beflux *bfx) {
   bfx_free(bfx);
-  free(bfx);
+  bfx_dealloc(bfx, bfx, sizeof(beflux));
+}
+
+/**
+ * \brief Returns the interpreter to the state bfx_init left it in, without
+ *        reallocating it. Programs, registers and stacks are cleared, while
+ *        bindings, hooks, files, the timeout and max_workers are kept.
+ */
+void bfx_reset(beflux *bfx) {
+  size_t i;
+
+  bfx_workers_del(bfx);
+  bfx_dealloc(bfx, bfx->ips, bfx->ip_capacity * sizeof(bfx_ip_state));
+  bfx->ips = NULL;
+  bfx->ip_count = 1;
+  bfx->ip_index = 0;
+  bfx->ip_capacity = 0;
+  bfx->ip_dead = 0;
+
+#ifdef BFX_SPARSE
+  bfx_grid_empty(bfx->grid);
+#else
+  for (i = 0; i < BFX_PROGRAM_COUNT; ++i) {
+    if (bfx->programs_used[i]) {
+      memset(bfx->programs + BFX_CELL(i, 0, 0), 0, BFX_PROGRAM_CELLS * sizeof(bfx_word));
+      memset(BFX_DIRTY_FLAGS(bfx, i), BFX_DIRTY_ALL, BFX_DIRTY_ROWS);
+      bfx->programs_used[i] = 0;
+    }
+  }
+#endif
+  memset(bfx->registers, 0, BFX_REGISTER_COUNT * sizeof(bfx_word));
+  bfx_watcher_forget(bfx, 1, 0);
+  bfx->verified = 0;
+
+  for (i = 0; i < BFX_BANK_SIZE; ++i) {
+    bfx_stack_init(bfx->frames + i);
+  }
+  bfx_stack_init(&bfx->calls_row);
+  bfx_stack_init(&bfx->calls_col);
+
+  bfx->current_program = 0;
+  bfx->current_frame = 0;
+
+  bfx->mode = BFX_MODE_HALT;
+  bfx->status = 0;
+  bfx->value = 0;
+  bfx->value_width = 0;
+
+  bfx->t_minor = 0;
+  bfx->t_major = 0;
+  bfx->loop_count = 0;
+  bfx->wrap_offset = 0;
+
+  bfx->tick = 0;
+  bfx->sleep = 0;
+
+  bfx->interrupt = BFX_INTERRUPT_NONE;
+  bfx->interrupt_reason = BFX_INTERRUPT_NONE;
+  bfx->resume_mode = BFX_MODE_NORMAL;
+  bfx->batch = 0;
+  bfx->pending = 0;
+
+  bfx_ip_reset(bfx);
+  bfx_trace_clear(bfx);
 }
 
 /* I/O */
@@ -147,7 +1027,6 @@ void bfx_del(beflux *bfx) {
  * \param filename C string containing a path to the source file.
  */
 void bfx_load(beflux *bfx, bfx_word prog, const char *filename) {
-  size_t linewidth = BFX_PROGRAM_WIDTH + 1;
   char filename_ext[BFX_BANK_SIZE];
   FILE *fin;
 
@@ -155,34 +1034,9 @@ void bfx_load(beflux *bfx, bfx_word prog, const char *filename) {
   fin = fopen(filename_ext, "r");
 
   if (fin != NULL) {
-    char buffer[linewidth];
-    size_t row, col;
-
-    memset(bfx->programs + BFX_PROGRAM_SIZE * prog, ' ', BFX_PROGRAM_SIZE);
-
-    if (fgets(buffer, linewidth, fin) != NULL) {
-      for (row = 0; row < BFX_PROGRAM_HEIGHT; ++row) {
-        size_t len;
-
-        memset(buffer, '\0', linewidth);
-        if (
-          fgets(buffer, linewidth, fin) == NULL ||
-          !(len = strlen(buffer))
-        ) break;
-
-        for (col = 0; col < BFX_PROGRAM_WIDTH; ++col) {
-          bfx_word c = ' ';
-          if (col < len) {
-            c = buffer[col];
-            if (c == '\n') {
-              break;
-            }
-          }
-          bfx_program_set(bfx, prog, row, col, c);
-        }
-      }
-    }
+    bfx_load_stream(bfx, prog, fin);
     fclose(fin);
+    bfx_watcher_add(bfx, prog, filename_ext);
   }
   else {
     char msg[BFX_BANK_SIZE];
@@ -191,33 +1045,328 @@ void bfx_load(beflux *bfx, bfx_word prog, const char *filename) {
   }
 }
 
-/**
- * \brief Writes the contents of a program in interpreter memory to a file.
- * \param prog The index of the program.
+/*
+ * Source rows: bfx_load_stream and hot reload read source text the same
+ * way, one program row at a time. Dense programs take rows of up to
+ * BFX_PROGRAM_WIDTH characters and continue longer lines on the next row,
+ * while sparse programs cut lines at BFX_ROW_LIMIT.
+ */
+typedef struct bfx_source {
+  beflux *bfx; /* Allocates the row, or NULL for malloc */
+  FILE *fin;
+  char *row;
+  size_t capacity;
+} bfx_source;
+
+/**
+ * \brief Grows a source's row buffer to hold at least size characters.
+ * \return Nonzero on success.
+ */
+static int bfx_source_reserve(bfx_source *src, size_t size) {
+  char *row;
+
+  if (size <= src->capacity)
+    return 1;
+  if (size < 2 * src->capacity)
+    size = 2 * src->capacity;
+  row = src->bfx != NULL
+    ? bfx_resize(src->bfx, src->row, src->capacity, size)
+    : realloc(src->row, size);
+  if (row == NULL)
+    return 0;
+  src->row = row;
+  src->capacity = size;
+  return 1;
+}
+
+/**
+ * \brief Reads the next row of a source into src->row, without its
+ *        newline.
+ * \return The length of the row, or -1 at the end of the source.
+ */
+static long bfx_source_row(bfx_source *src) {
+#ifdef BFX_SPARSE
+  size_t len = 0;
+  int c;
+
+  while ((c = fgetc(src->fin)) != EOF && c != '\n') {
+    if (len < BFX_ROW_LIMIT && bfx_source_reserve(src, len + 1))
+      src->row[len++] = (char) c;
+  }
+  return c == EOF && len == 0 ? -1 : (long) len;
+#else
+  size_t len;
+
+  if (
+    !bfx_source_reserve(src, BFX_PROGRAM_WIDTH + 1) ||
+    fgets(src->row, BFX_PROGRAM_WIDTH + 1, src->fin) == NULL ||
+    !(len = strlen(src->row))
+  ) return -1;
+  return src->row[len - 1] == '\n' ? (long) len - 1 : (long) len;
+#endif
+}
+
+/**
+ * \brief Frees a source's row buffer.
+ */
+static void bfx_source_free(bfx_source *src) {
+  if (src->bfx != NULL)
+    bfx_dealloc(src->bfx, src->row, src->capacity);
+  else
+    free(src->row);
+}
+
+/**
+ * \brief Loads source text from an open file into the interpreter. The
+ *        first line is a header and is skipped, as with bfx_load.
+ * \param prog The index of the program.
+ * \param fin The file to read from, which is left open.
+ */
+void bfx_load_stream(beflux *bfx, bfx_word prog, FILE *fin) {
+  bfx_source src = { NULL, NULL, NULL, 0 };
+  size_t row, col;
+  long len;
+
+  src.bfx = bfx;
+  src.fin = fin;
+  bfx_trace_clear(bfx);
+  bfx_watcher_forget(bfx, 0, prog);
+  if (prog == 0)
+    bfx->verified = 0;
+  ++bfx->stats.loads;
+
+#ifdef BFX_SPARSE
+  bfx_grid_clear(bfx->grid, prog);
+#else
+  bfx_fill(bfx->programs + BFX_CELL(prog, 0, 0), ' ', BFX_PROGRAM_CELLS);
+  memset(BFX_DIRTY_FLAGS(bfx, prog), BFX_DIRTY_ALL, BFX_DIRTY_ROWS);
+  bfx->programs_used[BFX_PROGRAM_INDEX(prog)] = 1;
+#endif
+
+  if (bfx_source_row(&src) >= 0) { /* Header */
+    for (row = 0; row < BFX_SOURCE_HEIGHT && (len = bfx_source_row(&src)) >= 0; ++row) {
+      for (col = 0; col < (size_t) len; ++col) {
+        bfx_program_set(bfx, prog, row, col, (unsigned char) src.row[col]);
+      }
+    }
+  }
+  bfx_source_free(&src);
+}
+
+/*
+ * Saved files: bfx_save remembers where each row of the last file it wrote
+ * for a program starts. Saving to the same file again, if nothing else has
+ * touched it, keeps every row before the first dirty one and rewrites the
+ * rest from there.
+ */
+struct bfx_saved {
+  char path[BFX_BANK_SIZE];
+  long size;
+  time_t mtime;
+  long mtime_ns;
+  size_t rows;
+  size_t capacity;
+  long *offsets; /* Of the newline before each row, then the end */
+};
+
+/**
+ * \brief Finds a program's save record, creating it if needed.
+ * \return The record, or NULL if it could not be allocated.
+ */
+static bfx_saved *bfx_saved_get(beflux *bfx, bfx_word prog) {
+  beflux *root = bfx->root;
+  bfx_saved **slot;
+
+  if (root->saved == NULL) {
+    root->saved = bfx_alloc(root, BFX_PROGRAM_COUNT * sizeof(bfx_saved *));
+    if (root->saved == NULL)
+      return NULL;
+  }
+  slot = root->saved + BFX_PROGRAM_INDEX(prog);
+  if (*slot == NULL)
+    *slot = bfx_alloc(root, sizeof(bfx_saved));
+  return *slot;
+}
+
+/**
+ * \brief Frees every save record.
+ */
+static void bfx_saved_del(beflux *bfx) {
+  size_t i;
+
+  if (bfx->saved == NULL)
+    return;
+  for (i = 0; i < BFX_PROGRAM_COUNT; ++i) {
+    bfx_saved *saved = bfx->saved[i];
+    if (saved != NULL) {
+      bfx_dealloc(bfx, saved->offsets, saved->capacity * sizeof(long));
+      bfx_dealloc(bfx, saved, sizeof(bfx_saved));
+    }
+  }
+  bfx_dealloc(bfx, bfx->saved, BFX_PROGRAM_COUNT * sizeof(bfx_saved *));
+  bfx->saved = NULL;
+}
+
+/**
+ * \brief Records the size and modification time of a file just written,
+ *        or checks them against the record.
+ * \param check Nonzero to compare instead of record.
+ * \return Nonzero if the file matches, or was recorded.
+ */
+static int bfx_saved_stat(bfx_saved *saved, const char *path, int check) {
+#ifdef BFX_SAVE_INCREMENTAL
+  struct stat st;
+  long ns = 0;
+
+  if (stat(path, &st) != 0)
+    return 0;
+#ifdef __linux__
+  ns = st.st_mtim.tv_nsec;
+#endif
+  if (check) {
+    return strcmp(saved->path, path) == 0 &&
+      saved->size == (long) st.st_size &&
+      saved->mtime == st.st_mtime && saved->mtime_ns == ns;
+  }
+  strcpy(saved->path, path);
+  saved->size = (long) st.st_size;
+  saved->mtime = st.st_mtime;
+  saved->mtime_ns = ns;
+  return 1;
+#else
+  (void) saved;
+  (void) path;
+  (void) check;
+  return 0;
+#endif
+}
+
+/**
+ * \brief Copies a program row into a line of text without its trailing
+ *        spaces.
+ * \return The length of the line.
+ */
+static size_t bfx_save_row(beflux *bfx, bfx_word prog, size_t row, size_t cols, char *line) {
+  size_t col, len = 0;
+  for (col = 0; col < cols; ++col) {
+#ifdef BFX_SPARSE
+    bfx_word c = bfx_program_get(bfx, prog, row, col);
+#else
+    bfx_word c = bfx->programs[BFX_CELL(prog, row, col)];
+#endif
+    line[col] = (char) c;
+    if (c != ' ')
+      len = col + 1;
+  }
+  return len;
+}
+
+/**
+ * \brief Writes the contents of a program in interpreter memory to a file,
+ *        one line per row, without trailing spaces or blank rows.
+ * \param prog The index of the program.
  * \param filename C string containing a path to the destination file.
  */
 void bfx_save(beflux *bfx, bfx_word prog, const char *filename) {
   char filename_ext[BFX_BANK_SIZE];
-  FILE *fout;
+  bfx_saved *saved = bfx_saved_get(bfx, prog);
+  size_t rows, cols, row, start = 0, first, end;
+  FILE *fout = NULL;
+  int in_place = 0;
+  char *line;
+  long pos;
 
   sprintf(filename_ext, "%s.bfx", filename);
-  fout = fopen(filename_ext, "w");
+#ifdef BFX_SPARSE
+  bfx_grid_extent(bfx->grid, prog, &rows, &cols);
+#else
+  rows = BFX_PROGRAM_HEIGHT;
+  cols = BFX_PROGRAM_WIDTH;
+#endif
+  line = bfx_alloc(bfx, cols ? cols : 1);
+  if (line == NULL) {
+    bfx_error(bfx, "Out of memory.");
+    return;
+  }
+  while (rows && bfx_save_row(bfx, prog, rows - 1, cols, line) == 0) {
+    --rows;
+  }
+
+  if (saved != NULL && saved->capacity < rows + 1) {
+    long *offsets = bfx_resize(
+      bfx, saved->offsets, saved->capacity * sizeof(long), (rows + 1) * sizeof(long)
+    );
+    if (offsets != NULL) {
+      saved->offsets = offsets;
+      saved->capacity = rows + 1;
+    }
+    else {
+      saved->rows = 0;
+      saved->path[0] = '\0';
+      saved = NULL;
+    }
+  }
+
+  /* Keep the rows before the first dirty one if the file is as we left it. */
+  if (saved != NULL && bfx_saved_stat(saved, filename_ext, 1)) {
+    start = bfx_dirty_range(bfx, BFX_DIRTY_SAVE, prog, &first, &end) ? first : saved->rows;
+    if (start > saved->rows)
+      start = saved->rows;
+    if (start > rows)
+      start = rows;
+    if (start == rows && rows == saved->rows) {
+      bfx_dealloc(bfx, line, cols ? cols : 1);
+      bfx_dirty_clean(bfx, BFX_DIRTY_SAVE, prog);
+      return; /* Unchanged */
+    }
+    fout = fopen(filename_ext, "r+");
+    if (fout != NULL && fseek(fout, saved->offsets[start], SEEK_SET) != 0) {
+      fclose(fout);
+      fout = NULL;
+    }
+    in_place = fout != NULL;
+  }
+  if (fout == NULL) {
+    start = 0;
+    fout = fopen(filename_ext, "w");
+  }
+
   if (fout != NULL) {
-    size_t s, w;
-    for (s = 0, w = 0; s < BFX_PROGRAM_SIZE; ++s, ++w) {
-      if (w && w % BFX_PROGRAM_WIDTH == 0) {
+    for (row = start; row < rows; ++row) {
+      size_t len = bfx_save_row(bfx, prog, row, cols, line);
+      if (saved != NULL)
+        saved->offsets[row] = ftell(fout);
+      if (row) {
         fputc('\n', fout);
-        w = 0;
       }
-      fputc(bfx->programs[BFX_PROGRAM_SIZE * prog + s], fout);
+      fwrite(line, 1, len, fout);
     }
+    pos = ftell(fout);
+#ifdef BFX_SAVE_INCREMENTAL
+    fflush(fout);
+    if (in_place && ftruncate(fileno(fout), pos) != 0)
+      pos = -1;
+#endif
+    if (ferror(fout))
+      pos = -1;
     fclose(fout);
+
+    if (saved != NULL) {
+      saved->offsets[rows] = pos;
+      saved->rows = rows;
+      if (pos < 0 || !bfx_saved_stat(saved, filename_ext, 0)) {
+        saved->rows = 0;
+        saved->path[0] = '\0';
+      }
+    }
+    bfx_dirty_clean(bfx, BFX_DIRTY_SAVE, prog);
   }
   else {
     char msg[BFX_BANK_SIZE];
     sprintf(msg, "Failed to write program to \"%s\"", filename_ext);
     bfx_error(bfx, msg);
   }
+  bfx_dealloc(bfx, line, cols ? cols : 1);
 }
 
 /**
@@ -227,7 +1376,36 @@ void bfx_save(beflux *bfx, bfx_word prog, const char *filename) {
  * \param size The number of words to read.
  */
 void bfx_read(beflux *bfx, bfx_word prog, const bfx_word *src, size_t size) {
-  memcpy(bfx->programs + BFX_PROGRAM_SIZE * prog, src, size);
+  bfx_trace_clear(bfx);
+  bfx_watcher_forget(bfx, 0, prog);
+  if (prog == 0)
+    bfx->verified = 0;
+  ++bfx->stats.loads;
+#ifdef BFX_SPARSE
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    bfx_program_set(
+      bfx, prog, i / BFX_PROGRAM_WIDTH, i % BFX_PROGRAM_WIDTH, src[i]
+    );
+  }
+#else
+  size_t rows = (size + BFX_PROGRAM_WIDTH - 1) / BFX_PROGRAM_WIDTH;
+#ifdef BFX_TILED
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    bfx->programs[
+      BFX_CELL(prog, i / BFX_PROGRAM_WIDTH, i % BFX_PROGRAM_WIDTH)
+    ] = src[i];
+  }
+#else
+  memcpy(bfx->programs + BFX_CELL(prog, 0, 0), src, size * sizeof(bfx_word));
+#endif
+  bfx->programs_used[BFX_PROGRAM_INDEX(prog)] = 1;
+  memset(
+    BFX_DIRTY_FLAGS(bfx, prog), BFX_DIRTY_ALL,
+    rows < BFX_DIRTY_ROWS ? rows : BFX_DIRTY_ROWS
+  );
+#endif
 }
 
 /**
@@ -237,7 +1415,23 @@ void bfx_read(beflux *bfx, bfx_word prog, const bfx_word *src, size_t size) {
  * \param size The number of words to write.
  */
 void bfx_write(beflux *bfx, bfx_word prog, bfx_word *dst, size_t size) {
-  memcpy(dst, bfx->programs + BFX_PROGRAM_SIZE * prog, size);
+#ifdef BFX_SPARSE
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    dst[i] = bfx_program_get(
+      bfx, prog, i / BFX_PROGRAM_WIDTH, i % BFX_PROGRAM_WIDTH
+    );
+  }
+#elif defined(BFX_TILED)
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    dst[i] = bfx->programs[
+      BFX_CELL(prog, i / BFX_PROGRAM_WIDTH, i % BFX_PROGRAM_WIDTH)
+    ];
+  }
+#else
+  memcpy(dst, bfx->programs + BFX_CELL(prog, 0, 0), size * sizeof(bfx_word));
+#endif
 }
 
 /**
@@ -248,8 +1442,9 @@ void bfx_note(beflux *bfx, const char *message) {
   bfx_word op = bfx_ip_get_op(bfx);
   fprintf(
     bfx->err,
-    "Note: %s (op%02x='%c') at %02x%02x%02x\n  %s\n\n",
-    bfx_opnames[op], op, op,
+    "Note: %s (op" BFX_WORD_FMT "='%c') at "
+    BFX_WORD_FMT BFX_WORD_FMT BFX_WORD_FMT "\n  %s\n\n",
+    BFX_OP_NAME(op), op, op,
     bfx->current_program, bfx->ip.row, bfx->ip.col,
     message
   );
@@ -263,8 +1458,9 @@ void bfx_warning(beflux *bfx, const char *message) {
   bfx_word op = bfx_ip_get_op(bfx);
   fprintf(
     bfx->err,
-    "Warning: %s (op%02x='%c') at %02x%02x%02x\n  %s\n\n",
-    bfx_opnames[op], op, op,
+    "Warning: %s (op" BFX_WORD_FMT "='%c') at "
+    BFX_WORD_FMT BFX_WORD_FMT BFX_WORD_FMT "\n  %s\n\n",
+    BFX_OP_NAME(op), op, op,
     bfx->current_program, bfx->ip.row, bfx->ip.col,
     message
   );
@@ -279,13 +1475,15 @@ void bfx_error(beflux *bfx, const char *message) {
   bfx_word op = bfx_ip_get_op(bfx);
   fprintf(
     bfx->err,
-    "Error: %s (op%02x='%c') at %02x%02x%02x\n  %s\nExiting.\n\n",
-    bfx_opnames[op], op, op,
+    "Error: %s (op" BFX_WORD_FMT "='%c') at "
+    BFX_WORD_FMT BFX_WORD_FMT BFX_WORD_FMT "\n  %s\nExiting.\n\n",
+    BFX_OP_NAME(op), op, op,
     bfx->current_program, bfx->ip.row, bfx->ip.col,
     message
   );
   bfx->status = BFX_WORD_MAX;
   bfx->mode = BFX_MODE_HALT;
+  bfx_flight_crash(bfx);
 }
 
 
@@ -294,21 +1492,21 @@ void bfx_error(beflux *bfx, const char *message) {
  * \brief Pushes a word onto the interpreter's current stack frame.
  */
 void bfx_push(beflux *bfx, bfx_word value) {
-  bfx_stack_push(bfx->frames + bfx->current_frame, value);
+  bfx_stack_push(bfx->frames + BFX_FRAME_INDEX(bfx->current_frame), value);
 }
 
 /**
  * \brief Pops a word from the interpreter's current stack frame.
  */
 bfx_word bfx_pop(beflux *bfx) {
-  return bfx_stack_pop(bfx->frames + bfx->current_frame);
+  return bfx_stack_pop(bfx->frames + BFX_FRAME_INDEX(bfx->current_frame));
 }
 
 /**
  * \brief Reads a word from the top of the interpreter's current stack frame.
  */
 bfx_word bfx_top(beflux *bfx) {
-  return bfx_stack_top(bfx->frames + bfx->current_frame);
+  return bfx_stack_top(bfx->frames + BFX_FRAME_INDEX(bfx->current_frame));
 }
 
 /**
@@ -316,33 +1514,329 @@ bfx_word bfx_top(beflux *bfx) {
  *        until it is empty.
  */
 void bfx_clear(beflux *bfx) {
-  bfx_stack_clear(bfx->frames + bfx->current_frame);
+  bfx_stack_clear(bfx->frames + BFX_FRAME_INDEX(bfx->current_frame));
+}
+
+/**
+ * \brief Pushes an array of words onto the interpreter's current stack
+ *        frame, first to last, so that the last word ends up on top.
+ * \param src Words to push.
+ * \param count Number of words in src.
+ */
+void bfx_push_span(beflux *bfx, const bfx_word *src, size_t count) {
+  bfx_stack_push_span(bfx->frames + BFX_FRAME_INDEX(bfx->current_frame), src, count);
+}
+
+/**
+ * \brief Pops words from the interpreter's current stack frame into an
+ *        array, in the order bfx_push_span would push them back.
+ * \param dst Destination array, or NULL to drop the words.
+ * \param count Number of words to pop.
+ */
+void bfx_pop_span(beflux *bfx, bfx_word *dst, size_t count) {
+  bfx_stack_pop_span(bfx->frames + BFX_FRAME_INDEX(bfx->current_frame), dst, count);
+}
+
+/**
+ * \brief Pushes a C string onto the interpreter's current stack frame the
+ *        way string mode does, as a null word followed by the characters.
+ */
+void bfx_push_string(beflux *bfx, const char *str) {
+  bfx_stack *s = bfx->frames + BFX_FRAME_INDEX(bfx->current_frame);
+
+  bfx_stack_push(s, '\0');
+#if BFX_WORD_BITS == 8
+  bfx_stack_push_span(s, (const bfx_word *) str, strlen(str));
+#else
+  while (*str)
+    bfx_stack_push(s, (unsigned char) *str++);
+#endif
+}
+
+/**
+ * \brief Gives read-only access to the interpreter's current stack frame,
+ *        bottom first. The view stays valid until the frame next changes.
+ * \param count Set to the number of words in the frame.
+ * \return A pointer to the bottom of the frame. The top is at count - 1.
+ */
+const bfx_word *bfx_frame_view(beflux *bfx, size_t *count) {
+  bfx_stack *s = bfx->frames + BFX_FRAME_INDEX(bfx->current_frame);
+  *count = s->size;
+  return s->data;
 }
 
 /* Execution */
+static inline void bfx_ip_advance_flat(beflux *bfx);
+static inline void bfx_ip_advance_wrap(beflux *bfx);
+static void bfx_ip_switch(beflux *bfx);
+static void bfx_workers_interrupt(beflux *bfx, int reason);
+static void bfx_workers_resume(beflux *bfx);
+static void bfx_workers_wait(beflux *bfx);
+static void bfx_workers_wake(beflux *bfx);
+static size_t bfx_frames_lock(beflux *bfx, bfx_word op);
+static void bfx_frames_unlock(beflux *bfx, size_t held);
+static bfx_func *bfx_trace_batch(beflux *bfx);
+
+/**
+ * \brief Runs one batch of ticks. Each variant is specialized for whether
+ *        pre_update and post_update are set, whether wrapping is on and
+ *        whether the flight recorder is attached, so the common case does
+ *        no per-tick bookkeeping beyond the batch count.
+ */
+#define BFX_DEFINE_RUN_BATCH(NAME, PRE, POST, WRAP, FLIGHT)                  \
+static void NAME(beflux *bfx) {                                              \
+  size_t ticks = 0;                                                          \
+  while (bfx->batch && bfx->mode) {                                          \
+    bfx_word op;                                                             \
+    --bfx->batch;                                                            \
+    if (PRE && bfx->pre_update != NULL)                                      \
+      bfx->pre_update(bfx);                                                  \
+                                                                             \
+    op = bfx_ip_get_op(bfx);                                                 \
+    if (FLIGHT)                                                              \
+      bfx_flight_note(bfx, op, bfx->tick);                                   \
+    bfx_eval(bfx, op);                                                       \
+    if (WRAP)                                                                \
+      bfx_ip_advance_wrap(bfx);                                              \
+    else                                                                     \
+      bfx_ip_advance_flat(bfx);                                              \
+                                                                             \
+    if (PRE || POST || FLIGHT)                                               \
+      ++bfx->tick;                                                           \
+    else                                                                     \
+      ++ticks;                                                               \
+                                                                             \
+    if (POST && bfx->post_update != NULL)                                    \
+      bfx->post_update(bfx);                                                 \
+  }                                                                          \
+  bfx->tick += ticks;                                                        \
+}
+
+BFX_DEFINE_RUN_BATCH(bfx_run_batch_0, 0, 0, 0, 0)
+BFX_DEFINE_RUN_BATCH(bfx_run_batch_1, 1, 0, 0, 0)
+BFX_DEFINE_RUN_BATCH(bfx_run_batch_2, 0, 1, 0, 0)
+BFX_DEFINE_RUN_BATCH(bfx_run_batch_3, 1, 1, 0, 0)
+BFX_DEFINE_RUN_BATCH(bfx_run_batch_4, 0, 0, 1, 0)
+BFX_DEFINE_RUN_BATCH(bfx_run_batch_5, 1, 0, 1, 0)
+BFX_DEFINE_RUN_BATCH(bfx_run_batch_6, 0, 1, 1, 0)
+BFX_DEFINE_RUN_BATCH(bfx_run_batch_7, 1, 1, 1, 0)
+BFX_DEFINE_RUN_BATCH(bfx_run_batch_flight, 0, 0, 0, 1)
+BFX_DEFINE_RUN_BATCH(bfx_run_batch_flight_wrap, 0, 0, 1, 1)
+
+/**
+ * \brief Runs one batch of ticks with several instruction pointers taking
+ *        turns. bfx_update switches to the next one after every tick.
+ */
+static void bfx_run_batch_multi(beflux *bfx) {
+  while (bfx->batch && bfx->mode) {
+    --bfx->batch;
+    if (bfx->pre_update != NULL)
+      bfx->pre_update(bfx);
+
+    bfx_update(bfx);
+
+    if (bfx->post_update != NULL)
+      bfx->post_update(bfx);
+  }
+}
+
+/**
+ * \brief Runs one batch of ticks for the features that look at every
+ *        tick before it runs: the flight recorder, stack checks, which
+ *        stop with an error instead of letting the stack wrap, and frames
+ *        shared with workers, which are locked for the tick.
+ */
+static void bfx_run_batch_watched(beflux *bfx) {
+  while (bfx->batch && bfx->mode) {
+    bfx_word op = bfx_ip_get_op(bfx);
+    size_t held;
+    --bfx->batch;
+    if (bfx->pre_update != NULL)
+      bfx->pre_update(bfx);
+
+    held = bfx_frames_lock(bfx, op);
+    if (bfx->flight != NULL)
+      bfx_flight_note(bfx, op, bfx->tick);
+    if (!bfx->checked || bfx->verified || bfx_check_stack(bfx, op))
+      bfx_update(bfx);
+    bfx_frames_unlock(bfx, held);
+
+    if (bfx->post_update != NULL)
+      bfx->post_update(bfx);
+  }
+}
+
+static bfx_func *bfx_run_batches[8] = {
+  bfx_run_batch_0, bfx_run_batch_1, bfx_run_batch_2, bfx_run_batch_3,
+  bfx_run_batch_4, bfx_run_batch_5, bfx_run_batch_6, bfx_run_batch_7
+};
+
+/**
+ * \brief Picks the batch variant matching the interpreter's configuration.
+ */
+static bfx_func *bfx_select_batch(beflux *bfx) {
+  int checked = bfx->checked && !bfx->verified;
+  if (bfx->root->workers != NULL)
+    return bfx_run_batch_watched;
+  if ((bfx->flight != NULL || checked) && bfx->ip_count > 1)
+    return bfx_run_batch_watched;
+  if (bfx->flight != NULL && (checked || bfx->pre_update != NULL || bfx->post_update != NULL))
+    return bfx_run_batch_watched;
+  if (bfx->flight != NULL) {
+    bfx_func *traced = bfx->trace != NULL ? bfx_trace_batch(bfx) : NULL;
+    if (traced != NULL)
+      return traced;
+    return bfx->wrap_offset != 0 ? bfx_run_batch_flight_wrap : bfx_run_batch_flight;
+  }
+  if (bfx->ip_count > 1)
+    return bfx_run_batch_multi;
+  if (checked && !(bfx->run_batch != NULL && bfx->run_batch_checks))
+    return bfx_run_batch_watched;
+  if (bfx->run_batch != NULL && bfx->pre_update == NULL && bfx->post_update == NULL)
+    return bfx->run_batch;
+  if (bfx->trace != NULL) {
+    bfx_func *traced = bfx_trace_batch(bfx);
+    if (traced != NULL)
+      return traced;
+  }
+  return bfx_run_batches[
+    (bfx->pre_update != NULL) |
+    (bfx->post_update != NULL) << 1 |
+    (bfx->wrap_offset != 0) << 2
+  ];
+}
+
+/**
+ * \brief Reads a monotonic clock, in seconds.
+ */
+static double bfx_clock(void) {
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+  return (double) time(NULL);
+#endif
+}
+
+/**
+ * \brief Handles timers and pending interrupts between batches of ticks.
+ *        The clock is only read when something depends on it.
+ * \return Nonzero if the main loop should keep running.
+ */
+static int bfx_run_boundary(beflux *bfx) {
+  int reason;
+  int metered =
+    bfx->timeout || bfx->sleep ||
+    bfx->pre_update != NULL || bfx->post_update != NULL;
+
+  if (metered) {
+    time(&bfx->post_timer);
+    bfx_sleep(bfx);
+  }
+
+#ifdef BFX_WATCH
+  if (bfx->root == bfx && __atomic_load_n(&bfx->reloads, __ATOMIC_ACQUIRE) != NULL)
+    bfx_reload_apply(bfx);
+#endif
+
+  reason = BFX_ATOMIC_EXCHANGE(&bfx->interrupt, BFX_INTERRUPT_NONE);
+  switch (reason) {
+    case BFX_INTERRUPT_NONE:
+      break;
+
+    case BFX_INTERRUPT_PAUSE:
+      if (bfx->mode != BFX_MODE_HALT && bfx->mode != BFX_MODE_PARKED) {
+        bfx->resume_mode = bfx->mode;
+        bfx->mode = BFX_MODE_PAUSED;
+      }
+      break;
+
+    case BFX_INTERRUPT_HALT:
+      if (bfx->mode != BFX_MODE_HALT && bfx->mode != BFX_MODE_PARKED) {
+        bfx_error(bfx, "Interrupted.");
+      }
+      break;
+
+    case BFX_INTERRUPT_QUIT:
+      bfx->mode = BFX_MODE_HALT;
+      break;
+
+    default:
+      bfx->interrupt_reason = reason;
+      if (bfx->on_interrupt != NULL)
+        bfx->on_interrupt(bfx);
+      bfx->interrupt_reason = BFX_INTERRUPT_NONE;
+      break;
+  }
+
+  if (reason > BFX_INTERRUPT_NONE && reason < BFX_INTERRUPT_USER)
+    bfx_workers_interrupt(bfx, reason);
+
+  if (metered)
+    time(&bfx->pre_timer);
+  return
+    bfx->mode != BFX_MODE_HALT &&
+    bfx->mode != BFX_MODE_PAUSED &&
+    bfx->mode != BFX_MODE_PARKED;
+}
+
+/**
+ * \brief Runs batches of ticks until the interpreter halts, pauses or parks.
+ *        The batch variant is chosen again after every batch, and ops that
+ *        change the configuration end the current batch early. With fuel
+ *        set, the last batch is cut short so tick never passes it.
+ */
+static void bfx_run_loop(beflux *bfx) {
+  time(&bfx->pre_timer);
+  do {
+    bfx->batch = BFX_BATCH_SIZE;
+    if (bfx->fuel) {
+      if (bfx->tick >= bfx->fuel) {
+        bfx_error(bfx, "Out of fuel.");
+        break;
+      }
+      if (bfx->fuel - bfx->tick < BFX_BATCH_SIZE)
+        bfx->batch = bfx->fuel - bfx->tick;
+    }
+    bfx_select_batch(bfx)(bfx);
+  } while (bfx_run_boundary(bfx));
+}
+
 /**
  * \brief Enters the interpreter's main loop.
  * \return The interpreter's exit status.
  */
 bfx_word bfx_run(beflux *bfx) {
   time(&bfx->run_timer);
+  bfx->run_clock = bfx_clock();
+  bfx->run_tick = bfx->tick;
+  bfx_trace_clear(bfx);
+  bfx_reload_apply(bfx);
 
   switch (bfx->mode) {
     case BFX_MODE_HALT:
       bfx->mode = BFX_MODE_NORMAL;
-      while (bfx->mode) { /* MAIN LOOP */
-        time(&bfx->pre_timer);
-        if (bfx->pre_update != NULL)
-          bfx->pre_update(bfx);
-
-        bfx_update(bfx);
-        time(&bfx->post_timer);
+      bfx_run_loop(bfx);
+      if (bfx->mode != BFX_MODE_PARKED)
+        bfx_workers_wait(bfx);
+      break;
 
-        if (bfx->post_update != NULL)
-          bfx->post_update(bfx);
+    case BFX_MODE_PAUSED:
+      bfx->mode = bfx->resume_mode;
+      bfx_workers_resume(bfx);
+      bfx_run_loop(bfx);
+      if (bfx->mode != BFX_MODE_PARKED)
+        bfx_workers_wait(bfx);
+      break;
 
-        bfx_sleep(bfx);
-      }
+    case BFX_MODE_PARKED:
+      if (BFX_ATOMIC_LOAD(&bfx->pending))
+        break; /* Still waiting on bfx_complete */
+      bfx->mode = bfx->resume_mode;
+      bfx_run_loop(bfx);
+      if (bfx->mode != BFX_MODE_PARKED)
+        bfx_workers_wait(bfx);
       break;
 
     case BFX_MODE_FREED:
@@ -353,6 +1847,9 @@ bfx_word bfx_run(beflux *bfx) {
       bfx_error(bfx, "Bad interpreter mode.");
       break;
   }
+  bfx->stats.ticks += bfx->tick - bfx->run_tick;
+  bfx->stats.running += bfx_clock() - bfx->run_clock;
+  bfx->run_clock = 0;
   return bfx->status;
 }
 
@@ -363,17 +1860,38 @@ void bfx_update(beflux *bfx) {
   bfx_eval(bfx, bfx_ip_get_op(bfx));
   bfx_ip_advance(bfx);
   ++bfx->tick;
+
+  if (bfx->ip_count > 1 && bfx->mode && bfx->mode != BFX_MODE_PARKED)
+    bfx_ip_switch(bfx);
+}
+
+/**
+ * \brief Evaluates an op read from under the IP, then advances the IP,
+ *        without counting a tick. For run_batch loops that handle some ops
+ *        themselves.
+ * \return The op under the IP afterwards.
+ */
+bfx_word bfx_step(beflux *bfx, bfx_word op) {
+  bfx_eval(bfx, op);
+  bfx_ip_advance(bfx);
+  return bfx_ip_get_op(bfx);
 }
 
 /**
  * \brief Pauses or halts execution depending on the interpreter's timers.
+ *        A pending interrupt cuts a sleep short.
  */
 void bfx_sleep(beflux *bfx) {
   if (bfx->sleep) {
+    double start = bfx_clock();
     time_t now;
     do {
       time(&now);
-    } while (difftime(now, bfx->post_timer) <= bfx->sleep);
+    } while (
+      difftime(now, bfx->post_timer) <= bfx->sleep &&
+      BFX_ATOMIC_LOAD(&bfx->interrupt) == BFX_INTERRUPT_NONE
+    );
+    bfx->stats.sleeping += bfx_clock() - start;
   }
   bfx->sleep = 0;
 
@@ -385,6 +1903,57 @@ void bfx_sleep(beflux *bfx) {
   }
 }
 
+/**
+ * \brief Requests that a running interpreter pause, halt, or call its
+ *        on_interrupt handler at the end of the current batch of ticks.
+ *        Safe to call from other threads and from signal handlers.
+ * \param reason One of BFX_INTERRUPT_PAUSE, BFX_INTERRUPT_HALT, or a value
+ *        of BFX_INTERRUPT_USER or greater, which is passed to the handler
+ *        through interrupt_reason.
+ */
+void bfx_interrupt(beflux *bfx, int reason) {
+  BFX_ATOMIC_STORE(&bfx->interrupt, reason);
+}
+
+/**
+ * \brief Sets the interpreter's update hooks. Hooks assigned directly take
+ *        effect at the start of the next batch; hooks set through this
+ *        function take effect on the next tick.
+ */
+void bfx_set_hooks(beflux *bfx, bfx_func *pre_update, bfx_func *post_update) {
+  bfx->pre_update = pre_update;
+  bfx->post_update = post_update;
+  bfx->batch = 0;
+  bfx_trace_clear(bfx);
+}
+
+/**
+ * \brief Finishes a pending asynchronous function by pushing its results
+ *        onto the frame that was current when it was called. The
+ *        interpreter resumes on the next call to bfx_run. Safe to call from
+ *        other threads, but not more than once per pending function.
+ * \param results Values to push, first to last.
+ * \param count Number of values in results.
+ */
+void bfx_complete(beflux *bfx, const bfx_word *results, size_t count) {
+  if (!BFX_ATOMIC_LOAD(&bfx->pending)) {
+    bfx_warning(bfx, "No pending function to complete.");
+    return;
+  }
+  bfx_push_span(bfx, results, count);
+  BFX_ATOMIC_STORE(&bfx->pending, 0);
+  bfx_workers_wake(bfx);
+}
+
+/**
+ * \brief Checks whether the interpreter is parked on an asynchronous
+ *        function that has not completed yet.
+ * \return Nonzero if bfx_run would return without running.
+ */
+int bfx_pending(beflux *bfx) {
+  return bfx->mode == BFX_MODE_PARKED && BFX_ATOMIC_LOAD(&bfx->pending);
+}
+
 /**
  * \brief Evaluates a word as a beflux opcode.
  * \param op The opcode to evaluate.
@@ -393,7 +1962,7 @@ void bfx_eval(beflux *bfx, bfx_word op) {
   switch (bfx->mode) {
     default:
     case BFX_MODE_NORMAL: {
-      bfx_func *func = bfx->op_bindings[op];
+      bfx_func *func = BFX_BANK_VALID(op) ? bfx->op_bindings[op] : NULL;
       if (func == NULL) {
         bfx_error(bfx, "Undefined opcode.");
       }
@@ -436,11 +2005,42 @@ void bfx_eval(beflux *bfx, bfx_word op) {
  * \param prog The index of the program.
  */
 bfx_word bfx_program_get(beflux *bfx, bfx_word prog, bfx_word row, bfx_word col) {
-  return bfx->programs[
-    col + 
-    BFX_PROGRAM_WIDTH * row +
-    BFX_PROGRAM_SIZE  * prog
+#ifdef BFX_SPARSE
+  bfx_tile *t = bfx_grid_tile(
+    bfx->grid, prog, row >> BFX_TILE_BITS, col >> BFX_TILE_BITS, 0
+  );
+  return t == NULL ? ' ' : t->cells[
+    (row & BFX_TILE_MASK) << BFX_TILE_BITS | (col & BFX_TILE_MASK)
   ];
+#else
+  return BFX_RELAXED_LOAD(&bfx->programs[BFX_CELL(prog, row, col)]);
+#endif
+}
+
+/**
+ * \brief Writes a word to a program, leaving the pass trace to the caller.
+ */
+static void bfx_program_store(
+  beflux *bfx, bfx_word prog, bfx_word row, bfx_word col, bfx_word value
+) {
+#ifdef BFX_SPARSE
+  bfx_tile *t = bfx_grid_tile(
+    bfx->grid, prog, row >> BFX_TILE_BITS, col >> BFX_TILE_BITS, value != ' '
+  );
+  if (t != NULL) {
+    t->cells[(row & BFX_TILE_MASK) << BFX_TILE_BITS | (col & BFX_TILE_MASK)] = value;
+    bfx_dirty_mark(t->dirty + (row & BFX_TILE_MASK));
+  }
+  else if (value != ' ') {
+    bfx_error(bfx, "Out of memory.");
+  }
+#else
+  BFX_RELAXED_STORE(&bfx->programs[BFX_CELL(prog, row, col)], value);
+  BFX_RELAXED_STORE(&bfx->programs_used[BFX_PROGRAM_INDEX(prog)], 1);
+  bfx_dirty_mark(BFX_DIRTY_FLAGS(bfx, prog) + BFX_DIRTY_ROW(row));
+#endif
+  if (prog == 0)
+    bfx->verified = 0;
 }
 
 /**
@@ -448,1128 +2048,7420 @@ bfx_word bfx_program_get(beflux *bfx, bfx_word prog, bfx_word row, bfx_word col)
  * \param prog The index of the program.
  */
 void bfx_program_set(beflux *bfx, bfx_word prog, bfx_word row, bfx_word col, bfx_word value) {
-  bfx->programs[
-    col +
-    BFX_PROGRAM_WIDTH * row +
-    BFX_PROGRAM_SIZE  * prog
-  ] = value;
+  bfx_program_store(bfx, prog, row, col, value);
+  if (bfx->trace != NULL)
+    bfx_trace_invalidate(bfx);
 }
 
-
-/* IP Manipulatiion */
+/* Dirty Rows */
 /**
- * \brief Resets the interpreter's instruction pointer to the default state.
+ * \brief Checks whether a row has changed since a consumer last cleaned
+ *        the program. Sparse builds look through the program's tiles.
+ * \param consumer One of BFX_DIRTY_SAVE or BFX_DIRTY_USER.
  */
-void bfx_ip_reset(beflux *bfx) {
-  bfx->ip.row = bfx->ip.col = 0;
-  bfx->ip.dir = BFX_IP_E;
-  bfx->ip.wait = 0;
+static int bfx_dirty_row(beflux *bfx, uint8_t consumer, bfx_word prog, size_t row) {
+#ifdef BFX_SPARSE
+  bfx_grid *g = bfx->grid;
+  size_t i;
+
+  if (row < g->cleared[BFX_PROGRAM_INDEX(prog)][consumer >> 1])
+    return 1;
+  for (i = 0; i < g->capacity; ++i) {
+    bfx_tile *t = g->tiles[i];
+    if (
+      t != NULL && t->prog == prog && t->row == row >> BFX_TILE_BITS &&
+      (t->dirty[row & BFX_TILE_MASK] & consumer)
+    ) return 1;
+  }
+  return 0;
+#else
+  return row < BFX_DIRTY_ROWS &&
+    (BFX_RELAXED_LOAD(BFX_DIRTY_FLAGS(bfx, prog) + row) & consumer) != 0;
+#endif
 }
 
 /**
- * \brief Moves the interpreter's instruction pointer forward one step.
- */
-void bfx_ip_advance(beflux *bfx) {
-  if (bfx->ip.wait) {
-    --bfx->ip.wait;
-  }
-  else {
-    if (bfx->wrap_offset) {
-      switch (bfx->ip.dir) {
-        case BFX_IP_E:
-          if (bfx->ip.col == BFX_WORD_MAX) {
-            bfx->ip.row += bfx->wrap_offset;
-            bfx->ip.wait = 1;
-          }
-          ++bfx->ip.col; break;
-        case BFX_IP_N: --bfx->ip.row; break;
-        case BFX_IP_W:
-          if (bfx->ip.col == 0x00) {
-            bfx->ip.row -= bfx->wrap_offset;
-            bfx->ip.wait = 1;
-          }
-          --bfx->ip.col; break;
-        case BFX_IP_S: ++bfx->ip.row; break;
-        default: break;
+ * \brief Finds the span of rows that have changed since a consumer last
+ *        cleaned the program.
+ * \param first Receives the first dirty row.
+ * \param end Receives one past the last dirty row.
+ * \return Nonzero if any row is dirty.
+ */
+static int bfx_dirty_range(
+  beflux *bfx, uint8_t consumer, bfx_word prog, size_t *first, size_t *end
+) {
+#ifdef BFX_SPARSE
+  bfx_grid *g = bfx->grid;
+  size_t i, row;
+
+  *first = (size_t) -1;
+  *end = g->cleared[BFX_PROGRAM_INDEX(prog)][consumer >> 1];
+  if (*end)
+    *first = 0;
+  for (i = 0; i < g->capacity; ++i) {
+    bfx_tile *t = g->tiles[i];
+    if (t == NULL || t->prog != prog)
+      continue;
+    for (row = 0; row < BFX_TILE_SIZE; ++row) {
+      if (t->dirty[row] & consumer) {
+        size_t r = (size_t) t->row * BFX_TILE_SIZE + row;
+        if (r < *first)
+          *first = r;
+        if (r >= *end)
+          *end = r + 1;
       }
     }
-    else {
-      switch (bfx->ip.dir) {
-        case BFX_IP_E: ++bfx->ip.col; break;
-        case BFX_IP_N: --bfx->ip.row; break;
-        case BFX_IP_W: --bfx->ip.col; break;
-        case BFX_IP_S: ++bfx->ip.row; break;
-        default: break;
+  }
+#else
+  const uint8_t *flags = BFX_DIRTY_FLAGS(bfx, prog);
+  size_t row;
+
+  *first = (size_t) -1;
+  *end = 0;
+  for (row = 0; row < BFX_DIRTY_ROWS; ++row) {
+    if (BFX_RELAXED_LOAD(flags + row) & consumer) {
+      if (*first == (size_t) -1)
+        *first = row;
+      *end = row + 1;
+    }
+  }
+#endif
+  if (*end == 0) {
+    *first = 0;
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * \brief Clears a consumer's dirty flags for every row of a program.
+ */
+static void bfx_dirty_clean(beflux *bfx, uint8_t consumer, bfx_word prog) {
+#ifdef BFX_SPARSE
+  bfx_grid *g = bfx->grid;
+  size_t i, row;
+
+  g->cleared[BFX_PROGRAM_INDEX(prog)][consumer >> 1] = 0;
+  for (i = 0; i < g->capacity; ++i) {
+    bfx_tile *t = g->tiles[i];
+    if (t != NULL && t->prog == prog) {
+      for (row = 0; row < BFX_TILE_SIZE; ++row) {
+        t->dirty[row] &= (uint8_t) ~consumer;
       }
     }
   }
+#else
+  uint8_t *flags = BFX_DIRTY_FLAGS(bfx, prog);
+  size_t row;
+
+  for (row = 0; row < BFX_DIRTY_ROWS; ++row) {
+    if (BFX_RELAXED_LOAD(flags + row) & consumer)
+      BFX_RELAXED_AND(flags + row, (uint8_t) ~consumer);
+  }
+#endif
 }
 
 /**
- * \brief Reads the word at the position of the interpreter's
- *        instruction pointer.
+ * \brief Checks whether a program row has been written since the last
+ *        call to bfx_program_clean, by ops, loads, reads or hot reload.
+ *        Writes that leave a cell as it was still count.
+ * \param prog The index of the program.
  */
-bfx_word bfx_ip_get_op(beflux *bfx) {
-  return bfx_program_get(bfx, bfx->current_program, bfx->ip.row, bfx->ip.col);
+int bfx_program_dirty(beflux *bfx, bfx_word prog, bfx_word row) {
+  return bfx_dirty_row(bfx, BFX_DIRTY_USER, prog, row);
 }
 
-/* Utility Functions */
 /**
- * \brief Constructs a literal word value one digit at a time.
+ * \brief Finds the span of program rows written since the last call to
+ *        bfx_program_clean. Rows in between may be clean; check them with
+ *        bfx_program_dirty.
+ * \param first Receives the first dirty row.
+ * \param end Receives one past the last dirty row.
+ * \return Nonzero if any row is dirty.
  */
-void bfx_get_digit(beflux *bfx, bfx_word digit) {
-  bfx->value <<= 4;
-  bfx->value |= digit;
-  if (bfx->value_width == sizeof(bfx_word)) {
-    bfx_push(bfx, bfx->value);
-    bfx->value = 0;
-    bfx->value_width = 0;
-  }
-  else {
-    ++bfx->value_width;
-  }
+int bfx_program_dirty_range(beflux *bfx, bfx_word prog, size_t *first, size_t *end) {
+  return bfx_dirty_range(bfx, BFX_DIRTY_USER, prog, first, end);
 }
 
 /**
- * \brief Writes a string on the stack to an array.
+ * \brief Marks every row of a program clean for bfx_program_dirty. Does
+ *        not affect which rows bfx_save writes.
  */
-void bfx_get_string(beflux *bfx, char *dst) {
-  bfx_op72(bfx); /* 'r' */
-  bfx_word c;
-  do {
-    c = bfx_pop(bfx);
-    *dst++ = c;
-  } while (c != '\0');
+void bfx_program_clean(beflux *bfx, bfx_word prog) {
+  bfx_dirty_clean(bfx, BFX_DIRTY_USER, prog);
 }
 
-/*******************************************************************************
- * Beflux Operators
+
+/* IP Manipulatiion */
+/**
+ * \brief Resets the interpreter's instruction pointer to the default state.
  */
-/* 0x20 */
+void bfx_ip_reset(beflux *bfx) {
+  bfx->ip.row = bfx->ip.col = 0;
+  bfx->ip.dir = BFX_IP_E;
+  bfx->ip.wait = 0;
+}
 
 /**
- * \brief ' ' - SKIP (0:0) - Skip to next non-space character.
+ * \brief Moves the instruction pointer forward one step, ignoring the
+ *        wrapping offset.
  */
-void bfx_op20(beflux *bfx) {
-  size_t i = 0;
-  size_t limit = bfx->wrap_offset == 0 ? BFX_PROGRAM_WIDTH : BFX_PROGRAM_SIZE;
-  while (bfx_ip_get_op(bfx) == ' ') {
-    bfx_ip_advance(bfx);
-    if (i ++ > limit) {
-      bfx_error(bfx, "Infinite empty loop detected.");
-      break;
+static inline void bfx_ip_advance_flat(beflux *bfx) {
+  if (bfx->ip.wait) {
+    --bfx->ip.wait;
+  }
+  else {
+    switch (bfx->ip.dir) {
+      case BFX_IP_E: ++bfx->ip.col; break;
+      case BFX_IP_N: --bfx->ip.row; break;
+      case BFX_IP_W: --bfx->ip.col; break;
+      case BFX_IP_S: ++bfx->ip.row; break;
+      default: break;
     }
   }
-  bfx->ip.wait = 1;
 }
 
 /**
- * \brief '!' - NOT (1:1) - Boolean negation.
+ * \brief Moves the instruction pointer forward one step, moving to another
+ *        row when it wraps around the East or West edge of the program.
  */
-void bfx_op21(beflux *bfx) {
-  bfx_push(bfx, bfx_pop(bfx) == 0);
+static inline void bfx_ip_advance_wrap(beflux *bfx) {
+  if (bfx->ip.wait) {
+    --bfx->ip.wait;
+  }
+  else {
+    switch (bfx->ip.dir) {
+      case BFX_IP_E:
+        if (BFX_EDGE_E(bfx->ip.col)) {
+          bfx->ip.row += bfx->wrap_offset;
+          bfx->ip.wait = 1;
+        }
+        ++bfx->ip.col; break;
+      case BFX_IP_N: --bfx->ip.row; break;
+      case BFX_IP_W:
+        if (BFX_EDGE_W(bfx->ip.col)) {
+          bfx->ip.row -= bfx->wrap_offset;
+          bfx->ip.wait = 1;
+        }
+        --bfx->ip.col; break;
+      case BFX_IP_S: ++bfx->ip.row; break;
+      default: break;
+    }
+  }
 }
 
 /**
- * \brief '"' - STR (0:0) - Toggle string mode.
+ * \brief Moves the interpreter's instruction pointer forward one step.
  */
-void bfx_op22(beflux *bfx) {
-  bfx_push(bfx, '\0');
-  bfx->mode = BFX_MODE_STRING;
+void bfx_ip_advance(beflux *bfx) {
+  if (bfx->wrap_offset)
+    bfx_ip_advance_wrap(bfx);
+  else
+    bfx_ip_advance_flat(bfx);
 }
 
 /**
- * \brief '#' - HOP (0:0) - Skip the next character.
+ * \brief Reads the word at the position of the interpreter's
+ *        instruction pointer.
  */
-void bfx_op23(beflux *bfx) {
-  bfx_ip_advance(bfx);
+bfx_word bfx_ip_get_op(beflux *bfx) {
+  return bfx_program_get(bfx, bfx->current_program, bfx->ip.row, bfx->ip.col);
 }
 
 /**
- * \brief '$' - POP (1:0) - Pop from the current stack.
+ * \brief Advances the interpreter's instruction pointer and reads the word
+ *        under it.
  */
-void bfx_op24(beflux *bfx) {
-  bfx_pop(bfx);
+bfx_word bfx_ip_next(beflux *bfx) {
+  bfx_ip_advance(bfx);
+  return bfx_ip_get_op(bfx);
+}
+
+/* IP Scheduling */
+/**
+ * \brief Copies the running instruction pointer's state out of the
+ *        interpreter.
+ */
+static void bfx_ip_save(beflux *bfx, bfx_ip_state *st) {
+  st->ip = bfx->ip;
+  st->current_frame = bfx->current_frame;
+  st->mode = bfx->mode;
+  st->value = bfx->value;
+  st->value_width = bfx->value_width;
+  st->calls_row.size = bfx->calls_row.size;
+  st->calls_col.size = bfx->calls_col.size;
+  memcpy(st->calls_row.data, bfx->calls_row.data, bfx->calls_row.size * sizeof(bfx_word));
+  memcpy(st->calls_col.data, bfx->calls_col.data, bfx->calls_col.size * sizeof(bfx_word));
 }
 
 /**
- * \brief '%' - MOD (2:1) - Calculate remainder.
+ * \brief Makes a saved instruction pointer the running one.
  */
-void bfx_op25(beflux *bfx) {
-  bfx_word b = bfx_pop(bfx);
-  if (b == 0) {
-    bfx_error(bfx, "Zero modulus.");
-  }
-  bfx_push(bfx, bfx_pop(bfx) % b);
+static void bfx_ip_load(beflux *bfx, const bfx_ip_state *st) {
+  bfx->ip = st->ip;
+  bfx->current_frame = st->current_frame;
+  bfx->mode = st->mode;
+  bfx->value = st->value;
+  bfx->value_width = st->value_width;
+  bfx->calls_row.size = st->calls_row.size;
+  bfx->calls_col.size = st->calls_col.size;
+  memcpy(bfx->calls_row.data, st->calls_row.data, st->calls_row.size * sizeof(bfx_word));
+  memcpy(bfx->calls_col.data, st->calls_col.data, st->calls_col.size * sizeof(bfx_word));
 }
 
 /**
- * \brief '&' - GETX (0:?) - Reads a single hex digit from input.
- */
-void bfx_op26(beflux *bfx) {
-  if (bfx->in == NULL) {
-    bfx_error(bfx, "No input file.");
+ * \brief Passes control to the next instruction pointer, dropping the
+ *        running one if it was killed.
+ */
+static void bfx_ip_switch(beflux *bfx) {
+  if (bfx->ip_dead) {
+    --bfx->ip_count;
+    memmove(
+      bfx->ips + bfx->ip_index,
+      bfx->ips + bfx->ip_index + 1,
+      (bfx->ip_count - bfx->ip_index) * sizeof(bfx_ip_state)
+    );
+    if (bfx->ip_index == bfx->ip_count)
+      bfx->ip_index = 0;
+    bfx->ip_dead = 0;
+    if (bfx->ip_count == 1)
+      bfx->batch = 0; /* Back to the single IP run loop */
   }
   else {
-    int c = fgetc(bfx->in);
-    switch (c) {
-      case '0':
-      case '1':
-      case '2':
-      case '3':
-      case '4':
-      case '5':
-      case '6':
-      case '7':
-      case '8':
-      case '9':
-        bfx_get_digit(bfx, c - '0');
-        break;
-      case 'A':
-      case 'B':
-      case 'C':
-      case 'D':
-      case 'E':
-      case 'F':
-        bfx_get_digit(bfx, c - 'A' + 10);
-        break;
-      case 'a':
-      case 'b':
-      case 'c':
-      case 'd':
-      case 'e':
-      case 'f':
-        bfx_get_digit(bfx, c - 'a' + 10);
-        break;
-      case EOF:
-        bfx_error(bfx, "End of input stream.");
-      default: break;
-    };
+    bfx_ip_save(bfx, bfx->ips + bfx->ip_index);
+    if (++bfx->ip_index == bfx->ip_count)
+      bfx->ip_index = 0;
   }
+  bfx_ip_load(bfx, bfx->ips + bfx->ip_index);
 }
 
 /**
- * \brief ''' - OVER (2:3) - Copies the value under the top of the stack.
+ * \brief Adds an instruction pointer to the interpreter's round-robin
+ *        schedule.
  */
-void bfx_op27(beflux *bfx) {
-  bfx_word a = bfx_pop(bfx);
-  bfx_word b = bfx_top(bfx);
-  bfx_push(bfx, a);
-  bfx_push(bfx, b);
+static void bfx_ip_push(beflux *bfx, const bfx_ip_state *st) {
+  if (bfx->ip_count >= BFX_IP_MAX) {
+    bfx_error(bfx, "Too many instruction pointers.");
+    return;
+  }
+
+  if (bfx->ip_count + 1 > bfx->ip_capacity) {
+    size_t capacity = bfx->ip_capacity ? 2 * bfx->ip_capacity : 4;
+    bfx_ip_state *ips = bfx_resize(
+      bfx, bfx->ips,
+      bfx->ip_capacity * sizeof(bfx_ip_state), capacity * sizeof(bfx_ip_state)
+    );
+    if (ips == NULL) {
+      bfx_error(bfx, "Out of memory.");
+      return;
+    }
+    bfx->ips = ips;
+    bfx->ip_capacity = capacity;
+  }
+
+  if (bfx->ip_count == 1) {
+    bfx->ip_index = 0;
+    bfx_ip_save(bfx, bfx->ips);
+  }
+  bfx->ips[bfx->ip_count++] = *st;
+  bfx->batch = 0; /* Switch to the multiple IP run loop */
 }
 
+
+#ifdef BFX_PARALLEL_IPS
+/*******************************************************************************
+ * Worker Threads
+ */
+/* Ops that may reach frames other than the current one. */
+#define BFX_FRAMES_ALL "FKMkx"
+
+struct bfx_workers {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;                   /* Completions and interrupts */
+  pthread_rwlock_t bank;                 /* Written by ops that reach further */
+  pthread_mutex_t frames[BFX_BANK_SIZE]; /* One per frame of the root's bank */
+  int reason;
+  size_t count;
+  size_t capacity;
+  struct {
+    pthread_t thread;
+    beflux *bfx;
+    int running;
+  } *list;
+};
+
 /**
- * \brief '(' - PSHF (0:0) - Pushes a new stack frame.
+ * \brief Locks what a tick may touch in a frame bank shared with workers:
+ *        the current frame, or the whole bank for ops that reach further.
+ * \return The frame held, BFX_BANK_SIZE for the whole bank, or
+ *         BFX_BANK_SIZE + 1 for nothing.
  */
-void bfx_op28(beflux *bfx) {
-  ++bfx->current_frame;
+static size_t bfx_frames_lock(beflux *bfx, bfx_word op) {
+  bfx_workers *w = bfx->root->workers;
+  size_t i;
+
+  if (w == NULL)
+    return BFX_BANK_SIZE + 1;
+  if (
+    bfx->mode == BFX_MODE_NORMAL && op > 0 && op < 0x80 &&
+    strchr(BFX_FRAMES_ALL, op) != NULL
+  ) {
+    pthread_rwlock_wrlock(&w->bank);
+    return BFX_BANK_SIZE;
+  }
+  i = BFX_FRAME_INDEX(bfx->current_frame);
+  pthread_rwlock_rdlock(&w->bank);
+  pthread_mutex_lock(w->frames + i);
+  return i;
 }
 
 /**
- * \brief ')' - POPF (0:0) - Pops the current stack frame.
+ * \brief Releases what bfx_frames_lock took.
  */
-void bfx_op29(beflux *bfx) {
-  --bfx->current_frame;
+static void bfx_frames_unlock(beflux *bfx, size_t held) {
+  bfx_workers *w = bfx->root->workers;
+
+  if (held > BFX_BANK_SIZE)
+    return;
+  if (held < BFX_BANK_SIZE)
+    pthread_mutex_unlock(w->frames + held);
+  pthread_rwlock_unlock(&w->bank);
 }
 
 /**
- * \brief '*' - MUL (2:1) - Calculate product.
+ * \brief Thread entry point; runs a cloned interpreter until it stops. A
+ *        parked worker sleeps until its call completes or it is
+ *        interrupted. Interrupted while still pending, it stops parked, to
+ *        be resumed with the root, or halts if told to quit, dropping the
+ *        call.
  */
-void bfx_op2a(beflux *bfx) {
-  bfx_push(bfx, bfx_pop(bfx) * bfx_pop(bfx));
+static void *bfx_worker_main(void *arg) {
+  beflux *bfx = (beflux *) arg;
+  bfx_workers *w = bfx->root->workers;
+
+  bfx_run(bfx);
+  while (bfx->mode == BFX_MODE_PARKED) {
+    pthread_mutex_lock(&w->lock);
+    while (BFX_ATOMIC_LOAD(&bfx->pending) && !BFX_ATOMIC_LOAD(&bfx->interrupt)) {
+      pthread_cond_wait(&w->wake, &w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    if (BFX_ATOMIC_LOAD(&bfx->pending)) {
+      if (BFX_ATOMIC_EXCHANGE(&bfx->interrupt, BFX_INTERRUPT_NONE) == BFX_INTERRUPT_QUIT)
+        bfx->mode = BFX_MODE_HALT;
+      break;
+    }
+    bfx_run(bfx);
+  }
+  return NULL;
 }
 
 /**
- * \brief '+' - ADD (2:1) - Calculate sum.
+ * \brief Wakes the root's parked workers to look at their calls again.
  */
-void bfx_op2b(beflux *bfx) {
-  bfx_push(bfx, bfx_pop(bfx) + bfx_pop(bfx));
+static void bfx_workers_wake(beflux *bfx) {
+  bfx_workers *w = bfx->root->workers;
+  if (bfx->root == bfx || w == NULL)
+    return;
+  pthread_mutex_lock(&w->lock);
+  pthread_cond_broadcast(&w->wake);
+  pthread_mutex_unlock(&w->lock);
 }
 
 /**
- * \brief ',' - PUTC (1:0) - Writes an ASCII character to output.
- */
-void bfx_op2c(beflux *bfx) {
-  if (bfx->out == NULL) {
-    bfx_error(bfx, "No output file.");
+ * \brief Starts an instruction pointer on its own thread, if the root
+ *        interpreter allows another worker. The worker runs on a copy of
+ *        the interpreter that shares its programs, registers and frame
+ *        bank; from then on every IP of the root locks frames for each tick.
+ * \return Nonzero if a worker was started.
+ */
+static int bfx_workers_spawn(beflux *bfx, const bfx_ip_state *st) {
+  beflux *root = bfx->root;
+  bfx_workers *w;
+  beflux *clone;
+  size_t i, running = 0;
+  int started = 0;
+
+  if (root->max_workers == 0)
+    return 0;
+
+  if (root->workers == NULL) {
+    root->workers = bfx_alloc(root, sizeof(bfx_workers));
+    if (root->workers == NULL)
+      return 0;
+    pthread_mutex_init(&root->workers->lock, NULL);
+    pthread_cond_init(&root->workers->wake, NULL);
+    pthread_rwlock_init(&root->workers->bank, NULL);
+    for (i = 0; i < BFX_BANK_SIZE; ++i) {
+      pthread_mutex_init(root->workers->frames + i, NULL);
+    }
+  }
+  w = root->workers;
+
+  pthread_mutex_lock(&w->lock);
+  for (i = 0; i < w->count; ++i) {
+    running += w->list[i].running;
+  }
+
+  if (running < root->max_workers && (clone = bfx_alloc(root, sizeof(beflux)))) {
+    memcpy(clone, bfx, sizeof(beflux));
+    clone->ips = NULL;
+    clone->ip_count = 1;
+    clone->ip_index = 0;
+    clone->ip_capacity = 0;
+    clone->ip_dead = 0;
+    clone->workers = NULL;
+    clone->trace = NULL;
+    clone->flight = NULL; /* The ring is not shared between threads */
+    clone->reloads = NULL; /* Applied by the root */
+    clone->interrupt = BFX_INTERRUPT_NONE;
+    clone->pending = 0;
+    clone->tick = 0;
+    bfx_ip_load(clone, st);
+    clone->mode = BFX_MODE_HALT;
+
+    if (w->count == w->capacity) {
+      size_t capacity = w->capacity ? 2 * w->capacity : 8;
+      void *list = bfx_resize(
+        root, w->list,
+        w->capacity * sizeof(*w->list), capacity * sizeof(*w->list)
+      );
+      if (list != NULL) {
+        w->list = list;
+        w->capacity = capacity;
+      }
+    }
+    if (w->count < w->capacity) {
+      w->list[w->count].bfx = clone;
+      w->list[w->count].running = 1;
+      if (w->reason != BFX_INTERRUPT_NONE)
+        bfx_interrupt(clone, w->reason); /* Missed the last forwarded interrupt */
+      if (pthread_create(&w->list[w->count].thread, NULL, bfx_worker_main, clone) == 0) {
+        ++w->count;
+        started = 1;
+      }
+    }
+    if (!started)
+      bfx_dealloc(root, clone, sizeof(beflux));
   }
-  fputc(bfx_pop(bfx), bfx->out);
+  pthread_mutex_unlock(&w->lock);
+  bfx->batch = 0; /* Lock frames from the next tick on */
+  return started;
 }
 
 /**
- * \brief '-' - SUB (2:1) - Calculate difference.
+ * \brief Forwards an interrupt from the root interpreter to its workers.
  */
-void bfx_op2d(beflux *bfx) {
-  bfx_word b = bfx_pop(bfx);
-  bfx_push(bfx, bfx_pop(bfx) - b);
+static void bfx_workers_interrupt(beflux *bfx, int reason) {
+  size_t i;
+  if (bfx->workers == NULL)
+    return;
+  pthread_mutex_lock(&bfx->workers->lock);
+  bfx->workers->reason = reason;
+  for (i = 0; i < bfx->workers->count; ++i) {
+    if (bfx->workers->list[i].running)
+      bfx_interrupt(bfx->workers->list[i].bfx, reason);
+  }
+  pthread_cond_broadcast(&bfx->workers->wake);
+  pthread_mutex_unlock(&bfx->workers->lock);
 }
 
 /**
- * \brief '.' - PUTX (1:0) - Writes a hexadecimal value to output.
+ * \brief Waits for every running worker to halt, pause or stop parked.
+ *        Halted workers are released; the others are kept until the root
+ *        resumes.
  */
-void bfx_op2e(beflux *bfx) {
-  if (bfx->out == NULL) {
-    bfx_error(bfx, "No output file.");
+static void bfx_workers_wait(beflux *bfx) {
+  bfx_workers *w = bfx->workers;
+  size_t i;
+
+  if (w == NULL)
+    return;
+
+  for (;;) {
+    pthread_t thread;
+    int found = 0;
+
+    pthread_mutex_lock(&w->lock);
+    for (i = 0; i < w->count; ++i) {
+      if (w->list[i].running) {
+        thread = w->list[i].thread;
+        w->list[i].running = 0;
+        found = 1;
+        break;
+      }
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    if (!found)
+      break;
+    pthread_join(thread, NULL);
+  }
+
+  pthread_mutex_lock(&w->lock);
+  for (i = 0; i < w->count; ) {
+    if (w->list[i].bfx->mode == BFX_MODE_HALT) {
+      bfx->tick += w->list[i].bfx->tick;
+      bfx_dealloc(bfx, w->list[i].bfx->ips, w->list[i].bfx->ip_capacity * sizeof(bfx_ip_state));
+      bfx_dealloc(bfx, w->list[i].bfx, sizeof(beflux));
+      w->list[i] = w->list[--w->count];
+    }
+    else {
+      ++i;
+    }
   }
-  fprintf(bfx->out, "%02x", bfx_pop(bfx));
+  w->reason = BFX_INTERRUPT_NONE;
+  pthread_mutex_unlock(&w->lock);
 }
 
 /**
- * \brief '/' - DIV (2:1) - Calculate quotient.
+ * \brief Restarts workers that were paused along with the root.
  */
-void bfx_op2f(beflux *bfx) {
-  bfx_word b = bfx_pop(bfx);
-  if (b == 0) {
-    bfx_error(bfx, "Zero denominator.");
+static void bfx_workers_resume(beflux *bfx) {
+  size_t i;
+  if (bfx->workers == NULL)
+    return;
+  pthread_mutex_lock(&bfx->workers->lock);
+  for (i = 0; i < bfx->workers->count; ++i) {
+    if (!bfx->workers->list[i].running) {
+      bfx->workers->list[i].running = pthread_create(
+        &bfx->workers->list[i].thread, NULL,
+        bfx_worker_main, bfx->workers->list[i].bfx
+      ) == 0;
+    }
   }
-  bfx_push(bfx, bfx_pop(bfx) / b);
+  pthread_mutex_unlock(&bfx->workers->lock);
 }
 
-/* 0x30 */
 /**
- * \brief '0' - V0 (0:?) - Hex digit 0.
+ * \brief Stops all workers and releases them.
  */
-void bfx_op30(beflux *bfx) { bfx_get_digit(bfx, 0); }
+static void bfx_workers_del(beflux *bfx) {
+  size_t i;
+  if (bfx->workers == NULL)
+    return;
+  bfx_workers_interrupt(bfx, BFX_INTERRUPT_QUIT);
+  bfx_workers_wait(bfx);
+  for (i = 0; i < bfx->workers->count; ++i) {
+    beflux *clone = bfx->workers->list[i].bfx;
+    bfx_dealloc(bfx, clone->ips, clone->ip_capacity * sizeof(bfx_ip_state));
+    bfx_dealloc(bfx, clone, sizeof(beflux));
+  }
+  pthread_mutex_destroy(&bfx->workers->lock);
+  pthread_cond_destroy(&bfx->workers->wake);
+  pthread_rwlock_destroy(&bfx->workers->bank);
+  for (i = 0; i < BFX_BANK_SIZE; ++i) {
+    pthread_mutex_destroy(bfx->workers->frames + i);
+  }
+  bfx_dealloc(bfx, bfx->workers->list, bfx->workers->capacity * sizeof(*bfx->workers->list));
+  bfx_dealloc(bfx, bfx->workers, sizeof(bfx_workers));
+  bfx->workers = NULL;
+}
+#else
+static int bfx_workers_spawn(beflux *bfx, const bfx_ip_state *st) {
+  (void) bfx; (void) st;
+  return 0;
+}
+static void bfx_workers_interrupt(beflux *bfx, int reason) {
+  (void) bfx; (void) reason;
+}
+static void bfx_workers_wait(beflux *bfx) { (void) bfx; }
+static void bfx_workers_resume(beflux *bfx) { (void) bfx; }
+static void bfx_workers_del(beflux *bfx) { (void) bfx; }
+static void bfx_workers_wake(beflux *bfx) { (void) bfx; }
+static size_t bfx_frames_lock(beflux *bfx, bfx_word op) {
+  (void) bfx; (void) op;
+  return 0;
+}
+static void bfx_frames_unlock(beflux *bfx, size_t held) {
+  (void) bfx; (void) held;
+}
+#endif
 
 /**
- * \brief '1' - V1 (0:?) - Hex digit 1.
+ * \brief Ends execution on every instruction pointer, including those
+ *        running on worker threads.
  */
-void bfx_op31(beflux *bfx) { bfx_get_digit(bfx, 1); }
+static void bfx_workers_quit(beflux *bfx) {
+  if (bfx->root != bfx)
+    bfx_interrupt(bfx->root, BFX_INTERRUPT_QUIT);
+  else
+    bfx_workers_interrupt(bfx, BFX_INTERRUPT_QUIT);
+}
 
-/**
- * \brief '2' - V2 (0:?) - Hex digit 2.
- */
-void bfx_op32(beflux *bfx) { bfx_get_digit(bfx, 2); }
+/*******************************************************************************
+ * Pass Traces
+ *
+ * Programs that loop with REP ('@') often take the same path through the
+ * program on every pass. Once a pass from the reset IP back to '@' has been
+ * recorded without touching anything that could change the program or the
+ * op bindings, later passes replay the recording instead. Steps that only
+ * move the IP are folded into the steps around them. Steps whose effect on
+ * the IP depends on data are checked against the recording afterwards, and
+ * a pass that strays from it carries on in the main loop.
+ */
+#define BFX_TRACE_MAX     65536 /* Longest pass worth recording */
+#define BFX_TRACE_STRAYS  8     /* Passes in a row that may stray */
+
+#define BFX_TRACE_IDLE      0
+#define BFX_TRACE_RECORDING 1
+#define BFX_TRACE_REPLAYING 2
+
+#define BFX_STEP_MOVE   0 /* Moves the IP the same way every time */
+#define BFX_STEP_EFFECT 1 /* Leaves the IP alone */
+#define BFX_STEP_BRANCH 2 /* Moves the IP depending on data */
+#define BFX_STEP_UNSAFE 3 /* May change programs, bindings or IPs */
+
+/* Built-in ops that never touch the IP, beyond those ITER may repeat. */
+#define BFX_TRACE_EFFECT BFX_ITER_SAFE "\"IOQqz"
+#define BFX_TRACE_MOVE   " #;<>B[]^hvy}\x7f"
+#define BFX_TRACE_BRANCH "?@CJR_jkmw{|"
+
+typedef struct bfx_trace_step {
+  bfx_func *func;
+  bfx_ip ip;
+  bfx_ip after;
+  bfx_word op;
+  bfx_word mode;
+  bfx_word after_mode;
+  uint8_t kind;
+  size_t ticks;
+} bfx_trace_step;
+
+struct bfx_trace {
+  int state;
+  int valid;
+  int rejected;
+  size_t strays;
+
+  /* Entry state at the '@' that starts a pass */
+  bfx_word program;
+  bfx_word frame;
+  bfx_word wrap_offset;
+
+  /* Rows the recorded pass runs through */
+  bfx_word row_min;
+  bfx_word row_max;
+
+  bfx_trace_step *steps;
+  size_t length;
+  size_t capacity;
+  size_t lead_ticks;
+  size_t pos;
+};
 
 /**
- * \brief '3' - V3 (0:?) - Hex digit 3.
- */
-void bfx_op33(beflux *bfx) { bfx_get_digit(bfx, 3); }
+ * \brief Sorts an op into one of the BFX_STEP kinds.
+ */
+static int bfx_trace_kind(beflux *bfx, bfx_word op) {
+  if (bfx->mode != BFX_MODE_NORMAL)
+    return BFX_STEP_EFFECT; /* String characters */
+  if (
+    op == 0 || op > 0x7f ||
+    bfx->op_bindings[op] == NULL ||
+    bfx->op_bindings[op] != bfx_default_op_bindings[op]
+  ) return BFX_STEP_UNSAFE;
+  if (strchr(BFX_TRACE_MOVE, op) != NULL)
+    return BFX_STEP_MOVE;
+  if (strchr(BFX_TRACE_EFFECT, op) != NULL)
+    return BFX_STEP_EFFECT;
+  if (strchr(BFX_TRACE_BRANCH, op) != NULL)
+    return BFX_STEP_BRANCH;
+  return BFX_STEP_UNSAFE;
+}
 
 /**
- * \brief '4' - V4 (0:?) - Hex digit 4.
+ * \brief Frees the interpreter's trace, if it has one.
  */
-void bfx_op34(beflux *bfx) { bfx_get_digit(bfx, 4); }
+static void bfx_trace_del(beflux *bfx) {
+  if (bfx->trace != NULL) {
+    bfx_dealloc(bfx, bfx->trace->steps, bfx->trace->capacity * sizeof(bfx_trace_step));
+    bfx_dealloc(bfx, bfx->trace, sizeof(bfx_trace));
+    bfx->trace = NULL;
+  }
+}
 
 /**
- * \brief '5' - V5 (0:?) - Hex digit 5.
+ * \brief Drops the recorded pass. Called on every program write.
  */
-void bfx_op35(beflux *bfx) { bfx_get_digit(bfx, 5); }
+static void bfx_trace_invalidate(beflux *bfx) {
+  bfx_trace *t = bfx->trace;
+  if (t->state != BFX_TRACE_IDLE)
+    bfx->batch = 0;
+  t->state = BFX_TRACE_IDLE;
+  t->valid = 0;
+  t->strays = 0;
+}
 
 /**
- * \brief '6' - V6 (0:?) - Hex digit 6.
+ * \brief Forgets everything about earlier passes, including those that
+ *        could not be recorded. Called when programs are replaced and on
+ *        each bfx_run, since op bindings may have changed in between.
  */
-void bfx_op36(beflux *bfx) { bfx_get_digit(bfx, 6); }
+static void bfx_trace_clear(beflux *bfx) {
+  if (bfx->trace != NULL) {
+    bfx_trace_invalidate(bfx);
+    bfx->trace->rejected = 0;
+  }
+}
 
 /**
- * \brief '7' - V7 (0:?) - Hex digit 7.
+ * \brief Drops the recorded pass only if it runs through a row that hot
+ *        reload has rewritten, and lets passes through a rewritten program
+ *        be recorded again.
  */
-void bfx_op37(beflux *bfx) { bfx_get_digit(bfx, 7); }
+static void bfx_trace_patched(beflux *bfx, bfx_word prog, bfx_word row) {
+  bfx_trace *t = bfx->trace;
+  if (t == NULL || t->program != prog)
+    return;
+  if (t->state == BFX_TRACE_RECORDING || (row >= t->row_min && row <= t->row_max))
+    bfx_trace_invalidate(bfx);
+  t->rejected = 0;
+}
 
 /**
- * \brief '8' - V8 (0:?) - Hex digit 8.
+ * \brief Stops recording, and skips recording passes from the same entry
+ *        state until programs are loaded again.
  */
-void bfx_op38(beflux *bfx) { bfx_get_digit(bfx, 8); }
+static void bfx_trace_reject(beflux *bfx) {
+  bfx->trace->state = BFX_TRACE_IDLE;
+  bfx->trace->rejected = 1;
+  bfx->batch = 0;
+}
 
 /**
- * \brief '9' - V9 (0:?) - Hex digit 9.
+ * \brief Called by REP after it resets the IP. Finishes a recording, starts
+ *        a replay of a matching recording, or starts a new one.
  */
-void bfx_op39(beflux *bfx) { bfx_get_digit(bfx, 9); }
+static void bfx_trace_rep(beflux *bfx) {
+  bfx_trace *t = bfx->trace;
+  int same;
 
-/**
- * \brief ':' - DUP (1:2) - Duplicate current stack top.
- */
-void bfx_op3a(beflux *bfx) {
-  bfx_push(bfx, bfx_top(bfx));
+  if (
+    bfx->pre_update != NULL || bfx->post_update != NULL ||
+    bfx->ip_count > 1 || bfx->workers != NULL || bfx->root != bfx ||
+    bfx->run_batch != NULL
+  ) {
+    if (t != NULL && t->state != BFX_TRACE_IDLE)
+      bfx_trace_invalidate(bfx);
+    return;
+  }
+
+  if (t == NULL) {
+    t = bfx->trace = bfx_alloc(bfx, sizeof(bfx_trace));
+    if (t == NULL)
+      return;
+  }
+  same =
+    t->program == bfx->current_program &&
+    t->frame == bfx->current_frame &&
+    t->wrap_offset == bfx->wrap_offset;
+
+  if (t->state == BFX_TRACE_RECORDING && same && t->length) {
+    t->steps[t->length - 1].ticks += t->lead_ticks;
+    t->valid = 1;
+  }
+  else if (t->state == BFX_TRACE_REPLAYING && same) {
+    t->strays = 0;
+  }
+
+  if (t->valid && same && t->state != BFX_TRACE_REPLAYING &&
+      bfx->fuel && t->lead_ticks > bfx->batch) {
+    /* The moves to the start would pass the fuel; take them one by one. */
+    if (t->state != BFX_TRACE_IDLE) {
+      t->state = BFX_TRACE_IDLE;
+      bfx->batch = 0;
+    }
+  }
+  else if (t->valid && same) {
+    if (t->state != BFX_TRACE_REPLAYING) {
+      bfx->tick += t->lead_ticks; /* Moves skipped on the way to the start */
+      if (bfx->flight != NULL)
+        bfx_flight_extend(bfx, (long) t->lead_ticks);
+      bfx->batch = 0;
+    }
+    t->state = BFX_TRACE_REPLAYING;
+    t->pos = 0;
+  }
+  else if (!(t->rejected && same)) {
+    if (t->state != BFX_TRACE_RECORDING)
+      bfx->batch = 0;
+    t->state = BFX_TRACE_RECORDING;
+    t->valid = 0;
+    t->rejected = 0;
+    t->strays = 0;
+    t->program = bfx->current_program;
+    t->frame = bfx->current_frame;
+    t->wrap_offset = bfx->wrap_offset;
+    t->row_min = t->row_max = bfx->ip.row;
+    t->length = 0;
+    t->lead_ticks = 0;
+  }
+  else if (t->state != BFX_TRACE_IDLE) {
+    t->state = BFX_TRACE_IDLE;
+    bfx->batch = 0;
+  }
 }
 
 /**
- * \brief ';' - COM (0:0) - Skip to next comment character.
+ * \brief Runs one batch of ticks like the main loop, recording each step of
+ *        the current pass.
  */
-void bfx_op3b(beflux *bfx) {
-  size_t i = 0;
-  size_t limit = bfx->wrap_offset == 0 ? BFX_PROGRAM_WIDTH - 3 : BFX_PROGRAM_SIZE;
-  bfx_ip_advance(bfx);
-  while (bfx_ip_get_op(bfx) != ';') {
-    bfx_ip_advance(bfx);
-    if (i++ > limit) {
-      bfx_error(bfx, "Infinite comment loop detected.");
+static void bfx_run_batch_record(beflux *bfx) {
+  bfx_trace *t = bfx->trace;
+
+  while (bfx->batch && bfx->mode && t->state == BFX_TRACE_RECORDING) {
+    bfx_word op = bfx_ip_get_op(bfx);
+    int kind = bfx_trace_kind(bfx, op);
+    bfx_trace_step *step = NULL;
+
+    --bfx->batch;
+    if (kind == BFX_STEP_UNSAFE || t->length == BFX_TRACE_MAX) {
+      bfx_trace_reject(bfx);
       break;
     }
+    if (bfx->ip.row < t->row_min)
+      t->row_min = bfx->ip.row;
+    if (bfx->ip.row > t->row_max)
+      t->row_max = bfx->ip.row;
+
+    if (kind == BFX_STEP_MOVE) {
+      if (t->length)
+        ++t->steps[t->length - 1].ticks;
+      else
+        ++t->lead_ticks;
+    }
+    else {
+      if (t->length == t->capacity) {
+        size_t capacity = t->capacity ? 2 * t->capacity : 64;
+        bfx_trace_step *steps = bfx_resize(
+          bfx, t->steps,
+          t->capacity * sizeof(bfx_trace_step), capacity * sizeof(bfx_trace_step)
+        );
+        if (steps == NULL) {
+          bfx_trace_reject(bfx);
+          break;
+        }
+        t->steps = steps;
+        t->capacity = capacity;
+      }
+      step = t->steps + t->length++;
+      step->func = bfx->op_bindings[op];
+      step->ip = bfx->ip;
+      step->op = op;
+      step->mode = bfx->mode;
+      step->kind = kind;
+      step->ticks = 1;
+    }
+
+    if (bfx->flight != NULL)
+      bfx_flight_note(bfx, op, bfx->tick);
+    bfx_eval(bfx, op);
+    bfx_ip_advance(bfx);
+    ++bfx->tick;
+
+    /* REP may have finished this recording and started a new one. */
+    if (kind == BFX_STEP_BRANCH && op != '@') {
+      step->after = bfx->ip;
+      step->after_mode = bfx->mode;
+    }
   }
 }
 
 /**
- * \brief '<' - MVW (0:0) - Change direction to West.
+ * \brief Runs one batch of ticks from the recorded pass. Leaves the IP
+ *        where the main loop would have it, so the batch can end anywhere.
  */
-void bfx_op3c(beflux *bfx) {
-  bfx->ip.dir = BFX_IP_W;
+static void bfx_run_batch_replay(beflux *bfx) {
+  bfx_trace *t = bfx->trace;
+  size_t ticks = 0, noted = 0; /* Ticks the flight recorder has been given */
+
+  while (bfx->batch && bfx->mode && t->state == BFX_TRACE_REPLAYING) {
+    bfx_trace_step *step = t->steps + t->pos;
+
+    /* Batches may run over by a few moves, but fuel may not. */
+    if (bfx->fuel && step->ticks > bfx->batch) {
+      t->state = BFX_TRACE_IDLE;
+      bfx->ip = step->ip;
+      break;
+    }
+    bfx->batch -= bfx->batch < step->ticks ? bfx->batch : step->ticks;
+    bfx->ip = step->ip;
+    if (bfx->flight != NULL && t->pos == 0) {
+      /* One entry per pass, finished when the next begins. */
+      bfx_flight_extend(bfx, (long) (ticks - noted));
+      bfx_flight_note(bfx, step->op, bfx->tick + ticks);
+      noted = ticks + 1;
+    }
+    ++t->pos;
+    if (step->mode == BFX_MODE_NORMAL)
+      step->func(bfx);
+    else
+      bfx_eval(bfx, step->op);
+    ticks += step->ticks;
+
+    if (step->op == '@' && step->mode == BFX_MODE_NORMAL) {
+      bfx_ip_advance(bfx);
+    }
+    else if (step->kind == BFX_STEP_BRANCH) {
+      bfx_ip_advance(bfx);
+      if (
+        bfx->ip.row != step->after.row || bfx->ip.col != step->after.col ||
+        bfx->ip.dir != step->after.dir || bfx->ip.wait != step->after.wait ||
+        bfx->mode != step->after_mode
+      ) {
+        /* Strayed; the moves folded into this step have not happened. */
+        ticks -= step->ticks - 1;
+        t->state = BFX_TRACE_IDLE;
+        if (++t->strays == BFX_TRACE_STRAYS)
+          t->valid = 0;
+        break;
+      }
+    }
+  }
+
+  if (t->state == BFX_TRACE_REPLAYING && bfx->mode != BFX_MODE_HALT) {
+    bfx->ip = t->steps[t->pos].ip;
+  }
+  if (bfx->flight != NULL)
+    bfx_flight_extend(bfx, (long) (ticks - noted));
+  bfx->tick += ticks;
 }
 
 /**
- * \brief '=' - EQ (2:1) - Test for equality.
+ * \brief Picks the batch for the trace's state, or returns NULL to run
+ *        untraced.
  */
-void bfx_op3d(beflux *bfx) {
-  bfx_push(bfx, bfx_pop(bfx) == bfx_pop(bfx));
+static bfx_func *bfx_trace_batch(beflux *bfx) {
+  bfx_trace *t = bfx->trace;
+  if (t->state == BFX_TRACE_IDLE)
+    return NULL;
+  if (bfx->pre_update != NULL || bfx->post_update != NULL) {
+    t->state = BFX_TRACE_IDLE; /* Hooks watch every tick */
+    return NULL;
+  }
+  return t->state == BFX_TRACE_RECORDING
+    ? bfx_run_batch_record
+    : bfx_run_batch_replay;
 }
 
+
+/* Utility Functions */
 /**
- * \brief '>' - MVE (0:0) - Change direction to East.
+ * \brief Constructs a literal word value one digit at a time.
  */
-void bfx_op3e(beflux *bfx) {
-  bfx->ip.dir = BFX_IP_E;
+void bfx_get_digit(beflux *bfx, bfx_word digit) {
+  bfx->value <<= 4;
+  bfx->value |= digit;
+  if (bfx->value_width == BFX_WORD_DIGITS - 1) {
+    bfx_push(bfx, bfx->value);
+    bfx->value = 0;
+    bfx->value_width = 0;
+  }
+  else {
+    ++bfx->value_width;
+  }
 }
 
 /**
- * \brief '?' - AWAY (0:0) - Change direction at random.
+ * \brief Writes a string on the stack to an array.
  */
-void bfx_op3f(beflux *bfx) {
-  bfx->ip.dir = (rand() % 4) << 7;
+void bfx_get_string(beflux *bfx, char *dst) {
+  char *end = dst + BFX_BANK_SIZE - 1;
+  bfx_op72(bfx); /* 'r' */
+  bfx_word c;
+  do {
+    c = bfx_pop(bfx);
+    if (dst < end)
+      *dst++ = c;
+  } while (c != '\0');
+  *dst = '\0';
 }
 
-/* 0x40 */
 /**
- * \brief '@' - REP (0:0) - Reset the IP and increment t_minor.
+ * \brief Counts ticks run by bfx_iterate, and takes them out of the batch
+ *        when fuel is set. The flight recorder adds them to its latest
+ *        entry: the run's own, or the REP pass it is part of.
  */
-void bfx_op40(beflux *bfx) {
-  bfx_ip_reset(bfx);
-  bfx->ip.wait = 1;
-  ++bfx->t_minor;
+static inline void bfx_iterate_charge(beflux *bfx, size_t ticks) {
+  if (bfx->flight != NULL)
+    bfx_flight_extend(bfx, (long) ticks);
+  bfx->tick += ticks;
+  if (bfx->fuel)
+    bfx->batch -= ticks;
 }
 
 /**
- * \brief 'A' - PRVP (0:0) - Decrement program index.
- */
-void bfx_op41(beflux *bfx) {
-  --bfx->current_program;
+ * \brief Runs the op under the IP as many times as ip.wait asks for, as the
+ *        main loop would, and leaves ip.wait at the number of iterations
+ *        left. DUP, POP and ADD are done in closed form, other safe ops in a
+ *        tight loop. Nothing is done if hooks or other IPs could observe the
+ *        individual ticks, if stack checks are on, or if the op may have
+ *        been rebound. With fuel set, iterations are
+ *        charged against what is left of the batch, which the run loop
+ *        already cut to the fuel.
+ */
+static void bfx_iterate(beflux *bfx) {
+  bfx_word count = bfx->ip.wait, op, sum;
+  bfx_stack *s;
+  size_t i, budget = count;
+
+  if (bfx->fuel && budget > bfx->batch)
+    budget = bfx->batch;
+  if (
+    budget == 0 || bfx->mode != BFX_MODE_NORMAL || bfx->ip_count > 1 ||
+    bfx->pre_update != NULL || bfx->post_update != NULL ||
+    (bfx->checked && !bfx->verified)
+  ) return;
+
+  op = bfx_ip_get_op(bfx);
+  if (
+    op == 0 || op > 0x7f || strchr(BFX_ITER_SAFE, op) == NULL ||
+    bfx->op_bindings[op] != bfx_default_op_bindings[op]
+  ) return;
+  if (
+    bfx->flight != NULL &&
+    (bfx->trace == NULL || bfx->trace->state != BFX_TRACE_REPLAYING)
+  ) {
+    bfx_flight_note(bfx, op, bfx->tick);
+    bfx_flight_extend(bfx, -1); /* Counted as the iterations are */
+  }
+
+  s = bfx->frames + BFX_FRAME_INDEX(bfx->current_frame);
+  /* Closed forms only when every iteration fits in the budget. */
+  switch (budget == count ? op : 0) {
+    case ':':
+      if ((size_t) s->size + count <= BFX_STACK_SIZE) {
+        bfx_fill(s->data + s->size, bfx_stack_top(s), count);
+        s->size = BFX_STACK_INDEX(s->size + count);
+        bfx_iterate_charge(bfx, count);
+        bfx->ip.wait = 0;
+        return;
+      }
+      break;
+
+    case '$':
+      if (count <= s->size) {
+        s->size -= count;
+        bfx_fill(s->data + s->size, 0, count);
+        bfx_iterate_charge(bfx, count);
+        bfx->ip.wait = 0;
+        return;
+      }
+      break;
+
+    case '+':
+      if (count < s->size) {
+        for (sum = 0, i = 0; i <= count; ++i) {
+          sum += s->data[s->size - 1 - i];
+        }
+        s->size -= count;
+        bfx_fill(s->data + s->size, 0, count);
+        s->data[s->size - 1] = sum;
+        bfx_iterate_charge(bfx, count);
+        bfx->ip.wait = 0;
+        return;
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  /* Stop early for errors, and for interrupts so they are not held up. */
+  for (i = 0; i < budget && bfx->mode == BFX_MODE_NORMAL; ++i) {
+    if (i % BFX_BATCH_SIZE == BFX_BATCH_SIZE - 1 && BFX_ATOMIC_LOAD(&bfx->interrupt))
+      break;
+    bfx_default_op_bindings[op](bfx);
+  }
+  bfx_iterate_charge(bfx, i);
+  bfx->ip.wait = count - i;
 }
 
+/*******************************************************************************
+ * Ensembles
+ *
+ * An ensemble runs one program over many inputs, one interpreter per lane.
+ * While the lanes' IPs coincide they run in lockstep: the first lane of the
+ * group leads and keeps the shared IP, mode and counters, while the current
+ * frame and the registers in use are kept row by row, one word per lane, so
+ * arithmetic on every lane is one vector operation. Branches that go
+ * different ways split the smaller side off, and ops with effects that are
+ * hard to share are run lane by lane, after which the lanes that still
+ * agree with the leader carry on together. Lanes that leave the group
+ * finish in bfx_run.
+ */
+#define BFX_LANES_WIDTH     32 /* Slots per row are a multiple of this */
+#define BFX_LANES_REGISTERS 64 /* Register rows cached per group */
+
+/* Ops run lane by lane that may leave programs different between lanes. */
+#define BFX_LANES_WRITES "FPSkx"
+
+struct bfx_ensemble {
+  beflux **lanes;
+  size_t lane_count;
+  size_t width;          /* Slots per row */
+  uint8_t *resume;       /* Lanes left for bfx_run */
+
+  size_t *group;         /* Lanes in lockstep, in slot order */
+  size_t count;
+  bfx_word size;         /* Size of the group's current frame */
+  bfx_word *stack;       /* BFX_STACK_SIZE rows */
+  bfx_word *scratch;     /* One spare row */
+  uint8_t *keep;         /* Slots that stay after a split */
+
+  bfx_word *registers;   /* BFX_LANES_REGISTERS rows */
+  size_t reg_index[BFX_LANES_REGISTERS]; /* Register held, plus one */
+  uint8_t reg_dirty[BFX_LANES_REGISTERS];
+
+  int simd;
+  size_t lockstep;       /* Lane ticks run in lockstep */
+};
+
+#define BFX_LANES_ROW(e, i) \
+  ((e)->stack + (size_t) BFX_STACK_INDEX(i) * (e)->width)
+#define BFX_LANES_TOP(e)  BFX_LANES_ROW((e), (e)->size - 1)
+#define BFX_LANES_NEXT(e) BFX_LANES_ROW((e), (e)->size - 2)
+#define BFX_LANES_LEADER(e) ((e)->lanes[(e)->group[0]])
+
+/* Vector kernels */
+#ifdef BFX_LANES_AVX2
 /**
- * \brief 'B' - REV (0:0) - Reverse IP direction.
+ * \brief Combines two rows into the first, 32 lanes at a time.
+ * \param n Number of slots, a multiple of 32.
  */
-void bfx_op42(beflux *bfx) {
-  bfx->ip.dir += BFX_IP_TURN_B;
+__attribute__((target("avx2")))
+static void bfx_lanes_binary_avx2(bfx_word *dst, const bfx_word *src, size_t n, bfx_word op) {
+  const __m256i one = _mm256_set1_epi8(1);
+  const __m256i low = _mm256_set1_epi16(0x00ff);
+  size_t i;
+
+  for (i = 0; i < n; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *) (dst + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *) (src + i));
+    __m256i r;
+    switch (op) {
+      case '+': r = _mm256_add_epi8(a, b); break;
+      case '-': r = _mm256_sub_epi8(a, b); break;
+      case '*':
+        /* No 8-bit multiply: multiply even and odd bytes as 16-bit words */
+        r = _mm256_or_si256(
+          _mm256_and_si256(_mm256_mullo_epi16(a, b), low),
+          _mm256_slli_epi16(
+            _mm256_mullo_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)), 8
+          )
+        );
+        break;
+      case '=': r = _mm256_and_si256(_mm256_cmpeq_epi8(a, b), one); break;
+      case '`': /* b > a, unsigned */
+        r = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a), one);
+        break;
+      default: r = a; break;
+    }
+    _mm256_storeu_si256((__m256i *) (dst + i), r);
+  }
 }
 
 /**
- * \brief 'C' - CALL (2:0) - Jump to position using call stack.
+ * \brief Replaces each lane of a row with whether it was zero.
  */
-void bfx_op43(beflux *bfx) {
-  bfx_stack_push(&bfx->calls_row, bfx->ip.row);
-  bfx_stack_push(&bfx->calls_col, bfx->ip.col);
-  bfx_op4a(bfx); /* 'J' */
+__attribute__((target("avx2")))
+static void bfx_lanes_not_avx2(bfx_word *row, size_t n) {
+  const __m256i one = _mm256_set1_epi8(1);
+  size_t i;
+
+  for (i = 0; i < n; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *) (row + i));
+    a = _mm256_and_si256(_mm256_cmpeq_epi8(a, _mm256_setzero_si256()), one);
+    _mm256_storeu_si256((__m256i *) (row + i), a);
+  }
 }
+#endif
 
 /**
- * \brief 'D' - DICE (2:1) - Push a random number in the given range.
+ * \brief Combines the second row from the top with the top row, as the
+ *        binary op would for each lane, leaving the result in the first.
+ *        Only for ops that cannot fail.
  */
-void bfx_op44(beflux *bfx) {
-  bfx_word max = bfx_pop(bfx);
-  bfx_word min = bfx_pop(bfx);
-  bfx_push(bfx, (rand() % (max - min)) + min);
+static void bfx_lanes_binary(bfx_ensemble *e, bfx_word *dst, const bfx_word *src, bfx_word op) {
+  size_t i, n = e->count;
+
+#ifdef BFX_LANES_AVX2
+  if (e->simd) {
+    bfx_lanes_binary_avx2(dst, src, (n + BFX_LANES_WIDTH - 1) & ~(size_t) (BFX_LANES_WIDTH - 1), op);
+    return;
+  }
+#endif
+  /* Separate loops so that each one can be vectorized. Comparisons take
+   * their operands in the order the scalar ops pop them. */
+  switch (op) {
+    case '+': for (i = 0; i < n; ++i) dst[i] = dst[i] + src[i]; break;
+    case '-': for (i = 0; i < n; ++i) dst[i] = dst[i] - src[i]; break;
+    case '*': for (i = 0; i < n; ++i) dst[i] = dst[i] * src[i]; break;
+    case '=': for (i = 0; i < n; ++i) dst[i] = dst[i] == src[i]; break;
+    case '`': for (i = 0; i < n; ++i) dst[i] = src[i] > dst[i]; break;
+    default: break;
+  }
 }
 
 /**
- * \brief 'E' - EOF (0:1) - Return whether end of input has been reached.
+ * \brief Replaces each lane of a row with whether it was zero.
  */
-void bfx_op45(beflux *bfx) {
-  if (bfx->in == NULL) {
-    bfx_push(bfx, 0xff);
-  }
-  else {
-    bfx_push(bfx, !!feof(bfx->in));
+static void bfx_lanes_not(bfx_ensemble *e, bfx_word *row) {
+  size_t i, n = e->count;
+
+#ifdef BFX_LANES_AVX2
+  if (e->simd) {
+    bfx_lanes_not_avx2(row, (n + BFX_LANES_WIDTH - 1) & ~(size_t) (BFX_LANES_WIDTH - 1));
+    return;
   }
+#endif
+  for (i = 0; i < n; ++i)
+    row[i] = row[i] == 0;
 }
 
 /**
- * \brief 'F' - FUNC (1:?) - Call a user-defined function.
+ * \brief Counts the lanes of a row that are nonzero.
  */
-void bfx_op46(beflux *bfx) {
-  bfx->f_bindings[bfx_pop(bfx)](bfx);
+static size_t bfx_lanes_count(const bfx_ensemble *e, const bfx_word *row) {
+  size_t i, count = 0;
+  for (i = 0; i < e->count; ++i)
+    count += row[i] != 0;
+  return count;
 }
 
 /**
- * \brief 'G' - GETP (3:1) - Push character from a program.
+ * \brief Checks whether every lane of a row holds the same word.
  */
-void bfx_op47(beflux *bfx) {
-  bfx_word col = bfx_pop(bfx);
-  bfx_word row = bfx_pop(bfx);
-  bfx_push(bfx, bfx_program_get(bfx, bfx_pop(bfx), row, col));
+static int bfx_lanes_uniform(const bfx_ensemble *e, const bfx_word *row) {
+  size_t i;
+  for (i = 1; i < e->count; ++i) {
+    if (row[i] != row[0])
+      return 0;
+  }
+  return 1;
+}
+
+/* Lane State */
+/**
+ * \brief Checks whether two lanes are at the same point of the same run,
+ *        apart from their data, so that they can share one IP.
+ */
+static int bfx_lanes_same(const beflux *a, const beflux *b) {
+  return
+    a->ip.row == b->ip.row && a->ip.col == b->ip.col &&
+    a->ip.dir == b->ip.dir && a->ip.wait == b->ip.wait &&
+    a->mode == b->mode &&
+    a->current_program == b->current_program &&
+    a->current_frame == b->current_frame &&
+    a->frames[BFX_FRAME_INDEX(a->current_frame)].size ==
+      b->frames[BFX_FRAME_INDEX(b->current_frame)].size &&
+    a->value == b->value && a->value_width == b->value_width &&
+    a->t_minor == b->t_minor && a->t_major == b->t_major &&
+    a->loop_count == b->loop_count && a->wrap_offset == b->wrap_offset &&
+    a->tick == b->tick && a->sleep == b->sleep &&
+    a->ip_count == 1 && b->ip_count == 1 &&
+    a->workers == NULL && b->workers == NULL &&
+    a->calls_row.size == b->calls_row.size &&
+    a->calls_col.size == b->calls_col.size &&
+    memcmp(a->calls_row.data, b->calls_row.data, a->calls_row.size * sizeof(bfx_word)) == 0 &&
+    memcmp(a->calls_col.data, b->calls_col.data, a->calls_col.size * sizeof(bfx_word)) == 0;
 }
 
 /**
- * \brief 'H' - HOME (0:0) - Set program index to 0.
- */
-void bfx_op48(beflux *bfx) {
-  bfx->current_program = 0;
+ * \brief Copies the state bfx_lanes_same compares from the leader to a lane
+ *        leaving the group, except for the frame, which is copied from the
+ *        group's rows.
+ */
+static void bfx_lanes_copy(beflux *dst, const beflux *src) {
+  dst->ip = src->ip;
+  dst->mode = src->mode;
+  dst->current_program = src->current_program;
+  dst->current_frame = src->current_frame;
+  dst->value = src->value;
+  dst->value_width = src->value_width;
+  dst->t_minor = src->t_minor;
+  dst->t_major = src->t_major;
+  dst->loop_count = src->loop_count;
+  dst->wrap_offset = src->wrap_offset;
+  dst->tick = src->tick;
+  dst->sleep = src->sleep;
+  dst->calls_row.size = src->calls_row.size;
+  dst->calls_col.size = src->calls_col.size;
+  memcpy(dst->calls_row.data, src->calls_row.data, src->calls_row.size * sizeof(bfx_word));
+  memcpy(dst->calls_col.data, src->calls_col.data, src->calls_col.size * sizeof(bfx_word));
 }
 
 /**
- * \brief 'I' - FIN (str:0) - Open input file.
+ * \brief Checks whether two lanes hold the same programs.
  */
-void bfx_op49(beflux *bfx) {
-  bfx_word c = bfx_top(bfx);
-  if (c == 0x00) {
-    bfx_pop(bfx);
-    bfx->in = NULL;
-  }
-  else if (c == 0xff) {
-    bfx_pop(bfx);
-    bfx->in = stdin;
-  }
-  else {
-    char fname[BFX_BANK_SIZE] = "";
-    if (bfx->in != NULL && bfx->in != stdin) {
-      fclose(bfx->in);
-    }
-    bfx_get_string(bfx, fname);
-    bfx->in = fopen(fname, "rb");
-    if (bfx->in == NULL) {
-      char msg[BFX_BANK_SIZE + 32] = "";
-      sprintf(msg, "Failed to open input file %s.", fname);
-      bfx_error(bfx, msg);
-    }
+static int bfx_lanes_programs(const beflux *a, const beflux *b) {
+#ifdef BFX_SPARSE
+  (void) a;
+  (void) b;
+  return 0; /* Tiles are not compared */
+#else
+  size_t i;
+  for (i = 0; i < BFX_PROGRAM_COUNT; ++i) {
+    if (
+      (a->programs_used[i] || b->programs_used[i]) &&
+      memcmp(
+        a->programs + BFX_CELL(i, 0, 0), b->programs + BFX_CELL(i, 0, 0),
+        BFX_PROGRAM_CELLS * sizeof(bfx_word)
+      ) != 0
+    ) return 0;
   }
+  return 1;
+#endif
 }
 
 /**
- * \brief 'J' - JMP (2:0) - Jump to specified position.
+ * \brief Checks whether a lane can start in lockstep: it is halted and
+ *        nothing but the built-in ops and its own files can observe it.
  */
-void bfx_op4a(beflux *bfx) {
-  bfx->ip.col = bfx_pop(bfx);
-  bfx->ip.row = bfx_pop(bfx);
-  bfx->ip.wait = 1;
+static int bfx_lanes_ready(const beflux *bfx) {
+  return
+    bfx->mode == BFX_MODE_HALT && bfx->ip_count == 1 && bfx->workers == NULL &&
+    bfx->pre_update == NULL && bfx->post_update == NULL && bfx->run_batch == NULL &&
+    bfx->op_bindings == bfx_default_op_bindings &&
+    bfx->fuel == 0 && bfx->timeout == 0 && bfx->sleep == 0 &&
+    BFX_ATOMIC_LOAD(&bfx->interrupt) == BFX_INTERRUPT_NONE;
 }
 
+/* Rows */
 /**
- * \brief 'K' - DUPF (0:?) - Pushes a copy of the current stack frame.
+ * \brief Copies the group's lanes' current frames into the rows.
  */
-void bfx_op4b(beflux *bfx) {
-  bfx_op28(bfx); /* '(' */
-  memcpy(
-    &bfx->frames[bfx->current_frame],
-    &bfx->frames[bfx->current_frame - 1],
-    sizeof(bfx_stack)
-  );
+static void bfx_lanes_gather(bfx_ensemble *e) {
+  size_t row, k;
+
+  for (row = 0; row < BFX_STACK_SIZE; ++row) {
+    bfx_word *dst = e->stack + row * e->width;
+    for (k = 0; k < e->count; ++k) {
+      beflux *lane = e->lanes[e->group[k]];
+      dst[k] = lane->frames[BFX_FRAME_INDEX(lane->current_frame)].data[row];
+    }
+  }
+  e->size = BFX_LANES_LEADER(e)->frames[BFX_FRAME_INDEX(BFX_LANES_LEADER(e)->current_frame)].size;
 }
 
 /**
- * \brief 'L' - LEND (0:0) - Resets the loop counter.
+ * \brief Writes one slot's rows back to its lane, including its cached
+ *        registers, and copies the leader's state to it.
  */
-void bfx_op4c(beflux *bfx) {
-  bfx->loop_count = 0;
+static void bfx_lanes_scatter(bfx_ensemble *e, size_t k) {
+  beflux *lane = e->lanes[e->group[k]];
+  bfx_stack *s;
+  size_t row, i;
+
+  if (k != 0)
+    bfx_lanes_copy(lane, BFX_LANES_LEADER(e));
+  s = lane->frames + BFX_FRAME_INDEX(lane->current_frame);
+  for (row = 0; row < BFX_STACK_SIZE; ++row) {
+    s->data[row] = e->stack[row * e->width + k];
+  }
+  s->size = e->size;
+
+  for (i = 0; i < BFX_LANES_REGISTERS; ++i) {
+    if (e->reg_dirty[i])
+      lane->registers[e->reg_index[i] - 1] = e->registers[i * e->width + k];
+  }
 }
 
 /**
- * \brief 'M' - CLRS (0:0) - Clears all stack frames.
+ * \brief Writes cached registers back to every lane and forgets them.
  */
-void bfx_op4d(beflux *bfx) {
-  do {
-    bfx_clear(bfx);
-  } while (bfx->current_frame--);
+static void bfx_lanes_flush(bfx_ensemble *e) {
+  size_t i, k;
+
+  for (i = 0; i < BFX_LANES_REGISTERS; ++i) {
+    if (e->reg_dirty[i]) {
+      for (k = 0; k < e->count; ++k) {
+        e->lanes[e->group[k]]->registers[e->reg_index[i] - 1] = e->registers[i * e->width + k];
+      }
+    }
+    e->reg_index[i] = 0;
+    e->reg_dirty[i] = 0;
+  }
 }
 
 /**
- * \brief 'N' - CLRF (0:0) - Clear the current stack frame.
+ * \brief Finds a register's row, loading it from the lanes if needed.
+ * \param r A wrapped register index.
  */
-void bfx_op4e(beflux *bfx) {
-  bfx_clear(bfx);
+static bfx_word *bfx_lanes_register(bfx_ensemble *e, size_t r) {
+  size_t i = r % BFX_LANES_REGISTERS, k;
+  bfx_word *row = e->registers + i * e->width;
+
+  if (e->reg_index[i] != r + 1) {
+    if (e->reg_dirty[i]) {
+      for (k = 0; k < e->count; ++k) {
+        e->lanes[e->group[k]]->registers[e->reg_index[i] - 1] = row[k];
+      }
+    }
+    for (k = 0; k < e->count; ++k) {
+      row[k] = e->lanes[e->group[k]]->registers[r];
+    }
+    e->reg_index[i] = r + 1;
+    e->reg_dirty[i] = 0;
+  }
+  return row;
 }
 
 /**
- * \brief 'O' - FOUT (str:0) - Open output file.
+ * \brief Finds one lane's copy of a register, whether or not it is cached.
+ * \param write Nonzero if the register is about to be written.
  */
-void bfx_op4f(beflux *bfx) {
-  bfx_word c = bfx_top(bfx);
-  if (c == 0x00) {
-    bfx_pop(bfx);
-    bfx->out = NULL;;
+static bfx_word *bfx_lanes_register_at(bfx_ensemble *e, size_t k, size_t r, int write) {
+  size_t i = r % BFX_LANES_REGISTERS;
+  if (e->reg_index[i] == r + 1) {
+    e->reg_dirty[i] |= write;
+    return e->registers + i * e->width + k;
   }
-  else if (c == 0xff) {
-    bfx_pop(bfx);
-    bfx->out = stdout;
+  return e->lanes[e->group[k]]->registers + r;
+}
+
+/**
+ * \brief Moves the slots marked in keep to the front, after handing the
+ *        others back to their lanes to finish in bfx_run. A new leader
+ *        takes over the old one's state if the old one leaves.
+ */
+static void bfx_lanes_split(bfx_ensemble *e) {
+  beflux *leader = BFX_LANES_LEADER(e);
+  size_t k, j, kept = 0, row, i;
+
+  for (k = 0; k < e->count && !e->keep[k]; ++k)
+    ;
+  if (k == e->count)
+    return; /* Nothing would be left */
+  if (k != 0)
+    bfx_lanes_copy(e->lanes[e->group[k]], leader);
+
+  /* Leavers go first, so that they copy the leader's state before its own
+   * slot is written back. */
+  for (k = e->count; k-- > 0; ) {
+    if (!e->keep[k]) {
+      beflux *lane = e->lanes[e->group[k]];
+      bfx_lanes_scatter(e, k);
+      lane->resume_mode = lane->mode;
+      lane->mode = BFX_MODE_PAUSED;
+      e->resume[e->group[k]] = 1;
+    }
   }
-  else {
-    char fname[BFX_BANK_SIZE] = "";
-    if (bfx->out != NULL && bfx->out != stdout) {
-      fclose(bfx->out);
+
+  for (k = 0; k < e->count; ++k) {
+    if (!e->keep[k])
+      continue;
+    j = kept++;
+    if (j == k)
+      continue;
+    e->group[j] = e->group[k];
+    for (row = 0; row < BFX_STACK_SIZE; ++row) {
+      e->stack[row * e->width + j] = e->stack[row * e->width + k];
     }
-    bfx_get_string(bfx, fname);
-    bfx->out = fopen(fname, "wb");
-    if (bfx->out == NULL) {
-      char msg[BFX_BANK_SIZE + 32] = "";
-      sprintf(msg, "Failed to open output file %s.", fname);
-      bfx_error(bfx, msg);
+    for (i = 0; i < BFX_LANES_REGISTERS; ++i) {
+      e->registers[i * e->width + j] = e->registers[i * e->width + k];
     }
   }
+  e->count = kept;
 }
 
-/* 0x50 */
 /**
- * \brief 'P' - LOAD (1,str:0) - Load program into specified index.
+ * \brief Splits off the lanes whose top word's truth differs from most of
+ *        the group's, so that a branch can be taken one way.
  */
-void bfx_op50(beflux *bfx) {
-  char fname[BFX_BANK_SIZE] = "";
-  bfx_word prog = bfx_pop(bfx);
-  bfx_get_string(bfx, fname);
-  bfx_load(bfx, prog, fname);
+static void bfx_lanes_split_truth(bfx_ensemble *e) {
+  const bfx_word *top = BFX_LANES_TOP(e);
+  size_t k, count = bfx_lanes_count(e, top);
+  int truth = 2 * count >= e->count;
+
+  if (count == 0 || count == e->count)
+    return;
+  for (k = 0; k < e->count; ++k) {
+    e->keep[k] = (top[k] != 0) == truth;
+  }
+  bfx_lanes_split(e);
 }
 
 /**
- * \brief 'Q' - QUIT (0:0) - End execution.
+ * \brief Splits off the lanes whose top words differ from the leader's.
+ * \param depth Number of words from the top to compare.
  */
-void bfx_op51(beflux *bfx) {
-  bfx_ip_reset(bfx);
-  bfx->ip.wait = 1;
-  bfx->status = bfx->t_minor = 0;
-  ++bfx->t_major;
-  bfx->mode = BFX_MODE_HALT;
+static void bfx_lanes_split_values(bfx_ensemble *e, size_t depth) {
+  size_t k, d;
+
+  for (k = 0; k < e->count; ++k) {
+    e->keep[k] = 1;
+  }
+  for (d = 1; d <= depth; ++d) {
+    const bfx_word *row = BFX_LANES_ROW(e, e->size - d);
+    for (k = 0; k < e->count; ++k) {
+      e->keep[k] &= row[k] == row[0];
+    }
+  }
+  bfx_lanes_split(e);
 }
 
+/* Stack Rows */
 /**
- * \brief 'R' - RET (0:0) - Return from a CALL.
+ * \brief Pushes the same word onto every lane.
  */
-void bfx_op52(beflux *bfx) {
-  bfx_push(bfx, bfx_stack_pop(&bfx->calls_row));
-  bfx_push(bfx, bfx_stack_pop(&bfx->calls_col));
-  bfx_op4a(bfx); /* J */
-  bfx_ip_advance(bfx);
+static void bfx_lanes_push(bfx_ensemble *e, bfx_word value) {
+  bfx_fill(BFX_LANES_ROW(e, e->size), value, e->width);
+  e->size = BFX_STACK_INDEX(e->size + 1);
 }
 
 /**
- * \brief 'S' - SETP (4:0) - Set a specified program character.
+ * \brief Pops the top row from every lane.
  */
-void bfx_op53(beflux *bfx) {
-  bfx_word col = bfx_pop(bfx);
-  bfx_word row = bfx_pop(bfx);
-  bfx_word prog = bfx_pop(bfx);
-  bfx_program_set(bfx, prog, row, col, bfx_pop(bfx));
+static void bfx_lanes_pop(bfx_ensemble *e) {
+  e->size = BFX_STACK_INDEX(e->size - 1);
+  memset(BFX_LANES_ROW(e, e->size), 0, e->width * sizeof(bfx_word));
 }
 
 /**
- * \brief 'T' - TMAJ (0:1) - Push the t_major timer.
+ * \brief Pops words that every lane agrees on and pushes them onto the
+ *        leader's own frame, first to last, so that a built-in op can take
+ *        them from there. The leader's frame is only scratch space until
+ *        the rows are written back.
  */
-void bfx_op54(beflux *bfx) {
-  bfx_push(bfx, bfx->t_major);
+static void bfx_lanes_hand_over(bfx_ensemble *e, size_t depth) {
+  beflux *leader = BFX_LANES_LEADER(e);
+  size_t d;
+
+  for (d = depth; d > 0; --d) {
+    bfx_push(leader, BFX_LANES_ROW(e, e->size - d)[0]);
+  }
+  for (d = 0; d < depth; ++d) {
+    bfx_lanes_pop(e);
+  }
 }
 
 /**
- * \brief 'U' - CURP (0:1) - Push the current program index.
+ * \brief Runs a built-in op on the leader alone, for ops that only move the
+ *        IP, change the leader's counters or push one word every lane
+ *        agrees on, which is moved onto the rows.
  */
-void bfx_op55(beflux *bfx) {
-  bfx_push(bfx, bfx->current_program);
+static void bfx_lanes_lead(bfx_ensemble *e, bfx_word op) {
+  beflux *leader = BFX_LANES_LEADER(e);
+  bfx_stack *s = leader->frames + BFX_FRAME_INDEX(leader->current_frame);
+  bfx_word size = s->size;
+
+  bfx_eval(leader, op);
+  if (s->size != size)
+    bfx_lanes_push(e, bfx_stack_pop(s));
 }
 
 /**
- * \brief 'V' - NXTP (0:0) - Incrememnt the program index.
+ * \brief Measures the string on top of one lane, as REVS would see it.
+ * \return The number of words above the terminator, or BFX_STACK_SIZE if
+ *         there is none.
  */
-void bfx_op56(beflux *bfx) {
-  ++bfx->current_program;
+static size_t bfx_lanes_string(bfx_ensemble *e, size_t k) {
+  size_t len;
+  for (len = 0; len < BFX_STACK_SIZE; ++len) {
+    if (BFX_LANES_ROW(e, e->size - 1 - len)[k] == 0)
+      break;
+  }
+  return len;
 }
 
 /**
- * \brief 'W' - WRAP (1:0) - Set wrapping offset.
+ * \brief Checks whether every lane in the group has an input or output
+ *        file, without which the op is left to report the error itself.
  */
-void bfx_op57(beflux *bfx) {
-  bfx->wrap_offset = bfx_pop(bfx);
+static int bfx_lanes_files(bfx_ensemble *e, int out) {
+  size_t k;
+  for (k = 0; k < e->count; ++k) {
+    beflux *lane = e->lanes[e->group[k]];
+    if ((out ? lane->out : lane->in) == NULL)
+      return 0;
+  }
+  return 1;
 }
 
 /**
- * \brief 'X' - EXEP (1:0) - Execute program.
+ * \brief Runs one op lane by lane with the rows written back, then keeps
+ *        the lanes that still agree with the leader, and whose programs
+ *        still match if the op could have written to them.
  */
-void bfx_op58(beflux *bfx) {
-  bfx_op4a(bfx); /* 'J' */
-  bfx->current_program = bfx_pop(bfx);
+static void bfx_lanes_each(bfx_ensemble *e, bfx_word op) {
+  beflux *leader = BFX_LANES_LEADER(e);
+  int writes = strchr(BFX_LANES_WRITES, op) != NULL;
+  size_t k, kept = 0;
+
+  /* SETP with the same arguments everywhere leaves programs alike. */
+  if (op == 'S') {
+    size_t d;
+    writes = 0;
+    for (d = 1; d <= 4; ++d) {
+      writes |= !bfx_lanes_uniform(e, BFX_LANES_ROW(e, e->size - d));
+    }
+  }
+
+  for (k = e->count; k-- > 0; ) {
+    bfx_lanes_scatter(e, k);
+  }
+  bfx_lanes_flush(e);
+
+  for (k = 0; k < e->count; ++k) {
+    beflux *lane = e->lanes[e->group[k]];
+    bfx_eval(lane, op);
+    bfx_ip_advance(lane);
+    ++lane->tick;
+  }
+
+  for (k = 0; k < e->count; ++k) {
+    beflux *lane = e->lanes[e->group[k]];
+    if (
+      k == 0 || (
+        bfx_lanes_same(lane, leader) &&
+        (!writes || bfx_lanes_programs(lane, leader))
+      )
+    ) {
+      e->group[kept++] = e->group[k];
+    }
+    else if (
+      lane->mode != BFX_MODE_HALT && lane->mode != BFX_MODE_PAUSED &&
+      lane->mode != BFX_MODE_PARKED
+    ) {
+      lane->resume_mode = lane->mode;
+      lane->mode = BFX_MODE_PAUSED;
+      e->resume[e->group[k]] = 1;
+    }
+  }
+  e->count = kept;
+  bfx_lanes_gather(e);
 }
 
 /**
- * \brief 'Y' - CLRR (0:0) - Clear all registers.
+ * \brief Checks every lane in the group for a pending interrupt.
  */
-void bfx_op59(beflux *bfx) {
-  size_t i;
-  for (i = 0; i < BFX_BANK_SIZE; ++i) {
-    bfx->registers[i] = 0;
+static int bfx_lanes_interrupted(bfx_ensemble *e) {
+  size_t k;
+  for (k = 0; k < e->count; ++k) {
+    if (BFX_ATOMIC_LOAD(&e->lanes[e->group[k]]->interrupt) != BFX_INTERRUPT_NONE)
+      return 1;
   }
+  return 0;
 }
 
 /**
- * \brief 'Z' - RAND (0:1) - Push a random value.
+ * \brief Runs the group in lockstep until it halts, shrinks to one lane,
+ *        is interrupted or has to sleep, then writes the rows back. Lanes
+ *        that are still running are paused for bfx_run to resume.
  */
-void bfx_op5a(beflux *bfx) {
-  bfx_push(bfx, rand());
+static void bfx_lanes_run(bfx_ensemble *e) {
+  size_t ticks = 0, k, d;
+
+  while (e->count > 1) {
+    beflux *leader = BFX_LANES_LEADER(e);
+    bfx_word op, *top, *next, *row;
+
+    if (
+      (leader->mode != BFX_MODE_NORMAL && leader->mode != BFX_MODE_STRING &&
+       leader->mode != BFX_MODE_STRING_ESC) ||
+      leader->sleep ||
+      (++ticks % BFX_BATCH_SIZE == 0 && bfx_lanes_interrupted(e))
+    ) break;
+
+    op = bfx_ip_get_op(leader);
+    if (leader->mode != BFX_MODE_NORMAL) {
+      bfx_lanes_lead(e, op); /* String characters */
+      goto advance;
+    }
+
+    top = BFX_LANES_TOP(e);
+    next = BFX_LANES_NEXT(e);
+    switch (op) {
+      /* The same for every lane */
+      case ' ': case '"': case '#': case ';': case '<': case '>': case 'A':
+      case 'B': case 'H': case 'L': case 'R': case 'T': case 'U': case 'V':
+      case '[': case ']': case '^': case 'h': case 'l': case 't': case 'v':
+      case 'y': case '}': case 0x7f:
+      case '0': case '1': case '2': case '3': case '4': case '5': case '6':
+      case '7': case '8': case '9': case 'a': case 'b': case 'c': case 'd':
+      case 'e': case 'f':
+        bfx_lanes_lead(e, op);
+        break;
+
+      case '@': /* Without the pass trace */
+        bfx_ip_reset(leader);
+        leader->ip.wait = 1;
+        ++leader->t_minor;
+        break;
+
+      /* Stack and arithmetic, on whole rows */
+      case '!':
+        bfx_lanes_not(e, top);
+        break;
+
+      case '$':
+        bfx_lanes_pop(e);
+        break;
+
+      case ':':
+        memcpy(BFX_LANES_ROW(e, e->size), top, e->width * sizeof(bfx_word));
+        e->size = BFX_STACK_INDEX(e->size + 1);
+        break;
+
+      case '\'':
+        memcpy(BFX_LANES_ROW(e, e->size), next, e->width * sizeof(bfx_word));
+        e->size = BFX_STACK_INDEX(e->size + 1);
+        break;
+
+      case '\\':
+        memcpy(e->scratch, top, e->width * sizeof(bfx_word));
+        memcpy(top, next, e->width * sizeof(bfx_word));
+        memcpy(next, e->scratch, e->width * sizeof(bfx_word));
+        break;
+
+      case '*': case '+': case '-': case '=': case '`':
+        bfx_lanes_binary(e, next, top, op);
+        bfx_lanes_pop(e);
+        break;
+
+      case 'N':
+        while (e->size)
+          bfx_lanes_pop(e);
+        break;
+
+      case '%': case '/': {
+        /* Lanes dividing by zero leave to report it */
+        size_t count = bfx_lanes_count(e, top);
+        if (count == 0) {
+          bfx_lanes_each(e, op);
+          continue;
+        }
+        if (count < e->count) {
+          for (k = 0; k < e->count; ++k) {
+            e->keep[k] = top[k] != 0;
+          }
+          bfx_lanes_split(e);
+        }
+        for (k = 0; k < e->count; ++k) {
+          next[k] = op == '/' ? next[k] / top[k] : next[k] % top[k];
+        }
+        bfx_lanes_pop(e);
+      } break;
+
+      /* Branches, taken one way once the lanes going the other have left */
+      case '_': case 'm': case 'w': case '{': case '|':
+        bfx_lanes_split_truth(e);
+        bfx_lanes_hand_over(e, 1);
+        bfx_default_op_bindings[op](BFX_LANES_LEADER(e));
+        break;
+
+      /* Jumps, with the lanes going elsewhere split off */
+      case 'C': case 'J': case 'W': case 'X': case 'j':
+        d = op == 'X' ? 3 : op == 'W' ? 1 : 2;
+        bfx_lanes_split_values(e, d);
+        bfx_lanes_hand_over(e, d);
+        bfx_default_op_bindings[op](BFX_LANES_LEADER(e));
+        break;
+
+      /* Registers, by row when every lane uses the same one */
+      case 'g':
+        if (bfx_lanes_uniform(e, top)) {
+          row = bfx_lanes_register(e, BFX_REGISTER_INDEX(top[0]));
+          memcpy(top, row, e->count * sizeof(bfx_word));
+        }
+        else for (k = 0; k < e->count; ++k) {
+          top[k] = *bfx_lanes_register_at(e, k, BFX_REGISTER_INDEX(top[k]), 0);
+        }
+        break;
+
+      case 's':
+        if (bfx_lanes_uniform(e, top)) {
+          size_t r = BFX_REGISTER_INDEX(top[0]);
+          row = bfx_lanes_register(e, r);
+          memcpy(row, next, e->count * sizeof(bfx_word));
+          e->reg_dirty[r % BFX_LANES_REGISTERS] = 1;
+        }
+        else for (k = 0; k < e->count; ++k) {
+          *bfx_lanes_register_at(e, k, BFX_REGISTER_INDEX(top[k]), 1) = next[k];
+        }
+        bfx_lanes_pop(e);
+        bfx_lanes_pop(e);
+        break;
+
+      case 'p':
+        if (bfx_lanes_uniform(e, top)) {
+          size_t r = BFX_REGISTER_INDEX(top[0]);
+          row = bfx_lanes_register(e, r);
+          e->reg_dirty[r % BFX_LANES_REGISTERS] = 1;
+          memcpy(e->scratch, row, e->count * sizeof(bfx_word));
+          memcpy(row, next, e->count * sizeof(bfx_word));
+          memcpy(next, e->scratch, e->count * sizeof(bfx_word));
+        }
+        else for (k = 0; k < e->count; ++k) {
+          bfx_word *reg = bfx_lanes_register_at(e, k, BFX_REGISTER_INDEX(top[k]), 1);
+          bfx_word value = *reg;
+          *reg = next[k];
+          next[k] = value;
+        }
+        bfx_lanes_pop(e);
+        break;
+
+      /* Files, lane by lane */
+      case ',': case '.': case 'n':
+        if (!bfx_lanes_files(e, 1)) {
+          bfx_lanes_each(e, op);
+          continue;
+        }
+        for (k = 0; k < e->count; ++k) {
+          FILE *out = e->lanes[e->group[k]]->out;
+          if (op == ',')
+            fputc(top[k], out);
+          else if (op == '.')
+            fprintf(out, BFX_WORD_FMT, top[k]);
+          else
+            fputc('\n', out);
+        }
+        if (op != 'n')
+          bfx_lanes_pop(e);
+        break;
+
+      case 'o': {
+        size_t len = bfx_lanes_string(e, 0);
+        if (len >= BFX_STACK_SIZE - 1 || !bfx_lanes_files(e, 1)) {
+          bfx_lanes_each(e, op);
+          continue;
+        }
+        for (k = 0; k < e->count; ++k) {
+          e->keep[k] = bfx_lanes_string(e, k) == len;
+        }
+        bfx_lanes_split(e);
+        for (k = 0; k < e->count; ++k) {
+          FILE *out = e->lanes[e->group[k]]->out;
+          for (d = len; d > 0; --d) {
+            fputc(BFX_LANES_ROW(e, e->size - d)[k], out);
+          }
+        }
+        /* REVS leaves a second terminator, which PUTS stops at */
+        for (d = 0; d < len; ++d) {
+          bfx_lanes_pop(e);
+        }
+        bfx_lanes_push(e, 0);
+      } break;
+
+      case 'E': case '~':
+        if (!bfx_lanes_files(e, 0)) {
+          bfx_lanes_each(e, op);
+          continue;
+        }
+        row = BFX_LANES_ROW(e, e->size);
+        for (k = 0; k < e->count; ++k) {
+          FILE *in = e->lanes[e->group[k]]->in;
+          row[k] = op == '~' ? (bfx_word) fgetc(in) : (bfx_word) !!feof(in);
+        }
+        e->size = BFX_STACK_INDEX(e->size + 1);
+        break;
+
+      default:
+        bfx_lanes_each(e, op);
+        continue;
+    }
+
+  advance:
+    leader = BFX_LANES_LEADER(e);
+    bfx_ip_advance(leader);
+    ++leader->tick;
+    e->lockstep += e->count;
+  }
+
+  for (k = e->count; k-- > 0; ) {
+    beflux *lane = e->lanes[e->group[k]];
+    bfx_lanes_scatter(e, k);
+    if (
+      lane->mode == BFX_MODE_NORMAL || lane->mode == BFX_MODE_STRING ||
+      lane->mode == BFX_MODE_STRING_ESC
+    ) {
+      lane->resume_mode = lane->mode;
+      lane->mode = BFX_MODE_PAUSED;
+      e->resume[e->group[k]] = 1;
+    }
+  }
+  bfx_lanes_flush(e);
 }
 
+/* Ensemble Functions */
 /**
- * \brief '[' - TRNL (0:0) - Turn IP left.
+ * \brief Creates an ensemble of interpreters, one per lane, for running the
+ *        same program over many inputs. Each lane is set up like any
+ *        interpreter, through bfx_ensemble_lane.
+ * \param lanes Number of lanes.
+ * \return The new ensemble, or NULL if it could not be allocated.
  */
-void bfx_op5b(beflux *bfx) {
-  bfx->ip.dir += BFX_IP_TURN_L;
+bfx_ensemble *bfx_ensemble_new(size_t lanes) {
+  bfx_ensemble *e = calloc(1, sizeof(bfx_ensemble));
+  size_t i;
+
+  if (e == NULL)
+    return NULL;
+  e->lane_count = lanes;
+  e->width = (lanes + BFX_LANES_WIDTH - 1) / BFX_LANES_WIDTH * BFX_LANES_WIDTH;
+  if (e->width == 0)
+    e->width = BFX_LANES_WIDTH;
+
+  e->lanes = calloc(lanes ? lanes : 1, sizeof(beflux *));
+  e->resume = calloc(e->width, sizeof(uint8_t));
+  e->group = calloc(e->width, sizeof(size_t));
+  e->keep = calloc(e->width, sizeof(uint8_t));
+  e->stack = calloc(BFX_STACK_SIZE * e->width, sizeof(bfx_word));
+  e->scratch = calloc(e->width, sizeof(bfx_word));
+  e->registers = calloc(BFX_LANES_REGISTERS * e->width, sizeof(bfx_word));
+  if (
+    e->lanes == NULL || e->resume == NULL || e->group == NULL ||
+    e->keep == NULL || e->stack == NULL || e->scratch == NULL ||
+    e->registers == NULL
+  ) {
+    bfx_ensemble_del(e);
+    return NULL;
+  }
+
+  for (i = 0; i < lanes; ++i) {
+    if ((e->lanes[i] = bfx_new()) == NULL) {
+      bfx_ensemble_del(e);
+      return NULL;
+    }
+  }
+
+#ifdef BFX_LANES_AVX2
+  e->simd = __builtin_cpu_supports("avx2");
+#endif
+  return e;
 }
 
 /**
- * \brief '\' - SWP (2:2) - Swap the top two values on the current stack.
+ * \brief Frees an ensemble and its lanes.
  */
-void bfx_op5c(beflux *bfx) {
-  bfx_word a = bfx_pop(bfx);
-  bfx_word b = bfx_pop(bfx);
-  bfx_push(bfx, a);
-  bfx_push(bfx, b);
+void bfx_ensemble_del(bfx_ensemble *e) {
+  size_t i;
+
+  if (e->lanes != NULL) {
+    for (i = 0; i < e->lane_count; ++i) {
+      if (e->lanes[i] != NULL)
+        bfx_del(e->lanes[i]);
+    }
+  }
+  free(e->lanes);
+  free(e->resume);
+  free(e->group);
+  free(e->keep);
+  free(e->stack);
+  free(e->scratch);
+  free(e->registers);
+  free(e);
 }
 
 /**
- * \brief ']' - TRNR (0:0) - Turn IP right.
+ * \brief Returns the interpreter running in one lane of an ensemble.
  */
-void bfx_op5d(beflux *bfx) {
-  bfx->ip.dir += BFX_IP_TURN_R;
+beflux *bfx_ensemble_lane(bfx_ensemble *e, size_t lane) {
+  return lane < e->lane_count ? e->lanes[lane] : NULL;
 }
 
 /**
- * \brief '^' - MVN (0:0) - Change direction to North.
+ * \brief Runs the first count lanes of an ensemble as bfx_run would run
+ *        each of them. Halted lanes with the same programs and no hooks,
+ *        fuel, timeout or rebound ops start in lockstep, and every other
+ *        lane runs on its own, as do lanes once they leave the group.
+ * \return The number of lane ticks run in lockstep.
  */
-void bfx_op5e(beflux *bfx) {
-  bfx->ip.dir = BFX_IP_N;
+size_t bfx_ensemble_run(bfx_ensemble *e, size_t count) {
+  beflux *leader = NULL;
+  size_t i, k;
+
+  if (count > e->lane_count)
+    count = e->lane_count;
+  e->count = 0;
+  e->lockstep = 0;
+
+  for (i = 0; i < count; ++i) {
+    beflux *lane = e->lanes[i];
+    e->resume[i] = 1;
+    if (!bfx_lanes_ready(lane))
+      continue;
+    if (leader == NULL)
+      leader = lane;
+    else if (!bfx_lanes_same(lane, leader) || !bfx_lanes_programs(lane, leader))
+      continue;
+    e->group[e->count++] = i;
+    e->resume[i] = 0;
+  }
+
+  if (e->count > 1) {
+    for (k = 0; k < e->count; ++k) {
+      beflux *lane = e->lanes[e->group[k]];
+      time(&lane->run_timer);
+      bfx_trace_clear(lane);
+      lane->mode = BFX_MODE_NORMAL;
+    }
+    memset(e->reg_index, 0, sizeof(e->reg_index));
+    memset(e->reg_dirty, 0, sizeof(e->reg_dirty));
+    bfx_lanes_gather(e);
+    bfx_lanes_run(e);
+  }
+  else if (e->count == 1) {
+    e->resume[e->group[0]] = 1;
+  }
+
+  for (i = 0; i < count; ++i) {
+    if (e->resume[i])
+      bfx_run(e->lanes[i]);
+  }
+  return e->lockstep;
 }
 
+/*******************************************************************************
+ * Pipelines
+ *
+ * Every stage runs bfx_run on its own thread, reading what the stage before
+ * it writes. Between two stages is a single-producer, single-consumer ring
+ * of bytes, wrapped in a stdio stream at each end so that ops keep using
+ * FILE calls, and stdio's buffers move bytes through the ring in blocks. A
+ * producer facing a full ring, or a consumer facing an empty one, sleeps on
+ * the ring's condition variable instead of spinning; the other side only
+ * takes the lock when someone is waiting.
+ */
+#ifdef BFX_PIPES
+#define BFX_PIPE_CAPACITY 65536
+
+typedef struct bfx_pipe {
+  unsigned char *data;
+  size_t mask;
+  size_t head; /* Bytes written, stored by the producer */
+  size_t tail; /* Bytes read, stored by the consumer */
+  int writer_closed;
+  int reader_closed;
+  int waiting;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+} bfx_pipe;
+
+typedef struct bfx_pipe_stage {
+  beflux *bfx;
+  bfx_pipe *in;
+  bfx_pipe *out;
+  FILE *fin;
+  FILE *fout;
+  beflux *upstream;
+  pthread_t thread;
+} bfx_pipe_stage;
+#endif
+
+struct bfx_pipeline {
+  beflux **stages;
+  size_t count;
+  size_t capacity;
+#ifdef BFX_PIPES
+  bfx_pipe *pipes;
+  bfx_pipe_stage *threads;
+#endif
+};
+
+#ifdef BFX_PIPES
 /**
- * \brief '_' - WEIF (1:0) - West / East conditional branch.
+ * \brief Whether one end of a pipe has to wait for the other.
+ * \param producer Nonzero for the writing end.
  */
-void bfx_op5f(beflux *bfx) {
-  if (bfx_pop(bfx))
-    bfx_op3c(bfx); /* '<' */
-  else
-    bfx_op3e(bfx); /* '>' */
+static int bfx_pipe_blocked(bfx_pipe *pipe, int producer) {
+  size_t head = __atomic_load_n(&pipe->head, __ATOMIC_SEQ_CST);
+  size_t tail = __atomic_load_n(&pipe->tail, __ATOMIC_SEQ_CST);
+  if (producer)
+    return head - tail > pipe->mask && !__atomic_load_n(&pipe->reader_closed, __ATOMIC_SEQ_CST);
+  return head == tail && !__atomic_load_n(&pipe->writer_closed, __ATOMIC_SEQ_CST);
 }
 
-/* 0x60 */
 /**
- * \brief '`' - GT (2:1) - Compare values.
+ * \brief Sleeps until the other end of the pipe makes progress or closes.
+ *        The waiting count is raised before the last check, so a store
+ *        made after that check always sees it and signals.
  */
-void bfx_op60(beflux *bfx) {
-  bfx_push(bfx, bfx_pop(bfx) > bfx_pop(bfx));
+static void bfx_pipe_wait(bfx_pipe *pipe, int producer) {
+  pthread_mutex_lock(&pipe->lock);
+  __atomic_add_fetch(&pipe->waiting, 1, __ATOMIC_SEQ_CST);
+  while (bfx_pipe_blocked(pipe, producer)) {
+    pthread_cond_wait(&pipe->wake, &pipe->lock);
+  }
+  __atomic_sub_fetch(&pipe->waiting, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&pipe->lock);
 }
 
 /**
- * \brief 'a' - VA (0:?) - Hex digit A.
+ * \brief Wakes the other end of a pipe, if it is waiting.
  */
-void bfx_op61(beflux *bfx) { bfx_get_digit(bfx, 10); }
+static void bfx_pipe_wake(bfx_pipe *pipe) {
+  if (__atomic_load_n(&pipe->waiting, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&pipe->lock);
+    pthread_cond_broadcast(&pipe->wake);
+    pthread_mutex_unlock(&pipe->lock);
+  }
+}
 
 /**
- * \brief 'b' - VB (0:?) - Hex digit B.
+ * \brief Marks one end of a pipe closed and wakes the other.
  */
-void bfx_op62(beflux *bfx) { bfx_get_digit(bfx, 11); }
+static void bfx_pipe_shut(bfx_pipe *pipe, int *end) {
+  pthread_mutex_lock(&pipe->lock);
+  __atomic_store_n(end, 1, __ATOMIC_SEQ_CST);
+  pthread_cond_broadcast(&pipe->wake);
+  pthread_mutex_unlock(&pipe->lock);
+}
 
 /**
- * \brief 'c' - VC (0:?) - Hex digit C.
+ * \brief Stream read function for the consuming end of a pipe.
+ * \return The number of bytes read, or 0 once the producer has closed its
+ *         end and the ring is empty.
  */
-void bfx_op63(beflux *bfx) { bfx_get_digit(bfx, 12); }
+static ssize_t bfx_pipe_read(void *cookie, char *buf, size_t size) {
+  bfx_pipe *pipe = (bfx_pipe *) cookie;
+  size_t tail = pipe->tail, count, first;
 
-/**
- * \brief 'd' - VD (0:?) - Hex digit D.
- */
-void bfx_op64(beflux *bfx) { bfx_get_digit(bfx, 13); }
+  while (bfx_pipe_blocked(pipe, 0)) {
+    bfx_pipe_wait(pipe, 0);
+  }
+  count = __atomic_load_n(&pipe->head, __ATOMIC_SEQ_CST) - tail;
+  if (count > size)
+    count = size;
+  first = pipe->mask + 1 - (tail & pipe->mask);
+  if (first > count)
+    first = count;
+  memcpy(buf, pipe->data + (tail & pipe->mask), first);
+  memcpy(buf + first, pipe->data, count - first);
+
+  __atomic_store_n(&pipe->tail, tail + count, __ATOMIC_SEQ_CST);
+  bfx_pipe_wake(pipe);
+  return (ssize_t) count;
+}
 
 /**
- * \brief 'e' - VE (0:?) - Hex digit E.
+ * \brief Stream write function for the producing end of a pipe. Blocks
+ *        while the ring is full.
+ * \return The number of bytes written, or 0 if the consumer has closed its
+ *         end, which stdio reports as a write error.
  */
-void bfx_op65(beflux *bfx) { bfx_get_digit(bfx, 14); }
+static ssize_t bfx_pipe_write(void *cookie, const char *buf, size_t size) {
+  bfx_pipe *pipe = (bfx_pipe *) cookie;
+  size_t done = 0;
 
-/**
- * \brief 'f' - VF (0:?) - Hex digit F.
- */
-void bfx_op66(beflux *bfx) { bfx_get_digit(bfx, 15); }
+  while (done < size) {
+    size_t head = pipe->head, count, first;
 
-/**
- * \brief 'g' - GETR (1:1) - Push value from given register.
- */
-void bfx_op67(beflux *bfx) {
-  bfx_push(bfx, bfx->registers[bfx_pop(bfx)]);
+    while (bfx_pipe_blocked(pipe, 1)) {
+      bfx_pipe_wait(pipe, 1);
+    }
+    if (__atomic_load_n(&pipe->reader_closed, __ATOMIC_SEQ_CST))
+      return 0;
+
+    count = pipe->mask + 1 - (head - __atomic_load_n(&pipe->tail, __ATOMIC_SEQ_CST));
+    if (count > size - done)
+      count = size - done;
+    first = pipe->mask + 1 - (head & pipe->mask);
+    if (first > count)
+      first = count;
+    memcpy(pipe->data + (head & pipe->mask), buf + done, first);
+    memcpy(pipe->data, buf + done + first, count - first);
+
+    __atomic_store_n(&pipe->head, head + count, __ATOMIC_SEQ_CST);
+    bfx_pipe_wake(pipe);
+    done += count;
+  }
+  return (ssize_t) size;
 }
 
 /**
- * \brief 'h' - BMPN (0:0) - Bump IP North.
+ * \brief Stream close function for the consuming end of a pipe.
  */
-void bfx_op68(beflux *bfx) {
-  --bfx->ip.row;
-  bfx->ip.wait = 1;
+static int bfx_pipe_close_reader(void *cookie) {
+  bfx_pipe *pipe = (bfx_pipe *) cookie;
+  bfx_pipe_shut(pipe, &pipe->reader_closed);
+  return 0;
 }
 
 /**
- * \brief 'i' - GETS (0:str) - Read null-terminated string or line from input.
+ * \brief Stream close function for the producing end of a pipe.
  */
-void bfx_op69(beflux *bfx) {
-  bfx_word top;
-  do {
-    bfx_op7e(bfx); /* '~' */
-    top = bfx_top(bfx);
-  } while (top && top != '\n');
+static int bfx_pipe_close_writer(void *cookie) {
+  bfx_pipe *pipe = (bfx_pipe *) cookie;
+  bfx_pipe_shut(pipe, &pipe->writer_closed);
+  return 0;
 }
 
 /**
- * \brief 'j' - JREL (2:0) - Jump relative to current IP position.
+ * \brief Runs one stage, then closes its ends of the pipes around it. A
+ *        stage that stops reading also stops the stage feeding it, as a
+ *        broken pipe would.
  */
-void bfx_op6a(beflux *bfx) {
-  bfx_word dx = bfx_pop(bfx);
-  bfx_word dy = bfx_pop(bfx);
-  bfx_word dir = bfx->ip.dir;
+static void *bfx_pipeline_thread(void *arg) {
+  bfx_pipe_stage *stage = (bfx_pipe_stage *) arg;
+  beflux *bfx = stage->bfx;
 
-  bfx->ip.dir = BFX_IP_E;
-  while (dx--) {
-    bfx_ip_advance(bfx);
-  }
+  bfx_run(bfx);
 
-  bfx->ip.dir = BFX_IP_S;
-  while (dy--) {
-    bfx_ip_advance(bfx);
+  /* The program may have closed or replaced the streams itself with 'E'
+   * or 'i'; the pipe's own flags say whether they are still open. */
+  if (stage->out != NULL) {
+    if (!__atomic_load_n(&stage->out->writer_closed, __ATOMIC_SEQ_CST))
+      fclose(stage->fout);
+    if (bfx->out == stage->fout)
+      bfx->out = stdout;
   }
-
-  bfx->ip.dir = dir;
-  bfx->ip.wait = 1;
+  if (stage->in != NULL) {
+    if (!__atomic_load_n(&stage->in->reader_closed, __ATOMIC_SEQ_CST))
+      fclose(stage->fin);
+    if (bfx->in == stage->fin)
+      bfx->in = stdin;
+    bfx_interrupt(stage->upstream, BFX_INTERRUPT_QUIT);
+  }
+  return NULL;
 }
+#endif
 
 /**
- * \brief 'k' - ITER (1:?) - Iterate next instruction.
+ * \brief Creates a pipeline of interpreters, each stage reading the output
+ *        of the one before it. Load each stage through bfx_pipeline_stage.
+ * \param stages Number of stages.
+ * \param capacity Bytes buffered between two stages, rounded up to a power
+ *        of two, or 0 for a default.
+ * \return The new pipeline, or NULL if it could not be allocated or this
+ *         build has no threads.
  */
-void bfx_op6b(beflux *bfx) {
-  bfx_ip_advance(bfx);
-  bfx->ip.wait = bfx_pop(bfx);
-}
+bfx_pipeline *bfx_pipeline_new(size_t stages, size_t capacity) {
+#ifdef BFX_PIPES
+  bfx_pipeline *p = calloc(1, sizeof(bfx_pipeline));
+  size_t i;
 
-/**
- * \brief 'l' - LOOP (0:1) - Push and increment loop counter.
- */
-void bfx_op6c(beflux *bfx) {
-  bfx_push(bfx, bfx->loop_count++);
+  if (p == NULL)
+    return NULL;
+  p->count = stages;
+  p->capacity = BFX_PIPE_CAPACITY;
+  if (capacity) {
+    for (p->capacity = 1; p->capacity < capacity; p->capacity <<= 1);
+  }
+
+  p->stages = calloc(stages ? stages : 1, sizeof(beflux *));
+  p->pipes = calloc(stages ? stages : 1, sizeof(bfx_pipe));
+  p->threads = calloc(stages ? stages : 1, sizeof(bfx_pipe_stage));
+  if (p->stages == NULL || p->pipes == NULL || p->threads == NULL) {
+    bfx_pipeline_del(p);
+    return NULL;
+  }
+  for (i = 0; i < stages; ++i) {
+    if ((p->stages[i] = bfx_new()) == NULL) {
+      bfx_pipeline_del(p);
+      return NULL;
+    }
+  }
+  return p;
+#else
+  (void) stages;
+  (void) capacity;
+  return NULL;
+#endif
 }
 
 /**
- * \brief 'm' - NIF (1:0) - North / Continue conditional branch.
+ * \brief Frees a pipeline and its stages.
  */
-void bfx_op6d(beflux *bfx) {
-  if (bfx_pop(bfx))
-    bfx_op5e(bfx); /* '^' */
+void bfx_pipeline_del(bfx_pipeline *p) {
+  size_t i;
+
+  if (p->stages != NULL) {
+    for (i = 0; i < p->count; ++i) {
+      if (p->stages[i] != NULL)
+        bfx_del(p->stages[i]);
+    }
+  }
+  free(p->stages);
+#ifdef BFX_PIPES
+  free(p->pipes);
+  free(p->threads);
+#endif
+  free(p);
 }
 
 /**
- * \brief 'n' - ENDL (0:0) - Write newline to output.
+ * \brief Returns the interpreter running one stage of a pipeline. The first
+ *        stage reads from its own in, and the last writes to its own out.
  */
-void bfx_op6e(beflux *bfx) {
-  bfx_push(bfx, '\n');
-  bfx_op2c(bfx);
+beflux *bfx_pipeline_stage(bfx_pipeline *p, size_t stage) {
+  return stage < p->count ? p->stages[stage] : NULL;
 }
 
 /**
- * \brief 'o' - PUTS (str:0) - Write null-terminated string to output.
- */
-void bfx_op6f(beflux *bfx) {
-  bfx_op72(bfx); /* 'r' */
-  while (bfx_top(bfx)) {
-    bfx_op2c(bfx); /* ',' */
+ * \brief Runs every stage of a pipeline at once, each on its own thread,
+ *        until all of them return from bfx_run.
+ * \return The first nonzero exit status among the stages, or 0.
+ */
+bfx_word bfx_pipeline_run(bfx_pipeline *p) {
+  bfx_word status = 0;
+#ifdef BFX_PIPES
+  static cookie_io_functions_t reader = {
+    bfx_pipe_read, NULL, NULL, bfx_pipe_close_reader
+  };
+  static cookie_io_functions_t writer = {
+    NULL, bfx_pipe_write, NULL, bfx_pipe_close_writer
+  };
+  size_t i, started;
+
+  /* Pipe i runs from stage i to stage i + 1. */
+  for (i = 0; i + 1 < p->count; ++i) {
+    bfx_pipe *pipe = p->pipes + i;
+    memset(pipe, 0, sizeof(bfx_pipe));
+    pipe->data = malloc(p->capacity);
+    pipe->mask = p->capacity - 1;
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->wake, NULL);
+  }
+
+  for (i = 0; i < p->count; ++i) {
+    bfx_pipe_stage *stage = p->threads + i;
+    memset(stage, 0, sizeof(bfx_pipe_stage));
+    stage->bfx = p->stages[i];
+    if (i > 0) {
+      stage->in = p->pipes + i - 1;
+      stage->upstream = p->stages[i - 1];
+      stage->fin = stage->in->data != NULL ? fopencookie(stage->in, "r", reader) : NULL;
+      stage->bfx->in = stage->fin;
+    }
+    if (i + 1 < p->count) {
+      stage->out = p->pipes + i;
+      stage->fout = stage->out->data != NULL ? fopencookie(stage->out, "w", writer) : NULL;
+      stage->bfx->out = stage->fout;
+    }
+  }
+
+  /* A stage without its streams, or whose thread could not start, is run
+   * no further than an empty pipe; the stages beside it see it closed. */
+  for (started = 0; started < p->count; ++started) {
+    bfx_pipe_stage *stage = p->threads + started;
+    if (
+      (stage->in != NULL && stage->fin == NULL) ||
+      (stage->out != NULL && stage->fout == NULL) ||
+      pthread_create(&stage->thread, NULL, bfx_pipeline_thread, stage) != 0
+    ) {
+      bfx_error(stage->bfx, "Failed to start pipeline stage.");
+      break;
+    }
+  }
+  for (i = started; i < p->count; ++i) {
+    bfx_pipe_stage *stage = p->threads + i;
+    if (stage->in != NULL) {
+      if (stage->fin != NULL)
+        fclose(stage->fin);
+      else
+        bfx_pipe_shut(stage->in, &stage->in->reader_closed);
+      stage->bfx->in = stdin;
+      bfx_interrupt(stage->upstream, BFX_INTERRUPT_QUIT);
+    }
+    if (stage->out != NULL) {
+      if (stage->fout != NULL)
+        fclose(stage->fout);
+      else
+        bfx_pipe_shut(stage->out, &stage->out->writer_closed);
+      stage->bfx->out = stdout;
+    }
   }
+
+  for (i = 0; i < started; ++i) {
+    pthread_join(p->threads[i].thread, NULL);
+  }
+  for (i = 0; i < p->count; ++i) {
+    p->stages[i]->interrupt = BFX_INTERRUPT_NONE;
+    if (status == 0)
+      status = p->stages[i]->status;
+  }
+  for (i = 0; i + 1 < p->count; ++i) {
+    pthread_mutex_destroy(&p->pipes[i].lock);
+    pthread_cond_destroy(&p->pipes[i].wake);
+    free(p->pipes[i].data);
+  }
+#else
+  (void) p;
+#endif
+  return status;
 }
 
-/* 0x70 */
+/*******************************************************************************
+ * Hot Reload
+ *
+ * Interpreters attached to a watcher have every program loaded through
+ * bfx_load or LOAD ('P') watched for changes. When a source file is
+ * rewritten, bfx_watcher_poll parses it again and compares it with the text
+ * it last saw, row by row, and queues only the rows that differ. Each
+ * interpreter takes its queue at its next batch boundary, or the next time
+ * it is run, so rows never change under a running op. The pass trace is
+ * only dropped if the pass it recorded runs through a rewritten row.
+ */
+struct bfx_reload {
+  bfx_reload *next;
+  bfx_word prog;
+  bfx_word row;
+  size_t width;
+  bfx_word cells[];
+};
+
+#ifdef BFX_WATCH
+typedef struct bfx_watch {
+  beflux *bfx;
+  bfx_word prog;
+  int wd;
+  char path[BFX_BANK_SIZE + 4];
+  const char *name;
+  int changed;
+
+  /* The source text as of the last load or reload */
+  char **rows;
+  size_t *lengths;
+  size_t row_count;
+} bfx_watch;
+
+struct bfx_watcher {
+  int fd;
+  bfx_watch *watches;
+  size_t count;
+  size_t capacity;
+#ifdef BFX_THREADS
+  pthread_mutex_t lock;
+#endif
+};
+
 /**
- * \brief 'p' - SWPR (2:1) - Swap top of current stack with value in register.
+ * \brief Frees a watch's copy of its source text.
  */
-void bfx_op70(beflux *bfx) {
-  bfx_word i = bfx_pop(bfx);
-  bfx_word tmp = bfx->registers[i];
-  bfx->registers[i] = bfx_pop(bfx);
-  bfx_push(bfx, tmp);
+static void bfx_watch_rows_free(char **rows, size_t *lengths, size_t count) {
+  size_t i;
+  for (i = 0; i < count; ++i) {
+    free(rows[i]);
+  }
+  free(rows);
+  free(lengths);
 }
 
 /**
- * \brief 'q' - EXIT (1:0) - End execution with status.
+ * \brief Reads a source file into rows, as bfx_load would lay it out.
+ * \return Nonzero if the file could be read.
+ */
+static int bfx_watch_read(
+  const char *path, char ***rows, size_t **lengths, size_t *count
+) {
+  bfx_source src = { NULL, NULL, NULL, 0 };
+  size_t capacity = 0;
+  long len;
+  int ok = 1;
+
+  *rows = NULL;
+  *lengths = NULL;
+  *count = 0;
+  if ((src.fin = fopen(path, "r")) == NULL)
+    return 0;
+
+  if (bfx_source_row(&src) >= 0) { /* Header */
+    while (*count < BFX_SOURCE_HEIGHT && (len = bfx_source_row(&src)) >= 0) {
+      if (*count == capacity) {
+        char **r;
+        size_t *l;
+        capacity = capacity ? 2 * capacity : 64;
+        r = realloc(*rows, capacity * sizeof(char *));
+        if (r != NULL)
+          *rows = r;
+        l = realloc(*lengths, capacity * sizeof(size_t));
+        if (l != NULL)
+          *lengths = l;
+        if (r == NULL || l == NULL) {
+          ok = 0;
+          break;
+        }
+      }
+      if (((*rows)[*count] = malloc(len ? (size_t) len : 1)) == NULL) {
+        ok = 0;
+        break;
+      }
+      memcpy((*rows)[*count], src.row, (size_t) len);
+      (*lengths)[(*count)++] = (size_t) len;
+    }
+  }
+  bfx_source_free(&src);
+  fclose(src.fin);
+
+  if (!ok) {
+    bfx_watch_rows_free(*rows, *lengths, *count);
+    *rows = NULL;
+    *lengths = NULL;
+    *count = 0;
+  }
+  return ok;
+}
+
+/**
+ * \brief Queues a rewritten row for an interpreter.
  */
-void bfx_op71(beflux *bfx) {
-  bfx->status = bfx_pop(bfx);
-  if (bfx->status) {
-    char msg[BFX_BANK_SIZE] = "";
-    sprintf(msg, "Exited with status %02x.", bfx->status);
-    bfx_warning(bfx, msg);
+static bfx_reload *bfx_watch_patch(
+  bfx_reload *list, bfx_word prog, size_t row,
+  const char *text, size_t len, size_t width
+) {
+  bfx_reload *r = malloc(sizeof(bfx_reload) + width * sizeof(bfx_word));
+  size_t col;
+
+  if (r == NULL)
+    return list;
+  r->prog = prog;
+  r->row = (bfx_word) row;
+  r->width = width;
+  for (col = 0; col < width; ++col) {
+    r->cells[col] = col < len ? (unsigned char) text[col] : ' ';
   }
-  bfx_ip_reset(bfx);
-  bfx->ip.wait = 1;
-  bfx->t_minor = 0;
-  ++bfx->t_major;
-  bfx->mode = BFX_MODE_HALT;
+  r->next = list;
+  return r;
 }
 
 /**
- * \brief 'r' - REVS (str:str) - Reverse string on stack.
+ * \brief Parses a changed file again and queues the rows that differ from
+ *        the last version for its interpreter.
+ * \return The number of rows queued.
  */
-void bfx_op72(beflux *bfx) {
-  bfx_word buffer[BFX_BANK_SIZE];
+static size_t bfx_watch_reload(bfx_watch *watch) {
+  bfx_reload *list = NULL, *last = NULL;
+  char **rows;
+  size_t *lengths;
+  size_t count, row, queued = 0;
 
-  bfx_word i;
-  bfx_word count = 1;
+  if (!bfx_watch_read(watch->path, &rows, &lengths, &count))
+    return 0; /* Mid-replace; the next event will catch it */
 
-  buffer[0] = '\0';
-  while (bfx_top(bfx)) {
-    buffer[count++] = bfx_pop(bfx);
+  for (row = 0; row < count || row < watch->row_count; ++row) {
+    const char *text = row < count ? rows[row] : "";
+    size_t len = row < count ? lengths[row] : 0;
+    const char *old = row < watch->row_count ? watch->rows[row] : "";
+    size_t old_len = row < watch->row_count ? watch->lengths[row] : 0;
+
+    if (len == old_len && memcmp(text, old, len) == 0)
+      continue;
+    list = bfx_watch_patch(list, watch->prog, row, text, len, len > old_len ? len : old_len);
+    if (last == NULL)
+      last = list;
+    ++queued;
   }
 
-  for (i = 0; i < count; ++i) {
-    bfx_push(bfx, buffer[i]);
+  bfx_watch_rows_free(watch->rows, watch->lengths, watch->row_count);
+  watch->rows = rows;
+  watch->lengths = lengths;
+  watch->row_count = count;
+
+  /* Push the whole list at once; the interpreter reverses it. */
+  if (list != NULL) {
+    last->next = __atomic_load_n(&watch->bfx->reloads, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(
+      &watch->bfx->reloads, &last->next, list, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED
+    ));
   }
+  return queued;
 }
 
 /**
- * \brief 's' - SETR (2:0) - Set given register.
+ * \brief Stops watching one slot.
  */
-void bfx_op73(beflux *bfx) {
-  bfx_word i = bfx_pop(bfx);
-  bfx->registers[i] = bfx_pop(bfx);
+static void bfx_watch_remove(bfx_watcher *w, size_t i) {
+  bfx_watch_rows_free(w->watches[i].rows, w->watches[i].lengths, w->watches[i].row_count);
+  w->watches[i] = w->watches[--w->count];
 }
+#endif
 
 /**
- * \brief 't' - TMIN (0:1) - Push the t_minor timer.
+ * \brief Called by bfx_load after a program is loaded from a file, to watch
+ *        the file if the interpreter is attached to a watcher.
  */
-void bfx_op74(beflux *bfx) {
-  bfx_push(bfx, bfx->t_minor);
+static void bfx_watcher_add(beflux *bfx, bfx_word prog, const char *path) {
+#ifdef BFX_WATCH
+  beflux *root = bfx->root;
+  bfx_watcher *w = root->watcher;
+  bfx_watch *watch;
+  char dir[BFX_BANK_SIZE + 4];
+  const char *slash;
+
+  if (w == NULL || strlen(path) >= sizeof(watch->path))
+    return;
+  slash = strrchr(path, '/');
+  if (slash == NULL)
+    strcpy(dir, ".");
+  else
+    snprintf(dir, sizeof(dir), "%.*s", slash == path ? 1 : (int) (slash - path), path);
+
+#ifdef BFX_THREADS
+  pthread_mutex_lock(&w->lock);
+#endif
+  if (w->count == w->capacity) {
+    size_t capacity = w->capacity ? 2 * w->capacity : 8;
+    bfx_watch *watches = realloc(w->watches, capacity * sizeof(bfx_watch));
+    if (watches != NULL) {
+      w->watches = watches;
+      w->capacity = capacity;
+    }
+  }
+  if (w->count < w->capacity) {
+    watch = w->watches + w->count;
+    memset(watch, 0, sizeof(bfx_watch));
+    watch->bfx = root;
+    watch->prog = prog;
+    strcpy(watch->path, path);
+    watch->name = slash == NULL ? watch->path : watch->path + (slash - path) + 1;
+    /* Editors often write a new file and rename it over the old one. */
+    watch->wd = inotify_add_watch(w->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (watch->wd >= 0 && bfx_watch_read(path, &watch->rows, &watch->lengths, &watch->row_count))
+      ++w->count;
+  }
+#ifdef BFX_THREADS
+  pthread_mutex_unlock(&w->lock);
+#endif
+#else
+  (void) bfx;
+  (void) prog;
+  (void) path;
+#endif
 }
 
 /**
- * \brief 'u' - JOIN (str,str:str) - Join two strings on the stack.
+ * \brief Stops watching the file loaded into a slot, or into any slot,
+ *        when the slot is about to be overwritten or freed.
  */
-void bfx_op75(beflux *bfx) {
-  bfx_stack tmp;
-  tmp.size = 0;
-
-  while (bfx_top(bfx)) {
-    bfx_stack_push(&tmp, bfx_pop(bfx));
-  }
-  bfx_pop(bfx);
+static void bfx_watcher_forget(beflux *bfx, int all, bfx_word prog) {
+#ifdef BFX_WATCH
+  bfx_watcher *w = bfx->root->watcher;
+  size_t i;
 
-  while (tmp.size) {
-    bfx_push(bfx, bfx_stack_pop(&tmp));
+  if (w == NULL)
+    return;
+#ifdef BFX_THREADS
+  pthread_mutex_lock(&w->lock);
+#endif
+  for (i = w->count; i-- > 0;) {
+    if (w->watches[i].bfx == bfx->root && (all || w->watches[i].prog == prog))
+      bfx_watch_remove(w, i);
   }
-  bfx_pop(bfx);
+#ifdef BFX_THREADS
+  pthread_mutex_unlock(&w->lock);
+#endif
+#else
+  (void) bfx;
+  (void) all;
+  (void) prog;
+#endif
 }
 
 /**
- * \brief 'v' - MVS (0:0) - Change direction to South.
+ * \brief Writes queued rows into the interpreter's programs. Called at
+ *        batch boundaries and at the start of bfx_run.
  */
-void bfx_op76(beflux *bfx) {
-  bfx->ip.dir = BFX_IP_S;
+static void bfx_reload_apply(beflux *bfx) {
+#ifdef BFX_WATCH
+  bfx_reload *r, *next, *list = NULL;
+  size_t col;
+
+  if (bfx->root != bfx || bfx->reloads == NULL)
+    return;
+  r = __atomic_exchange_n(&bfx->reloads, NULL, __ATOMIC_ACQUIRE);
+  for (; r != NULL; r = next) {
+    next = r->next;
+    r->next = list;
+    list = r;
+  }
+
+  for (r = list; r != NULL; r = next) {
+    next = r->next;
+    if (bfx->mode != BFX_MODE_FREED) {
+      for (col = 0; col < r->width; ++col) {
+        bfx_program_store(bfx, r->prog, r->row, col, r->cells[col]);
+      }
+      bfx_trace_patched(bfx, r->prog, r->row);
+    }
+    free(r);
+  }
+#else
+  (void) bfx;
+#endif
 }
 
 /**
- * \brief 'w' - SIF (1:0) - South / Continue conditional branch.
+ * \brief Creates a watcher for hot reloading programs.
+ * \return The new watcher, or NULL where inotify is not available.
  */
-void bfx_op77(beflux *bfx) {
-  if (bfx_pop(bfx))
-    bfx_op76(bfx); /* 'v' */
+bfx_watcher *bfx_watcher_new(void) {
+#ifdef BFX_WATCH
+  bfx_watcher *w = calloc(1, sizeof(bfx_watcher));
+
+  if (w == NULL)
+    return NULL;
+  w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (w->fd < 0) {
+    free(w);
+    return NULL;
+  }
+#ifdef BFX_THREADS
+  pthread_mutex_init(&w->lock, NULL);
+#endif
+  return w;
+#else
+  return NULL;
+#endif
 }
 
 /**
- * \brief 'x' - EXEC (1:?) - Execute operator.
+ * \brief Frees a watcher, detaching it from its interpreters. Patches
+ *        already queued are still applied.
  */
-void bfx_op78(beflux *bfx) {
-  bfx_eval(bfx, bfx_pop(bfx));
+void bfx_watcher_del(bfx_watcher *w) {
+#ifdef BFX_WATCH
+  while (w->count) {
+    w->watches[0].bfx->watcher = NULL;
+    bfx_watch_remove(w, 0);
+  }
+  free(w->watches);
+  close(w->fd);
+#ifdef BFX_THREADS
+  pthread_mutex_destroy(&w->lock);
+#endif
+  free(w);
+#else
+  (void) w;
+#endif
 }
 
 /**
- * \brief 'y' - BMPS (0:0) - Bump IP South.
+ * \brief Attaches an interpreter to a watcher, so that programs it loads
+ *        from files from then on are reloaded when the files change. An
+ *        interpreter belongs to at most one watcher, and is detached by
+ *        passing NULL.
  */
-void bfx_op79(beflux *bfx) {
-  ++bfx->ip.row;
-  bfx->ip.wait = 1;
+void bfx_watcher_attach(bfx_watcher *w, beflux *bfx) {
+  bfx_watcher_forget(bfx, 1, 0);
+  bfx->root->watcher = w;
 }
 
 /**
- * \brief 'z' - WAIT (1:0) - Sleep for the given number of seconds.
+ * \brief Returns a file descriptor that becomes readable when a watched
+ *        file may have changed, for use with poll or epoll.
  */
-void bfx_op7a(beflux *bfx) {
-  bfx->sleep = bfx_pop(bfx);
-  fflush(bfx->out);
-  fflush(bfx->err);
+int bfx_watcher_fd(bfx_watcher *w) {
+#ifdef BFX_WATCH
+  return w->fd;
+#else
+  (void) w;
+  return -1;
+#endif
 }
 
 /**
- * \brief '{' - BLK (1:0) - Conditional block.
+ * \brief Handles pending file events without blocking, queueing changed
+ *        rows for their interpreters. May be called from any thread.
+ * \return The number of rows queued.
  */
-void bfx_op7b(beflux *bfx) {
-  bfx_word depth = 1;
-  if (!bfx_pop(bfx)) { /* Skip to matching BLOCK END */
-    bfx_word c;
-    size_t i = 0;
-    size_t limit = bfx->wrap_offset == 0 ? BFX_PROGRAM_WIDTH - 3 : BFX_PROGRAM_SIZE;
-    while (depth) {
-      bfx_ip_advance(bfx);
-      c = bfx_ip_get_op(bfx);
-      if (c == '}') {
-        --depth;
-      }
-      else if (c == '{') {
-        ++depth;
-      }
+size_t bfx_watcher_poll(bfx_watcher *w) {
+  size_t queued = 0;
+#ifdef BFX_WATCH
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t n;
+  size_t i;
 
-      if (i++ > limit || depth == BFX_WORD_MAX) {
-        bfx_error(bfx, "Infinite block loop detected.");
+#ifdef BFX_THREADS
+  pthread_mutex_lock(&w->lock);
+#endif
+  while ((n = read(w->fd, buffer, sizeof(buffer))) > 0) {
+    char *p;
+    for (p = buffer; p < buffer + n; p += sizeof(struct inotify_event) + ((struct inotify_event *) p)->len) {
+      const struct inotify_event *ev = (const struct inotify_event *) p;
+      for (i = 0; i < w->count; ++i) {
+        if (
+          (ev->mask & IN_Q_OVERFLOW) ||
+          (ev->len && w->watches[i].wd == ev->wd && strcmp(w->watches[i].name, ev->name) == 0)
+        ) w->watches[i].changed = 1;
       }
     }
   }
+  for (i = 0; i < w->count; ++i) {
+    if (w->watches[i].changed) {
+      w->watches[i].changed = 0;
+      queued += bfx_watch_reload(w->watches + i);
+    }
+  }
+#ifdef BFX_THREADS
+  pthread_mutex_unlock(&w->lock);
+#endif
+#else
+  (void) w;
+#endif
+  return queued;
+}
+
+/*******************************************************************************
+ * Analysis
+ *
+ * bfx_analyze walks the states an IP can reach in a program from (0, 0)
+ * heading East, without running it. Moves are followed through the program
+ * text, branches and AWAY ('?') go both ways, and the walk stops at ops
+ * that take their target from the stack, such as 'J', 'R' or 'x', or that
+ * leave the program. The stack depth on arrival is carried along from each
+ * op's stack effect, and is given up on (-1) wherever two paths disagree or
+ * an op's effect depends on what it pops or reads.
+ */
+#define BFX_ANALYSIS_MOVE   " #;<>@B[]^hvy}\x7f"
+#define BFX_ANALYSIS_BRANCH "?_mw{|"
+#define BFX_ANALYSIS_LEAVE  "ACJRVWXjkx"
+#define BFX_ANALYSIS_WRITE  "PSx"
+#define BFX_ANALYSIS_MAGIC  "bfa 1"
+
+/* Dense programs repeat every width and height, so states are kept modulo
+ * those. */
+#if BFX_WORD_BITS == 8 || defined(BFX_SPARSE)
+#define BFX_ANALYSIS_ROWS BFX_WORD_MAX
+#define BFX_ANALYSIS_COLS BFX_WORD_MAX
+#else
+#define BFX_ANALYSIS_ROWS (BFX_PROGRAM_HEIGHT - 1)
+#define BFX_ANALYSIS_COLS (BFX_PROGRAM_WIDTH - 1)
+#endif
+
+/* Values popped and pushed by each op when run on its own, or -1 where that
+ * depends on the stack, input or host. Digits are counted separately. */
+static const signed char bfx_op_effects[0x82][2] = {
+/* CONTROL */
+  {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1},
+  {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1},
+  {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1},
+  {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1},
+
+/* PRINTABLE */
+/*           !         "         #         $         %         &         '   */
+  { 0,  0}, { 1,  1}, { 0,  1}, { 0,  0}, { 1,  0}, { 2,  1}, {-1, -1}, { 2,  3},
+/* (         )         *         +         ,         -         .         /   */
+  {-1, -1}, {-1, -1}, { 2,  1}, { 2,  1}, { 1,  0}, { 2,  1}, { 1,  0}, { 2,  1},
+/* 0         1         2         3         4         5         6         7   */
+  { 0,  0}, { 0,  0}, { 0,  0}, { 0,  0}, { 0,  0}, { 0,  0}, { 0,  0}, { 0,  0},
+/* 8         9         :         ;         <         =         >         ?   */
+  { 0,  0}, { 0,  0}, { 1,  2}, { 0,  0}, { 0,  0}, { 2,  1}, { 0,  0}, { 0,  0},
+/* @         A         B         C         D         E         F         G   */
+  { 0,  0}, { 0,  0}, { 0,  0}, { 2,  0}, { 2,  1}, { 0,  1}, {-1, -1}, { 3,  1},
+/* H         I         J         K         L         M         N         O   */
+  { 0,  0}, {-1, -1}, { 2,  0}, {-1, -1}, { 0,  0}, {-1,  0}, {-1,  0}, {-1, -1},
+/* P         Q         R         S         T         U         V         W   */
+  {-1, -1}, { 0,  0}, { 0,  0}, { 4,  0}, { 0,  1}, { 0,  1}, { 0,  0}, { 1,  0},
+/* X         Y         Z         [         \         ]         ^         _   */
+  { 3,  0}, { 0,  0}, { 0,  1}, { 0,  0}, { 2,  2}, { 0,  0}, { 0,  0}, { 1,  0},
+/* `         a         b         c         d         e         f         g   */
+  { 2,  1}, { 0,  0}, { 0,  0}, { 0,  0}, { 0,  0}, { 0,  0}, { 0,  0}, { 1,  1},
+/* h         i         j         k         l         m         n         o   */
+  { 0,  0}, {-1, -1}, { 2,  0}, {-1, -1}, { 0,  1}, { 1,  0}, { 0,  0}, {-1, -1},
+/* p         q         r         s         t         u         v         w   */
+  { 2,  1}, { 1,  0}, {-1, -1}, { 2,  0}, { 0,  1}, {-1, -1}, { 0,  0}, { 1,  0},
+/* x         y         z         {         |         }         ~         DEL */
+  {-1, -1}, { 0,  0}, { 1,  0}, { 1,  0}, { 1,  0}, { 0,  0}, { 0,  1}, { 0,  0},
+
+/* EXTENDED */
+/* SPLT      KILL */
+  { 1,  0}, { 0,  0}
+};
+
+typedef struct bfx_walk_node {
+  bfx_reach s;
+  int width;  /* Digits held in value_width on arrival, or -1 */
+  int queued;
+} bfx_walk_node;
+
+typedef struct bfx_walk {
+  beflux *bfx;
+  bfx_analysis *a;
+  bfx_walk_node *nodes;
+  size_t count;
+  size_t capacity;
+  size_t *slots; /* Open addressing over nodes, offset by one */
+  size_t slot_count;
+  size_t *queue; /* Nodes whose depth changed since they were followed */
+  size_t queued;
+} bfx_walk;
+
+/**
+ * \brief Orders states by position, then direction and mode.
+ */
+static int bfx_reach_compare(const void *a, const void *b) {
+  const bfx_reach *x = (const bfx_reach *) a;
+  const bfx_reach *y = (const bfx_reach *) b;
+  if (x->row != y->row)
+    return x->row < y->row ? -1 : 1;
+  if (x->col != y->col)
+    return x->col < y->col ? -1 : 1;
+  if (x->dir != y->dir)
+    return x->dir < y->dir ? -1 : 1;
+  if (x->mode != y->mode)
+    return x->mode < y->mode ? -1 : 1;
+  return 0;
 }
 
 /**
- * \brief '|' - NSIF (1:0) - North / South conditional branch.
+ * \brief Hashes a state for the slot table.
  */
-void bfx_op7c(beflux *bfx) {
-  if (bfx_pop(bfx))
-    bfx_op5e(bfx); /* '^' */
-  else
-    bfx_op76(bfx); /* 'v' */
+static size_t bfx_reach_hash(const bfx_reach *s) {
+  size_t h = s->row;
+  h = h * 31 + s->col;
+  h = h * 31 + s->dir;
+  h = h * 31 + s->mode;
+  return h * 2654435761u;
 }
 
 /**
- * \brief '}' - BEND (0:0) - Block end.
+ * \brief Rebuilds the slot table at twice the size.
+ * \return Zero if out of memory.
  */
-void bfx_op7d(beflux *bfx) {
-  (void) bfx;
+static int bfx_walk_grow(bfx_walk *w) {
+  size_t count = w->slot_count ? w->slot_count * 2 : 1024;
+  size_t *slots = (size_t *) calloc(count, sizeof(size_t));
+  size_t *queue = (size_t *) realloc(w->queue, count / 2 * sizeof(size_t));
+  bfx_walk_node *nodes = (bfx_walk_node *) realloc(
+    w->nodes, count / 2 * sizeof(bfx_walk_node)
+  );
+  size_t i;
+
+  if (queue != NULL)
+    w->queue = queue;
+  if (nodes != NULL)
+    w->nodes = nodes;
+  if (slots == NULL || queue == NULL || nodes == NULL) {
+    free(slots);
+    return 0;
+  }
+  for (i = 0; i < w->count; ++i) {
+    size_t j = bfx_reach_hash(&w->nodes[i].s) & (count - 1);
+    while (slots[j])
+      j = (j + 1) & (count - 1);
+    slots[j] = i + 1;
+  }
+  free(w->slots);
+  w->slots = slots;
+  w->slot_count = count;
+  w->capacity = count / 2;
+  return 1;
 }
 
 /**
- * \brief '~' - GETC (0:1) - Reads an ASCII character from input.
+ * \brief Moves a state one step, the way bfx_ip_advance does without
+ *        wrapping.
  */
-void bfx_op7e(beflux *bfx) {
-  if (bfx->in == NULL) {
-    bfx_error(bfx, "No input file.");
+static void bfx_walk_advance(bfx_ip *ip) {
+  if (ip->wait) {
+    --ip->wait;
+  }
+  else {
+    switch (ip->dir) {
+      case BFX_IP_E: ++ip->col; break;
+      case BFX_IP_N: --ip->row; break;
+      case BFX_IP_W: --ip->col; break;
+      case BFX_IP_S: ++ip->row; break;
+      default: break;
+    }
   }
-  bfx_push(bfx, fgetc(bfx->in));
 }
 
 /**
- * \brief 'DEL' - NOP (0:0) - Does nothing!
+ * \brief Moves a state past an op the way running it would, reading only
+ *        the program text.
+ * \param op A move or branch op, or anything else to just step forward.
+ * \param cond For branches, whether the value popped was nonzero. For
+ *        AWAY ('?'), whether it turned West.
+ * \return Zero if the op errs there, such as on a row of nothing but
+ *         spaces.
  */
-void bfx_op7f(beflux *bfx) {
-  (void) bfx;
+static int bfx_walk_move(beflux *bfx, bfx_word prog, bfx_reach *s, bfx_word op, int cond) {
+  bfx_ip ip;
+  bfx_word depth = 1;
+  size_t i = 0;
+
+  ip.row = s->row;
+  ip.col = s->col;
+  ip.dir = s->dir;
+  ip.wait = 0;
+  switch (op) {
+    case ' ':
+      while (bfx_program_get(bfx, prog, ip.row, ip.col) == ' ') {
+        bfx_walk_advance(&ip);
+        if (i++ > BFX_ROW_LIMIT)
+          return 0;
+      }
+      ip.wait = 1;
+      break;
+    case '#': bfx_walk_advance(&ip); break;
+    case ';':
+      bfx_walk_advance(&ip);
+      while (bfx_program_get(bfx, prog, ip.row, ip.col) != ';') {
+        bfx_walk_advance(&ip);
+        if (i++ > BFX_ROW_LIMIT - 3)
+          return 0;
+      }
+      break;
+    case '<': ip.dir = BFX_IP_W; break;
+    case '>': ip.dir = BFX_IP_E; break;
+    case '^': ip.dir = BFX_IP_N; break;
+    case 'v': ip.dir = BFX_IP_S; break;
+    case '@':
+      ip.row = 0;
+      ip.col = 0;
+      ip.dir = BFX_IP_E;
+      ip.wait = 1;
+      break;
+    case 'B': ip.dir += BFX_IP_TURN_B; break;
+    case '[': ip.dir += BFX_IP_TURN_L; break;
+    case ']': ip.dir += BFX_IP_TURN_R; break;
+    case 'h': --ip.row; ip.wait = 1; break;
+    case 'y': ++ip.row; ip.wait = 1; break;
+    case '?':
+    case '_': ip.dir = cond ? BFX_IP_W : BFX_IP_E; break;
+    case '|': ip.dir = cond ? BFX_IP_N : BFX_IP_S; break;
+    case 'm': if (cond) ip.dir = BFX_IP_N; break;
+    case 'w': if (cond) ip.dir = BFX_IP_S; break;
+    case '{':
+      while (!cond && depth) {
+        bfx_word c;
+        bfx_walk_advance(&ip);
+        c = bfx_program_get(bfx, prog, ip.row, ip.col);
+        if (c == '}')
+          --depth;
+        else if (c == '{')
+          ++depth;
+        if (i++ > BFX_ROW_LIMIT - 3 || depth == BFX_WORD_MAX)
+          return 0;
+      }
+      break;
+    default: break;
+  }
+  bfx_walk_advance(&ip);
+  s->row = ip.row & BFX_ANALYSIS_ROWS;
+  s->col = ip.col & BFX_ANALYSIS_COLS;
+  s->dir = ip.dir;
+  return 1;
 }
 
-bfx_func *bfx_default_op_bindings[BFX_BANK_SIZE] = {
-  NULL,     NULL,     NULL,     NULL,
-  NULL,     NULL,     NULL,     NULL,
-  NULL,     NULL,     NULL,     NULL,
-  NULL,     NULL,     NULL,     NULL,
+/**
+ * \brief The stack depth after popping and pushing, or -1 if it is not
+ *        fixed or wraps around.
+ */
+static int bfx_walk_effect(int depth, int pops, int pushes) {
+  if (depth < 0 || pops < 0 || pushes < 0 || depth < pops)
+    return -1;
+  depth += pushes - pops;
+  return depth < BFX_STACK_SIZE ? depth : -1;
+}
 
-  NULL,     NULL,     NULL,     NULL,
-  NULL,     NULL,     NULL,     NULL,
-  NULL,     NULL,     NULL,     NULL,
-  NULL,     NULL,     NULL,     NULL,
+/**
+ * \brief Reaches a state with the given depth and digit count, adding it
+ *        if it is new, and queues it to be followed again if what is known
+ *        about it changed.
+ */
+static void bfx_walk_visit(bfx_walk *w, const bfx_reach *s, int depth, int width) {
+  bfx_walk_node *n;
+  size_t j;
 
-  bfx_op20, bfx_op21, bfx_op22, bfx_op23,
-  bfx_op24, bfx_op25, bfx_op26, bfx_op27,
-  bfx_op28, bfx_op29, bfx_op2a, bfx_op2b,
-  bfx_op2c, bfx_op2d, bfx_op2e, bfx_op2f,
+  if (w->count == w->capacity && (w->count == BFX_ANALYSIS_STATES || !bfx_walk_grow(w))) {
+    for (j = 0; j < w->count && bfx_reach_compare(&w->nodes[j].s, s) != 0; ++j);
+    if (j == w->count) {
+      w->a->truncated = 1;
+      return;
+    }
+    n = w->nodes + j;
+  }
+  else {
+    j = bfx_reach_hash(s) & (w->slot_count - 1);
+    while (w->slots[j] && bfx_reach_compare(&w->nodes[w->slots[j] - 1].s, s) != 0)
+      j = (j + 1) & (w->slot_count - 1);
+    if (w->slots[j] == 0) {
+      n = w->nodes + w->count;
+      n->s = *s;
+      n->s.depth = depth;
+      n->width = width;
+      n->queued = 1;
+      w->queue[w->queued++] = w->count;
+      w->slots[j] = ++w->count;
+      return;
+    }
+    n = w->nodes + w->slots[j] - 1;
+  }
 
-  bfx_op30, bfx_op31, bfx_op32, bfx_op33,
-  bfx_op34, bfx_op35, bfx_op36, bfx_op37,
-  bfx_op38, bfx_op39, bfx_op3a, bfx_op3b,
-  bfx_op3c, bfx_op3d, bfx_op3e, bfx_op3f,
+  if (n->s.depth == depth && n->width == width)
+    return;
+  if (n->s.depth != depth)
+    n->s.depth = -1;
+  if (n->width != width)
+    n->width = -1;
+  if (!n->queued) {
+    n->queued = 1;
+    w->queue[w->queued++] = (size_t) (n - w->nodes);
+  }
+}
 
-  bfx_op40, bfx_op41, bfx_op42, bfx_op43,
-  bfx_op44, bfx_op45, bfx_op46, bfx_op47,
-  bfx_op48, bfx_op49, bfx_op4a, bfx_op4b,
-  bfx_op4c, bfx_op4d, bfx_op4e, bfx_op4f,
+/**
+ * \brief Reaches the states that can follow a node.
+ */
+static void bfx_walk_follow(bfx_walk *w, size_t i) {
+  beflux *bfx = w->bfx;
+  bfx_word prog = w->a->prog;
+  bfx_reach s = w->nodes[i].s, next = s;
+  bfx_word op = bfx_program_get(bfx, prog, s.row, s.col);
+  bfx_func *func = BFX_BANK_VALID(op) ? bfx->op_bindings[op] : NULL;
+  int c = op > 0 && op < 0x80 ? (int) op : 0;
+  int depth = s.depth, width = w->nodes[i].width, cond;
+
+  if (s.mode != BFX_MODE_NORMAL) {
+    next.mode = BFX_MODE_STRING;
+    if (s.mode == BFX_MODE_STRING && op == '"')
+      next.mode = BFX_MODE_NORMAL;
+    else if (s.mode == BFX_MODE_STRING && op == '\\')
+      next.mode = BFX_MODE_STRING_ESC;
+    else
+      depth = bfx_walk_effect(depth, 0, 1);
+    bfx_walk_move(bfx, prog, &next, 0, 0);
+    bfx_walk_visit(w, &next, depth, width);
+    return;
+  }
 
-  bfx_op50, bfx_op51, bfx_op52, bfx_op53,
-  bfx_op54, bfx_op55, bfx_op56, bfx_op57,
-  bfx_op58, bfx_op59, bfx_op5a, bfx_op5b,
-  bfx_op5c, bfx_op5d, bfx_op5e, bfx_op5f,
+  if (func == NULL || op == 0x81 || c == 'Q' || c == 'q')
+    return; /* Ends here */
+  if (op > 0x81 || func != bfx_default_op_bindings[op]) {
+    /* Host ops are taken to leave the IP alone. */
+    bfx_walk_move(bfx, prog, &next, 0, 0);
+    bfx_walk_visit(w, &next, -1, -1);
+    return;
+  }
+  if (c && strchr(BFX_ANALYSIS_WRITE, c) != NULL)
+    w->a->self_modifies = 1;
+  if ((c && strchr(BFX_ANALYSIS_LEAVE, c) != NULL) || (c == 'H' && prog != 0)) {
+    ++w->a->dynamic;
+    return;
+  }
 
-  bfx_op60, bfx_op61, bfx_op62, bfx_op63,
-  bfx_op64, bfx_op65, bfx_op66, bfx_op67,
-  bfx_op68, bfx_op69, bfx_op6a, bfx_op6b,
-  bfx_op6c, bfx_op6d, bfx_op6e, bfx_op6f,
+  depth = bfx_walk_effect(depth, bfx_op_effects[op][0], bfx_op_effects[op][1]);
+  if (c == 'M' || c == 'N') {
+    depth = 0;
+  }
+  else if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')) {
+    /* Every BFX_WORD_DIGITS digits push a value. */
+    if (width < 0) {
+      depth = -1;
+    }
+    else if (width == (int) BFX_WORD_DIGITS - 1) {
+      depth = bfx_walk_effect(s.depth, 0, 1);
+      width = 0;
+    }
+    else {
+      depth = s.depth;
+      ++width;
+    }
+  }
+  else if (c == '&' || c == 'F') {
+    width = -1;
+  }
+
+  if (c && strchr(BFX_ANALYSIS_BRANCH, c) != NULL) {
+    for (cond = 0; cond < 2; ++cond) {
+      next = s;
+      if (bfx_walk_move(bfx, prog, &next, op, cond))
+        bfx_walk_visit(w, &next, depth, width);
+    }
+    return;
+  }
+  if (op == 0x80) {
+    /* SPLT starts another IP heading the other way, with its own frame. */
+    next.dir += BFX_IP_TURN_B;
+    bfx_walk_move(bfx, prog, &next, 0, 0);
+    bfx_walk_visit(w, &next, -1, width);
+    next = s;
+  }
+  if (c == '"')
+    next.mode = BFX_MODE_STRING;
+  if (bfx_walk_move(bfx, prog, &next, c && strchr(BFX_ANALYSIS_MOVE, c) ? op : 0, 0))
+    bfx_walk_visit(w, &next, depth, width);
+}
+
+/**
+ * \brief Checksums a program's text, to tell whether an analysis still
+ *        describes it.
+ */
+static uint32_t bfx_analysis_checksum(beflux *bfx, bfx_word prog) {
+  uint32_t h = 2166136261u;
+  size_t rows, cols, row, col;
+
+#ifdef BFX_SPARSE
+  bfx_grid_extent(bfx->grid, prog, &rows, &cols);
+#else
+  rows = BFX_PROGRAM_HEIGHT;
+  cols = BFX_PROGRAM_WIDTH;
+#endif
+  for (row = 0; row < rows; ++row) {
+    for (col = 0; col < cols; ++col) {
+      bfx_word c = bfx_program_get(bfx, prog, (bfx_word) row, (bfx_word) col);
+      if (c != ' ') {
+        h = (h ^ (uint32_t) (row * 31 + col)) * 16777619u;
+        h = (h ^ (uint32_t) c) * 16777619u;
+      }
+    }
+  }
+  return h;
+}
+
+/**
+ * \brief Works out how many values an op pops and pushes as it runs in a
+ *        mode, or -1 for each where that depends on the stack or host.
+ * \param digit Whether a digit would push the value it completes.
+ */
+static void bfx_op_effect(
+  beflux *bfx, bfx_word op, bfx_word mode, int digit, int *pops, int *pushes
+) {
+  *pops = 0;
+  *pushes = 1;
+  if (mode == BFX_MODE_STRING && (op == '"' || op == '\\')) {
+    *pushes = 0;
+  }
+  else if (mode != BFX_MODE_STRING && mode != BFX_MODE_STRING_ESC) {
+    if (op >= 0x82 || bfx->op_bindings[op] != bfx_default_op_bindings[op]) {
+      *pops = -1;
+      *pushes = -1;
+      return;
+    }
+    *pops = bfx_op_effects[op][0];
+    *pushes = bfx_op_effects[op][1];
+    if ((op >= '0' && op <= '9') || (op >= 'a' && op <= 'f'))
+      *pushes = digit;
+  }
+}
+
+/**
+ * \brief Whether an op can be run from a state without checks: its stack
+ *        effect is fixed and the depth there leaves room for it.
+ */
+static int bfx_reach_proven(beflux *bfx, bfx_word prog, const bfx_reach *s) {
+  int pops, pushes;
+  bfx_op_effect(bfx, bfx_program_get(bfx, prog, s->row, s->col), s->mode, 1, &pops, &pushes);
+  if (pops < 0 || pushes < 0 || (pops == 0 && pushes == 0))
+    return 1;
+  return s->depth >= pops && s->depth - pops + pushes < BFX_STACK_SIZE;
+}
+
+/**
+ * \brief Counts cells, ops and the deepest fixed depth over the states.
+ */
+static void bfx_analysis_tally(beflux *bfx, bfx_analysis *a) {
+  size_t i;
+
+  a->cells = 0;
+  a->max_depth = 0;
+  a->unproven = 0;
+  memset(a->ops, 0, sizeof(a->ops));
+  for (i = 0; i < a->count; ++i) {
+    const bfx_reach *s = a->states + i;
+    if (i == 0 || s->row != s[-1].row || s->col != s[-1].col)
+      ++a->cells;
+    if (s->mode == BFX_MODE_NORMAL) {
+      bfx_word op = bfx_program_get(bfx, a->prog, s->row, s->col);
+      if (BFX_BANK_VALID(op))
+        ++a->ops[op];
+    }
+    if (s->depth > a->max_depth)
+      a->max_depth = s->depth;
+    if (!bfx_reach_proven(bfx, a->prog, s))
+      ++a->unproven;
+  }
+}
+
+/**
+ * \brief Walks every state an IP can reach in a program from (0, 0)
+ *        heading East, with the ops currently bound.
+ * \param prog The index of the program.
+ * \return A new analysis, to be released with bfx_analysis_del, or NULL if
+ *         out of memory.
+ */
+bfx_analysis *bfx_analyze(beflux *bfx, bfx_word prog) {
+  bfx_analysis *a = (bfx_analysis *) calloc(1, sizeof(bfx_analysis));
+  bfx_walk w;
+  bfx_reach start;
+  size_t i;
+
+  if (a == NULL)
+    return NULL;
+  memset(&w, 0, sizeof(w));
+  w.bfx = bfx;
+  w.a = a;
+  a->prog = prog;
+  a->checksum = bfx_analysis_checksum(bfx, prog);
+
+  memset(&start, 0, sizeof(start));
+  start.dir = BFX_IP_E;
+  start.mode = BFX_MODE_NORMAL;
+  if (bfx_walk_grow(&w)) {
+    bfx_walk_visit(&w, &start, 0, 0);
+    while (w.queued) {
+      i = w.queue[--w.queued];
+      w.nodes[i].queued = 0;
+      bfx_walk_follow(&w, i);
+    }
+    a->states = (bfx_reach *) malloc(w.count * sizeof(bfx_reach));
+  }
+  if (a->states == NULL) {
+    free(w.nodes);
+    free(w.slots);
+    free(w.queue);
+    free(a);
+    return NULL;
+  }
+
+  for (i = 0; i < w.count; ++i) {
+    a->states[i] = w.nodes[i].s;
+  }
+  a->count = w.count;
+  free(w.nodes);
+  free(w.slots);
+  free(w.queue);
+  qsort(a->states, a->count, sizeof(bfx_reach), bfx_reach_compare);
+  bfx_analysis_tally(bfx, a);
+  return a;
+}
+
+/**
+ * \brief Releases an analysis.
+ */
+void bfx_analysis_del(bfx_analysis *a) {
+  if (a == NULL)
+    return;
+  free(a->states);
+  free(a);
+}
+
+/**
+ * \brief Finds a state by position, direction and mode.
+ * \return The state's index in a->states, or -1 if it cannot be reached.
+ */
+long bfx_analysis_find(const bfx_analysis *a, const bfx_reach *s) {
+  size_t lo = 0, hi = a->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = bfx_reach_compare(a->states + mid, s);
+    if (cmp == 0)
+      return (long) mid;
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return -1;
+}
+
+/**
+ * \brief The directions an IP can run a cell in.
+ * \return A bit for each direction that reaches the cell, 1 << (dir >> 6),
+ *         or zero if the cell never runs.
+ */
+int bfx_analysis_dirs(const bfx_analysis *a, bfx_word row, bfx_word col) {
+  bfx_reach key;
+  size_t lo = 0, hi = a->count;
+  int dirs = 0;
+
+  memset(&key, 0, sizeof(key));
+  key.row = row & BFX_ANALYSIS_ROWS;
+  key.col = col & BFX_ANALYSIS_COLS;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (bfx_reach_compare(a->states + mid, &key) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (; lo < a->count && a->states[lo].row == key.row && a->states[lo].col == key.col; ++lo) {
+    dirs |= 1 << (a->states[lo].dir >> 6);
+  }
+  return dirs;
+}
+
+/**
+ * \brief Tries to prove that no op reachable in program 0 can under- or
+ *        overflow the stack, for a run that starts with empty stacks. Once
+ *        proven, interpreters with checked set run it without checks until
+ *        program 0 is written to.
+ * \return Nonzero if proven.
+ */
+int bfx_verify(beflux *bfx) {
+  bfx_analysis *a = bfx_analyze(bfx, 0);
+  bfx->verified =
+    a != NULL && a->unproven == 0 && a->dynamic == 0 && !a->self_modifies &&
+    !a->truncated;
+  bfx_analysis_del(a);
+  return bfx->verified;
+}
+
+/**
+ * \brief Checks that an op can run without the current stack wrapping
+ *        around, erring if not. Ops whose effect depends on the stack or
+ *        host are let through, except that ITER and EXEC need an operand.
+ * \return Nonzero if the op can run.
+ */
+int bfx_check_stack(beflux *bfx, bfx_word op) {
+  const bfx_stack *s = bfx->frames + BFX_FRAME_INDEX(bfx->current_frame);
+  int pops, pushes;
+
+  bfx_op_effect(
+    bfx, op, bfx->mode, bfx->value_width == BFX_WORD_DIGITS - 1, &pops, &pushes
+  );
+  if (pops < 0 || pushes < 0) {
+    if (
+      s->size == 0 && (op == 'k' || op == 'x') && bfx->mode == BFX_MODE_NORMAL &&
+      bfx->op_bindings[op] == bfx_default_op_bindings[op]
+    ) {
+      bfx_error(bfx, "Stack underflow.");
+      return 0;
+    }
+    return 1;
+  }
+  if ((size_t) s->size < (size_t) pops) {
+    bfx_error(bfx, "Stack underflow.");
+    return 0;
+  }
+  if ((size_t) s->size - pops + pushes >= BFX_STACK_SIZE) {
+    bfx_error(bfx, "Stack overflow.");
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * \brief Writes an analysis next to its program, so that it can be loaded
+ *        instead of walked again while the program is unchanged.
+ * \param filename The program's path without its extension; ".bfa" is
+ *        added.
+ * \return Zero if the file could not be written.
+ */
+int bfx_analysis_save(const bfx_analysis *a, const char *filename) {
+  char filename_ext[BFX_BANK_SIZE];
+  FILE *fout;
+  size_t i;
+  int ok;
+
+  snprintf(filename_ext, sizeof(filename_ext), "%s.bfa", filename);
+  fout = fopen(filename_ext, "w");
+  if (fout == NULL)
+    return 0;
+  fprintf(
+    fout, BFX_ANALYSIS_MAGIC " %d %lx %lx %08lx %lu %lu %d %d\n",
+    BFX_WORD_BITS, (unsigned long) BFX_ANALYSIS_ROWS, (unsigned long) BFX_ANALYSIS_COLS,
+    (unsigned long) a->checksum, (unsigned long) a->count,
+    (unsigned long) a->dynamic, a->self_modifies, a->truncated
+  );
+  for (i = 0; i < a->count; ++i) {
+    const bfx_reach *s = a->states + i;
+    fprintf(
+      fout, "%lu %lu %u %u %d\n", (unsigned long) s->row, (unsigned long) s->col,
+      (unsigned) s->dir, (unsigned) s->mode, s->depth
+    );
+  }
+  ok = !ferror(fout);
+  return fclose(fout) == 0 && ok;
+}
+
+/**
+ * \brief Reads an analysis written by bfx_analysis_save, if it was made
+ *        from the program as it is now, by a build with the same program
+ *        storage.
+ * \param filename The program's path without its extension.
+ * \return A new analysis, or NULL if there is none to use.
+ */
+bfx_analysis *bfx_analysis_load(beflux *bfx, bfx_word prog, const char *filename) {
+  char filename_ext[BFX_BANK_SIZE];
+  unsigned long rows, cols, checksum, count, dynamic;
+  bfx_analysis *a = NULL;
+  FILE *fin;
+  int bits, self_modifies, truncated;
+  size_t i;
+
+  snprintf(filename_ext, sizeof(filename_ext), "%s.bfa", filename);
+  fin = fopen(filename_ext, "r");
+  if (fin == NULL)
+    return NULL;
+  if (
+    fscanf(
+      fin, BFX_ANALYSIS_MAGIC " %d %lx %lx %lx %lu %lu %d %d",
+      &bits, &rows, &cols, &checksum, &count, &dynamic, &self_modifies, &truncated
+    ) != 8 || bits != BFX_WORD_BITS || rows != (unsigned long) BFX_ANALYSIS_ROWS ||
+    cols != (unsigned long) BFX_ANALYSIS_COLS || count > BFX_ANALYSIS_STATES ||
+    checksum != bfx_analysis_checksum(bfx, prog) ||
+    (a = (bfx_analysis *) calloc(1, sizeof(bfx_analysis))) == NULL ||
+    (a->states = (bfx_reach *) malloc((count ? count : 1) * sizeof(bfx_reach))) == NULL
+  ) {
+    bfx_analysis_del(a);
+    fclose(fin);
+    return NULL;
+  }
+
+  a->prog = prog;
+  a->checksum = (uint32_t) checksum;
+  a->dynamic = dynamic;
+  a->self_modifies = self_modifies;
+  a->truncated = truncated;
+  for (i = 0; i < count; ++i) {
+    unsigned long row, col;
+    unsigned dir, mode;
+    int depth;
+    if (fscanf(fin, "%lu %lu %u %u %d", &row, &col, &dir, &mode, &depth) != 5)
+      break;
+    a->states[i].row = (bfx_word) row;
+    a->states[i].col = (bfx_word) col;
+    a->states[i].dir = (uint8_t) dir;
+    a->states[i].mode = (uint8_t) mode;
+    a->states[i].depth = depth;
+    if (i && bfx_reach_compare(a->states + i - 1, a->states + i) >= 0)
+      break;
+  }
+  fclose(fin);
+  if (i < count) {
+    bfx_analysis_del(a);
+    return NULL;
+  }
+  a->count = count;
+  bfx_analysis_tally(bfx, a);
+  return a;
+}
+
+/*******************************************************************************
+ * Flight Recorder
+ *
+ * While a recorder is attached, every tick stores where it ran, the op and
+ * the top of the stack into a ring of the last few thousand entries, with
+ * the same stores every time whether or not the ring has wrapped. A
+ * replayed REP pass or an ITER run is stored as one entry covering all of
+ * its ticks, so those keep their speed, at the cost of not showing the
+ * ticks inside them. bfx_error dumps the ring to the recorder's file, if it
+ * has one, so that a failed run leaves behind how it got there;
+ * bfx_flight_dump writes one on demand. Dumps are little-endian, and begin
+ * with a header giving the word size, so any build can decode them.
+ */
+#define BFX_FLIGHT_MAGIC   "BFXR"
+#define BFX_FLIGHT_VERSION 2
+
+typedef struct bfx_flight_tick {
+  size_t tick;
+  size_t count; /* Ticks the entry stands for */
+  bfx_word prog;
+  bfx_word row;
+  bfx_word col;
+  bfx_word op;
+  bfx_word top;
+  uint8_t dir;
+  uint8_t mode;
+} bfx_flight_tick;
+
+struct bfx_flight {
+  bfx_flight_tick *ticks;
+  size_t mask;              /* Capacity minus one */
+  size_t head;              /* Ticks recorded since the recorder started */
+  char path[BFX_BANK_SIZE]; /* Dumped here on error, if set */
+};
+
+/**
+ * \brief Records the tick about to run op.
+ */
+static inline void bfx_flight_note(beflux *bfx, bfx_word op, size_t tick) {
+  bfx_flight *f = bfx->flight;
+  bfx_flight_tick *t = f->ticks + (f->head++ & f->mask);
+  const bfx_stack *s = bfx->frames + BFX_FRAME_INDEX(bfx->current_frame);
+  t->tick = tick;
+  t->count = 1;
+  t->prog = bfx->current_program;
+  t->row = bfx->ip.row;
+  t->col = bfx->ip.col;
+  t->op = op;
+  t->top = s->data[BFX_STACK_INDEX(s->size - 1)];
+  t->dir = bfx->ip.dir;
+  t->mode = (uint8_t) bfx->mode;
+}
+
+/**
+ * \brief Adds ticks to the latest entry, for ticks run without a note of
+ *        their own.
+ */
+static inline void bfx_flight_extend(beflux *bfx, long ticks) {
+  bfx_flight *f = bfx->flight;
+  if (f->head)
+    f->ticks[(f->head - 1) & f->mask].count += ticks;
+}
+
+/**
+ * \brief Attaches a flight recorder, replacing any earlier one.
+ * \param ticks How many of the latest entries to keep, rounded up to a
+ *        power of two.
+ * \param filename Where to dump the recording when the interpreter errs,
+ *        or NULL to only dump it with bfx_flight_dump.
+ * \return Zero if out of memory.
+ */
+int bfx_flight_start(beflux *bfx, size_t ticks, const char *filename) {
+  size_t capacity = 1;
+  bfx_flight *f;
+
+  bfx_flight_stop(bfx);
+  while (capacity < ticks)
+    capacity <<= 1;
+  f = bfx_alloc(bfx, sizeof(bfx_flight));
+  if (f == NULL)
+    return 0;
+  f->ticks = bfx_alloc(bfx, capacity * sizeof(bfx_flight_tick));
+  if (f->ticks == NULL) {
+    bfx_dealloc(bfx, f, sizeof(bfx_flight));
+    return 0;
+  }
+  f->mask = capacity - 1;
+  f->head = 0;
+  f->path[0] = '\0';
+  if (filename != NULL)
+    snprintf(f->path, sizeof(f->path), "%s", filename);
+  bfx->flight = f;
+  bfx->batch = 0; /* Pick the recording loop */
+  return 1;
+}
+
+/**
+ * \brief Detaches and frees the flight recorder, if there is one.
+ */
+void bfx_flight_stop(beflux *bfx) {
+  bfx_flight *f = bfx->flight;
+  if (f == NULL)
+    return;
+  bfx->flight = NULL;
+  bfx->batch = 0;
+  bfx_dealloc(bfx, f->ticks, (f->mask + 1) * sizeof(bfx_flight_tick));
+  bfx_dealloc(bfx, f, sizeof(bfx_flight));
+}
+
+/**
+ * \brief Dumps the recording to the recorder's file, if it has one. Called
+ *        by bfx_error.
+ */
+static void bfx_flight_crash(beflux *bfx) {
+  if (bfx->flight != NULL && bfx->flight->path[0] != '\0')
+    bfx_flight_dump(bfx, bfx->flight->path);
+}
+
+/**
+ * \brief Writes an unsigned value in little-endian order.
+ */
+static void bfx_flight_put(FILE *fout, unsigned long long value, size_t bytes) {
+  while (bytes--) {
+    fputc((int) (value & 0xff), fout);
+    value >>= 8;
+  }
+}
+
+/**
+ * \brief Writes the recorded entries to a file, oldest first.
+ * \param filename The path of the dump.
+ * \return Zero if the file could not be written.
+ */
+int bfx_flight_dump(beflux *bfx, const char *filename) {
+  bfx_flight *f = bfx->flight;
+  size_t count, i;
+  FILE *fout;
+  int ok;
+
+  if (f == NULL)
+    return 0;
+  fout = fopen(filename, "wb");
+  if (fout == NULL)
+    return 0;
+  count = f->head <= f->mask ? f->head : f->mask + 1;
+  fputs(BFX_FLIGHT_MAGIC, fout);
+  fputc(BFX_FLIGHT_VERSION, fout);
+  fputc((int) sizeof(bfx_word), fout);
+  bfx_flight_put(fout, 0, 2);
+  bfx_flight_put(fout, count, 4);
+  for (i = f->head - count; i != f->head; ++i) {
+    const bfx_flight_tick *t = f->ticks + (i & f->mask);
+    bfx_flight_put(fout, t->tick, 8);
+    bfx_flight_put(fout, t->count, 8);
+    bfx_flight_put(fout, t->prog, sizeof(bfx_word));
+    bfx_flight_put(fout, t->row, sizeof(bfx_word));
+    bfx_flight_put(fout, t->col, sizeof(bfx_word));
+    bfx_flight_put(fout, t->op, sizeof(bfx_word));
+    bfx_flight_put(fout, t->top, sizeof(bfx_word));
+    fputc(t->dir, fout);
+    fputc(t->mode, fout);
+  }
+  ok = !ferror(fout);
+  return fclose(fout) == 0 && ok;
+}
+
+/*******************************************************************************
+ * Profiling
+ *
+ * A profile arms a timer on the process's CPU clock that raises SIGPROF, and
+ * the handler reads where the IP of the profiled interpreter is, along with
+ * the CALL sites on its call stacks, into a fixed table of sites. The
+ * handler only reads the interpreter and writes the table, so nothing is
+ * paid per tick, but fields written mid-tick may pair a row with the
+ * previous tick's column. Signals are process-wide, so one interpreter can
+ * be profiled at a time.
+ */
+#ifdef BFX_PROFILE
+static bfx_profile *volatile bfx_profiling = NULL;
+static int bfx_profile_busy = 0;
+static size_t bfx_profile_used = 0;
+static timer_t bfx_profile_timer;
+static struct sigaction bfx_profile_previous;
+
+/**
+ * \brief Hashes the cell and CALL sites of a sample.
+ */
+static size_t bfx_profile_hash(const bfx_profile_site *s) {
+  size_t h = 2166136261u, i, depth;
+  h = (h ^ s->prog) * 16777619u;
+  h = (h ^ s->row) * 16777619u;
+  h = (h ^ s->col) * 16777619u;
+  h = (h ^ s->depth) * 16777619u;
+  depth = s->depth < BFX_PROFILE_DEPTH ? s->depth : BFX_PROFILE_DEPTH;
+  for (i = 0; i < depth; ++i) {
+    h = (h ^ s->calls[i][0]) * 16777619u;
+    h = (h ^ s->calls[i][1]) * 16777619u;
+  }
+  return h;
+}
+
+/**
+ * \brief Returns whether two samples are at the same cell under the same
+ *        CALL sites.
+ */
+static int bfx_profile_same(const bfx_profile_site *a, const bfx_profile_site *b) {
+  size_t depth = a->depth < BFX_PROFILE_DEPTH ? a->depth : BFX_PROFILE_DEPTH;
+  return a->prog == b->prog && a->row == b->row && a->col == b->col &&
+    a->depth == b->depth &&
+    memcmp(a->calls, b->calls, depth * sizeof(a->calls[0])) == 0;
+}
+
+/**
+ * \brief Takes one sample of the profiled interpreter. Runs in the signal
+ *        handler, so it may only read the interpreter and write the table.
+ */
+static void bfx_profile_sample(bfx_profile *p) {
+  const beflux *bfx = p->bfx;
+  const bfx_stack *rows = &bfx->calls_row, *cols = &bfx->calls_col;
+  bfx_profile_site s, *site;
+  size_t i, depth, mask = p->capacity - 1;
+
+  s.samples = 0;
+  s.prog = bfx->current_program;
+  s.row = bfx->ip.row;
+  s.col = bfx->ip.col;
+  s.dir = bfx->ip.dir;
+#ifdef BFX_SPARSE
+  s.op = 0; /* Filled in by bfx_profile_stop; reads can move tiles */
+#else
+  s.op = BFX_RELAXED_LOAD(&bfx->programs[BFX_CELL(s.prog, s.row, s.col)]);
+#endif
+  s.depth = rows->size;
+  depth = s.depth < BFX_PROFILE_DEPTH ? s.depth : BFX_PROFILE_DEPTH;
+  for (i = 0; i < depth; ++i) {
+    s.calls[i][0] = rows->data[BFX_STACK_INDEX(rows->size - depth + i)];
+    s.calls[i][1] = cols->data[BFX_STACK_INDEX(cols->size - depth + i)];
+  }
+
+  ++p->samples;
+  for (i = bfx_profile_hash(&s) & mask; ; i = (i + 1) & mask) {
+    site = p->sites + i;
+    if (site->samples == 0) {
+      if (bfx_profile_used == mask) {
+        ++p->dropped; /* Keep one site free to end probes */
+        return;
+      }
+      *site = s;
+      ++bfx_profile_used;
+      break;
+    }
+    if (bfx_profile_same(site, &s))
+      break;
+  }
+  site->op = s.op;
+  site->dir = s.dir;
+  ++site->samples;
+}
+
+static void bfx_profile_signal(int signo) {
+  bfx_profile *p = bfx_profiling;
+  (void) signo;
+  if (p == NULL || BFX_ATOMIC_EXCHANGE(&bfx_profile_busy, 1))
+    return;
+  bfx_profile_sample(p);
+  BFX_ATOMIC_STORE(&bfx_profile_busy, 0);
+}
+#endif
+
+/**
+ * \brief Starts sampling an interpreter.
+ * \param hz Samples per second of CPU time used by the process.
+ * \return NULL if sampling is unavailable in this build, another profile is
+ *         running or the timer could not be set.
+ */
+bfx_profile *bfx_profile_start(beflux *bfx, unsigned long hz) {
+#ifdef BFX_PROFILE
+  struct sigevent event;
+  struct sigaction action;
+  struct itimerspec interval;
+  bfx_profile *p;
+
+  if (hz == 0 || bfx_profiling != NULL)
+    return NULL;
+  p = calloc(1, sizeof(bfx_profile));
+  if (p == NULL)
+    return NULL;
+  p->bfx = bfx;
+  p->capacity = 1;
+  while (p->capacity < BFX_PROFILE_SITES)
+    p->capacity <<= 1;
+  p->sites = calloc(p->capacity, sizeof(bfx_profile_site));
+  if (p->sites == NULL) {
+    free(p);
+    return NULL;
+  }
+
+  memset(&event, 0, sizeof(event));
+  event.sigev_notify = SIGEV_SIGNAL;
+  event.sigev_signo = SIGPROF;
+  if (timer_create(CLOCK_PROCESS_CPUTIME_ID, &event, &bfx_profile_timer) != 0) {
+    bfx_profile_del(p);
+    return NULL;
+  }
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = bfx_profile_signal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  bfx_profile_used = 0;
+  bfx_profiling = p;
+  sigaction(SIGPROF, &action, &bfx_profile_previous);
+
+  interval.it_interval.tv_sec = hz > 1 ? 0 : 1;
+  interval.it_interval.tv_nsec = hz > 1 ? 1000000000L / (long) hz : 0;
+  interval.it_value = interval.it_interval;
+  timer_settime(bfx_profile_timer, 0, &interval, NULL);
+  return p;
+#else
+  (void) bfx;
+  (void) hz;
+  return NULL;
+#endif
+}
+
+/**
+ * \brief Stops sampling. The profile keeps its samples until it is deleted.
+ */
+void bfx_profile_stop(bfx_profile *p) {
+#ifdef BFX_PROFILE
+  size_t i;
+  if (p == NULL || bfx_profiling != p)
+    return;
+  timer_delete(bfx_profile_timer);
+  bfx_profiling = NULL;
+  while (BFX_ATOMIC_LOAD(&bfx_profile_busy))
+    ; /* A handler on another thread is finishing its sample */
+  sigaction(SIGPROF, &bfx_profile_previous, NULL);
+#ifdef BFX_SPARSE
+  for (i = 0; i < p->capacity; ++i) {
+    bfx_profile_site *s = p->sites + i;
+    if (s->samples)
+      s->op = bfx_program_get(p->bfx, s->prog, s->row, s->col);
+  }
+#else
+  (void) i;
+#endif
+#else
+  (void) p;
+#endif
+}
+
+/**
+ * \brief Stops and frees a profile.
+ */
+void bfx_profile_del(bfx_profile *p) {
+  if (p == NULL)
+    return;
+  bfx_profile_stop(p);
+  free(p->sites);
+  free(p);
+}
+
+/**
+ * \brief Orders sites by cell, then most sampled first.
+ */
+static int bfx_profile_compare_cell(const void *a, const void *b) {
+  const bfx_profile_site *x = a, *y = b;
+  if (x->prog != y->prog)
+    return x->prog < y->prog ? -1 : 1;
+  if (x->row != y->row)
+    return x->row < y->row ? -1 : 1;
+  if (x->col != y->col)
+    return x->col < y->col ? -1 : 1;
+  return x->samples > y->samples ? -1 : x->samples < y->samples;
+}
+
+static int bfx_profile_compare_samples(const void *a, const void *b) {
+  const bfx_profile_site *x = a, *y = b;
+  if (x->samples != y->samples)
+    return x->samples > y->samples ? -1 : 1;
+  return bfx_profile_compare_cell(a, b);
+}
+
+/**
+ * \brief Writes an op as its character, or its name if it has no printable
+ *        one.
+ */
+static void bfx_profile_op(FILE *fout, bfx_word op) {
+  if (op > 0x20 && op < 0x7f && op != ';')
+    fputc((int) op, fout);
+  else
+    fputs(BFX_OP_NAME(op), fout);
+}
+
+/**
+ * \brief Writes a histogram of samples per cell, most sampled first.
+ */
+void bfx_profile_cells(const bfx_profile *p, FILE *fout) {
+  bfx_profile_site *cells;
+  size_t i, count = 0;
+
+  fprintf(
+    fout, "%lu samples, %lu dropped\n%10s %6s %6s %6s %6s  op\n",
+    (unsigned long) p->samples, (unsigned long) p->dropped,
+    "samples", "share", "prog", "row", "col"
+  );
+  cells = malloc(p->capacity * sizeof(bfx_profile_site));
+  if (cells == NULL)
+    return;
+  for (i = 0; i < p->capacity; ++i) {
+    if (p->sites[i].samples)
+      cells[count++] = p->sites[i];
+  }
+  qsort(cells, count, sizeof(bfx_profile_site), bfx_profile_compare_cell);
+  for (i = 1; i <= count; ++i) {
+    if (
+      i < count && cells[i].prog == cells[i - 1].prog &&
+      cells[i].row == cells[i - 1].row && cells[i].col == cells[i - 1].col
+    ) {
+      cells[i].samples += cells[i - 1].samples;
+      cells[i].op = cells[i - 1].op; /* Keep the op seen most often */
+      cells[i - 1].samples = 0;
+    }
+  }
+  qsort(cells, count, sizeof(bfx_profile_site), bfx_profile_compare_samples);
+  for (i = 0; i < count && cells[i].samples; ++i) {
+    fprintf(
+      fout, "%10lu %5.1f%% %6lu %6lu %6lu  ",
+      (unsigned long) cells[i].samples, 100.0 * cells[i].samples / p->samples,
+      (unsigned long) cells[i].prog, (unsigned long) cells[i].row,
+      (unsigned long) cells[i].col
+    );
+    bfx_profile_op(fout, cells[i].op);
+    fputc('\n', fout);
+  }
+  free(cells);
+}
+
+/**
+ * \brief Writes the samples as folded stacks, one line per cell and CALL
+ *        sites, for flame graph tools. Frames are the program, each CALL as
+ *        "C@row,col", outermost first, and the op under the IP.
+ */
+void bfx_profile_folded(const bfx_profile *p, FILE *fout) {
+  size_t i, j, depth;
+  for (i = 0; i < p->capacity; ++i) {
+    const bfx_profile_site *s = p->sites + i;
+    if (s->samples == 0)
+      continue;
+    fprintf(fout, "prog%lu;", (unsigned long) s->prog);
+    depth = s->depth < BFX_PROFILE_DEPTH ? s->depth : BFX_PROFILE_DEPTH;
+    if (depth < s->depth)
+      fputs("...;", fout);
+    for (j = 0; j < depth; ++j) {
+      fprintf(
+        fout, "C@%lu,%lu;",
+        (unsigned long) s->calls[j][0], (unsigned long) s->calls[j][1]
+      );
+    }
+    bfx_profile_op(fout, s->op);
+    fprintf(
+      fout, "@%lu,%lu %lu\n",
+      (unsigned long) s->row, (unsigned long) s->col, (unsigned long) s->samples
+    );
+  }
+}
+
+/*******************************************************************************
+ * Statistics
+ *
+ * Counters an interpreter keeps as it runs. Ticks that stay in the
+ * interpreter pay nothing for them; the clock is read around bfx_run, and
+ * around every sleep and host function. Input is timed only when a read
+ * has to refill the stream's buffer, which is where it can block, so bytes
+ * already buffered cost a check of the buffer. Worker threads keep their
+ * own.
+ */
+
+/**
+ * \brief Reads a byte of input, timing how long it waits if it has to.
+ */
+static int bfx_getc(beflux *bfx) {
+  double start;
+  int c;
+
+  if (BFX_BUFFERED(bfx->in)) {
+    c = fgetc(bfx->in);
+  }
+  else {
+    start = bfx_clock();
+    c = fgetc(bfx->in);
+    bfx->stats.reading += bfx_clock() - start;
+  }
+  bfx->stats.bytes_in += c != EOF;
+  return c;
+}
+
+/**
+ * \brief Copies an interpreter's statistics, including the bfx_run in
+ *        progress, if any. Safe to call from bfx_run's hooks and
+ *        on_interrupt.
+ */
+void bfx_stats_get(beflux *bfx, bfx_stats *stats) {
+  double busy;
+  *stats = bfx->stats;
+  if (bfx->run_clock != 0) {
+    stats->ticks += bfx->tick - bfx->run_tick;
+    stats->running += bfx_clock() - bfx->run_clock;
+  }
+  busy = stats->sleeping + stats->reading + stats->hosting;
+  stats->executing = stats->running > busy ? stats->running - busy : 0;
+  stats->ticks_per_second = stats->running > 0 ? stats->ticks / stats->running : 0;
+}
+
+/**
+ * \brief Writes statistics, one per line.
+ */
+void bfx_stats_print(const bfx_stats *stats, FILE *fout) {
+  double running = stats->running > 0 ? stats->running : 1;
+  fprintf(
+    fout,
+    "ticks:      %lu (%.0f per second)\n"
+    "running:    %.3fs: %.1f%% executing, %.1f%% sleeping, "
+    "%.1f%% reading, %.1f%% in host functions\n"
+    "bytes:      %lu in, %lu out\n"
+    "loads:      %lu\n"
+    "frames:     %lu pushed at most\n"
+    "calls:      %lu deep at most\n",
+    (unsigned long) stats->ticks, stats->ticks_per_second, stats->running,
+    100 * stats->executing / running, 100 * stats->sleeping / running,
+    100 * stats->reading / running, 100 * stats->hosting / running,
+    (unsigned long) stats->bytes_in, (unsigned long) stats->bytes_out,
+    (unsigned long) stats->loads, (unsigned long) stats->max_frames,
+    (unsigned long) stats->max_calls
+  );
+}
+
+/*******************************************************************************
+ * Performance Counters
+ *
+ * bfx_perf_begin opens a counter per event for the calling thread and any
+ * threads it starts, and bfx_perf_end reads them against the ticks run in
+ * between, so a change to dispatch or layout shows up as instructions, IPC
+ * or misses per tick rather than just time. Events the kernel or processor
+ * refuses are left out, and a build without perf events still times the
+ * window.
+ */
+#ifdef BFX_PERF
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} bfx_perf_events[BFX_PERF_COUNTERS] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  {
+    PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+    PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16
+  },
+  {
+    PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+    PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16
+  }
+};
+#endif
+
+static const char *bfx_perf_names[BFX_PERF_COUNTERS] = {
+  "cycles", "instructions", "branch misses", "L1d misses", "LLC misses"
+};
+
+/**
+ * \brief Starts counting cycles, instructions, branch misses, L1d misses
+ *        and LLC misses.
+ * \return How many of the counters could be opened.
+ */
+int bfx_perf_begin(beflux *bfx, bfx_perf *perf) {
+  int i, opened = 0;
+#ifdef BFX_PERF
+  struct perf_event_attr attr;
+  for (i = 0; i < BFX_PERF_COUNTERS; ++i) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = bfx_perf_events[i].type;
+    attr.config = bfx_perf_events[i].config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    perf->fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    perf->valid[i] = 0;
+    perf->counts[i] = 0;
+    opened += perf->fds[i] >= 0;
+  }
+#else
+  for (i = 0; i < BFX_PERF_COUNTERS; ++i) {
+    perf->fds[i] = -1;
+    perf->valid[i] = 0;
+    perf->counts[i] = 0;
+  }
+#endif
+  perf->tick = bfx->tick;
+  perf->ticks = 0;
+  perf->seconds = bfx_clock();
+#ifdef BFX_PERF
+  for (i = 0; i < BFX_PERF_COUNTERS; ++i) {
+    if (perf->fds[i] >= 0)
+      ioctl(perf->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+#endif
+  return opened;
+}
+
+/**
+ * \brief Stops counting and closes the counters. Counters the kernel
+ *        multiplexed are scaled up to the whole window.
+ */
+void bfx_perf_end(beflux *bfx, bfx_perf *perf) {
+  int i;
+#ifdef BFX_PERF
+  uint64_t values[3];
+  for (i = 0; i < BFX_PERF_COUNTERS; ++i) {
+    if (perf->fds[i] >= 0)
+      ioctl(perf->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+  }
+#endif
+  perf->seconds = bfx_clock() - perf->seconds;
+  perf->ticks = bfx->tick - perf->tick;
+  for (i = 0; i < BFX_PERF_COUNTERS; ++i) {
+    if (perf->fds[i] < 0)
+      continue;
+#ifdef BFX_PERF
+    if (read(perf->fds[i], values, sizeof(values)) == sizeof(values) && values[2]) {
+      perf->counts[i] = values[2] < values[1] ?
+        (uint64_t) ((double) values[0] * values[1] / values[2]) : values[0];
+      perf->valid[i] = 1;
+    }
+    close(perf->fds[i]);
+#endif
+    perf->fds[i] = -1;
+  }
+}
+
+/**
+ * \brief Writes each counter in total and per tick, and the instructions
+ *        per cycle if both were counted.
+ */
+void bfx_perf_print(const bfx_perf *perf, FILE *fout) {
+  double ticks = perf->ticks ? (double) perf->ticks : 1.0;
+  int i, any = 0;
+
+  fprintf(
+    fout, "%16lu ticks in %.3fs (%.1f Mticks/s)\n",
+    (unsigned long) perf->ticks, perf->seconds,
+    perf->seconds > 0 ? perf->ticks / perf->seconds / 1e6 : 0.0
+  );
+  for (i = 0; i < BFX_PERF_COUNTERS; ++i) {
+    if (!perf->valid[i])
+      continue;
+    fprintf(
+      fout, "%16llu %-14s %10.3f per tick\n",
+      (unsigned long long) perf->counts[i], bfx_perf_names[i],
+      perf->counts[i] / ticks
+    );
+    any = 1;
+  }
+  if (perf->valid[BFX_PERF_CYCLES] && perf->valid[BFX_PERF_INSTRUCTIONS] &&
+      perf->counts[BFX_PERF_CYCLES])
+    fprintf(
+      fout, "%16.2f IPC\n",
+      (double) perf->counts[BFX_PERF_INSTRUCTIONS] / perf->counts[BFX_PERF_CYCLES]
+    );
+  if (!any)
+    fprintf(fout, "Performance counters are not available.\n");
+}
+
+/*******************************************************************************
+ * Beflux Operators
+ */
+/* 0x20 */
+
+/**
+ * \brief ' ' - SKIP (0:0) - Skip to next non-space character.
+ */
+void bfx_op20(beflux *bfx) {
+  size_t i = 0;
+  size_t limit = bfx->wrap_offset == 0 ? BFX_ROW_LIMIT : BFX_GRID_LIMIT;
+  while (bfx_ip_get_op(bfx) == ' ') {
+    bfx_ip_advance(bfx);
+    if (i ++ > limit) {
+      bfx_error(bfx, "Infinite empty loop detected.");
+      break;
+    }
+  }
+  bfx->ip.wait = 1;
+}
+
+/**
+ * \brief '!' - NOT (1:1) - Boolean negation.
+ */
+void bfx_op21(beflux *bfx) {
+  bfx_push(bfx, bfx_pop(bfx) == 0);
+}
+
+/**
+ * \brief '"' - STR (0:0) - Toggle string mode.
+ */
+void bfx_op22(beflux *bfx) {
+  bfx_push(bfx, '\0');
+  bfx->mode = BFX_MODE_STRING;
+}
+
+/**
+ * \brief '#' - HOP (0:0) - Skip the next character.
+ */
+void bfx_op23(beflux *bfx) {
+  bfx_ip_advance(bfx);
+}
+
+/**
+ * \brief '$' - POP (1:0) - Pop from the current stack.
+ */
+void bfx_op24(beflux *bfx) {
+  bfx_pop(bfx);
+}
+
+/**
+ * \brief '%' - MOD (2:1) - Calculate remainder.
+ */
+void bfx_op25(beflux *bfx) {
+  bfx_word b = bfx_pop(bfx);
+  if (b == 0) {
+    bfx_error(bfx, "Zero modulus.");
+  }
+  bfx_push(bfx, bfx_pop(bfx) % b);
+}
+
+/**
+ * \brief '&' - GETX (0:?) - Reads a single hex digit from input.
+ */
+void bfx_op26(beflux *bfx) {
+  if (bfx->in == NULL) {
+    bfx_error(bfx, "No input file.");
+  }
+  else {
+    int c = bfx_getc(bfx);
+    switch (c) {
+      case '0':
+      case '1':
+      case '2':
+      case '3':
+      case '4':
+      case '5':
+      case '6':
+      case '7':
+      case '8':
+      case '9':
+        bfx_get_digit(bfx, c - '0');
+        break;
+      case 'A':
+      case 'B':
+      case 'C':
+      case 'D':
+      case 'E':
+      case 'F':
+        bfx_get_digit(bfx, c - 'A' + 10);
+        break;
+      case 'a':
+      case 'b':
+      case 'c':
+      case 'd':
+      case 'e':
+      case 'f':
+        bfx_get_digit(bfx, c - 'a' + 10);
+        break;
+      case EOF:
+        bfx_error(bfx, "End of input stream.");
+      default: break;
+    };
+  }
+}
+
+/**
+ * \brief ''' - OVER (2:3) - Copies the value under the top of the stack.
+ */
+void bfx_op27(beflux *bfx) {
+  bfx_word a = bfx_pop(bfx);
+  bfx_word b = bfx_top(bfx);
+  bfx_push(bfx, a);
+  bfx_push(bfx, b);
+}
+
+/**
+ * \brief '(' - PSHF (0:0) - Pushes a new stack frame.
+ */
+void bfx_op28(beflux *bfx) {
+  ++bfx->current_frame;
+  if (bfx->current_frame > bfx->stats.max_frames)
+    bfx->stats.max_frames = bfx->current_frame;
+}
+
+/**
+ * \brief ')' - POPF (0:0) - Pops the current stack frame.
+ */
+void bfx_op29(beflux *bfx) {
+  --bfx->current_frame;
+}
+
+/**
+ * \brief '*' - MUL (2:1) - Calculate product.
+ */
+void bfx_op2a(beflux *bfx) {
+  bfx_push(bfx, bfx_pop(bfx) * bfx_pop(bfx));
+}
+
+/**
+ * \brief '+' - ADD (2:1) - Calculate sum.
+ */
+void bfx_op2b(beflux *bfx) {
+  bfx_push(bfx, bfx_pop(bfx) + bfx_pop(bfx));
+}
+
+/**
+ * \brief ',' - PUTC (1:0) - Writes an ASCII character to output.
+ */
+void bfx_op2c(beflux *bfx) {
+  if (bfx->out == NULL) {
+    bfx_error(bfx, "No output file.");
+  }
+  if (fputc(bfx_pop(bfx), bfx->out) != EOF)
+    ++bfx->stats.bytes_out;
+}
+
+/**
+ * \brief '-' - SUB (2:1) - Calculate difference.
+ */
+void bfx_op2d(beflux *bfx) {
+  bfx_word b = bfx_pop(bfx);
+  bfx_push(bfx, bfx_pop(bfx) - b);
+}
+
+/**
+ * \brief '.' - PUTX (1:0) - Writes a hexadecimal value to output.
+ */
+void bfx_op2e(beflux *bfx) {
+  int written;
+  if (bfx->out == NULL) {
+    bfx_error(bfx, "No output file.");
+  }
+  written = fprintf(bfx->out, BFX_WORD_FMT, bfx_pop(bfx));
+  if (written > 0)
+    bfx->stats.bytes_out += (size_t) written;
+}
+
+/**
+ * \brief '/' - DIV (2:1) - Calculate quotient.
+ */
+void bfx_op2f(beflux *bfx) {
+  bfx_word b = bfx_pop(bfx);
+  if (b == 0) {
+    bfx_error(bfx, "Zero denominator.");
+  }
+  bfx_push(bfx, bfx_pop(bfx) / b);
+}
+
+/* 0x30 */
+/**
+ * \brief '0' - V0 (0:?) - Hex digit 0.
+ */
+void bfx_op30(beflux *bfx) { bfx_get_digit(bfx, 0); }
+
+/**
+ * \brief '1' - V1 (0:?) - Hex digit 1.
+ */
+void bfx_op31(beflux *bfx) { bfx_get_digit(bfx, 1); }
+
+/**
+ * \brief '2' - V2 (0:?) - Hex digit 2.
+ */
+void bfx_op32(beflux *bfx) { bfx_get_digit(bfx, 2); }
+
+/**
+ * \brief '3' - V3 (0:?) - Hex digit 3.
+ */
+void bfx_op33(beflux *bfx) { bfx_get_digit(bfx, 3); }
+
+/**
+ * \brief '4' - V4 (0:?) - Hex digit 4.
+ */
+void bfx_op34(beflux *bfx) { bfx_get_digit(bfx, 4); }
+
+/**
+ * \brief '5' - V5 (0:?) - Hex digit 5.
+ */
+void bfx_op35(beflux *bfx) { bfx_get_digit(bfx, 5); }
+
+/**
+ * \brief '6' - V6 (0:?) - Hex digit 6.
+ */
+void bfx_op36(beflux *bfx) { bfx_get_digit(bfx, 6); }
+
+/**
+ * \brief '7' - V7 (0:?) - Hex digit 7.
+ */
+void bfx_op37(beflux *bfx) { bfx_get_digit(bfx, 7); }
+
+/**
+ * \brief '8' - V8 (0:?) - Hex digit 8.
+ */
+void bfx_op38(beflux *bfx) { bfx_get_digit(bfx, 8); }
+
+/**
+ * \brief '9' - V9 (0:?) - Hex digit 9.
+ */
+void bfx_op39(beflux *bfx) { bfx_get_digit(bfx, 9); }
+
+/**
+ * \brief ':' - DUP (1:2) - Duplicate current stack top.
+ */
+void bfx_op3a(beflux *bfx) {
+  bfx_push(bfx, bfx_top(bfx));
+}
+
+/**
+ * \brief ';' - COM (0:0) - Skip to next comment character.
+ */
+void bfx_op3b(beflux *bfx) {
+  size_t i = 0;
+  size_t limit = bfx->wrap_offset == 0 ? BFX_ROW_LIMIT - 3 : BFX_GRID_LIMIT;
+  bfx_ip_advance(bfx);
+  while (bfx_ip_get_op(bfx) != ';') {
+    bfx_ip_advance(bfx);
+    if (i++ > limit) {
+      bfx_error(bfx, "Infinite comment loop detected.");
+      break;
+    }
+  }
+}
+
+/**
+ * \brief '<' - MVW (0:0) - Change direction to West.
+ */
+void bfx_op3c(beflux *bfx) {
+  bfx->ip.dir = BFX_IP_W;
+}
+
+/**
+ * \brief '=' - EQ (2:1) - Test for equality.
+ */
+void bfx_op3d(beflux *bfx) {
+  bfx_push(bfx, bfx_pop(bfx) == bfx_pop(bfx));
+}
+
+/**
+ * \brief '>' - MVE (0:0) - Change direction to East.
+ */
+void bfx_op3e(beflux *bfx) {
+  bfx->ip.dir = BFX_IP_E;
+}
+
+/**
+ * \brief '?' - AWAY (0:0) - Change direction at random.
+ */
+void bfx_op3f(beflux *bfx) {
+  bfx->ip.dir = (rand() % 4) << 7;
+}
+
+/* 0x40 */
+/**
+ * \brief '@' - REP (0:0) - Reset the IP and increment t_minor.
+ */
+void bfx_op40(beflux *bfx) {
+  bfx_ip_reset(bfx);
+  bfx->ip.wait = 1;
+  ++bfx->t_minor;
+  bfx_trace_rep(bfx);
+}
+
+/**
+ * \brief 'A' - PRVP (0:0) - Decrement program index.
+ */
+void bfx_op41(beflux *bfx) {
+  --bfx->current_program;
+}
+
+/**
+ * \brief 'B' - REV (0:0) - Reverse IP direction.
+ */
+void bfx_op42(beflux *bfx) {
+  bfx->ip.dir += BFX_IP_TURN_B;
+}
+
+/**
+ * \brief 'C' - CALL (2:0) - Jump to position using call stack.
+ */
+void bfx_op43(beflux *bfx) {
+  bfx_stack_push(&bfx->calls_row, bfx->ip.row);
+  bfx_stack_push(&bfx->calls_col, bfx->ip.col);
+  if (bfx->calls_row.size > bfx->stats.max_calls)
+    bfx->stats.max_calls = bfx->calls_row.size;
+  bfx_op4a(bfx); /* 'J' */
+}
+
+/**
+ * \brief 'D' - DICE (2:1) - Push a random number in the given range.
+ */
+void bfx_op44(beflux *bfx) {
+  bfx_word max = bfx_pop(bfx);
+  bfx_word min = bfx_pop(bfx);
+  bfx_push(bfx, (rand() % (max - min)) + min);
+}
+
+/**
+ * \brief 'E' - EOF (0:1) - Return whether end of input has been reached.
+ */
+void bfx_op45(beflux *bfx) {
+  if (bfx->in == NULL) {
+    bfx_push(bfx, BFX_WORD_MAX);
+  }
+  else {
+    bfx_push(bfx, !!feof(bfx->in));
+  }
+}
+
+/**
+ * \brief 'F' - FUNC (1:?) - Call a user-defined function.
+ */
+void bfx_op46(beflux *bfx) {
+  bfx_word f = bfx_pop(bfx);
+  double start = bfx_clock();
+  if (!BFX_BANK_VALID(f)) {
+    bfx_error(bfx, "Undefined function.");
+  }
+  else if (bfx->async_bindings[f] != NULL) {
+    /* Mark the call pending first, in case it completes on another thread
+     * before returning. */
+    BFX_ATOMIC_STORE(&bfx->pending, 1);
+    if (bfx->async_bindings[f](bfx) == BFX_ASYNC_PENDING) {
+      bfx->resume_mode = bfx->mode;
+      bfx->mode = BFX_MODE_PARKED;
+      bfx->batch = 0;
+    }
+    else {
+      BFX_ATOMIC_STORE(&bfx->pending, 0);
+    }
+  }
+  else if (bfx->f_bindings[f] != NULL) {
+    bfx->f_bindings[f](bfx);
+  }
+  else {
+    bfx_error(bfx, "Undefined function.");
+  }
+  bfx->stats.hosting += bfx_clock() - start;
+}
+
+/**
+ * \brief 'G' - GETP (3:1) - Push character from a program.
+ */
+void bfx_op47(beflux *bfx) {
+  bfx_word col = bfx_pop(bfx);
+  bfx_word row = bfx_pop(bfx);
+  bfx_push(bfx, bfx_program_get(bfx, bfx_pop(bfx), row, col));
+}
+
+/**
+ * \brief 'H' - HOME (0:0) - Set program index to 0.
+ */
+void bfx_op48(beflux *bfx) {
+  bfx->current_program = 0;
+}
+
+/**
+ * \brief 'I' - FIN (str:0) - Open input file.
+ */
+void bfx_op49(beflux *bfx) {
+  bfx_word c = bfx_top(bfx);
+  if (c == 0x00) {
+    bfx_pop(bfx);
+    bfx->in = NULL;
+  }
+  else if (c == BFX_WORD_MAX) {
+    bfx_pop(bfx);
+    bfx->in = stdin;
+  }
+  else {
+    char fname[BFX_BANK_SIZE] = "";
+    if (bfx->in != NULL && bfx->in != stdin) {
+      fclose(bfx->in);
+    }
+    bfx_get_string(bfx, fname);
+    bfx->in = fopen(fname, "rb");
+    if (bfx->in == NULL) {
+      char msg[BFX_BANK_SIZE + 32] = "";
+      sprintf(msg, "Failed to open input file %s.", fname);
+      bfx_error(bfx, msg);
+    }
+  }
+}
+
+/**
+ * \brief 'J' - JMP (2:0) - Jump to specified position.
+ */
+void bfx_op4a(beflux *bfx) {
+  bfx->ip.col = bfx_pop(bfx);
+  bfx->ip.row = bfx_pop(bfx);
+  bfx->ip.wait = 1;
+}
+
+/**
+ * \brief 'K' - DUPF (0:?) - Pushes a copy of the current stack frame.
+ */
+void bfx_op4b(beflux *bfx) {
+  bfx_op28(bfx); /* '(' */
+  memcpy(
+    &bfx->frames[BFX_FRAME_INDEX(bfx->current_frame)],
+    &bfx->frames[BFX_FRAME_INDEX(bfx->current_frame - 1)],
+    sizeof(bfx_stack)
+  );
+}
+
+/**
+ * \brief 'L' - LEND (0:0) - Resets the loop counter.
+ */
+void bfx_op4c(beflux *bfx) {
+  bfx->loop_count = 0;
+}
+
+/**
+ * \brief 'M' - CLRS (0:0) - Clears all stack frames.
+ */
+void bfx_op4d(beflux *bfx) {
+  do {
+    bfx_clear(bfx);
+  } while (bfx->current_frame--);
+}
+
+/**
+ * \brief 'N' - CLRF (0:0) - Clear the current stack frame.
+ */
+void bfx_op4e(beflux *bfx) {
+  bfx_clear(bfx);
+}
+
+/**
+ * \brief 'O' - FOUT (str:0) - Open output file.
+ */
+void bfx_op4f(beflux *bfx) {
+  bfx_word c = bfx_top(bfx);
+  if (c == 0x00) {
+    bfx_pop(bfx);
+    bfx->out = NULL;;
+  }
+  else if (c == BFX_WORD_MAX) {
+    bfx_pop(bfx);
+    bfx->out = stdout;
+  }
+  else {
+    char fname[BFX_BANK_SIZE] = "";
+    if (bfx->out != NULL && bfx->out != stdout) {
+      fclose(bfx->out);
+    }
+    bfx_get_string(bfx, fname);
+    bfx->out = fopen(fname, "wb");
+    if (bfx->out == NULL) {
+      char msg[BFX_BANK_SIZE + 32] = "";
+      sprintf(msg, "Failed to open output file %s.", fname);
+      bfx_error(bfx, msg);
+    }
+  }
+}
+
+/* 0x50 */
+/**
+ * \brief 'P' - LOAD (1,str:0) - Load program into specified index.
+ */
+void bfx_op50(beflux *bfx) {
+  char fname[BFX_BANK_SIZE] = "";
+  bfx_word prog = bfx_pop(bfx);
+  bfx_get_string(bfx, fname);
+  bfx_load(bfx, prog, fname);
+}
+
+/**
+ * \brief 'Q' - QUIT (0:0) - End execution.
+ */
+void bfx_op51(beflux *bfx) {
+  bfx_ip_reset(bfx);
+  bfx->ip.wait = 1;
+  bfx->status = bfx->t_minor = 0;
+  ++bfx->t_major;
+  bfx->mode = BFX_MODE_HALT;
+  bfx_workers_quit(bfx);
+}
+
+/**
+ * \brief 'R' - RET (0:0) - Return from a CALL.
+ */
+void bfx_op52(beflux *bfx) {
+  bfx_push(bfx, bfx_stack_pop(&bfx->calls_row));
+  bfx_push(bfx, bfx_stack_pop(&bfx->calls_col));
+  bfx_op4a(bfx); /* J */
+  bfx_ip_advance(bfx);
+}
+
+/**
+ * \brief 'S' - SETP (4:0) - Set a specified program character.
+ */
+void bfx_op53(beflux *bfx) {
+  bfx_word col = bfx_pop(bfx);
+  bfx_word row = bfx_pop(bfx);
+  bfx_word prog = bfx_pop(bfx);
+  bfx_program_set(bfx, prog, row, col, bfx_pop(bfx));
+}
+
+/**
+ * \brief 'T' - TMAJ (0:1) - Push the t_major timer.
+ */
+void bfx_op54(beflux *bfx) {
+  bfx_push(bfx, bfx->t_major);
+}
+
+/**
+ * \brief 'U' - CURP (0:1) - Push the current program index.
+ */
+void bfx_op55(beflux *bfx) {
+  bfx_push(bfx, bfx->current_program);
+}
+
+/**
+ * \brief 'V' - NXTP (0:0) - Incrememnt the program index.
+ */
+void bfx_op56(beflux *bfx) {
+  ++bfx->current_program;
+}
+
+/**
+ * \brief 'W' - WRAP (1:0) - Set wrapping offset.
+ */
+void bfx_op57(beflux *bfx) {
+  bfx->wrap_offset = bfx_pop(bfx);
+  bfx->batch = 0; /* Reselect the run loop */
+}
+
+/**
+ * \brief 'X' - EXEP (1:0) - Execute program.
+ */
+void bfx_op58(beflux *bfx) {
+  bfx_op4a(bfx); /* 'J' */
+  bfx->current_program = bfx_pop(bfx);
+}
+
+/**
+ * \brief 'Y' - CLRR (0:0) - Clear all registers.
+ */
+void bfx_op59(beflux *bfx) {
+  size_t i;
+  for (i = 0; i < BFX_REGISTER_COUNT; ++i) {
+    BFX_RELAXED_STORE(&bfx->registers[i], 0);
+  }
+}
+
+/**
+ * \brief 'Z' - RAND (0:1) - Push a random value.
+ */
+void bfx_op5a(beflux *bfx) {
+  bfx_push(bfx, rand());
+}
+
+/**
+ * \brief '[' - TRNL (0:0) - Turn IP left.
+ */
+void bfx_op5b(beflux *bfx) {
+  bfx->ip.dir += BFX_IP_TURN_L;
+}
+
+/**
+ * \brief '\' - SWP (2:2) - Swap the top two values on the current stack.
+ */
+void bfx_op5c(beflux *bfx) {
+  bfx_word a = bfx_pop(bfx);
+  bfx_word b = bfx_pop(bfx);
+  bfx_push(bfx, a);
+  bfx_push(bfx, b);
+}
+
+/**
+ * \brief ']' - TRNR (0:0) - Turn IP right.
+ */
+void bfx_op5d(beflux *bfx) {
+  bfx->ip.dir += BFX_IP_TURN_R;
+}
+
+/**
+ * \brief '^' - MVN (0:0) - Change direction to North.
+ */
+void bfx_op5e(beflux *bfx) {
+  bfx->ip.dir = BFX_IP_N;
+}
+
+/**
+ * \brief '_' - WEIF (1:0) - West / East conditional branch.
+ */
+void bfx_op5f(beflux *bfx) {
+  if (bfx_pop(bfx))
+    bfx_op3c(bfx); /* '<' */
+  else
+    bfx_op3e(bfx); /* '>' */
+}
+
+/* 0x60 */
+/**
+ * \brief '`' - GT (2:1) - Compare values.
+ */
+void bfx_op60(beflux *bfx) {
+  bfx_push(bfx, bfx_pop(bfx) > bfx_pop(bfx));
+}
+
+/**
+ * \brief 'a' - VA (0:?) - Hex digit A.
+ */
+void bfx_op61(beflux *bfx) { bfx_get_digit(bfx, 10); }
+
+/**
+ * \brief 'b' - VB (0:?) - Hex digit B.
+ */
+void bfx_op62(beflux *bfx) { bfx_get_digit(bfx, 11); }
+
+/**
+ * \brief 'c' - VC (0:?) - Hex digit C.
+ */
+void bfx_op63(beflux *bfx) { bfx_get_digit(bfx, 12); }
+
+/**
+ * \brief 'd' - VD (0:?) - Hex digit D.
+ */
+void bfx_op64(beflux *bfx) { bfx_get_digit(bfx, 13); }
+
+/**
+ * \brief 'e' - VE (0:?) - Hex digit E.
+ */
+void bfx_op65(beflux *bfx) { bfx_get_digit(bfx, 14); }
+
+/**
+ * \brief 'f' - VF (0:?) - Hex digit F.
+ */
+void bfx_op66(beflux *bfx) { bfx_get_digit(bfx, 15); }
+
+/**
+ * \brief 'g' - GETR (1:1) - Push value from given register.
+ */
+void bfx_op67(beflux *bfx) {
+  bfx_push(bfx, BFX_RELAXED_LOAD(&bfx->registers[BFX_REGISTER_INDEX(bfx_pop(bfx))]));
+}
+
+/**
+ * \brief 'h' - BMPN (0:0) - Bump IP North.
+ */
+void bfx_op68(beflux *bfx) {
+  --bfx->ip.row;
+  bfx->ip.wait = 1;
+}
+
+/**
+ * \brief 'i' - GETS (0:str) - Read null-terminated string or line from input.
+ */
+void bfx_op69(beflux *bfx) {
+  bfx_word top;
+  do {
+    bfx_op7e(bfx); /* '~' */
+    top = bfx_top(bfx);
+  } while (top && top != '\n');
+}
+
+/**
+ * \brief 'j' - JREL (2:0) - Jump relative to current IP position.
+ */
+void bfx_op6a(beflux *bfx) {
+  bfx_word dx = bfx_pop(bfx);
+  bfx_word dy = bfx_pop(bfx);
+  bfx_word dir = bfx->ip.dir;
+
+  bfx->ip.dir = BFX_IP_E;
+  while (dx--) {
+    bfx_ip_advance(bfx);
+  }
+
+  bfx->ip.dir = BFX_IP_S;
+  while (dy--) {
+    bfx_ip_advance(bfx);
+  }
+
+  bfx->ip.dir = dir;
+  bfx->ip.wait = 1;
+}
+
+/**
+ * \brief 'k' - ITER (1:?) - Iterate next instruction.
+ */
+void bfx_op6b(beflux *bfx) {
+  bfx_ip_advance(bfx);
+  bfx->ip.wait = bfx_pop(bfx);
+  bfx_iterate(bfx);
+}
+
+/**
+ * \brief 'l' - LOOP (0:1) - Push and increment loop counter.
+ */
+void bfx_op6c(beflux *bfx) {
+  bfx_push(bfx, bfx->loop_count++);
+}
+
+/**
+ * \brief 'm' - NIF (1:0) - North / Continue conditional branch.
+ */
+void bfx_op6d(beflux *bfx) {
+  if (bfx_pop(bfx))
+    bfx_op5e(bfx); /* '^' */
+}
+
+/**
+ * \brief 'n' - ENDL (0:0) - Write newline to output.
+ */
+void bfx_op6e(beflux *bfx) {
+  bfx_push(bfx, '\n');
+  bfx_op2c(bfx);
+}
+
+/**
+ * \brief 'o' - PUTS (str:0) - Write null-terminated string to output.
+ */
+void bfx_op6f(beflux *bfx) {
+  bfx_op72(bfx); /* 'r' */
+  while (bfx_top(bfx)) {
+    bfx_op2c(bfx); /* ',' */
+  }
+}
+
+/* 0x70 */
+/**
+ * \brief 'p' - SWPR (2:1) - Swap top of current stack with value in register.
+ */
+void bfx_op70(beflux *bfx) {
+  bfx_word i = BFX_REGISTER_INDEX(bfx_pop(bfx));
+  bfx_push(bfx, BFX_RELAXED_EXCHANGE(&bfx->registers[i], bfx_pop(bfx)));
+}
+
+/**
+ * \brief 'q' - EXIT (1:0) - End execution with status.
+ */
+void bfx_op71(beflux *bfx) {
+  bfx->status = bfx_pop(bfx);
+  if (bfx->status) {
+    char msg[BFX_BANK_SIZE] = "";
+    sprintf(msg, "Exited with status " BFX_WORD_FMT ".", bfx->status);
+    bfx_warning(bfx, msg);
+  }
+  bfx_ip_reset(bfx);
+  bfx->ip.wait = 1;
+  bfx->t_minor = 0;
+  ++bfx->t_major;
+  bfx->mode = BFX_MODE_HALT;
+  bfx_workers_quit(bfx);
+}
+
+/**
+ * \brief 'r' - REVS (str:str) - Reverse string on stack.
+ */
+void bfx_op72(beflux *bfx) {
+  bfx_word buffer[BFX_STACK_SIZE + 1];
+  bfx_word count = 1;
+
+  buffer[0] = '\0';
+  while (bfx_top(bfx)) {
+    buffer[count++] = bfx_pop(bfx);
+  }
+
+  bfx_push_span(bfx, buffer, count);
+}
+
+/**
+ * \brief 's' - SETR (2:0) - Set given register.
+ */
+void bfx_op73(beflux *bfx) {
+  bfx_word i = BFX_REGISTER_INDEX(bfx_pop(bfx));
+  BFX_RELAXED_STORE(&bfx->registers[i], bfx_pop(bfx));
+}
+
+/**
+ * \brief 't' - TMIN (0:1) - Push the t_minor timer.
+ */
+void bfx_op74(beflux *bfx) {
+  bfx_push(bfx, bfx->t_minor);
+}
+
+/**
+ * \brief 'u' - JOIN (str,str:str) - Join two strings on the stack.
+ */
+void bfx_op75(beflux *bfx) {
+  bfx_stack tmp;
+  tmp.size = 0;
+
+  while (bfx_top(bfx)) {
+    bfx_stack_push(&tmp, bfx_pop(bfx));
+  }
+  bfx_pop(bfx);
+
+  while (tmp.size) {
+    bfx_push(bfx, bfx_stack_pop(&tmp));
+  }
+  bfx_pop(bfx);
+}
+
+/**
+ * \brief 'v' - MVS (0:0) - Change direction to South.
+ */
+void bfx_op76(beflux *bfx) {
+  bfx->ip.dir = BFX_IP_S;
+}
+
+/**
+ * \brief 'w' - SIF (1:0) - South / Continue conditional branch.
+ */
+void bfx_op77(beflux *bfx) {
+  if (bfx_pop(bfx))
+    bfx_op76(bfx); /* 'v' */
+}
+
+/**
+ * \brief 'x' - EXEC (1:?) - Execute operator.
+ */
+void bfx_op78(beflux *bfx) {
+  bfx_eval(bfx, bfx_pop(bfx));
+}
+
+/**
+ * \brief 'y' - BMPS (0:0) - Bump IP South.
+ */
+void bfx_op79(beflux *bfx) {
+  ++bfx->ip.row;
+  bfx->ip.wait = 1;
+}
+
+/**
+ * \brief 'z' - WAIT (1:0) - Sleep for the given number of seconds.
+ */
+void bfx_op7a(beflux *bfx) {
+  bfx->sleep = bfx_pop(bfx);
+  bfx->batch = 0; /* Sleep at the end of this tick */
+  fflush(bfx->out);
+  fflush(bfx->err);
+}
+
+/**
+ * \brief '{' - BLK (1:0) - Conditional block.
+ */
+void bfx_op7b(beflux *bfx) {
+  bfx_word depth = 1;
+  if (!bfx_pop(bfx)) { /* Skip to matching BLOCK END */
+    bfx_word c;
+    size_t i = 0;
+    size_t limit = bfx->wrap_offset == 0 ? BFX_ROW_LIMIT - 3 : BFX_GRID_LIMIT;
+    while (depth) {
+      bfx_ip_advance(bfx);
+      c = bfx_ip_get_op(bfx);
+      if (c == '}') {
+        --depth;
+      }
+      else if (c == '{') {
+        ++depth;
+      }
+
+      if (i++ > limit || depth == BFX_WORD_MAX) {
+        bfx_error(bfx, "Infinite block loop detected.");
+      }
+    }
+  }
+}
+
+/**
+ * \brief '|' - NSIF (1:0) - North / South conditional branch.
+ */
+void bfx_op7c(beflux *bfx) {
+  if (bfx_pop(bfx))
+    bfx_op5e(bfx); /* '^' */
+  else
+    bfx_op76(bfx); /* 'v' */
+}
+
+/**
+ * \brief '}' - BEND (0:0) - Block end.
+ */
+void bfx_op7d(beflux *bfx) {
+  (void) bfx;
+}
+
+/**
+ * \brief '~' - GETC (0:1) - Reads an ASCII character from input.
+ */
+void bfx_op7e(beflux *bfx) {
+  if (bfx->in == NULL) {
+    bfx_error(bfx, "No input file.");
+  }
+  bfx_push(bfx, bfx_getc(bfx));
+}
+
+/**
+ * \brief 'DEL' - NOP (0:0) - Does nothing!
+ */
+void bfx_op7f(beflux *bfx) {
+  (void) bfx;
+}
+
+/* 0x80 */
+/**
+ * \brief 0x80 - SPLT (1:0) - Start a new IP using the given stack frame.
+ *        The new IP moves in the opposite direction, and runs on a worker
+ *        thread if max_workers allows it.
+ */
+void bfx_op80(beflux *bfx) {
+  bfx_ip_state st;
+  bfx_ip ip = bfx->ip;
+  bfx_word frame = bfx_pop(bfx);
+
+  bfx->ip.dir += BFX_IP_TURN_B;
+  bfx->ip.wait = 0;
+  bfx_ip_advance(bfx);
+  bfx_ip_save(bfx, &st);
+  st.current_frame = frame;
+  bfx->ip = ip;
+
+  if (!bfx_workers_spawn(bfx, &st)) {
+    bfx_ip_push(bfx, &st);
+  }
+}
+
+/**
+ * \brief 0x81 - KILL (0:0) - End the current IP, or execution if it is the
+ *        last one.
+ */
+void bfx_op81(beflux *bfx) {
+  if (bfx->ip_count > 1) {
+    bfx->ip_dead = 1;
+  }
+  else {
+    bfx_ip_reset(bfx);
+    bfx->ip.wait = 1;
+    bfx->mode = BFX_MODE_HALT;
+  }
+}
+
+bfx_func *bfx_default_op_bindings[BFX_BANK_SIZE] = {
+  NULL,     NULL,     NULL,     NULL,
+  NULL,     NULL,     NULL,     NULL,
+  NULL,     NULL,     NULL,     NULL,
+  NULL,     NULL,     NULL,     NULL,
+
+  NULL,     NULL,     NULL,     NULL,
+  NULL,     NULL,     NULL,     NULL,
+  NULL,     NULL,     NULL,     NULL,
+  NULL,     NULL,     NULL,     NULL,
+
+  bfx_op20, bfx_op21, bfx_op22, bfx_op23,
+  bfx_op24, bfx_op25, bfx_op26, bfx_op27,
+  bfx_op28, bfx_op29, bfx_op2a, bfx_op2b,
+  bfx_op2c, bfx_op2d, bfx_op2e, bfx_op2f,
+
+  bfx_op30, bfx_op31, bfx_op32, bfx_op33,
+  bfx_op34, bfx_op35, bfx_op36, bfx_op37,
+  bfx_op38, bfx_op39, bfx_op3a, bfx_op3b,
+  bfx_op3c, bfx_op3d, bfx_op3e, bfx_op3f,
+
+  bfx_op40, bfx_op41, bfx_op42, bfx_op43,
+  bfx_op44, bfx_op45, bfx_op46, bfx_op47,
+  bfx_op48, bfx_op49, bfx_op4a, bfx_op4b,
+  bfx_op4c, bfx_op4d, bfx_op4e, bfx_op4f,
+
+  bfx_op50, bfx_op51, bfx_op52, bfx_op53,
+  bfx_op54, bfx_op55, bfx_op56, bfx_op57,
+  bfx_op58, bfx_op59, bfx_op5a, bfx_op5b,
+  bfx_op5c, bfx_op5d, bfx_op5e, bfx_op5f,
+
+  bfx_op60, bfx_op61, bfx_op62, bfx_op63,
+  bfx_op64, bfx_op65, bfx_op66, bfx_op67,
+  bfx_op68, bfx_op69, bfx_op6a, bfx_op6b,
+  bfx_op6c, bfx_op6d, bfx_op6e, bfx_op6f,
 
   bfx_op70, bfx_op71, bfx_op72, bfx_op73,
   bfx_op74, bfx_op75, bfx_op76, bfx_op77,
   bfx_op78, bfx_op79, bfx_op7a, bfx_op7b,
-  bfx_op7c, bfx_op7d, bfx_op7e, bfx_op7f
+  bfx_op7c, bfx_op7d, bfx_op7e, bfx_op7f,
+
+  bfx_op80, bfx_op81
+
+  /* NULL ... */
+};
+
+const char *bfx_opnames[BFX_BANK_SIZE] = {
+/* CONTROL */
+/* NUL     SOH     STX     ETX     EOT     ENQ     ACK     BEL */
+  "OP00", "OP01", "OP02", "OP03", "OP04", "OP05", "OP06", "OP07",
+/* BS      TAB     LF      VT      FF      CR      SO      SI  */
+  "OP08", "OP09", "OP0A", "OP0B", "OP0C", "OP0D", "OP0E", "OP0F",
+
+/* DLE     DC1     DC2     DC3     DC4     NAK     SYN     ETB */
+  "OP10", "OP11", "OP12", "OP13", "OP14", "OP15", "OP16", "OP17",
+/* CAN     EM      SUB     ESC     FS      GS      RS      US  */
+  "OP18", "OP19", "OP1A", "OP1B", "OP1C", "OP1D", "OP1E", "OP1F",
+
+/* PRINTABLE */
+/*         !       "       #       $       %       &       '   */
+  "SKIP", "NOT" , "STR" , "HOP" , "POP" , "MOD",  "GETX", "OVER",
+/* (       )       *       +       ,       -       .       /   */
+  "PSHF", "POPF", "MUL" , "ADD" , "PUTC", "SUB",  "PUTX", "DIV" ,
+
+/* 0       1       2       3       4       5       6       7   */
+  "V0"  , "V1"  , "V2"  , "V3"  , "V4"  , "V5"  , "V6"  , "V7"  ,
+/* 8       9       :       ;       <       =       >       ?   */
+  "V8"  , "V9"  , "DUP" , "COM" , "MVW" , "EQ"  , "MVE" , "AWAY",
+
+/* @       A       B       C       D       E       F       G   */
+  "REP" , "PRVP", "REV" , "CALL", "DICE", "EOF" , "FUNC", "GETP",
+/* H       I       J       K       L       M       N       O   */
+  "HOME", "FIN" , "JMP" , "DUPF", "LEND", "CLRS", "CLRF", "FOUT",
+
+/* P       Q       R       S       T       U       V       W   */
+  "LOAD", "QUIT", "RET" , "SETP", "TMAJ", "CURP", "NXTP", "WRAP",
+/* X       Y       Z       [       \       ]       ^       _   */
+  "EXEP", "CLRR", "RAND", "TRNL", "SWP" , "TRNR", "MVN" , "WEIF",
+
+/* `       a       b       c       d       e       f       g   */
+  "GT"  , "VA"  , "VB"  , "VC"  , "VD"  , "VE"  , "VF"  , "GETR",
+/* h       i       j       k       l       m       n       o   */
+  "BMPN", "GETS", "JREL", "ITER", "LOOP", "NIF" , "ENDL", "PUTS",
+
+/* p       q       r       s       t       u       v       w    */
+  "SWPR", "EXIT", "REVS", "SETR", "TMIN", "JOIN", "MVS" , "SIF" ,
+/* x       y       z       {       |       }       ~       DEL  */
+  "EXEC", "BMPS", "WAIT", "BLK" , "NSIF", "BEND", "GETC", "NOP" ,
+
+/* EXTENDED */
+  "SPLT", "KILL", "OP82", "OP83", "OP84", "OP85", "OP86", "OP87",
+  "OP88", "OP89", "OP8A", "OP8B", "OP8C", "OP8D", "OP8E", "OP8F",
+
+  "OP90", "OP91", "OP92", "OP93", "OP94", "OP95", "OP96", "OP97",
+  "OP98", "OP99", "OP9A", "OP9B", "OP9C", "OP9D", "OP9E", "OP9F",
+
+  "OPA0", "OPA1", "OPA2", "OPA3", "OPA4", "OPA5", "OPA6", "OPA7",
+  "OPA8", "OPA9", "OPAA", "OPAB", "OPAC", "OPAD", "OPAE", "OPAF",
+
+  "OPB0", "OPB1", "OPB2", "OPB3", "OPB4", "OPB5", "OPB6", "OPB7",
+  "OPB8", "OPB9", "OPBA", "OPBB", "OPBC", "OPBD", "OPBE", "OPBF",
+
+  "OPC0", "OPC1", "OPC2", "OPC3", "OPC4", "OPC5", "OPC6", "OPC7",
+  "OPC8", "OPC9", "OPCA", "OPCB", "OPCC", "OPCD", "OPCE", "OPCF",
+
+  "OPD0", "OPD1", "OPD2", "OPD3", "OPD4", "OPD5", "OPD6", "OPD7",
+  "OPD8", "OPD9", "OPDA", "OPDB", "OPDC", "OPDD", "OPDE", "OPDF",
+
+  "OPE0", "OPE1", "OPE2", "OPE3", "OPE4", "OPE5", "OPE6", "OPE7",
+  "OPE8", "OPE9", "OPEA", "OPEB", "OPEC", "OPED", "OPEE", "OPEF",
+
+  "OPF0", "OPF1", "OPF2", "OPF3", "OPF4", "OPF5", "OPF6", "OPF7",
+  "OPF8", "OPF9", "OPFA", "OPFB", "OPFC", "OPFD", "OPFE", "OPFF"
+};
+
+#ifndef LIBBEFLUX
+/**
+ * \brief Counts the online processors, for sizing thread pools.
+ */
+static size_t bfx_main_cpus(void) {
+#ifdef _SC_NPROCESSORS_ONLN
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? (size_t) cpus : 1;
+#else
+  return 1;
+#endif
+}
+
+/**
+ * \brief Copies a program name from the command line, without the .bfx
+ *        extension that bfx_load adds.
+ */
+static void bfx_main_program(char *dst, size_t size, const char *arg) {
+  size_t len = strlen(arg);
+  if (len > 4 && strcmp(arg + len - 4, ".bfx") == 0)
+    len -= 4;
+  if (len >= size)
+    len = size - 1;
+  memcpy(dst, arg, len);
+  dst[len] = '\0';
+}
+
+/*******************************************************************************
+ * Batch Mode
+ */
+typedef struct bfx_batch {
+  char program[BFX_BANK_SIZE];
+  const char *inputs;
+  const char *outputs;
+  bfx_word *image;
+
+  char **names;
+  size_t count;
+  size_t next;
+
+  size_t lanes;
+
+  size_t ticks;
+  size_t nonzero;
+  size_t lockstep;
+#ifdef BFX_THREADS
+  pthread_mutex_t lock;
+#endif
+} bfx_batch;
+
+/**
+ * \brief Orders input names for qsort.
+ */
+static int bfx_batch_compare(const void *a, const void *b) {
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/**
+ * \brief Collects the regular files in the input directory, skipping hidden
+ *        files and previous outputs.
+ * \return 1 if the directory was read, 0 if it could not be opened and -1
+ *         if memory ran out. Names collected so far are freed on failure.
+ */
+static int bfx_batch_scan(bfx_batch *batch) {
+  size_t capacity = 0;
+  int full = 0;
+  struct dirent *entry;
+  DIR *dir = opendir(batch->inputs);
+
+  if (dir == NULL)
+    return 0;
+
+  while (!full && (entry = readdir(dir)) != NULL) {
+    char path[FILENAME_MAX];
+    struct stat st;
+    size_t len = strlen(entry->d_name);
+
+    if (entry->d_name[0] == '.')
+      continue;
+    if (len > 4 && strcmp(entry->d_name + len - 4, ".out") == 0)
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", batch->inputs, entry->d_name);
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+      continue;
+
+    if (batch->count == capacity) {
+      size_t grown = capacity ? 2 * capacity : 64;
+      char **names = realloc(batch->names, grown * sizeof(char *));
+      if (names == NULL) {
+        full = 1;
+        break;
+      }
+      batch->names = names;
+      capacity = grown;
+    }
+    batch->names[batch->count] = malloc(len + 1);
+    if (batch->names[batch->count] == NULL) {
+      full = 1;
+      break;
+    }
+    memcpy(batch->names[batch->count++], entry->d_name, len + 1);
+  }
+  closedir(dir);
+
+  if (full) {
+    while (batch->count)
+      free(batch->names[--batch->count]);
+    free(batch->names);
+    batch->names = NULL;
+    return -1;
+  }
+
+  qsort(batch->names, batch->count, sizeof(char *), bfx_batch_compare);
+  return 1;
+}
+
+/**
+ * \brief Claims the next input for a worker.
+ * \return The input's index, or the input count once all are claimed.
+ */
+static size_t bfx_batch_claim(bfx_batch *batch) {
+  size_t i;
+#ifdef BFX_THREADS
+  pthread_mutex_lock(&batch->lock);
+#endif
+  i = batch->next < batch->count ? batch->next++ : batch->count;
+#ifdef BFX_THREADS
+  pthread_mutex_unlock(&batch->lock);
+#endif
+  return i;
+}
+
+/**
+ * \brief Opens a claimed input and its output, and readies an
+ *        interpreter to run it.
+ * \return Nonzero if both files could be opened.
+ */
+static int bfx_batch_open(bfx_batch *batch, beflux *b, size_t i) {
+  char path[FILENAME_MAX];
+  FILE *fin, *fout;
+
+  snprintf(path, sizeof(path), "%s/%s", batch->inputs, batch->names[i]);
+  fin = fopen(path, "r");
+  snprintf(path, sizeof(path), "%s/%s.out", batch->outputs, batch->names[i]);
+  fout = fin != NULL ? fopen(path, "w") : NULL;
+  if (fout == NULL) {
+    fprintf(stderr, "Failed to open \"%s\"\n", path);
+    if (fin != NULL)
+      fclose(fin);
+    return 0;
+  }
+
+  bfx_reset(b);
+#ifdef BFX_SPARSE
+  bfx_load(b, 0, batch->program); /* Sparse programs may exceed the image */
+#else
+  bfx_read(b, 0, batch->image, BFX_PROGRAM_SIZE);
+#endif
+  b->in = fin;
+  b->out = fout;
+  return 1;
+}
+
+/**
+ * \brief Closes a finished job's files.
+ */
+static void bfx_batch_close(beflux *b) {
+  fclose(b->in);
+  fclose(b->out);
+  b->in = stdin;
+  b->out = stdout;
+}
+
+/**
+ * \brief Runs inputs through one interpreter, resetting it between jobs,
+ *        until none are left. With lanes, claims that many inputs at a
+ *        time and runs them as an ensemble, or one at a time if the
+ *        ensemble cannot be allocated.
+ */
+static void *bfx_batch_worker(void *arg) {
+  bfx_batch *batch = (bfx_batch *) arg;
+  size_t ticks = 0, nonzero = 0, lockstep = 0, i;
+  bfx_ensemble *e = batch->lanes > 1 ? bfx_ensemble_new(batch->lanes) : NULL;
+
+  if (e != NULL) {
+    size_t used;
+
+    do {
+      used = 0;
+      while (used < batch->lanes && (i = bfx_batch_claim(batch)) < batch->count) {
+        if (bfx_batch_open(batch, bfx_ensemble_lane(e, used), i))
+          ++used;
+        else
+          ++nonzero;
+      }
+      lockstep += bfx_ensemble_run(e, used);
+      for (i = 0; i < used; ++i) {
+        beflux *b = bfx_ensemble_lane(e, i);
+        nonzero += b->status != 0;
+        ticks += b->tick;
+        bfx_batch_close(b);
+      }
+    } while (used == batch->lanes);
+    bfx_ensemble_del(e);
+  }
+  else {
+    beflux *b = bfx_new();
+
+    while ((i = bfx_batch_claim(batch)) < batch->count) {
+      if (!bfx_batch_open(batch, b, i)) {
+        ++nonzero;
+        continue;
+      }
+      nonzero += bfx_run(b) != 0;
+      ticks += b->tick;
+      bfx_batch_close(b);
+    }
+    bfx_del(b);
+  }
+
+#ifdef BFX_THREADS
+  pthread_mutex_lock(&batch->lock);
+#endif
+  batch->ticks += ticks;
+  batch->nonzero += nonzero;
+  batch->lockstep += lockstep;
+#ifdef BFX_THREADS
+  pthread_mutex_unlock(&batch->lock);
+#endif
+  return NULL;
+}
+
+/**
+ * \brief Runs one program over every file in a directory, writing each
+ *        file's output to <name>.out, and prints a throughput summary.
+ *        Usage: beflux --batch prog --inputs dir [--outputs dir] [--jobs N]
+ *                      [--lanes N]
+ * \return The process exit status.
+ */
+static int bfx_batch_main(int argc, char **argv) {
+  bfx_batch batch;
+  size_t jobs = 0, i;
+  double start, elapsed;
+  beflux *b;
+
+  memset(&batch, 0, sizeof(batch));
+  for (i = 1; i < (size_t) argc; ++i) {
+    const char *value = i + 1 < (size_t) argc ? argv[i + 1] : NULL;
+    if (value == NULL) {
+      break;
+    }
+    else if (strcmp(argv[i], "--batch") == 0) {
+      bfx_main_program(batch.program, sizeof(batch.program), value);
+    }
+    else if (strcmp(argv[i], "--inputs") == 0) {
+      batch.inputs = value;
+    }
+    else if (strcmp(argv[i], "--outputs") == 0) {
+      batch.outputs = value;
+    }
+    else if (strcmp(argv[i], "--jobs") == 0) {
+      jobs = (size_t) atol(value);
+    }
+    else if (strcmp(argv[i], "--lanes") == 0) {
+      batch.lanes = (size_t) atol(value);
+    }
+    else {
+      break;
+    }
+    ++i;
+  }
+  if (i < (size_t) argc || !batch.program[0] || batch.inputs == NULL) {
+    fprintf(
+      stderr,
+      "Usage: beflux --batch program.bfx --inputs dir "
+      "[--outputs dir] [--jobs N] [--lanes N]\n"
+    );
+    return 1;
+  }
+  if (batch.outputs == NULL)
+    batch.outputs = batch.inputs;
+
+  if (jobs == 0)
+    jobs = bfx_main_cpus();
+#ifndef BFX_THREADS
+  jobs = 1;
+#endif
+
+  /* Load the program once; every job starts from a copy of this image. */
+  b = bfx_new();
+  bfx_load(b, 0, batch.program);
+  if (b->status) {
+    bfx_del(b);
+    return 1;
+  }
+  batch.image = malloc(BFX_PROGRAM_SIZE * sizeof(bfx_word));
+  if (batch.image == NULL) {
+    fprintf(stderr, "Out of memory.\n");
+    bfx_del(b);
+    return 1;
+  }
+  bfx_write(b, 0, batch.image, BFX_PROGRAM_SIZE);
+  bfx_del(b);
+
+  switch (bfx_batch_scan(&batch)) {
+  case 0:
+    fprintf(stderr, "Failed to read input directory \"%s\"\n", batch.inputs);
+    free(batch.image);
+    return 1;
+  case -1:
+    fprintf(stderr, "Out of memory.\n");
+    free(batch.image);
+    return 1;
+  }
+  if (jobs > batch.count && batch.count)
+    jobs = batch.count;
+
+  start = bfx_clock();
+#ifdef BFX_THREADS
+  if (jobs > 1) {
+    pthread_t *threads = malloc(jobs * sizeof(pthread_t));
+    size_t started = 0;
+
+    pthread_mutex_init(&batch.lock, NULL);
+    for (i = 0; i < jobs; ++i) {
+      started += pthread_create(threads + started, NULL, bfx_batch_worker, &batch) == 0;
+    }
+    if (started == 0)
+      bfx_batch_worker(&batch);
+    for (i = 0; i < started; ++i) {
+      pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&batch.lock);
+    free(threads);
+    jobs = started ? started : 1;
+  }
+  else
+#endif
+  {
+#ifdef BFX_THREADS
+    pthread_mutex_init(&batch.lock, NULL);
+#endif
+    bfx_batch_worker(&batch);
+#ifdef BFX_THREADS
+    pthread_mutex_destroy(&batch.lock);
+#endif
+  }
+  elapsed = bfx_clock() - start;
+  if (elapsed <= 0)
+    elapsed = 1e-9;
+
+  printf(
+    ":: BEFLUX BATCH ::\n"
+    "%zu files, %zu jobs, %.3f s\n"
+    "%.1f files/s, %.4g ticks/s, %zu nonzero exits\n",
+    batch.count, jobs, elapsed,
+    batch.count / elapsed, batch.ticks / elapsed, batch.nonzero
+  );
+  if (batch.lanes > 1 && batch.ticks)
+    printf("%.1f%% of ticks in lockstep\n", 100.0 * batch.lockstep / batch.ticks);
+
+  for (i = 0; i < batch.count; ++i) {
+    free(batch.names[i]);
+  }
+  free(batch.names);
+  free(batch.image);
+  return batch.nonzero != 0;
+}
+
+/*******************************************************************************
+ * Pipe Mode
+ */
+/**
+ * \brief Runs programs as the stages of a pipeline, from stdin to stdout,
+ *        each reading the output of the one before it.
+ *        Usage: beflux --pipe a.bfx b.bfx ...
+ * \return The first nonzero exit status among the stages.
+ */
+static int bfx_pipe_main(int argc, char **argv) {
+  bfx_pipeline *p;
+  bfx_word status;
+  size_t i;
+
+  if (argc < 3) {
+    fprintf(stderr, "Usage: beflux --pipe a.bfx b.bfx ...\n");
+    return 1;
+  }
+  p = bfx_pipeline_new((size_t) argc - 2, 0);
+  if (p == NULL) {
+    fprintf(stderr, "Pipe mode is not available in this build.\n");
+    return 1;
+  }
+
+  for (i = 2; i < (size_t) argc; ++i) {
+    beflux *b = bfx_pipeline_stage(p, i - 2);
+    char program[BFX_BANK_SIZE];
+    bfx_main_program(program, sizeof(program), argv[i]);
+    bfx_load(b, 0, program);
+    if (b->status) {
+      bfx_pipeline_del(p);
+      return 1;
+    }
+  }
+  status = bfx_pipeline_run(p);
+  bfx_pipeline_del(p);
+  return status;
+}
+
+/*******************************************************************************
+ * Watch Mode
+ */
+#if defined(BFX_WATCH) && defined(BFX_THREADS)
+typedef struct bfx_watch_thread {
+  bfx_watcher *watcher;
+  volatile int stopping;
+} bfx_watch_thread;
+
+/**
+ * \brief Waits for file events and hands them to the watcher, until the
+ *        program ends.
+ */
+static void *bfx_watch_thread_main(void *arg) {
+  bfx_watch_thread *t = (bfx_watch_thread *) arg;
+  struct pollfd pfd;
+
+  pfd.fd = bfx_watcher_fd(t->watcher);
+  pfd.events = POLLIN;
+  while (!__atomic_load_n(&t->stopping, __ATOMIC_ACQUIRE)) {
+    if (poll(&pfd, 1, 100) > 0) {
+      size_t rows = bfx_watcher_poll(t->watcher);
+      if (rows)
+        fprintf(stderr, "Reloaded %zu row%s.\n", rows, rows == 1 ? "" : "s");
+    }
+  }
+  return NULL;
+}
+#endif
+
+/**
+ * \brief Runs a program, reloading changed rows of it, and of programs it
+ *        loads with 'P', while it runs.
+ *        Usage: beflux --watch program.bfx
+ * \return The program's exit status.
+ */
+static int bfx_watch_main(int argc, char **argv) {
+#if defined(BFX_WATCH) && defined(BFX_THREADS)
+  char program[BFX_BANK_SIZE];
+  bfx_watch_thread t;
+  pthread_t thread;
+  beflux *b;
+  int status;
+
+  if (argc != 3) {
+    fprintf(stderr, "Usage: beflux --watch program.bfx\n");
+    return 1;
+  }
+  t.watcher = bfx_watcher_new();
+  t.stopping = 0;
+  if (t.watcher == NULL) {
+    fprintf(stderr, "Failed to watch for changes.\n");
+    return 1;
+  }
+
+  b = bfx_new();
+  bfx_watcher_attach(t.watcher, b);
+  bfx_main_program(program, sizeof(program), argv[2]);
+  bfx_load(b, 0, program);
+  if (pthread_create(&thread, NULL, bfx_watch_thread_main, &t) != 0) {
+    fprintf(stderr, "Failed to watch for changes.\n");
+    bfx_del(b);
+    bfx_watcher_del(t.watcher);
+    return 1;
+  }
+
+  status = bfx_run(b);
+  __atomic_store_n(&t.stopping, 1, __ATOMIC_RELEASE);
+  pthread_join(thread, NULL);
+  bfx_del(b);
+  bfx_watcher_del(t.watcher);
+  return status;
+#else
+  (void) argc;
+  (void) argv;
+  fprintf(stderr, "Watch mode is not available in this build.\n");
+  return 1;
+#endif
+}
+
+/*******************************************************************************
+ * Analyze Mode
+ *
+ * Reports what bfx_analyze finds in a program, keeping the analysis in a
+ * .bfa file beside it for as long as the program is unchanged.
+ */
+
+/**
+ * \brief Prints the program with every cell that can never run shown as a
+ *        dot.
+ */
+static void bfx_analyze_map(beflux *b, const bfx_analysis *a) {
+  size_t rows, cols, row, col;
+  char *line;
+
+#ifdef BFX_SPARSE
+  bfx_grid_extent(b->grid, 0, &rows, &cols);
+#else
+  rows = BFX_PROGRAM_HEIGHT;
+  cols = BFX_PROGRAM_WIDTH;
+#endif
+  line = (char *) malloc(cols ? cols : 1);
+  if (line == NULL)
+    return;
+  while (rows && bfx_save_row(b, 0, rows - 1, cols, line) == 0) {
+    --rows;
+  }
+  for (row = 0; row < rows; ++row) {
+    size_t len = bfx_save_row(b, 0, row, cols, line);
+    for (col = 0; col < len; ++col) {
+      if (line[col] != ' ' && !bfx_analysis_dirs(a, (bfx_word) row, (bfx_word) col))
+        line[col] = '.';
+    }
+    fwrite(line, 1, len, stdout);
+    fputc('\n', stdout);
+  }
+  free(line);
+}
+
+/**
+ * \brief Analyzes a program and prints what can run in it.
+ *        Usage: beflux --analyze [--map] program.bfx
+ * \return Zero on success.
+ */
+static int bfx_analyze_main(int argc, char **argv) {
+  char program[BFX_BANK_SIZE];
+  bfx_analysis *a;
+  beflux *b;
+  size_t i, fixed = 0;
+  int map = argc == 4 && strcmp(argv[2], "--map") == 0, cached = 1;
+
+  if (argc != 3 + map) {
+    fprintf(stderr, "Usage: beflux --analyze [--map] program.bfx\n");
+    return 1;
+  }
+  b = bfx_new();
+  bfx_main_program(program, sizeof(program), argv[2 + map]);
+  bfx_load(b, 0, program);
+  if (b->status != 0) {
+    bfx_del(b);
+    return 1;
+  }
+
+  a = bfx_analysis_load(b, 0, program);
+  if (a == NULL) {
+    cached = 0;
+    a = bfx_analyze(b, 0);
+    if (a == NULL) {
+      fprintf(stderr, "Out of memory.\n");
+      bfx_del(b);
+      return 1;
+    }
+    if (!bfx_analysis_save(a, program))
+      fprintf(stderr, "Failed to write analysis to \"%s.bfa\"\n", program);
+  }
+
+  for (i = 0; i < a->count; ++i) {
+    fixed += a->states[i].depth >= 0;
+  }
+  printf(
+    "states:     %lu over %lu cells%s%s\n"
+    "depth:      fixed at %lu states, at most %d; %lu may under- or overflow\n"
+    "writes:     %s\n"
+    "dynamic:    %lu (the next state comes from the stack, or another program)\n"
+    "ops:       ",
+    (unsigned long) a->count, (unsigned long) a->cells, cached ? ", cached" : "",
+    a->truncated ? ", gave up" : "", (unsigned long) fixed, a->max_depth,
+    (unsigned long) a->unproven,
+    a->self_modifies ? "can modify programs" : "none", (unsigned long) a->dynamic
+  );
+  for (i = 0; i < BFX_BANK_SIZE; ++i) {
+    if (a->ops[i] && i > 0x20 && i < 0x7f)
+      printf(" %c", (int) i);
+    else if (a->ops[i])
+      printf(" %s", BFX_OP_NAME(i));
+  }
+  printf("\n");
+  if (map)
+    bfx_analyze_map(b, a);
+
+  bfx_analysis_del(a);
+  bfx_del(b);
+  return 0;
+}
+
+/*******************************************************************************
+ * Emit Mode
+ *
+ * Translates program 0 to C ahead of time. Each state bfx_analyze finds
+ * the IP can reach becomes a label in a run_batch function, so that a
+ * tick is a few stores, the op, and a goto. Branches pop and pick one of two
+ * labels. Ops whose target depends on the stack, such as 'J', 'R' or 'x',
+ * look the new IP up in a table of states, and anything that was not
+ * compiled goes through bfx_eval until a jump lands on a compiled state
+ * again. A write to program 0 drops the translation for the rest of the run.
+ */
+#define BFX_EMIT_WRITE "AHPSVW"
+
+typedef struct bfx_emit {
+  beflux *bfx;
+  FILE *out;
+  bfx_analysis *a; /* The states to compile */
+  int checked;     /* Check the stack where the analysis can't prove it */
+} bfx_emit;
+
+/**
+ * \brief Works out where the IP goes after the op under a state.
+ * \param op The op for bfx_walk_move, or zero for ops that leave the IP
+ *        alone.
+ * \param mode The mode after the op.
+ * \return Zero if the op errs there.
+ */
+static int bfx_emit_next(
+  bfx_emit *e, const bfx_reach *s, bfx_word op, int cond, bfx_word mode, bfx_reach *next
+) {
+  *next = *s;
+  next->mode = (uint8_t) mode;
+  return bfx_walk_move(e->bfx, 0, next, op, cond);
+}
+
+/**
+ * \brief Writes a jump to a state, or out to bfx_eval if the analysis
+ *        did not reach it.
+ */
+static void bfx_emit_goto(bfx_emit *e, const char *indent, const bfx_reach *s) {
+  long i = bfx_analysis_find(e->a, s);
+  if (i >= 0) {
+    fprintf(e->out, "%sgoto s%ld;\n", indent, i);
+  }
+  else {
+    fprintf(
+      e->out,
+      "%s{ BFX_C_IP(%lu, %lu, 0x%02x, 0); bfx->mode = %u; goto interpret; }\n",
+      indent, (unsigned long) s->row, (unsigned long) s->col, s->dir, (unsigned) s->mode
+    );
+  }
+}
+
+/**
+ * \brief The C for an op that only touches the stack, or NULL to call
+ *        the library's op.
+ */
+static const char *bfx_emit_inline(bfx_word op) {
+  switch (op) {
+    case '!': return "bfx_c_push(bfx, bfx_c_pop(bfx) == 0);";
+    case '$': return "bfx_c_pop(bfx);";
+    case '*': return "bfx_c_push(bfx, bfx_c_pop(bfx) * bfx_c_pop(bfx));";
+    case '+': return "bfx_c_push(bfx, bfx_c_pop(bfx) + bfx_c_pop(bfx));";
+    case '-': return "word = bfx_c_pop(bfx);\n  bfx_c_push(bfx, bfx_c_pop(bfx) - word);";
+    case ':': return "bfx_c_push(bfx, bfx_c_peek(bfx, 0));";
+    case '=': return "bfx_c_push(bfx, bfx_c_pop(bfx) == bfx_c_pop(bfx));";
+    case '\\':
+      return "word = bfx_c_pop(bfx);\n  other = bfx_c_pop(bfx);\n"
+        "  bfx_c_push(bfx, word);\n  bfx_c_push(bfx, other);";
+    default: return NULL;
+  }
+}
+
+/**
+ * \brief Writes the call the generated code makes for an op.
+ */
+static void bfx_emit_call(bfx_emit *e, bfx_word op) {
+  if (op >= 0x20 && op <= 0x81)
+    fprintf(e->out, "  BFX_C_CALL(bfx_op%02x);\n", (unsigned) op);
+  else
+    fprintf(e->out, "  BFX_C_EVAL(0x%lx);\n", (unsigned long) op);
+}
+
+/**
+ * \brief Writes the label and code for one state, adding the states it
+ *        leads to.
+ */
+static void bfx_emit_code(bfx_emit *e, size_t i) {
+  static const char *modes[] = {"", "NORMAL", "STRING", "STRING_ESC"};
+  bfx_reach s = e->a->states[i], next, other;
+  bfx_word op = bfx_program_get(e->bfx, 0, s.row, s.col);
+  int c = op > 0 && op < 0x80 ? (int) op : 0;
+
+  fprintf(
+    e->out, "s%lu: /* %lu,%lu %c %s */\n  BFX_C_ENTER(%lu, %lu, 0x%02x, 0);\n",
+    (unsigned long) i, (unsigned long) s.row, (unsigned long) s.col,
+    "ENWS"[s.dir >> 6], s.mode == BFX_MODE_NORMAL ? BFX_OP_NAME(op) : "STR",
+    (unsigned long) s.row, (unsigned long) s.col, s.dir
+  );
+  if (e->checked && !bfx_reach_proven(e->bfx, 0, &s))
+    fprintf(e->out, "  BFX_C_NEED(0x%lx);\n", (unsigned long) op);
+
+  if (s.mode == BFX_MODE_STRING) {
+    bfx_word mode = BFX_MODE_STRING;
+    if (op == '"')
+      mode = BFX_MODE_NORMAL;
+    else if (op == '\\')
+      mode = BFX_MODE_STRING_ESC;
+    else
+      fprintf(e->out, "  bfx_c_push(bfx, 0x%lx);\n", (unsigned long) op);
+    if (mode != BFX_MODE_STRING)
+      fprintf(e->out, "  bfx->mode = BFX_MODE_%s;\n", modes[mode]);
+    bfx_emit_next(e, &s, 0, 0, mode, &next);
+    bfx_emit_goto(e, "  ", &next);
+    return;
+  }
+  if (s.mode == BFX_MODE_STRING_ESC) {
+    const char *escapes = "a\ab\bf\fn\nr\rt\tv\v", *x = c ? strchr(escapes, c) : NULL;
+    bfx_word value = x != NULL && (x - escapes) % 2 == 0 ? (bfx_word) x[1] : op;
+    fprintf(
+      e->out, "  bfx_c_push(bfx, 0x%lx);\n  bfx->mode = BFX_MODE_STRING;\n",
+      (unsigned long) value
+    );
+    bfx_emit_next(e, &s, 0, 0, BFX_MODE_STRING, &next);
+    bfx_emit_goto(e, "  ", &next);
+    return;
+  }
+
+  if (c && strchr(BFX_ANALYSIS_MOVE, c) != NULL) {
+    if (bfx_emit_next(e, &s, op, 0, BFX_MODE_NORMAL, &next)) {
+      if (c == '@')
+        fprintf(e->out, "  ++bfx->t_minor;\n");
+      bfx_emit_goto(e, "  ", &next);
+      return;
+    }
+  }
+  else if (c == '?') {
+    /* The library's op keeps rand() in step with the interpreter. */
+    bfx_emit_next(e, &s, op, 1, BFX_MODE_NORMAL, &next);
+    bfx_emit_next(e, &s, op, 0, BFX_MODE_NORMAL, &other);
+    bfx_emit_call(e, op);
+    fprintf(e->out, "  if (bfx->ip.dir == BFX_IP_W)\n");
+    bfx_emit_goto(e, "    ", &next);
+    bfx_emit_goto(e, "  ", &other);
+    return;
+  }
+  else if (c && strchr(BFX_ANALYSIS_BRANCH, c) != NULL) {
+    if (
+      bfx_emit_next(e, &s, op, 1, BFX_MODE_NORMAL, &next) &&
+      bfx_emit_next(e, &s, op, 0, BFX_MODE_NORMAL, &other)
+    ) {
+      fprintf(e->out, "  if (bfx_c_pop(bfx))\n");
+      bfx_emit_goto(e, "    ", &next);
+      bfx_emit_goto(e, "  ", &other);
+      return;
+    }
+  }
+  else if (c && strchr(BFX_TRACE_EFFECT, c) != NULL) {
+    const char *code = bfx_emit_inline(op);
+    bfx_word mode = c == '"' ? BFX_MODE_STRING : BFX_MODE_NORMAL;
+    if (c == '"') {
+      fprintf(e->out, "  bfx_c_push(bfx, 0);\n  bfx->mode = BFX_MODE_STRING;\n");
+    }
+    else if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')) {
+      fprintf(e->out, "  bfx_c_digit(bfx, %d);\n", c <= '9' ? c - '0' : c - 'a' + 10);
+    }
+    else if (code != NULL) {
+      fprintf(e->out, "  %s\n", code);
+    }
+    else {
+      bfx_emit_call(e, op);
+      fprintf(e->out, "  BFX_C_CHECK(BFX_MODE_NORMAL);\n");
+    }
+    bfx_emit_next(e, &s, 0, 0, mode, &next);
+    bfx_emit_goto(e, "  ", &next);
+    return;
+  }
+  else if (c && strchr(BFX_EMIT_WRITE, c) != NULL) {
+    if (c == 'S')
+      fprintf(e->out, "  word = bfx_c_peek(bfx, 1);\n");
+    bfx_emit_call(e, op);
+    if (c == 'S')
+      fprintf(e->out, "  BFX_C_WROTE(word);\n");
+    else if (c == 'P')
+      fprintf(e->out, "  bfx_c_dirty(bfx);\n");
+    fprintf(e->out, "  BFX_C_LEAVE(BFX_MODE_NORMAL);\n");
+    bfx_emit_next(e, &s, 0, 0, BFX_MODE_NORMAL, &next);
+    bfx_emit_goto(e, "  ", &next);
+    return;
+  }
+
+  /* The stack decides where this goes. */
+  bfx_emit_call(e, op);
+  if (c == 'x' || c == 'F')
+    fprintf(e->out, "  bfx_c_dirty(bfx);\n");
+  fprintf(e->out, "  bfx_ip_advance(bfx);\n  goto dispatch;\n");
+}
+
+/* The helpers every generated file starts with. */
+static const char *bfx_emit_prelude =
+  "#include <string.h>\n"
+  "#include \"beflux.h\"\n"
+  "\n"
+  "#define BFX_C_STACK(bfx) \\\n"
+  "  ((bfx)->frames + ((bfx)->current_frame & (BFX_BANK_SIZE - 1)))\n"
+  "\n"
+  "/* Moves the IP to a state, ending the batch there if it is used up. */\n"
+  "#define BFX_C_IP(r, c, d, w) \\\n"
+  "  (bfx->ip.row = (r), bfx->ip.col = (c), bfx->ip.dir = (d), bfx->ip.wait = (w))\n"
+  "#define BFX_C_ENTER(r, c, d, w) \\\n"
+  "  BFX_C_IP(r, c, d, w); \\\n"
+  "  if (!batch) goto done; \\\n"
+  "  --batch; \\\n"
+  "  ++ticks\n"
+  "\n"
+  "/* Library ops can end the batch early, as 'z' does. */\n"
+  "#define BFX_C_CALL(f) (bfx->batch = batch, f(bfx), batch = bfx->batch)\n"
+  "#define BFX_C_EVAL(op) (bfx->batch = batch, bfx_eval(bfx, op), batch = bfx->batch)\n"
+  "#define BFX_C_NEED(op) \\\n"
+  "  if (!bfx_check_stack(bfx, op)) goto done\n"
+  "#define BFX_C_CHECK(m) \\\n"
+  "  if (bfx->mode != (m)) { bfx_ip_advance(bfx); goto done; }\n"
+  "#define BFX_C_LEAVE(m) \\\n"
+  "  if ( \\\n"
+  "    bfx->mode != (m) || bfx->current_program != 0 || bfx->wrap_offset != 0 || \\\n"
+  "    bfx->run_batch != bfx_c_batch \\\n"
+  "  ) { bfx_ip_advance(bfx); goto done; }\n"
+  "#define BFX_C_WROTE(row) \\\n"
+  "  if (bfx_program_dirty(bfx, 0, row)) bfx->run_batch = NULL\n"
+  "\n"
+  "static void bfx_c_batch(beflux *bfx);\n"
+  "static long bfx_c_find(const beflux *bfx);\n"
+  "\n"
+  "static inline void bfx_c_push(beflux *bfx, bfx_word value) {\n"
+  "  bfx_stack *s = BFX_C_STACK(bfx);\n"
+  "  s->data[s->size] = value;\n"
+  "  s->size = (s->size + 1) & (BFX_STACK_SIZE - 1);\n"
+  "}\n"
+  "\n"
+  "static inline bfx_word bfx_c_pop(beflux *bfx) {\n"
+  "  bfx_stack *s = BFX_C_STACK(bfx);\n"
+  "  bfx_word top = (s->size - 1) & (BFX_STACK_SIZE - 1);\n"
+  "  bfx_word value = s->data[top];\n"
+  "  s->data[top] = 0;\n"
+  "  s->size = top;\n"
+  "  return value;\n"
+  "}\n"
+  "\n"
+  "static inline bfx_word bfx_c_peek(beflux *bfx, bfx_word depth) {\n"
+  "  bfx_stack *s = BFX_C_STACK(bfx);\n"
+  "  return s->data[(s->size - 1 - depth) & (BFX_STACK_SIZE - 1)];\n"
+  "}\n"
+  "\n"
+  "static inline void bfx_c_digit(beflux *bfx, bfx_word digit) {\n"
+  "  bfx->value = (bfx_word) (bfx->value << 4 | digit);\n"
+  "  if (bfx->value_width == BFX_WORD_DIGITS - 1) {\n"
+  "    bfx_c_push(bfx, bfx->value);\n"
+  "    bfx->value = 0;\n"
+  "    bfx->value_width = 0;\n"
+  "  }\n"
+  "  else {\n"
+  "    ++bfx->value_width;\n"
+  "  }\n"
+  "}\n"
+  "\n"
+  "/* Drops the translation once program 0 has been written to. */\n"
+  "static void bfx_c_dirty(beflux *bfx) {\n"
+  "  size_t first, end;\n"
+  "  if (bfx_program_dirty_range(bfx, 0, &first, &end))\n"
+  "    bfx->run_batch = NULL;\n"
+  "}\n"
+  "\n"
+  "static void bfx_c_batch(beflux *bfx) {\n"
+  "  size_t batch = bfx->batch, ticks = 0;\n"
+  "  bfx_word op, word, other;\n"
+  "\n"
+  "  (void) word;\n"
+  "  (void) other;\n"
+  "  bfx_c_dirty(bfx);\n"
+  "  goto dispatch;\n"
+  "\n";
+
+/* The lookup and the interpreter fallback at the end of the function. */
+static const char *bfx_emit_interpret =
+  "    default: break;\n"
+  "  }\n"
+  "interpret:\n"
+  "  while (batch && bfx->mode) {\n"
+  "    op = bfx_ip_get_op(bfx);\n"
+  "    --batch;\n"
+  "    ++ticks;\n"
+  "    if (BFX_C_CHECKED && !bfx_check_stack(bfx, op))\n"
+  "      goto done;\n"
+  "    BFX_C_EVAL(op);\n"
+  "    bfx_ip_advance(bfx);\n"
+  "    if (op > 0 && op < 0x80 && strchr(\"FPSx\", op) != NULL)\n"
+  "      bfx_c_dirty(bfx);\n"
+  "    if (op > 0 && op < 0x80 && strchr(\"@CHJRXjx\", op) != NULL)\n"
+  "      goto dispatch;\n"
+  "  }\n"
+  "done:\n"
+  "  bfx->batch = batch;\n"
+  "  bfx->tick += ticks;\n"
+  "}\n"
+  "\n"
+  "typedef struct bfx_c_key {\n"
+  "  bfx_word row;\n"
+  "  bfx_word col;\n"
+  "  bfx_word dir;\n"
+  "  bfx_word wait;\n"
+  "  bfx_word mode;\n"
+  "  long state;\n"
+  "} bfx_c_key;\n"
+  "\n";
+
+/* The binary search over the keys, and main. */
+static const char *bfx_emit_find_code =
+  "};\n"
+  "\n"
+  "static long bfx_c_find(const beflux *bfx) {\n"
+  "  const bfx_c_key k = {\n"
+  "    bfx->ip.row & BFX_C_ROWS, bfx->ip.col & BFX_C_COLS,\n"
+  "    bfx->ip.dir, bfx->ip.wait, bfx->mode, 0\n"
+  "  };\n"
+  "  size_t lo = 0, hi = sizeof(bfx_c_keys) / sizeof(*bfx_c_keys);\n"
+  "  while (lo < hi) {\n"
+  "    size_t mid = lo + (hi - lo) / 2;\n"
+  "    const bfx_c_key *m = bfx_c_keys + mid;\n"
+  "    int cmp =\n"
+  "      m->row != k.row ? (m->row < k.row ? -1 : 1) :\n"
+  "      m->col != k.col ? (m->col < k.col ? -1 : 1) :\n"
+  "      m->dir != k.dir ? (m->dir < k.dir ? -1 : 1) :\n"
+  "      m->wait != k.wait ? (m->wait < k.wait ? -1 : 1) :\n"
+  "      m->mode != k.mode ? (m->mode < k.mode ? -1 : 1) : 0;\n"
+  "    if (cmp == 0)\n"
+  "      return m->state;\n"
+  "    if (cmp < 0)\n"
+  "      lo = mid + 1;\n"
+  "    else\n"
+  "      hi = mid;\n"
+  "  }\n"
+  "  return -1;\n"
+  "}\n"
+  "\n";
+
+/* Loads the program the way bfx_load would, then runs it translated. */
+static const char *bfx_emit_main_code =
+  ";\n"
+  "\n"
+  "int main(void) {\n"
+  "  beflux *bfx = bfx_new();\n"
+  "  FILE *src = tmpfile();\n"
+  "  int status;\n"
+  "\n"
+  "  if (src == NULL) {\n"
+  "    bfx_error(bfx, \"Failed to load program.\");\n"
+  "    status = bfx->status;\n"
+  "    bfx_del(bfx);\n"
+  "    return status;\n"
+  "  }\n"
+  "  fwrite(bfx_c_source, 1, sizeof(bfx_c_source) - 1, src);\n"
+  "  rewind(src);\n"
+  "  bfx_load_stream(bfx, 0, src);\n"
+  "  fclose(src);\n"
+  "  bfx_program_clean(bfx, 0);\n"
+  "  bfx->checked = BFX_C_CHECKED;\n"
+  "  bfx->run_batch_checks = 1;\n"
+  "  bfx->run_batch = bfx_c_batch;\n"
+  "  status = bfx_run(bfx);\n"
+  "  bfx_del(bfx);\n"
+  "  return status;\n"
+  "}\n";
+
+/**
+ * \brief Writes a C translation of the emitter's program 0.
+ * \param name The source file, for the header comment.
+ * \return Zero if out of memory.
+ */
+static int bfx_emit_c(bfx_emit *e, const char *name) {
+  beflux *b = e->bfx;
+  size_t i, rows, cols, row, col;
+  char *line;
+
+  fprintf(
+    e->out,
+    "/* Generated by beflux --emit-c from %s. Build it against a libbeflux\n"
+    " * with the same word width and program storage:\n"
+    " *   cc -O2 -Isrc program.c libbeflux.a -lpthread\n"
+    " */\n"
+    "#if defined(BFX_WORD_BITS) && BFX_WORD_BITS != %d\n"
+    "#error \"Generated for BFX_WORD_BITS=%d\"\n"
+    "#endif\n"
+    "#define BFX_WORD_BITS %d\n"
+    "#define BFX_C_ROWS 0x%lx\n"
+    "#define BFX_C_COLS 0x%lx\n"
+    "#define BFX_C_CHECKED %d\n\n%s",
+    name, BFX_WORD_BITS, BFX_WORD_BITS, BFX_WORD_BITS,
+    (unsigned long) BFX_ANALYSIS_ROWS, (unsigned long) BFX_ANALYSIS_COLS, e->checked,
+    bfx_emit_prelude
+  );
+  for (i = 0; i < e->a->count; ++i) {
+    bfx_emit_code(e, i);
+  }
+
+  fprintf(
+    e->out,
+    "\ndispatch:\n"
+    "  if (!batch || bfx->mode == BFX_MODE_HALT || bfx->mode > BFX_MODE_STRING_ESC)\n"
+    "    goto done;\n"
+    "  if (\n"
+    "    bfx->current_program != 0 || bfx->wrap_offset != 0 ||\n"
+    "    bfx->run_batch != bfx_c_batch\n"
+    "  ) goto interpret;\n"
+    "  switch (bfx_c_find(bfx)) {\n"
+  );
+  for (i = 0; i < e->a->count; ++i) {
+    fprintf(e->out, "    case %lu: goto s%lu;\n", (unsigned long) i, (unsigned long) i);
+  }
+  fputs(bfx_emit_interpret, e->out);
+
+  /* The analysis keeps its states sorted, as the lookup needs. */
+  fprintf(e->out, "static const bfx_c_key bfx_c_keys[] = {\n");
+  for (i = 0; i < e->a->count; ++i) {
+    bfx_reach *s = e->a->states + i;
+    fprintf(
+      e->out, "  {%lu, %lu, 0x%02x, 0, %u, %lu},\n",
+      (unsigned long) s->row, (unsigned long) s->col, s->dir,
+      (unsigned) s->mode, (unsigned long) i
+    );
+  }
+  fputs(bfx_emit_find_code, e->out);
+
+  /* The source again, header line first, for G and the fallback. */
+#ifdef BFX_SPARSE
+  bfx_grid_extent(b->grid, 0, &rows, &cols);
+#else
+  rows = BFX_PROGRAM_HEIGHT;
+  cols = BFX_PROGRAM_WIDTH;
+#endif
+  line = (char *) malloc(cols ? cols : 1);
+  if (line == NULL)
+    return 0;
+  while (rows && bfx_save_row(b, 0, rows - 1, cols, line) == 0) {
+    --rows;
+  }
+  fprintf(e->out, "static const char bfx_c_source[] =\n  \":: beflux --emit-c ::\\n\"");
+  for (row = 0; row < rows; ++row) {
+    size_t len = bfx_save_row(b, 0, row, cols, line);
+    fprintf(e->out, "\n  \"");
+    for (col = 0; col < len; ++col) {
+      unsigned char c = (unsigned char) line[col];
+      if (c < 0x20 || c >= 0x7f || c == '"' || c == '\\' || c == '?')
+        fprintf(e->out, "\\%03o", c);
+      else
+        fputc(c, e->out);
+    }
+    fprintf(e->out, "\\n\"");
+  }
+  free(line);
+  fputs(bfx_emit_main_code, e->out);
+  return 1;
+}
+
+/**
+ * \brief Writes a C translation of a program to stdout, to be built
+ *        against libbeflux.
+ *        Usage: beflux --emit-c [--checked] program.bfx > program.c
+ * \return Zero on success.
+ */
+static int bfx_emit_main(int argc, char **argv) {
+  char program[BFX_BANK_SIZE];
+  bfx_emit e;
+  int ok, checked = argc == 4 && strcmp(argv[2], "--checked") == 0;
+
+  if (argc != 3 + checked) {
+    fprintf(stderr, "Usage: beflux --emit-c [--checked] program.bfx > program.c\n");
+    return 1;
+  }
+  memset(&e, 0, sizeof(e));
+  e.out = stdout;
+  e.checked = checked;
+  e.bfx = bfx_new();
+  bfx_main_program(program, sizeof(program), argv[2 + checked]);
+  bfx_load(e.bfx, 0, program);
+  if (e.bfx->status != 0) {
+    bfx_del(e.bfx);
+    return 1;
+  }
+
+  e.a = bfx_analyze(e.bfx, 0);
+  ok = e.a != NULL && bfx_emit_c(&e, argv[2 + checked]);
+  bfx_analysis_del(e.a);
+  bfx_del(e.bfx);
+  if (!ok) {
+    fprintf(stderr, "Out of memory.\n");
+    return 1;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * Flight Mode
+ *
+ * Prints a dump written by the flight recorder, one entry per line, oldest
+ * first, with the number of ticks each stands for. The header gives the
+ * word size, so this build can read dumps from a build with wider or
+ * narrower words.
+ */
 
-  /* NULL ... */
+/**
+ * \brief Reads an unsigned little-endian value.
+ */
+static unsigned long long bfx_flight_get(const unsigned char *src, size_t bytes) {
+  unsigned long long value = 0;
+  while (bytes--) {
+    value = (value << 8) | src[bytes];
+  }
+  return value;
+}
+
+static int bfx_flight_main(int argc, char **argv) {
+  unsigned char header[12], record[16 + 5 * 8 + 2];
+  unsigned long long count, i, op;
+  size_t word, size, tick;
+  FILE *fin;
+
+  if (argc != 3) {
+    fprintf(stderr, "Usage: beflux --flight program.bfr\n");
+    return 1;
+  }
+  fin = fopen(argv[2], "rb");
+  if (fin == NULL) {
+    fprintf(stderr, "Failed to open \"%s\"\n", argv[2]);
+    return 1;
+  }
+  word = 0;
+  if (fread(header, 1, sizeof(header), fin) == sizeof(header) &&
+      memcmp(header, BFX_FLIGHT_MAGIC, 4) == 0 && header[4] >= 1 &&
+      header[4] <= BFX_FLIGHT_VERSION)
+    word = header[5];
+  if (word == 0 || word > 8) {
+    fprintf(stderr, "\"%s\" is not a flight recording.\n", argv[2]);
+    fclose(fin);
+    return 1;
+  }
+
+  /* Version 1 has no tick counts; each entry is one tick. */
+  count = bfx_flight_get(header + 8, 4);
+  tick = header[4] == 1 ? 8 : 16;
+  size = tick + 5 * word + 2;
+  printf("%llu entries, %lu-bit words\n", count, (unsigned long) word * 8);
+  printf(
+    "%12s %8s %6s %6s %6s dir %-6s %s\n",
+    "tick", "ticks", "prog", "row", "col", "op", "top"
+  );
+  for (i = 0; i < count && fread(record, 1, size, fin) == size; ++i) {
+    op = bfx_flight_get(record + tick + 3 * word, word);
+    printf(
+      "%12llu %8llu %6llu %6llu %6llu  %c  ",
+      bfx_flight_get(record, 8),
+      tick == 8 ? 1 : bfx_flight_get(record + 8, 8),
+      bfx_flight_get(record + tick, word),
+      bfx_flight_get(record + tick + word, word),
+      bfx_flight_get(record + tick + 2 * word, word),
+      ">^<v"[record[size - 2] >> 6]
+    );
+    if (record[size - 1] == BFX_MODE_STRING || record[size - 1] == BFX_MODE_STRING_ESC)
+      printf("%-6s ", "str");
+    else if (op > 0x20 && op < 0x7f)
+      printf("%-6c ", (int) op);
+    else
+      printf("%-6s ", op < BFX_BANK_SIZE ? BFX_OP_NAME(op) : "OP??");
+    printf("%llu\n", bfx_flight_get(record + tick + 4 * word, word));
+  }
+  if (i != count)
+    fprintf(stderr, "\"%s\" ends after %llu entries.\n", argv[2], i);
+  fclose(fin);
+  return i != count;
+}
+
+#ifdef BFX_SERVE
+/*******************************************************************************
+ * Serve Mode
+ *
+ * Requests are a header line, optionally followed by a payload:
+ *
+ *   RUN <program> <fuel> <time limit ms> <input bytes>\n<input>
+ *   IMAGE <source bytes> <fuel> <time limit ms> <input bytes>\n<source><input>
+ *   STATS\n
+ *
+ * A fuel or time limit of 0 means none. RUN loads a program the same way as
+ * bfx_load, through a cache that is checked against the file's size and
+ * mtime, to the nanosecond, while
+ * IMAGE sends the program source itself. Each run is answered with
+ *
+ *   DONE <status> <ticks> <microseconds> <output bytes> <error bytes>\n
+ *
+ * followed by the program's output and error text, and malformed requests
+ * with a single ERROR line before the connection is closed.
+ */
+#define BFX_SERVE_CACHE_SIZE  64
+#define BFX_SERVE_HEADER_MAX  (2 * BFX_BANK_SIZE)
+#define BFX_SERVE_PAYLOAD_MAX ((size_t) 64 << 20)
+#define BFX_SERVE_EVENTS      64
+
+typedef struct bfx_serve bfx_serve;
+typedef struct bfx_serve_client bfx_serve_client;
+
+struct bfx_serve_client {
+  int fd;
+  size_t index;
+  int busy;
+  int closing;
+
+  char *in;
+  size_t in_len;
+  size_t in_cap;
+  char *out;
+  size_t out_len;
+  size_t out_pos;
+
+  /* The request at the front of the input buffer */
+  size_t request_len;
+  char program[BFX_BANK_SIZE];
+  const char *image;
+  size_t image_len;
+  const char *input;
+  size_t input_len;
+  size_t fuel;
+  double time_limit;
+
+  bfx_serve_client *next;
 };
 
-const char *bfx_opnames[BFX_BANK_SIZE] = {
-/* CONTROL */
-/* NUL     SOH     STX     ETX     EOT     ENQ     ACK     BEL */
-  "OP00", "OP01", "OP02", "OP03", "OP04", "OP05", "OP06", "OP07",
-/* BS      TAB     LF      VT      FF      CR      SO      SI  */
-  "OP08", "OP09", "OP0A", "OP0B", "OP0C", "OP0D", "OP0E", "OP0F",
+typedef struct bfx_serve_program {
+  char path[BFX_BANK_SIZE];
+  long size;
+  time_t mtime;
+  long mtime_ns;
+  bfx_word *image;
+} bfx_serve_program;
+
+typedef struct bfx_serve_worker {
+  pthread_t thread;
+  bfx_serve *serve;
+  beflux *bfx;
+  bfx_serve_client *client;
+  double deadline;
+} bfx_serve_worker;
+
+struct bfx_serve {
+  int listen_fd;
+  int epoll_fd;
+  int wake[2];
+  double start;
+
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  bfx_serve_client *jobs;
+  bfx_serve_client *jobs_tail;
+  bfx_serve_client *done;
+  int stopping;
+
+  bfx_serve_worker *workers;
+  size_t worker_count;
+
+  bfx_serve_client **clients;
+  size_t client_count;
+  size_t client_capacity;
+
+  bfx_serve_program cache[BFX_SERVE_CACHE_SIZE];
+  size_t cache_next;
+
+  size_t requests;
+  size_t failures;
+  size_t ticks;
+  size_t hits;
+  size_t misses;
+};
 
-/* DLE     DC1     DC2     DC3     DC4     NAK     SYN     ETB */
-  "OP10", "OP11", "OP12", "OP13", "OP14", "OP15", "OP16", "OP17",
-/* CAN     EM      SUB     ESC     FS      GS      RS      US  */
-  "OP18", "OP19", "OP1A", "OP1B", "OP1C", "OP1D", "OP1E", "OP1F",
+static volatile sig_atomic_t bfx_serve_stop = 0;
 
-/* PRINTABLE */
-/*         !       "       #       $       %       &       '   */
-  "SKIP", "NOT" , "STR" , "HOP" , "POP" , "MOD",  "GETX", "OVER",
-/* (       )       *       +       ,       -       .       /   */
-  "PSHF", "POPF", "MUL" , "ADD" , "PUTC", "SUB",  "PUTX", "DIV" ,
+/**
+ * \brief Signal handler that ends the serve loop.
+ */
+static void bfx_serve_signal(int sig) {
+  (void) sig;
+  bfx_serve_stop = 1;
+}
 
-/* 0       1       2       3       4       5       6       7   */
-  "V0"  , "V1"  , "V2"  , "V3"  , "V4"  , "V5"  , "V6"  , "V7"  ,
-/* 8       9       :       ;       <       =       >       ?   */
-  "V8"  , "V9"  , "DUP" , "COM" , "MVW" , "EQ"  , "MVE" , "AWAY",
+/**
+ * \brief Copies a program into an interpreter from the cache, loading and
+ *        caching it first if it is missing or its file has changed.
+ * \return Nonzero if the program was loaded.
+ */
+static int bfx_serve_cached(bfx_serve *s, beflux *b, const char *program) {
+#ifdef BFX_SPARSE
+  (void) s;
+  bfx_load(b, 0, program); /* Sparse programs may exceed the image */
+  return !b->status;
+#else
+  char filename_ext[BFX_BANK_SIZE + 4];
+  bfx_serve_program *entry = NULL;
+  struct stat st;
+  size_t i;
+  int known;
+
+  snprintf(filename_ext, sizeof(filename_ext), "%s.bfx", program);
+  known = stat(filename_ext, &st) == 0;
+  if (known) {
+    pthread_mutex_lock(&s->lock);
+    for (i = 0; i < BFX_SERVE_CACHE_SIZE; ++i) {
+      if (
+        s->cache[i].image != NULL &&
+        s->cache[i].size == (long) st.st_size &&
+        s->cache[i].mtime == st.st_mtime &&
+        s->cache[i].mtime_ns == st.st_mtim.tv_nsec &&
+        strcmp(s->cache[i].path, program) == 0
+      ) {
+        bfx_read(b, 0, s->cache[i].image, BFX_PROGRAM_SIZE);
+        ++s->hits;
+        pthread_mutex_unlock(&s->lock);
+        return 1;
+      }
+    }
+    ++s->misses;
+    pthread_mutex_unlock(&s->lock);
+  }
 
-/* @       A       B       C       D       E       F       G   */
-  "REP" , "PRVP", "REV" , "CALL", "DICE", "EOF" , "FUNC", "GETP",
-/* H       I       J       K       L       M       N       O   */
-  "HOME", "FIN" , "JMP" , "DUPF", "LEND", "CLRS", "CLRF", "FOUT",
+  bfx_load(b, 0, program);
+  if (b->status)
+    return 0;
+  if (!known)
+    return 1; /* Nothing to check a cached copy against */
 
-/* P       Q       R       S       T       U       V       W   */
-  "LOAD", "QUIT", "RET" , "SETP", "TMAJ", "CURP", "NXTP", "WRAP",
-/* X       Y       Z       [       \       ]       ^       _   */
-  "EXEP", "CLRR", "RAND", "TRNL", "SWP" , "TRNR", "MVN" , "WEIF",
+  pthread_mutex_lock(&s->lock);
+  for (i = 0; i < BFX_SERVE_CACHE_SIZE && entry == NULL; ++i) {
+    if (strcmp(s->cache[i].path, program) == 0)
+      entry = s->cache + i;
+  }
+  if (entry == NULL)
+    entry = s->cache + s->cache_next++ % BFX_SERVE_CACHE_SIZE;
+  if (entry->image == NULL)
+    entry->image = malloc(BFX_PROGRAM_SIZE * sizeof(bfx_word));
+  if (entry->image != NULL) {
+    bfx_write(b, 0, entry->image, BFX_PROGRAM_SIZE);
+    strcpy(entry->path, program);
+    entry->size = (long) st.st_size;
+    entry->mtime = st.st_mtime;
+    entry->mtime_ns = st.st_mtim.tv_nsec;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return 1;
+#endif
+}
 
-/* `       a       b       c       d       e       f       g   */
-  "GT"  , "VA"  , "VB"  , "VC"  , "VD"  , "VE"  , "VF"  , "GETR",
-/* h       i       j       k       l       m       n       o   */
-  "BMPN", "GETS", "JREL", "ITER", "LOOP", "NIF" , "ENDL", "PUTS",
+/**
+ * \brief Runs a client's request on a worker's interpreter and stores the
+ *        response in the client's output buffer.
+ */
+static void bfx_serve_execute(bfx_serve_worker *w, bfx_serve_client *c) {
+  bfx_serve *s = w->serve;
+  beflux *b = w->bfx;
+  char *out = NULL, *err = NULL;
+  size_t out_len = 0, err_len = 0, header;
+  double start = bfx_clock(), usec;
+  FILE *fin, *fout, *ferr;
+  int loaded = 0;
+
+  fin = c->input_len
+    ? fmemopen((char *) c->input, c->input_len, "r")
+    : fopen("/dev/null", "r");
+  fout = open_memstream(&out, &out_len);
+  ferr = open_memstream(&err, &err_len);
+
+  bfx_reset(b);
+  if (fin != NULL && fout != NULL && ferr != NULL) {
+    b->in = fin;
+    b->out = fout;
+    b->err = ferr;
+    b->fuel = c->fuel;
+
+    if (c->image != NULL) {
+      FILE *fsrc = fmemopen((char *) c->image, c->image_len, "r");
+      if (fsrc != NULL) {
+        bfx_load_stream(b, 0, fsrc);
+        fclose(fsrc);
+        loaded = 1;
+      }
+    }
+    else {
+      loaded = bfx_serve_cached(s, b, c->program);
+    }
+    if (loaded)
+      bfx_run(b);
+  }
+  if (fin != NULL)
+    fclose(fin);
+  if (fout != NULL)
+    fclose(fout);
+  if (ferr != NULL)
+    fclose(ferr);
+  b->in = stdin;
+  b->out = stdout;
+  b->err = stderr;
+  usec = (bfx_clock() - start) * 1e6;
+
+  if (fout == NULL || ferr == NULL) {
+    out_len = err_len = 0;
+  }
+  c->out = malloc(BFX_SERVE_HEADER_MAX + out_len + err_len);
+  header = (size_t) snprintf(
+    c->out, BFX_SERVE_HEADER_MAX, "DONE %u %zu %.0f %zu %zu\n",
+    (unsigned) (loaded ? b->status : BFX_WORD_MAX), b->tick, usec,
+    out_len, err_len
+  );
+  memcpy(c->out + header, out, out_len);
+  memcpy(c->out + header + out_len, err, err_len);
+  c->out_len = header + out_len + err_len;
+  c->out_pos = 0;
+  free(out);
+  free(err);
+
+  pthread_mutex_lock(&s->lock);
+  ++s->requests;
+  s->failures += !loaded || b->status != 0;
+  s->ticks += b->tick;
+  pthread_mutex_unlock(&s->lock);
+}
 
-/* p       q       r       s       t       u       v       w    */
-  "SWPR", "EXIT", "REVS", "SETR", "TMIN", "JOIN", "MVS" , "SIF" ,
-/* x       y       z       {       |       }       ~       DEL  */
-  "EXEC", "BMPS", "WAIT", "BLK" , "NSIF", "BEND", "GETC", "NOP" ,
+/**
+ * \brief Wakes the main loop from a worker thread.
+ */
+static void bfx_serve_wake(bfx_serve *s) {
+  if (write(s->wake[1], "", 1) < 0) {
+    /* The pipe is full, so the main loop is already due to wake up. */
+  }
+}
 
-/* EXTENDED */
-  "OP80", "OP81", "OP82", "OP83", "OP84", "OP85", "OP86", "OP87",
-  "OP88", "OP89", "OP8A", "OP8B", "OP8C", "OP8D", "OP8E", "OP8F",
+/**
+ * \brief Worker thread; owns one pre-initialized interpreter and runs
+ *        queued requests on it until the server stops.
+ */
+static void *bfx_serve_worker_main(void *arg) {
+  bfx_serve_worker *w = (bfx_serve_worker *) arg;
+  bfx_serve *s = w->serve;
 
-  "OP90", "OP91", "OP92", "OP93", "OP94", "OP95", "OP96", "OP97",
-  "OP98", "OP99", "OP9A", "OP9B", "OP9C", "OP9D", "OP9E", "OP9F",
+  for (;;) {
+    bfx_serve_client *c;
 
-  "OPA0", "OPA1", "OPA2", "OPA3", "OPA4", "OPA5", "OPA6", "OPA7",
-  "OPA8", "OPA9", "OPAA", "OPAB", "OPAC", "OPAD", "OPAE", "OPAF",
+    pthread_mutex_lock(&s->lock);
+    while (s->jobs == NULL && !s->stopping) {
+      pthread_cond_wait(&s->ready, &s->lock);
+    }
+    if (s->jobs == NULL) {
+      pthread_mutex_unlock(&s->lock);
+      break;
+    }
+    c = s->jobs;
+    s->jobs = c->next;
+    w->client = c;
+    w->deadline = c->time_limit > 0 ? bfx_clock() + c->time_limit : 0;
+    pthread_mutex_unlock(&s->lock);
+    if (w->deadline)
+      bfx_serve_wake(s); /* Let the main loop start timing this run */
+
+    bfx_serve_execute(w, c);
+
+    pthread_mutex_lock(&s->lock);
+    w->client = NULL;
+    w->deadline = 0;
+    c->next = s->done;
+    s->done = c;
+    pthread_mutex_unlock(&s->lock);
+    bfx_serve_wake(s);
+  }
+  return NULL;
+}
 
-  "OPB0", "OPB1", "OPB2", "OPB3", "OPB4", "OPB5", "OPB6", "OPB7",
-  "OPB8", "OPB9", "OPBA", "OPBB", "OPBC", "OPBD", "OPBE", "OPBF",
+/**
+ * \brief Halts runs that have passed their time limit.
+ * \return Milliseconds until the next deadline, or -1 if there is none.
+ */
+static int bfx_serve_deadlines(bfx_serve *s) {
+  double now = bfx_clock(), next = 0;
+  size_t i;
 
-  "OPC0", "OPC1", "OPC2", "OPC3", "OPC4", "OPC5", "OPC6", "OPC7",
-  "OPC8", "OPC9", "OPCA", "OPCB", "OPCC", "OPCD", "OPCE", "OPCF",
+  pthread_mutex_lock(&s->lock);
+  for (i = 0; i < s->worker_count; ++i) {
+    bfx_serve_worker *w = s->workers + i;
+    if (w->client == NULL || w->deadline == 0)
+      continue;
+    if (now >= w->deadline) {
+      bfx_interrupt(w->bfx, BFX_INTERRUPT_HALT);
+      w->deadline = 0;
+    }
+    else if (next == 0 || w->deadline < next) {
+      next = w->deadline;
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+  return next == 0 ? -1 : (int) ((next - now) * 1e3) + 1;
+}
 
-  "OPD0", "OPD1", "OPD2", "OPD3", "OPD4", "OPD5", "OPD6", "OPD7",
-  "OPD8", "OPD9", "OPDA", "OPDB", "OPDC", "OPDD", "OPDE", "OPDF",
+/**
+ * \brief Points epoll at whatever the client is waiting for next.
+ */
+static void bfx_serve_watch(bfx_serve *s, bfx_serve_client *c) {
+  struct epoll_event ev;
+  ev.events = c->busy ? 0 : c->out_len ? EPOLLOUT : EPOLLIN;
+  ev.data.ptr = c;
+  epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+}
 
-  "OPE0", "OPE1", "OPE2", "OPE3", "OPE4", "OPE5", "OPE6", "OPE7",
-  "OPE8", "OPE9", "OPEA", "OPEB", "OPEC", "OPED", "OPEE", "OPEF",
+/**
+ * \brief Disconnects a client and frees it.
+ */
+static void bfx_serve_close(bfx_serve *s, bfx_serve_client *c) {
+  epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  s->clients[c->index] = s->clients[--s->client_count];
+  s->clients[c->index]->index = c->index;
+  free(c->in);
+  free(c->out);
+  free(c);
+}
 
-  "OPF0", "OPF1", "OPF2", "OPF3", "OPF4", "OPF5", "OPF6", "OPF7",
-  "OPF8", "OPF9", "OPFA", "OPFB", "OPFC", "OPFD", "OPFE", "OPFF"
-};
+/**
+ * \brief Drops the request at the front of the client's input buffer.
+ */
+static void bfx_serve_consume(bfx_serve_client *c) {
+  c->in_len -= c->request_len;
+  memmove(c->in, c->in + c->request_len, c->in_len);
+  c->request_len = 0;
+}
+
+/**
+ * \brief Queues a short response that the main thread builds itself.
+ */
+static void bfx_serve_reply(bfx_serve_client *c, const char *text) {
+  c->out_len = strlen(text);
+  c->out_pos = 0;
+  c->out = malloc(c->out_len);
+  memcpy(c->out, text, c->out_len);
+}
+
+/**
+ * \brief Parses the request at the front of a client's input buffer.
+ * \return 1 if it is complete, 0 if more input is needed, or -1 if it is
+ *         malformed.
+ */
+static int bfx_serve_parse(bfx_serve_client *c) {
+  char line[BFX_SERVE_HEADER_MAX];
+  char *end = memchr(c->in, '\n', c->in_len);
+  size_t header, payload;
+  double limit = 0;
+
+  if (end == NULL)
+    return c->in_len < BFX_SERVE_HEADER_MAX ? 0 : -1;
+  header = end - c->in + 1;
+  if (header >= BFX_SERVE_HEADER_MAX)
+    return -1;
+  memcpy(line, c->in, header - 1);
+  line[header - 1] = '\0';
+
+  c->program[0] = '\0';
+  c->image = NULL;
+  c->image_len = 0;
+  c->fuel = 0;
+  c->input_len = 0;
+
+  if (strcmp(line, "STATS") == 0) {
+    c->request_len = header;
+    return 1;
+  }
+  else if (
+    sscanf(
+      line, "RUN %255s %zu %lf %zu",
+      c->program, &c->fuel, &limit, &c->input_len
+    ) == 4
+  ) {
+    size_t len = strlen(c->program);
+    if (len >= BFX_BANK_SIZE - 4)
+      return -1;
+    if (len > 4 && strcmp(c->program + len - 4, ".bfx") == 0)
+      c->program[len - 4] = '\0';
+  }
+  else if (
+    sscanf(
+      line, "IMAGE %zu %zu %lf %zu",
+      &c->image_len, &c->fuel, &limit, &c->input_len
+    ) != 4
+  ) {
+    return -1;
+  }
+
+  payload = c->image_len + c->input_len;
+  if (
+    c->image_len > BFX_SERVE_PAYLOAD_MAX ||
+    c->input_len > BFX_SERVE_PAYLOAD_MAX ||
+    limit < 0
+  ) return -1;
+  if (c->in_len < header + payload)
+    return 0;
+
+  c->request_len = header + payload;
+  c->image = c->program[0] ? NULL : c->in + header;
+  c->input = c->in + header + c->image_len;
+  c->time_limit = limit / 1e3;
+  return 1;
+}
+
+/**
+ * \brief Sends as much of a client's pending response as the socket takes.
+ * \return Zero if the client was closed.
+ */
+static int bfx_serve_flush(bfx_serve *s, bfx_serve_client *c) {
+  while (c->out_pos < c->out_len) {
+    ssize_t n = send(
+      c->fd, c->out + c->out_pos, c->out_len - c->out_pos, MSG_NOSIGNAL
+    );
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return 1;
+    if (n <= 0) {
+      bfx_serve_close(s, c);
+      return 0;
+    }
+    c->out_pos += n;
+  }
+
+  free(c->out);
+  c->out = NULL;
+  c->out_len = c->out_pos = 0;
+  if (c->closing) {
+    bfx_serve_close(s, c);
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * \brief Handles buffered requests until one is handed to a worker, more
+ *        input is needed, or the socket stops taking output.
+ */
+static void bfx_serve_process(bfx_serve *s, bfx_serve_client *c) {
+  while (!c->busy) {
+    int parsed;
+
+    if (c->out_len || c->closing) {
+      if (!bfx_serve_flush(s, c))
+        return;
+      if (c->out_len)
+        break;
+    }
+
+    parsed = bfx_serve_parse(c);
+    if (parsed == 0) {
+      break;
+    }
+    else if (parsed < 0) {
+      bfx_serve_reply(c, "ERROR Malformed request\n");
+      c->closing = 1;
+    }
+    else if (c->image == NULL && c->program[0] == '\0') {
+      char text[BFX_SERVE_HEADER_MAX];
+      pthread_mutex_lock(&s->lock);
+      snprintf(
+        text, sizeof(text),
+        "STATS requests %zu failures %zu ticks %zu cache_hits %zu "
+        "cache_misses %zu workers %zu clients %zu uptime %.3f\n",
+        s->requests, s->failures, s->ticks, s->hits, s->misses,
+        s->worker_count, s->client_count, bfx_clock() - s->start
+      );
+      pthread_mutex_unlock(&s->lock);
+      bfx_serve_consume(c);
+      bfx_serve_reply(c, text);
+    }
+    else {
+      c->busy = 1;
+      c->next = NULL;
+      pthread_mutex_lock(&s->lock);
+      if (s->jobs == NULL)
+        s->jobs = c;
+      else
+        s->jobs_tail->next = c;
+      s->jobs_tail = c;
+      pthread_cond_signal(&s->ready);
+      pthread_mutex_unlock(&s->lock);
+    }
+  }
+  bfx_serve_watch(s, c);
+}
+
+/**
+ * \brief Reads whatever a client has sent.
+ * \return Zero if the client was closed.
+ */
+static int bfx_serve_read(bfx_serve *s, bfx_serve_client *c) {
+  for (;;) {
+    ssize_t n;
+
+    if (c->in_cap - c->in_len < 4096) {
+      c->in_cap = c->in_cap ? 2 * c->in_cap : 8192;
+      c->in = realloc(c->in, c->in_cap);
+    }
+    n = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len, 0);
+    if (n > 0) {
+      c->in_len += n;
+      if (c->in_len > BFX_SERVE_HEADER_MAX + 4 * BFX_SERVE_PAYLOAD_MAX) {
+        bfx_serve_close(s, c);
+        return 0;
+      }
+    }
+    else if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 1;
+    }
+    else {
+      bfx_serve_close(s, c);
+      return 0;
+    }
+  }
+}
+
+/**
+ * \brief Accepts every pending connection.
+ */
+static void bfx_serve_accept(bfx_serve *s) {
+  int fd;
+  while ((fd = accept(s->listen_fd, NULL, NULL)) >= 0) {
+    bfx_serve_client *c = calloc(1, sizeof(bfx_serve_client));
+    struct epoll_event ev;
+
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    c->fd = fd;
+    if (s->client_count == s->client_capacity) {
+      s->client_capacity = s->client_capacity ? 2 * s->client_capacity : 64;
+      s->clients = realloc(s->clients, s->client_capacity * sizeof(*s->clients));
+    }
+    c->index = s->client_count;
+    s->clients[s->client_count++] = c;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+  }
+}
+
+/**
+ * \brief Sends the responses of finished runs and picks up the clients'
+ *        next requests.
+ */
+static void bfx_serve_finish(bfx_serve *s) {
+  bfx_serve_client *c, *next;
+  char drain[256];
+
+  while (read(s->wake[0], drain, sizeof(drain)) > 0);
+
+  pthread_mutex_lock(&s->lock);
+  c = s->done;
+  s->done = NULL;
+  pthread_mutex_unlock(&s->lock);
+
+  for (; c != NULL; c = next) {
+    next = c->next;
+    c->busy = 0;
+    bfx_serve_consume(c);
+    if (c->closing) {
+      bfx_serve_close(s, c);
+    }
+    else {
+      bfx_serve_process(s, c);
+    }
+  }
+}
+
+/**
+ * \brief Serves requests on a Unix socket until interrupted.
+ *        Usage: beflux --serve path [--jobs N]
+ * \return The process exit status.
+ */
+static int bfx_serve_main(int argc, char **argv) {
+  bfx_serve s;
+  struct sockaddr_un addr;
+  struct epoll_event ev, events[BFX_SERVE_EVENTS];
+  const char *path = NULL;
+  size_t jobs = 0, i;
+  int n;
+
+  for (i = 1; i + 1 < (size_t) argc; i += 2) {
+    if (strcmp(argv[i], "--serve") == 0)
+      path = argv[i + 1];
+    else if (strcmp(argv[i], "--jobs") == 0)
+      jobs = (size_t) atol(argv[i + 1]);
+    else
+      break;
+  }
+  if (i < (size_t) argc || path == NULL || strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Usage: beflux --serve socket [--jobs N]\n");
+    return 1;
+  }
+  if (jobs == 0)
+    jobs = bfx_main_cpus();
+
+  memset(&s, 0, sizeof(s));
+  s.start = bfx_clock();
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  s.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  unlink(path);
+  if (
+    s.listen_fd < 0 ||
+    bind(s.listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+    listen(s.listen_fd, SOMAXCONN) != 0 ||
+    pipe(s.wake) != 0
+  ) {
+    perror("beflux --serve");
+    return 1;
+  }
+  fcntl(s.wake[0], F_SETFL, O_NONBLOCK);
+  fcntl(s.wake[1], F_SETFL, O_NONBLOCK);
+
+  s.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  ev.events = EPOLLIN;
+  ev.data.ptr = &s;
+  epoll_ctl(s.epoll_fd, EPOLL_CTL_ADD, s.listen_fd, &ev);
+  ev.data.ptr = s.wake;
+  epoll_ctl(s.epoll_fd, EPOLL_CTL_ADD, s.wake[0], &ev);
+
+  signal(SIGINT, bfx_serve_signal);
+  signal(SIGTERM, bfx_serve_signal);
+  signal(SIGPIPE, SIG_IGN);
+
+  pthread_mutex_init(&s.lock, NULL);
+  pthread_cond_init(&s.ready, NULL);
+  s.workers = calloc(jobs, sizeof(bfx_serve_worker));
+  for (i = 0; i < jobs; ++i) {
+    s.workers[s.worker_count].serve = &s;
+    s.workers[s.worker_count].bfx = bfx_new();
+    if (pthread_create(
+      &s.workers[s.worker_count].thread, NULL,
+      bfx_serve_worker_main, s.workers + s.worker_count
+    ) == 0) {
+      ++s.worker_count;
+    }
+    else {
+      bfx_del(s.workers[s.worker_count].bfx);
+    }
+  }
+  fprintf(stderr, ":: BEFLUX ::\nServing on %s with %zu workers\n", path, s.worker_count);
+
+  while (!bfx_serve_stop) {
+    n = epoll_wait(s.epoll_fd, events, BFX_SERVE_EVENTS, bfx_serve_deadlines(&s));
+    for (i = 0; i < (size_t) (n > 0 ? n : 0); ++i) {
+      void *ptr = events[i].data.ptr;
+      bfx_serve_client *c = (bfx_serve_client *) ptr;
+
+      if (ptr == &s) {
+        bfx_serve_accept(&s);
+      }
+      else if (ptr == s.wake) {
+        bfx_serve_finish(&s);
+      }
+      else if (c->busy) {
+        /* Hung up mid-run; freed when the run finishes */
+        c->closing = 1;
+        epoll_ctl(s.epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+      }
+      else if (events[i].events & EPOLLOUT) {
+        bfx_serve_process(&s, c);
+      }
+      else if (bfx_serve_read(&s, c)) {
+        bfx_serve_process(&s, c);
+      }
+    }
+  }
+
+  pthread_mutex_lock(&s.lock);
+  s.stopping = 1;
+  for (i = 0; i < s.worker_count; ++i) {
+    if (s.workers[i].client != NULL)
+      bfx_interrupt(s.workers[i].bfx, BFX_INTERRUPT_HALT);
+  }
+  pthread_cond_broadcast(&s.ready);
+  pthread_mutex_unlock(&s.lock);
+  for (i = 0; i < s.worker_count; ++i) {
+    pthread_join(s.workers[i].thread, NULL);
+    bfx_del(s.workers[i].bfx);
+  }
+  while (s.client_count) {
+    bfx_serve_close(&s, s.clients[0]);
+  }
+  for (i = 0; i < BFX_SERVE_CACHE_SIZE; ++i) {
+    free(s.cache[i].image);
+  }
+  free(s.clients);
+  free(s.workers);
+  pthread_cond_destroy(&s.ready);
+  pthread_mutex_destroy(&s.lock);
+  close(s.epoll_fd);
+  close(s.listen_fd);
+  close(s.wake[0]);
+  close(s.wake[1]);
+  unlink(path);
+  return 0;
+}
+#endif
+
+/*******************************************************************************
+ * Run Mode
+ */
+#define BFX_MAIN_STATS BFX_INTERRUPT_USER
+
+static beflux *volatile bfx_main_running = NULL;
+
+/**
+ * \brief Asks the running interpreter to print its statistics at the end
+ *        of the current batch.
+ */
+static void bfx_main_signal_stats(int signo) {
+  beflux *b = bfx_main_running;
+  (void) signo;
+  if (b != NULL)
+    bfx_interrupt(b, BFX_MAIN_STATS);
+}
+
+static void bfx_main_print_stats(beflux *bfx) {
+  bfx_stats stats;
+  if (bfx->interrupt_reason != BFX_MAIN_STATS)
+    return;
+  bfx_stats_get(bfx, &stats);
+  bfx_stats_print(&stats, stderr);
+}
+
+static int bfx_run_main(int argc, char **argv) {
+  char program[BFX_BANK_SIZE], dump[BFX_BANK_SIZE + 8];
+  unsigned long record = 0, hz = 0;
+  const char *arg = NULL;
+  bfx_profile *profile = NULL;
+  bfx_perf perf;
+  bfx_stats stats;
+  FILE *fout;
+  beflux *b;
+  int i, checked = 0, counted = 0, reported = 0, status;
+
+  for (i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--checked") == 0)
+      checked = 1;
+    else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+      record = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+      hz = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--perf") == 0)
+      counted = 1;
+    else if (strcmp(argv[i], "--stats") == 0)
+      reported = 1;
+    else if (arg == NULL)
+      arg = argv[i];
+    else
+      arg = "";
+  }
+  if (arg == NULL || arg[0] == '\0') {
+    fprintf(
+      stderr,
+      "Usage: beflux [--checked] [--record N] [--profile HZ] [--perf] [--stats] "
+      "program.bfx\n"
+    );
+    return 1;
+  }
+
+  b = bfx_new();
+  bfx_main_program(program, sizeof(program), arg);
+  bfx_load(b, 0, program);
+  if (checked) {
+    b->checked = 1;
+    bfx_verify(b);
+  }
+  if (record) {
+    snprintf(dump, sizeof(dump), "%s.bfr", program);
+    if (!bfx_flight_start(b, record, dump))
+      fprintf(stderr, "Out of memory.\n");
+  }
+  if (hz) {
+    profile = bfx_profile_start(b, hz);
+    if (profile == NULL)
+      fprintf(stderr, "Profiling is not available.\n");
+  }
+  if (reported) {
+    b->on_interrupt = bfx_main_print_stats;
+    bfx_main_running = b;
+#ifdef SIGUSR1
+    signal(SIGUSR1, bfx_main_signal_stats);
+#endif
+  }
+  if (counted)
+    bfx_perf_begin(b, &perf);
+  status = bfx_run(b);
+
+  if (counted) {
+    bfx_perf_end(b, &perf);
+    bfx_perf_print(&perf, stderr);
+  }
+  if (profile != NULL) {
+    bfx_profile_stop(profile);
+    bfx_profile_cells(profile, stderr);
+    snprintf(dump, sizeof(dump), "%s.folded", program);
+    fout = fopen(dump, "w");
+    if (fout != NULL) {
+      bfx_profile_folded(profile, fout);
+      fclose(fout);
+    }
+    else {
+      fprintf(stderr, "Failed to write \"%s\"\n", dump);
+    }
+    bfx_profile_del(profile);
+  }
+  if (reported) {
+#ifdef SIGUSR1
+    signal(SIGUSR1, SIG_DFL);
+#endif
+    bfx_main_running = NULL;
+    bfx_stats_get(b, &stats);
+    bfx_stats_print(&stats, stderr);
+  }
+  bfx_del(b);
+  return status;
+}
 
-#ifndef LIBBEFLUX
 int main(int argc, char **argv) {
   int status = 0;
-  if (argc == 1) {
-    fprintf(stderr, ":: BEFLUX ::\nUsage: beflux [program.bfx]\n");
+  if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+    status = bfx_batch_main(argc, argv);
+  }
+  else if (argc > 1 && strcmp(argv[1], "--pipe") == 0) {
+    status = bfx_pipe_main(argc, argv);
+  }
+  else if (argc > 1 && strcmp(argv[1], "--watch") == 0) {
+    status = bfx_watch_main(argc, argv);
+  }
+  else if (argc > 1 && strcmp(argv[1], "--analyze") == 0) {
+    status = bfx_analyze_main(argc, argv);
+  }
+  else if (argc > 1 && strcmp(argv[1], "--emit-c") == 0) {
+    status = bfx_emit_main(argc, argv);
+  }
+  else if (argc > 1 && strcmp(argv[1], "--flight") == 0) {
+    status = bfx_flight_main(argc, argv);
+  }
+  else if (argc > 1 && strcmp(argv[1], "--serve") == 0) {
+#ifdef BFX_SERVE
+    status = bfx_serve_main(argc, argv);
+#else
+    fprintf(stderr, "Serve mode is not available in this build.\n");
+    status = 1;
+#endif
+  }
+  else if (argc == 1) {
+    fprintf(
+      stderr,
+      ":: BEFLUX ::\nUsage: beflux [--checked] [--record N] [--profile HZ] "
+      "[--perf] [--stats] [program.bfx]\n"
+      "       beflux --batch program.bfx --inputs dir "
+      "[--outputs dir] [--jobs N] [--lanes N]\n"
+      "       beflux --pipe a.bfx b.bfx ...\n"
+      "       beflux --watch program.bfx\n"
+      "       beflux --analyze [--map] program.bfx\n"
+      "       beflux --emit-c [--checked] program.bfx > program.c\n"
+      "       beflux --flight program.bfr\n"
+      "       beflux --serve socket [--jobs N]\n"
+    );
   }
   else {
-    beflux *b = bfx_new();
-    bfx_load(b, 0, argv[1]);
-    status = bfx_run(b);
-    bfx_del(b);
+    status = bfx_run_main(argc, argv);
   }
   return status;
 }
@@ -13,15 +13,74 @@ extern "C" {
 
 #include <stdio.h>
 #include <stdint.h>
+#include <time.h>
+#include <signal.h>
 
+/* Word width: build with -DBFX_WORD_BITS=16 or 32 for wider words. */
+#ifndef BFX_WORD_BITS
+#define BFX_WORD_BITS 8
+#endif
+
+#if BFX_WORD_BITS == 8
 typedef uint8_t bfx_word;
 #define BFX_WORD_MAX  UINT8_MAX
-#define BFX_BANK_SIZE BFX_WORD_MAX + 1
+#define BFX_WORD_FMT  "%02x"
+#elif BFX_WORD_BITS == 16
+typedef uint16_t bfx_word;
+#define BFX_WORD_MAX  UINT16_MAX
+#define BFX_WORD_FMT  "%04x"
+#elif BFX_WORD_BITS == 32
+typedef uint32_t bfx_word;
+#define BFX_WORD_MAX  UINT32_MAX
+#define BFX_WORD_FMT  "%08x"
+#else
+#error "BFX_WORD_BITS must be 8, 16 or 32"
+#endif
+
+#define BFX_WORD_DIGITS (2 * sizeof(bfx_word))
+
+/* Opcodes, functions, stack frames and string buffers */
+#define BFX_BANK_SIZE 256
+
+#if BFX_WORD_BITS == 8
+#define BFX_STACK_SIZE     BFX_BANK_SIZE
+#define BFX_REGISTER_COUNT BFX_BANK_SIZE
+#define BFX_PROGRAM_COUNT  BFX_BANK_SIZE
 
 #define BFX_PROGRAM_WIDTH  BFX_WORD_MAX
 #define BFX_PROGRAM_HEIGHT BFX_WORD_MAX
+#else
+/* Sizes must be powers of two; coordinates and indices wrap around them. */
+#ifndef BFX_STACK_SIZE
+#define BFX_STACK_SIZE     1024
+#endif
+#ifndef BFX_REGISTER_COUNT
+#define BFX_REGISTER_COUNT 65536
+#endif
+#ifndef BFX_PROGRAM_COUNT
+#define BFX_PROGRAM_COUNT  16
+#endif
+
+#ifndef BFX_PROGRAM_WIDTH
+#define BFX_PROGRAM_WIDTH  1024
+#endif
+#ifndef BFX_PROGRAM_HEIGHT
+#define BFX_PROGRAM_HEIGHT 1024
+#endif
+#endif
+
 #define BFX_PROGRAM_SIZE   BFX_PROGRAM_WIDTH * BFX_PROGRAM_HEIGHT
 
+/*
+ * Build with -DBFX_SPARSE to store programs in tiles allocated on demand
+ * instead of one dense bank. Coordinates then span the full word range.
+ */
+#ifndef BFX_TILE_BITS
+#define BFX_TILE_BITS 4
+#endif
+#define BFX_TILE_SIZE       (1 << BFX_TILE_BITS)
+#define BFX_TILE_CACHE_SIZE 64
+
 #define BFX_IP_E      0x00
 #define BFX_IP_N      0x40
 #define BFX_IP_W      0x80
@@ -34,27 +93,203 @@ typedef uint8_t bfx_word;
 #define BFX_MODE_NORMAL     1
 #define BFX_MODE_STRING     2
 #define BFX_MODE_STRING_ESC 3
+#define BFX_MODE_PAUSED     4
+#define BFX_MODE_PARKED     5
 #define BFX_MODE_FREED      BFX_WORD_MAX
 
+#define BFX_INTERRUPT_NONE  0
+#define BFX_INTERRUPT_PAUSE 1
+#define BFX_INTERRUPT_HALT  2
+#define BFX_INTERRUPT_QUIT  3
+#define BFX_INTERRUPT_USER  4
+
+/* Results of an asynchronous function binding. */
+#define BFX_ASYNC_DONE    0
+#define BFX_ASYNC_PENDING 1
+
+/* Maximum number of instruction pointers per interpreter. */
+#ifndef BFX_IP_MAX
+#define BFX_IP_MAX 4096
+#endif
+
+/* Number of ticks executed between interrupt and timer checks. */
+#ifndef BFX_BATCH_SIZE
+#define BFX_BATCH_SIZE 4096
+#endif
+
+/* Most states bfx_analyze follows in one program. */
+#ifndef BFX_ANALYSIS_STATES
+#define BFX_ANALYSIS_STATES (1 << 20)
+#endif
+
+/* Innermost CALL sites kept with each profile sample, and distinct samples
+ * a profile can hold. */
+#ifndef BFX_PROFILE_DEPTH
+#define BFX_PROFILE_DEPTH 16
+#endif
+#ifndef BFX_PROFILE_SITES
+#define BFX_PROFILE_SITES 4096
+#endif
+
 typedef struct beflux beflux;
+typedef struct bfx_grid bfx_grid;
+typedef struct bfx_workers bfx_workers;
+typedef struct bfx_trace bfx_trace;
+typedef struct bfx_ensemble bfx_ensemble;
+typedef struct bfx_pipeline bfx_pipeline;
+typedef struct bfx_watcher bfx_watcher;
+typedef struct bfx_reload bfx_reload;
+typedef struct bfx_saved bfx_saved;
+typedef struct bfx_flight bfx_flight;
 
 typedef void bfx_func(struct beflux *bfx);
+typedef int bfx_async_func(struct beflux *bfx);
+
+/*
+ * Memory allocator for everything an interpreter owns. alloc must return
+ * zeroed memory or NULL. resize may be NULL to allocate, copy and release
+ * instead, and release may be NULL for allocators that free everything at
+ * once. Allocators used by interpreters with max_workers set must be
+ * thread-safe.
+ */
+typedef struct bfx_allocator {
+  void *(*alloc)(void *ctx, size_t size);
+  void *(*resize)(void *ctx, void *ptr, size_t old_size, size_t size);
+  void (*release)(void *ctx, void *ptr, size_t size);
+  void *ctx;
+} bfx_allocator;
+
+typedef struct bfx_alloc_stats {
+  size_t allocs;   /* Successful allocations and resizes */
+  size_t releases;
+  size_t failures;
+  size_t bytes;    /* Currently allocated */
+  size_t peak;
+} bfx_alloc_stats;
+
+/* What an interpreter has done, from bfx_stats_get. */
+typedef struct bfx_stats {
+  size_t ticks;            /* Ticks run by bfx_run, across resets */
+  double ticks_per_second; /* Over the time spent in bfx_run */
+  double running;          /* Seconds spent in bfx_run */
+  double executing;        /* Running, less the three below */
+  double sleeping;         /* Seconds in 'z' */
+  double reading;          /* Seconds waiting on input */
+  double hosting;          /* Seconds in 'F' host functions */
+  size_t bytes_in;
+  size_t bytes_out;
+  size_t loads;            /* Programs loaded or read */
+  size_t max_frames;       /* Most frames pushed by '(' at once */
+  size_t max_calls;        /* Deepest nesting of CALLs */
+} bfx_stats;
+
+/* Bump allocator over a single block of memory. */
+typedef struct bfx_arena {
+  unsigned char *base;
+  size_t size;
+  size_t used;
+} bfx_arena;
 
 typedef struct bfx_stack {
   bfx_word size;
-  bfx_word data[BFX_BANK_SIZE];
+  bfx_word data[BFX_STACK_SIZE];
 } bfx_stack;
 
+typedef struct bfx_ip {
+  bfx_word row;
+  bfx_word col;
+  uint8_t dir;
+  bfx_word wait;
+} bfx_ip;
+
+/* State owned by one instruction pointer while another one is running. */
+typedef struct bfx_ip_state {
+  bfx_ip ip;
+  bfx_word current_frame;
+  bfx_word mode;
+  bfx_word value;
+  bfx_word value_width;
+  bfx_stack calls_row;
+  bfx_stack calls_col;
+} bfx_ip_state;
+
+/* A state the IP can reach in a program, as found by bfx_analyze. */
+typedef struct bfx_reach {
+  bfx_word row;
+  bfx_word col;
+  uint8_t dir;
+  uint8_t mode;  /* BFX_MODE_NORMAL, BFX_MODE_STRING or BFX_MODE_STRING_ESC */
+  int depth;     /* Stack depth on arrival, or -1 where it is not fixed */
+} bfx_reach;
+
+/* What can run in a program, walking from (0, 0) heading East. */
+typedef struct bfx_analysis {
+  bfx_word prog;
+  uint32_t checksum;         /* Of the program text it was made from */
+  bfx_reach *states;         /* Sorted by row, col, dir and mode */
+  size_t count;
+  size_t cells;              /* Distinct cells among the states */
+  size_t ops[BFX_BANK_SIZE]; /* Normal mode states on each opcode */
+  int max_depth;             /* Deepest fixed stack depth */
+  size_t dynamic;            /* States whose next state comes from the stack */
+  int self_modifies;         /* A reachable op can write to a program */
+  int truncated;             /* Gave up after BFX_ANALYSIS_STATES states */
+  size_t unproven;           /* States whose op may under- or overflow */
+} bfx_analysis;
+
+/* Counters bfx_perf_begin opens, in the order of bfx_perf's arrays. */
+#define BFX_PERF_CYCLES        0
+#define BFX_PERF_INSTRUCTIONS  1
+#define BFX_PERF_BRANCH_MISSES 2
+#define BFX_PERF_L1D_MISSES    3
+#define BFX_PERF_LLC_MISSES    4
+#define BFX_PERF_COUNTERS      5
+
+typedef struct bfx_perf {
+  int fds[BFX_PERF_COUNTERS];         /* Open counters, or -1 */
+  int valid[BFX_PERF_COUNTERS];       /* Counters read by bfx_perf_end */
+  uint64_t counts[BFX_PERF_COUNTERS];
+  size_t tick;                        /* Tick bfx_perf_begin was called at */
+  size_t ticks;                       /* Ticks run between begin and end */
+  double seconds;                     /* Wall time between begin and end */
+} bfx_perf;
+
+typedef struct bfx_profile_site {
+  size_t samples;
+  size_t depth;                         /* CALLs the IP was inside */
+  bfx_word calls[BFX_PROFILE_DEPTH][2]; /* Row and column of the innermost */
+  bfx_word prog;
+  bfx_word row;
+  bfx_word col;
+  bfx_word op;
+  uint8_t dir;
+} bfx_profile_site;
+
+typedef struct bfx_profile {
+  beflux *bfx;
+  bfx_profile_site *sites; /* Open-addressed by cell and CALL sites */
+  size_t capacity;
+  size_t samples;
+  size_t dropped;          /* Samples that found every site taken */
+} bfx_profile;
+
 struct beflux {
   bfx_word *programs;
+  uint8_t *programs_used;
+  uint8_t *dirty;
+  bfx_grid *grid;
   bfx_word *registers;
 
   bfx_func **op_bindings;
   bfx_func **f_bindings;
+  bfx_async_func **async_bindings;
   bfx_func *pre_update;
   bfx_func *post_update;
+  bfx_func *on_interrupt;
+  bfx_func *run_batch; /* Replaces the main loop for one IP without hooks */
 
-  bfx_stack frames[BFX_BANK_SIZE];
+  bfx_stack *frames; /* The frame bank; workers use their root's */
+  bfx_stack frame_bank[BFX_BANK_SIZE];
   bfx_stack calls_row;
   bfx_stack calls_col;
 
@@ -76,18 +311,47 @@ struct beflux {
   time_t pre_timer;
   time_t post_timer;
   size_t timeout;
+  size_t fuel;
   bfx_word sleep;
+  int checked;  /* Nonzero to stop on stack underflow and overflow */
+  int verified; /* bfx_verify proved program 0 needs no checks */
+  int run_batch_checks; /* run_batch does its own stack checks */
+
+  volatile sig_atomic_t interrupt;
+  int interrupt_reason;
+  bfx_word resume_mode;
+  size_t batch;
+  volatile int pending;
 
   FILE *in;
   FILE *out;
   FILE *err;
 
-  struct {
-    bfx_word row;
-    bfx_word col;
-    bfx_word dir;
-    bfx_word wait;
-  } ip;
+  bfx_ip ip;
+
+  bfx_ip_state *ips;
+  size_t ip_count;
+  size_t ip_index;
+  size_t ip_capacity;
+  int ip_dead;
+
+  size_t max_workers;
+  beflux *root;
+  bfx_workers *workers;
+
+  bfx_trace *trace;
+  bfx_flight *flight;
+
+  bfx_watcher *watcher;
+  bfx_reload *reloads;
+  bfx_saved **saved;
+
+  bfx_allocator allocator;
+  bfx_alloc_stats alloc_stats;
+
+  bfx_stats stats;
+  double run_clock; /* When the current bfx_run began, or 0 */
+  size_t run_tick;  /* tick when the current bfx_run began */
 };
 
 /*******************************************************************************
@@ -97,9 +361,17 @@ beflux *bfx_new(void);
 void bfx_init(beflux *bfx);
 void bfx_free(beflux *bfx);
 void bfx_del(beflux *bfx);
+void bfx_reset(beflux *bfx);
+
+/* Memory */
+beflux *bfx_new_with_allocator(const bfx_allocator *allocator);
+void bfx_alloc_stats_get(beflux *bfx, bfx_alloc_stats *stats);
+void bfx_arena_init(bfx_arena *arena, void *base, size_t size);
+bfx_allocator bfx_arena_allocator(bfx_arena *arena);
 
 /* I/O */
 void bfx_load(beflux *bfx, bfx_word prog, const char *filename);
+void bfx_load_stream(beflux *bfx, bfx_word prog, FILE *fin);
 void bfx_save(beflux *bfx, bfx_word prog, const char *filename);
 void bfx_read(beflux *bfx, bfx_word prog, const bfx_word *src, size_t size);
 void bfx_write(beflux *bfx, bfx_word prog, bfx_word *dst, size_t size);
@@ -113,12 +385,71 @@ void bfx_push(beflux *bfx, bfx_word value);
 bfx_word bfx_pop(beflux *bfx);
 bfx_word bfx_top(beflux *bfx);
 void bfx_clear(beflux *bfx);
+void bfx_push_span(beflux *bfx, const bfx_word *src, size_t count);
+void bfx_pop_span(beflux *bfx, bfx_word *dst, size_t count);
+void bfx_push_string(beflux *bfx, const char *str);
+const bfx_word *bfx_frame_view(beflux *bfx, size_t *count);
 
 /* Execution */
 bfx_word bfx_run(beflux *bfx);
 void bfx_update(beflux *bfx);
+bfx_word bfx_step(beflux *bfx, bfx_word op);
 void bfx_sleep(beflux *bfx);
 void bfx_eval(beflux *bfx, bfx_word op);
+void bfx_interrupt(beflux *bfx, int reason);
+void bfx_set_hooks(beflux *bfx, bfx_func *pre_update, bfx_func *post_update);
+void bfx_complete(beflux *bfx, const bfx_word *results, size_t count);
+int bfx_pending(beflux *bfx);
+
+/* Ensembles */
+bfx_ensemble *bfx_ensemble_new(size_t lanes);
+void bfx_ensemble_del(bfx_ensemble *e);
+beflux *bfx_ensemble_lane(bfx_ensemble *e, size_t lane);
+size_t bfx_ensemble_run(bfx_ensemble *e, size_t count);
+
+/* Pipelines */
+bfx_pipeline *bfx_pipeline_new(size_t stages, size_t capacity);
+void bfx_pipeline_del(bfx_pipeline *p);
+beflux *bfx_pipeline_stage(bfx_pipeline *p, size_t stage);
+bfx_word bfx_pipeline_run(bfx_pipeline *p);
+
+/* Hot Reload */
+bfx_watcher *bfx_watcher_new(void);
+void bfx_watcher_del(bfx_watcher *w);
+void bfx_watcher_attach(bfx_watcher *w, beflux *bfx);
+int bfx_watcher_fd(bfx_watcher *w);
+size_t bfx_watcher_poll(bfx_watcher *w);
+
+/* Analysis */
+bfx_analysis *bfx_analyze(beflux *bfx, bfx_word prog);
+void bfx_analysis_del(bfx_analysis *a);
+long bfx_analysis_find(const bfx_analysis *a, const bfx_reach *s);
+int bfx_analysis_dirs(const bfx_analysis *a, bfx_word row, bfx_word col);
+int bfx_analysis_save(const bfx_analysis *a, const char *filename);
+bfx_analysis *bfx_analysis_load(beflux *bfx, bfx_word prog, const char *filename);
+int bfx_verify(beflux *bfx);
+int bfx_check_stack(beflux *bfx, bfx_word op);
+
+/* Flight Recorder */
+int bfx_flight_start(beflux *bfx, size_t ticks, const char *filename);
+void bfx_flight_stop(beflux *bfx);
+int bfx_flight_dump(beflux *bfx, const char *filename);
+
+/* Profiling */
+bfx_profile *bfx_profile_start(beflux *bfx, unsigned long hz);
+void bfx_profile_stop(bfx_profile *p);
+void bfx_profile_del(bfx_profile *p);
+void bfx_profile_cells(const bfx_profile *p, FILE *fout);
+void bfx_profile_folded(const bfx_profile *p, FILE *fout);
+
+/* Statistics */
+void bfx_stats_get(beflux *bfx, bfx_stats *stats);
+void bfx_stats_print(const bfx_stats *stats, FILE *fout);
+
+/* Performance Counters */
+int bfx_perf_begin(beflux *bfx, bfx_perf *perf);
+void bfx_perf_end(beflux *bfx, bfx_perf *perf);
+void bfx_perf_print(const bfx_perf *perf, FILE *fout);
 
 /* Program Manipulation */
 bfx_word bfx_program_get(
@@ -136,10 +467,15 @@ void bfx_program_set(
   bfx_word value
 );
 
+int bfx_program_dirty(beflux *bfx, bfx_word prog, bfx_word row);
+int bfx_program_dirty_range(beflux *bfx, bfx_word prog, size_t *first, size_t *end);
+void bfx_program_clean(beflux *bfx, bfx_word prog);
+
 /* IP Manipulation */
 void bfx_ip_reset(beflux *bfx);
 void bfx_ip_advance(beflux *bfx);
 bfx_word bfx_ip_get_op(beflux *bfx);
+bfx_word bfx_ip_next(beflux *bfx);
 
 /* Beflux Operators */
 bfx_func bfx_op20; bfx_func bfx_op21; bfx_func bfx_op22; bfx_func bfx_op23;
@@ -172,6 +508,9 @@ bfx_func bfx_op74; bfx_func bfx_op75; bfx_func bfx_op76; bfx_func bfx_op77;
 bfx_func bfx_op78; bfx_func bfx_op79; bfx_func bfx_op7a; bfx_func bfx_op7b;
 bfx_func bfx_op7c; bfx_func bfx_op7d; bfx_func bfx_op7e; bfx_func bfx_op7f;
 
+bfx_func bfx_op80; bfx_func bfx_op81;
+
+extern const bfx_allocator bfx_default_allocator;
 extern bfx_func *bfx_default_op_bindings[BFX_BANK_SIZE];
 extern const char *bfx_opnames[BFX_BANK_SIZE];
 
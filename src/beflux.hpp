@@ -0,0 +1,216 @@
+/**
+ * @file beflux.hpp
+ * @author Tony Chiodo (http://dodecaplex.net)
+ *
+ * C++17 embedding layer over the C API. Host opcodes and FUNC ('F')
+ * functions are listed in an op_table at compile time. A table that binds
+ * ops gets its own run loop with those ops called directly, so the
+ * compiler can inline them, while every built-in op goes through
+ * bfx_step, which is slower than the C loop. Tables of FUNC functions
+ * alone keep the C loop, which reaches them through FUNC just as fast.
+ *
+ *   static void square(beflux *b) { bfx_word v = bfx_pop(b); bfx_push(b, v * v); }
+ *   using Table = bfx::op_table<bfx::op<0x82, square>, bfx::fn<0, square>>;
+ *   bfx::Interpreter<Table> interpreter;
+ *
+ * The namespace is bfx rather than beflux, which C++ already knows as the
+ * interpreter's struct.
+ */
+
+#ifndef BEFLUX_HPP
+#define BEFLUX_HPP
+
+#include <array>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+#include "beflux.h"
+
+namespace bfx {
+
+/**
+ * \brief Binds a host function to an opcode.
+ */
+template <bfx_word Op, bfx_func *Func>
+struct op {
+  static_assert(Op < BFX_BANK_SIZE, "opcode out of range");
+  static constexpr bool is_op = true;
+  static constexpr bfx_word code = Op;
+  static constexpr bfx_func *func = Func;
+};
+
+/**
+ * \brief Binds a host function to a FUNC ('F') index.
+ */
+template <bfx_word Index, bfx_func *Func>
+struct fn {
+  static_assert(Index < BFX_BANK_SIZE, "function index out of range");
+  static constexpr bool is_op = false;
+  static constexpr bfx_word code = Index;
+  static constexpr bfx_func *func = Func;
+};
+
+/**
+ * \brief A compile-time list of op and fn bindings, and the run loop
+ *        specialized for them.
+ */
+template <typename... Entries>
+struct op_table {
+  /** \brief Whether any entry binds an op, and so needs run_batch. */
+  static constexpr bool has_ops = (Entries::is_op || ... || false);
+
+  /**
+   * \brief Calls the host op bound to code, if there is one.
+   * \return Whether an op was called.
+   */
+  static bool call_op(beflux *b, bfx_word code) {
+    return (
+      (Entries::is_op && Entries::code == code ? (Entries::func(b), true) : false) ||
+      ...
+    );
+  }
+
+  /**
+   * \brief Calls the host function FUNC would call, if it is in the table
+   *        and still bound, popping its index like FUNC does.
+   * \return Whether a function was called.
+   */
+  static bool call_fn(beflux *b) {
+    bfx_word index = bfx_top(b);
+    return (
+      (
+        !Entries::is_op && Entries::code == index &&
+        b->async_bindings[index] == nullptr &&
+        b->f_bindings[index] == Entries::func
+          ? (bfx_pop(b), Entries::func(b), true)
+          : false
+      ) ||
+      ...
+    );
+  }
+
+  /**
+   * \brief The default op bindings with the table's ops in place. Shared
+   *        by every interpreter using the table, like the C defaults.
+   */
+  static bfx_func **op_bindings() {
+    static std::array<bfx_func *, BFX_BANK_SIZE> table = [] {
+      std::array<bfx_func *, BFX_BANK_SIZE> t;
+      for (std::size_t i = 0; i < t.size(); ++i) {
+        t[i] = bfx_default_op_bindings[i];
+      }
+      ((Entries::is_op ? (void) (t[Entries::code] = Entries::func) : (void) 0), ...);
+      return t;
+    }();
+    return table.data();
+  }
+
+  /**
+   * \brief Binds the table's functions for FUNC, so that everything else
+   *        that calls them, such as EXEC ('x') or the C loops used with
+   *        hooks or several IPs, finds them too. run_batch is installed
+   *        only for tables with ops; it trades slower built-ins for
+   *        inlined host ops, which suits programs heavy in host ops.
+   */
+  static void bind(beflux *b) {
+    b->op_bindings = op_bindings();
+    ((Entries::is_op ? (void) 0 : (void) (b->f_bindings[Entries::code] = Entries::func)), ...);
+    if (has_ops)
+      b->run_batch = &run_batch;
+  }
+
+  /**
+   * \brief Runs one batch of ticks like the C main loop, calling the
+   *        table's functions directly. Falls back to bfx_step for
+   *        everything else, including ops rebound after the table was
+   *        installed.
+   */
+  static void run_batch(beflux *b) {
+    std::size_t ticks = 0;
+    bool bound = b->op_bindings == op_bindings();
+    bfx_word code = bfx_ip_get_op(b);
+
+    while (b->batch && b->mode) {
+      --b->batch;
+      if (bound && b->mode == BFX_MODE_NORMAL && (
+        call_op(b, code) || (code == 'F' && b->op_bindings['F'] == bfx_op46 && call_fn(b))
+      )) {
+        code = bfx_ip_next(b);
+      }
+      else {
+        code = bfx_step(b, code);
+      }
+      ++ticks;
+    }
+    b->tick += ticks;
+  }
+};
+
+/**
+ * \brief Owns an interpreter whose host ops and functions come from
+ *        OpTable.
+ */
+template <typename OpTable = op_table<>>
+class Interpreter {
+ public:
+  Interpreter() : Interpreter(nullptr) {}
+
+  /**
+   * \param allocator As for bfx_new_with_allocator.
+   * \throws std::bad_alloc if the interpreter could not be allocated.
+   */
+  explicit Interpreter(const bfx_allocator *allocator)
+    : b_(bfx_new_with_allocator(allocator)) {
+    if (b_ == nullptr)
+      throw std::bad_alloc();
+    OpTable::bind(b_);
+  }
+
+  ~Interpreter() {
+    if (b_ != nullptr)
+      bfx_del(b_);
+  }
+
+  Interpreter(const Interpreter &) = delete;
+  Interpreter &operator=(const Interpreter &) = delete;
+
+  Interpreter(Interpreter &&other) noexcept
+    : b_(std::exchange(other.b_, nullptr)) {}
+
+  Interpreter &operator=(Interpreter &&other) noexcept {
+    if (this != &other) {
+      if (b_ != nullptr)
+        bfx_del(b_);
+      b_ = std::exchange(other.b_, nullptr);
+    }
+    return *this;
+  }
+
+  /**
+   * \brief The underlying interpreter, for the rest of the C API.
+   */
+  beflux *get() const noexcept { return b_; }
+  beflux *operator->() const noexcept { return b_; }
+
+  void load(bfx_word prog, const char *filename) { bfx_load(b_, prog, filename); }
+  void read(bfx_word prog, const bfx_word *src, std::size_t size) { bfx_read(b_, prog, src, size); }
+  void write(bfx_word prog, bfx_word *dst, std::size_t size) { bfx_write(b_, prog, dst, size); }
+  void reset() { bfx_reset(b_); }
+
+  bfx_word run() { return bfx_run(b_); }
+  void interrupt(int reason) { bfx_interrupt(b_, reason); }
+
+  void push(bfx_word value) { bfx_push(b_, value); }
+  bfx_word pop() { return bfx_pop(b_); }
+  void push_span(const bfx_word *src, std::size_t count) { bfx_push_span(b_, src, count); }
+  void pop_span(bfx_word *dst, std::size_t count) { bfx_pop_span(b_, dst, count); }
+  void push_string(const char *str) { bfx_push_string(b_, str); }
+
+ private:
+  beflux *b_;
+};
+
+} /* namespace bfx */
+
+#endif
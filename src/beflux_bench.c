@@ -0,0 +1,153 @@
+/**
+ * @file beflux_bench.c
+ * @author Tony Chiodo (http://dodecaplex.net)
+ *
+ * Measures program storage and execution speed. Build once per storage
+ * backend (see the bench target in the Makefile) and compare the output.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "beflux.h"
+
+#ifdef BFX_SPARSE
+#define BENCH_BACKEND "sparse"
+#elif defined(BFX_TILED)
+#define BENCH_BACKEND "tiled"
+#else
+#define BENCH_BACKEND "dense"
+#endif
+
+#define BENCH_NOP 0x7f
+
+/**
+ * \brief Returns the processor time elapsed since start, in seconds.
+ */
+static double bench_elapsed(clock_t start) {
+  return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+/**
+ * \brief Fills a program with a serpentine path that visits every cell,
+ *        then jumps back to the origin.
+ * \param rows An even number of rows.
+ */
+static void bench_serpentine(beflux *b, size_t rows, size_t cols) {
+  size_t row, col;
+
+  for (row = 0; row < rows; ++row) {
+    for (col = 0; col < cols; ++col) {
+      bfx_program_set(b, 0, row, col, BENCH_NOP);
+    }
+    if (row % 2 == 0) {
+      bfx_program_set(b, 0, row, 0, '>');
+      bfx_program_set(b, 0, row, cols - 1, 'v');
+    }
+    else {
+      bfx_program_set(b, 0, row, cols - 1, '<');
+      bfx_program_set(b, 0, row, 0, 'v');
+    }
+  }
+
+  /* Last row: push two zero words and jump to the origin */
+  for (col = 1; col <= 2 * BFX_WORD_DIGITS; ++col) {
+    bfx_program_set(b, 0, rows - 1, col, '0');
+  }
+  bfx_program_set(b, 0, rows - 1, 0, 'J');
+}
+
+/**
+ * \brief Fills a program with a serpentine path that runs down and up each
+ *        column in turn, then jumps back to the origin.
+ * \param cols An even number of columns.
+ */
+static void bench_columns(beflux *b, size_t rows, size_t cols) {
+  size_t row, col;
+
+  for (col = 0; col < cols; ++col) {
+    for (row = 0; row < rows; ++row) {
+      bfx_program_set(b, 0, row, col, BENCH_NOP);
+    }
+    if (col % 2 == 0) {
+      bfx_program_set(b, 0, 0, col, 'v');
+      bfx_program_set(b, 0, rows - 1, col, '>');
+    }
+    else {
+      bfx_program_set(b, 0, rows - 1, col, '^');
+      bfx_program_set(b, 0, 0, col, '>');
+    }
+  }
+
+  /* Last column: push two zero words and jump to the origin */
+  for (row = 1; row <= 2 * BFX_WORD_DIGITS; ++row) {
+    bfx_program_set(b, 0, row, cols - 1, '0');
+  }
+  bfx_program_set(b, 0, 0, cols - 1, 'J');
+}
+
+/**
+ * \brief Builds and runs a serpentine program, then reports timings.
+ * \param fill Lays out the path, row by row or column by column.
+ */
+static void bench_run(
+  const char *name,
+  void (*fill)(beflux *, size_t, size_t),
+  size_t rows,
+  size_t cols,
+  size_t ticks
+) {
+  beflux *b = bfx_new();
+  clock_t start;
+  double populate, run, lookup;
+  size_t i;
+  unsigned sum = 0;
+
+  start = clock();
+  fill(b, rows, cols);
+  populate = bench_elapsed(start);
+
+  b->mode = BFX_MODE_NORMAL;
+  start = clock();
+  for (i = 0; i < ticks && b->mode; ++i) {
+    bfx_update(b);
+  }
+  run = bench_elapsed(start);
+
+  srand(1);
+  start = clock();
+  for (i = 0; i < ticks; ++i) {
+    sum += bfx_program_get(b, 0, rand() % rows, rand() % cols);
+  }
+  lookup = bench_elapsed(start);
+
+  printf(
+    "%-6s %-6s %6zu x %-6zu populate %9.3f ms  run %8.2f Mticks/s"
+    "  random get %8.2f M/s%s\n",
+    BENCH_BACKEND, name, rows, cols,
+    populate * 1e3,
+    ticks / run / 1e6,
+    ticks / lookup / 1e6,
+    sum ? "" : " (?)"
+  );
+  bfx_del(b);
+}
+
+int main(int argc, char **argv) {
+  size_t ticks = argc > 1 ? (size_t) atol(argv[1]) : 20000000;
+
+  printf(":: BEFLUX BENCH :: %d-bit words\n", BFX_WORD_BITS);
+  bench_run("small", bench_serpentine, 16, 64, ticks);
+
+#if BFX_WORD_BITS == 8
+  bench_run("huge", bench_serpentine, 254, 255, ticks);
+  bench_run("tall", bench_columns, 255, 254, ticks);
+#else
+  bench_run("huge", bench_serpentine, 1024, 1024, ticks);
+  bench_run("tall", bench_columns, 1024, 1024, ticks);
+#ifdef BFX_SPARSE
+  bench_run("vast", bench_serpentine, 2, BFX_WORD_BITS == 16 ? 65535 : 1000000, ticks);
+#endif
+#endif
+  return 0;
+}
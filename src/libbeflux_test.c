@@ -1,9 +1,849 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 #include "beflux.h"
 
+#if !defined(BFX_NO_THREADS) && !defined(BFX_SPARSE)
+#include <pthread.h>
+#define TEST_WORKERS
+#endif
+
+#ifdef __unix__
+#include <sys/wait.h>
+#define TEST_EMIT
+#endif
+
+/*******************************************************************************
+ * Checks
+ *
+ * Run with --check. Each check writes a small program into program 0 with
+ * bfx_program_set, runs it and compares how it ended. Programs spell word
+ * literals with two digits, so the checks need an 8-bit build. Given a
+ * beflux executable and the library it matches, --check also compiles
+ * programs with --emit-c and compares them with this interpreter.
+ */
+#if BFX_WORD_BITS == 8
+static int test_failures = 0;
+
+static void test_expect(const char *name, int ok) {
+  printf("%s %s\n", ok ? "ok  " : "FAIL", name);
+  test_failures += !ok;
+}
+
+/**
+ * \brief Creates an interpreter running a program given as rows separated
+ *        by newlines. Errors go to a scratch file instead of stderr.
+ */
+static beflux *test_load(beflux *b, const char *src) {
+  size_t row = 0, col = 0;
+  b->err = tmpfile();
+  for (; *src; ++src) {
+    if (*src == '\n') {
+      ++row;
+      col = 0;
+    }
+    else {
+      bfx_program_set(b, 0, row, col++, (unsigned char) *src);
+    }
+  }
+  return b;
+}
+
+static beflux *test_new(const char *src) {
+  return test_load(bfx_new(), src);
+}
+
+static void test_del(beflux *b) {
+  if (b->err != NULL && b->err != stderr)
+    fclose(b->err);
+  b->err = stderr;
+  bfx_del(b);
+}
+
+/* A split IP pushes 0x08 and 0x10 onto frame 1, then raises register 0.
+ * Its parent waits for the register, then exits with the top of frame 1. */
+static const char *test_split_program =
+  "0180#vxv    <\n"
+  "     0 >00gw^\n"
+  "     8     (\n"
+  "     1     q\n"
+  "     0\n"
+  "     0\n"
+  "     1\n"
+  "     0\n"
+  "     0\n"
+  "     s\n"
+  "     8\n"
+  "     1\n"
+  "     x\n";
+
+static void test_split(void) {
+  beflux *b = test_new(test_split_program);
+  test_expect("split IPs taking turns share frames", bfx_run(b) == 0x10);
+  test_del(b);
+
+#ifdef TEST_WORKERS
+  b = test_new(test_split_program);
+  b->max_workers = 1;
+  test_expect("worker IPs share frames", bfx_run(b) == 0x10);
+  test_del(b);
+#endif
+}
+
+#ifdef TEST_WORKERS
+/* A split IP calls async function 0 on frame 1, then raises register 0
+ * and ends. Its parent waits for the register, then exits with the top of
+ * frame 1. */
+static const char *test_park_program =
+  "0180#vxv    <\n"
+  "     0 >00gw^\n"
+  "     0     (\n"
+  "     F     q\n"
+  "     0\n"
+  "     1\n"
+  "     0\n"
+  "     0\n"
+  "     s\n"
+  "     8\n"
+  "     1\n"
+  "     x\n";
+
+static pthread_t test_completer;
+
+static void *test_complete_later(void *arg) {
+  struct timespec nap = {0, 10000000};
+  bfx_word result = 0x10;
+  nanosleep(&nap, NULL);
+  bfx_complete((beflux *) arg, &result, 1);
+  return NULL;
+}
+
+static int test_park_complete(beflux *b) {
+  pthread_create(&test_completer, NULL, test_complete_later, b);
+  return BFX_ASYNC_PENDING;
+}
+
+/* Never completes; lets the parent go on instead. */
+static int test_park_forever(beflux *b) {
+  b->registers[0] = 1;
+  return BFX_ASYNC_PENDING;
+}
+
+static void test_park(void) {
+  beflux *b = test_new(test_park_program);
+  b->max_workers = 1;
+  b->async_bindings[0] = test_park_complete;
+  test_expect("parked worker resumes on completion", bfx_run(b) == 0x10);
+  pthread_join(test_completer, NULL);
+  test_del(b);
+
+  /* Quitting wakes the worker instead of leaving it parked. */
+  b = test_new(test_park_program);
+  b->max_workers = 1;
+  b->async_bindings[0] = test_park_forever;
+  test_expect("quitting drops a call pending on a worker", bfx_run(b) == 0);
+  test_del(b);
+}
+#endif
+
+/* Runs 90 NOPs, then a program, with fuel for 100 ticks. */
+static beflux *test_fuel_new(const char *src) {
+  char row[BFX_BANK_SIZE];
+  beflux *b;
+  memset(row, 0x7f, 90);
+  strcpy(row + 90, src);
+  b = test_new(row);
+  b->fuel = 100;
+  return b;
+}
+
+static void test_iterate_fuel(void) {
+  beflux *b = test_fuel_new("04k\x7f" "00q");
+  test_expect("ITER up to the fuel limit", bfx_run(b) == 0 && b->tick == 100);
+  test_del(b);
+
+  b = test_fuel_new("32k\x7fq");
+  test_expect(
+    "ITER past the fuel limit runs out",
+    bfx_run(b) == BFX_WORD_MAX && b->tick == 100
+  );
+  test_del(b);
+}
+
+/* Runs ticks like the main loop without checking stacks. */
+static void test_batch(beflux *b) {
+  while (b->batch && b->mode) {
+    --b->batch;
+    bfx_update(b);
+  }
+}
+
+static void test_checked(void) {
+  static const char *underflows[] = { "05k$00q", "03k+00q", "k00q", "x00q" };
+  size_t i;
+  beflux *b;
+
+  for (i = 0; i < sizeof(underflows) / sizeof(underflows[0]); ++i) {
+    b = test_new(underflows[i]);
+    b->checked = 1;
+    test_expect(underflows[i], bfx_run(b) == BFX_WORD_MAX);
+    test_del(b);
+  }
+
+  b = test_new("0105k:00q");
+  b->checked = 1;
+  test_expect("checked ITER within the stack", bfx_run(b) == 0 && b->tick == 13);
+  test_del(b);
+
+  b = test_new("$00q");
+  b->checked = 1;
+  b->run_batch = test_batch;
+  test_expect("checked stacks pass over run_batch", bfx_run(b) == BFX_WORD_MAX);
+  test_del(b);
+}
+
+/**
+ * \brief Dumps an interpreter's flight recording and reads back how many
+ *        entries it holds and how many ticks they stand for.
+ */
+static void test_flight_read(beflux *b, unsigned long *entries, unsigned long *ticks) {
+  unsigned char record[16 + 5 + 2];
+  const char *filename = "libbeflux_test.bfr";
+  FILE *fin;
+  int i;
+
+  *entries = *ticks = 0;
+  bfx_flight_dump(b, filename);
+  fin = fopen(filename, "rb");
+  if (fin != NULL && fread(record, 1, 12, fin) == 12) {
+    for (i = 3; i >= 0; --i)
+      *entries = *entries << 8 | record[8 + i];
+    while (fread(record, 1, sizeof(record), fin) == sizeof(record)) {
+      for (i = 7; i >= 0; --i)
+        *ticks += (unsigned long) record[8 + i] << (8 * i);
+    }
+  }
+  if (fin != NULL)
+    fclose(fin);
+  remove(filename);
+}
+
+/* An ITER run is one entry standing for each tick it repeats, and so is
+ * each replayed REP pass. */
+static void test_flight(void) {
+  unsigned long entries, ticks;
+  beflux *b = test_new("05k\x7f" "00q");
+
+  bfx_flight_start(b, 64, NULL);
+  bfx_run(b);
+  test_flight_read(b, &entries, &ticks);
+  test_expect(
+    "flight recorder sees ITER ticks",
+    entries == 7 && ticks == 11 && b->tick == 11
+  );
+  test_del(b);
+
+  b = test_new("\x7f\x7f\x7f:$@");
+  b->fuel = 1000;
+  bfx_flight_start(b, 4096, NULL);
+  bfx_run(b);
+  test_flight_read(b, &entries, &ticks);
+  test_expect(
+    "flight recorder sees REP passes",
+    entries < 400 && ticks == 1000 && b->tick == 1000
+  );
+  test_del(b);
+}
+
+static void test_untraced(beflux *b) {
+  (void) b; /* Hooks keep REP from tracing */
+}
+
+/* Three moves lead to the first recorded step of each pass. */
+static void test_trace_fuel(void) {
+  static const size_t fuels[] = { 100, 101, 102, 103, 104, 105, 4096, 5000 };
+  size_t i;
+  int ok = 1;
+
+  for (i = 0; i < sizeof(fuels) / sizeof(fuels[0]); ++i) {
+    beflux *traced = test_new("\x7f\x7f\x7f:$@");
+    beflux *untraced = test_new("\x7f\x7f\x7f:$@");
+    bfx_word status;
+
+    traced->fuel = untraced->fuel = fuels[i];
+    untraced->pre_update = test_untraced;
+    status = bfx_run(traced);
+    ok &=
+      status == bfx_run(untraced) && traced->tick == untraced->tick &&
+      traced->tick == fuels[i];
+    test_del(traced);
+    test_del(untraced);
+  }
+  test_expect("REP replays stop at the fuel limit", ok);
+}
+
+/* Spans must leave frames as single pushes and pops would, including when
+ * a frame wraps around or pops past empty. */
+static void test_span(void) {
+  static const size_t runs[][3] = {
+    /* filled, pushed, popped */
+    { 50, 100, 30 }, { 200, 100, 10 }, { 10, 0, 40 }, { 250, 600, 700 }
+  };
+  bfx_word words[1024], spans[1024], singles[1024];
+  const bfx_word *a, *b;
+  size_t i, j, n, m;
+  int ok = 1;
+
+  for (i = 0; i < sizeof(words) / sizeof(words[0]); ++i) {
+    words[i] = (bfx_word) (i * 7 + 3);
+  }
+  for (i = 0; i < sizeof(runs) / sizeof(runs[0]); ++i) {
+    beflux *span = bfx_new(), *single = bfx_new();
+
+    for (j = 0; j < runs[i][0]; ++j) {
+      bfx_push(span, words[j]);
+      bfx_push(single, words[j]);
+    }
+    bfx_push_span(span, words, runs[i][1]);
+    for (j = 0; j < runs[i][1]; ++j) {
+      bfx_push(single, words[j]);
+    }
+    a = bfx_frame_view(span, &n);
+    b = bfx_frame_view(single, &m);
+    ok &= n == m && memcmp(a, b, sizeof(span->frames[0].data)) == 0;
+
+    bfx_pop_span(span, spans, runs[i][2]);
+    for (j = runs[i][2]; j--; ) {
+      singles[j] = bfx_pop(single);
+    }
+    a = bfx_frame_view(span, &n);
+    b = bfx_frame_view(single, &m);
+    ok &=
+      memcmp(spans, singles, runs[i][2] * sizeof(bfx_word)) == 0 &&
+      n == m && memcmp(a, b, sizeof(span->frames[0].data)) == 0;
+
+    bfx_push_string(span, "span");
+    bfx_push(single, '\0');
+    for (j = 0; j < 4; ++j) {
+      bfx_push(single, (bfx_word) "span"[j]);
+    }
+    a = bfx_frame_view(span, &n);
+    b = bfx_frame_view(single, &m);
+    ok &= n == m && memcmp(a, b, sizeof(span->frames[0].data)) == 0;
+
+    bfx_del(span);
+    bfx_del(single);
+  }
+  test_expect("spans match single pushes and pops", ok);
+}
+
+/* A malloc-backed allocator that fails past a budget and counts what is
+ * still held. */
+typedef struct test_budget {
+  size_t budget;
+  size_t used;
+  size_t live;
+  size_t sizes[64]; /* Sizes allocated, in order */
+  size_t count;
+} test_budget;
+
+static void *test_budget_alloc(void *ctx, size_t size) {
+  test_budget *t = (test_budget *) ctx;
+  void *p;
+  if (t->used + size > t->budget || (p = calloc(1, size)) == NULL)
+    return NULL;
+  t->used += size;
+  ++t->live;
+  if (t->count < sizeof(t->sizes) / sizeof(t->sizes[0]))
+    t->sizes[t->count++] = size;
+  return p;
+}
+
+static void test_budget_release(void *ctx, void *ptr, size_t size) {
+  test_budget *t = (test_budget *) ctx;
+  free(ptr);
+  t->used -= size;
+  --t->live;
+}
+
+/* Creation that runs out of memory at any allocation must fail cleanly. */
+static void test_arena(void) {
+  test_budget t;
+  bfx_allocator a = { test_budget_alloc, NULL, test_budget_release, &t };
+  bfx_arena arena;
+  bfx_alloc_stats stats;
+  static unsigned char block[4096];
+  unsigned char *base;
+  size_t i, total = 0, allocs, size;
+  beflux *b;
+  int ok;
+
+  memset(&t, 0, sizeof(t));
+  t.budget = (size_t) -1;
+  b = bfx_new_with_allocator(&a);
+  ok = b != NULL;
+  bfx_del(b);
+  ok &= t.live == 0;
+  allocs = t.count;
+
+  for (i = 0; i < allocs; ++i) {
+    size_t sizes = total += t.sizes[i];
+    test_budget u;
+    memset(&u, 0, sizeof(u));
+    u.budget = sizes - 1; /* Allocation i fails */
+    a.ctx = &u;
+    b = bfx_new_with_allocator(&a);
+    ok &= b == NULL && u.live == 0;
+    if (b != NULL)
+      bfx_del(b);
+  }
+  test_expect("creation out of memory leaks nothing", ok);
+
+  bfx_arena_init(&arena, block, sizeof(block));
+  a = bfx_arena_allocator(&arena);
+  b = bfx_new_with_allocator(&a);
+  test_expect("a small arena fails creation", b == NULL);
+  if (b != NULL)
+    bfx_del(b);
+
+  /* An arena with exactly the room creation takes has none for a second
+   * IP, so splitting stops with an error. */
+  size = total + allocs * 64;
+  base = malloc(size);
+  bfx_arena_init(&arena, base, size);
+  b = bfx_new_with_allocator(&a);
+  ok = b != NULL;
+  if (ok) {
+    size = arena.used;
+    bfx_del(b);
+    bfx_arena_init(&arena, base, size);
+    b = bfx_new_with_allocator(&a);
+    ok = b != NULL;
+  }
+  if (ok) {
+    test_load(b, test_split_program);
+    ok = bfx_run(b) == BFX_WORD_MAX;
+    bfx_alloc_stats_get(b, &stats);
+    ok &= stats.failures > 0;
+    test_del(b);
+  }
+  free(base);
+  test_expect("an exhausted arena stops a run with an error", ok);
+
+  b = bfx_new();
+  bfx_alloc_stats_get(b, &stats);
+  ok = stats.failures == 0 && stats.bytes > 0 && stats.peak >= stats.bytes;
+  bfx_del(b);
+  test_expect("allocation stats count held bytes", ok);
+}
+
+/* Echoes its input one byte higher, stopping at end of input. */
+static const char *test_pipe_program =
+  "~:ff=w01+,@\n"
+  "     Q\n";
+
+/* Two stages through a ring smaller than the input shift every byte by
+ * two, and the last stage ends once the first does. */
+static void test_pipeline(void) {
+  bfx_pipeline *p = bfx_pipeline_new(2, 16);
+#if defined(BFX_NO_THREADS) || !defined(__linux__)
+  test_expect("pipelines need threads", p == NULL);
+#else
+  FILE *in = tmpfile(), *out = tmpfile();
+  beflux *b;
+  int i, ok = p != NULL && in != NULL && out != NULL;
+
+  if (ok) {
+    for (i = 0; i < 1000; ++i)
+      fputc('a' + i % 26, in);
+    rewind(in);
+    for (i = 0; i < 2; ++i)
+      test_load(bfx_pipeline_stage(p, i), test_pipe_program);
+    bfx_pipeline_stage(p, 0)->in = in;
+    bfx_pipeline_stage(p, 1)->out = out;
+    ok = bfx_pipeline_run(p) == 0;
+    rewind(out);
+    for (i = 0; i < 1000; ++i)
+      ok &= fgetc(out) == 'c' + i % 26;
+    ok &= fgetc(out) == EOF;
+    for (i = 0; i < 2; ++i) {
+      b = bfx_pipeline_stage(p, i);
+      b->in = stdin;
+      b->out = stdout;
+      fclose(b->err);
+      b->err = stderr;
+    }
+  }
+  if (p != NULL)
+    bfx_pipeline_del(p);
+  if (in != NULL)
+    fclose(in);
+  if (out != NULL)
+    fclose(out);
+  test_expect("pipeline stages feed each other", ok);
+#endif
+}
+
+static int test_wait(beflux *b) {
+  (void) b;
+  return BFX_ASYNC_PENDING;
+}
+
+static void test_write(const char *filename, const char *src) {
+  FILE *fout = fopen(filename, "w");
+  if (fout != NULL) {
+    fputs(src, fout);
+    fclose(fout);
+  }
+}
+
+/* Pushes 5 and waits on an async call, then exits with the top of the
+ * stack once it is completed. The edit adds 2 first, in a row the IP has not reached yet. */
+static void test_reload(void) {
+  bfx_watcher *w = bfx_watcher_new();
+#ifndef __linux__
+  test_expect("hot reload needs inotify", w == NULL);
+#else
+  beflux *b = bfx_new();
+  int ok = w != NULL;
+
+  b->err = tmpfile();
+  b->async_bindings[0] = test_wait;
+  if (ok) {
+    bfx_watcher_attach(w, b);
+    test_write("libbeflux_test.bfx", ":: reload ::\n0500Fv\n     q\n");
+    bfx_load(b, 0, "libbeflux_test");
+    ok = bfx_run(b) == 0 && b->mode == BFX_MODE_PARKED;
+    test_write("libbeflux_test.bfx", ":: reload ::\n0500Fv\n     >02+q\n");
+    ok &= bfx_watcher_poll(w) == 1;
+    bfx_complete(b, NULL, 0);
+    ok &= bfx_run(b) == 7;
+    bfx_watcher_attach(NULL, b);
+    bfx_watcher_del(w);
+    remove("libbeflux_test.bfx");
+  }
+  test_del(b);
+  test_expect("hot reload patches changed rows between runs", ok);
+#endif
+}
+
+/* Successive versions of a program, each saved over the last. */
+static const char *test_saves[] = {
+  "0500\n  v  \n abc\n  q\n\n  xyz\n",
+  "0500\n  v  \n abcdefgh\n  q\n\n  xyz\n",
+  "0500\n  v  \n abcdefgh\n",
+  "0500\n  v  \n abcdefgh\n\n\n\n      w\n",
+  "0501\n  v  \n abcdefgh\n\n\n\n      w\n",
+  "0501\n  v\n"
+};
+
+static int test_same_file(const char *a, const char *b) {
+  FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+  int ca, cb, same = fa != NULL && fb != NULL;
+  while (same && ((ca = fgetc(fa)) != EOF) | ((cb = fgetc(fb)) != EOF))
+    same = ca == cb;
+  if (fa != NULL)
+    fclose(fa);
+  if (fb != NULL)
+    fclose(fb);
+  return same;
+}
+
+/* Saving over a file the interpreter last wrote rewrites it from the first
+ * changed row; the result must match a full save by a fresh interpreter,
+ * including after the file is changed behind its back. */
+static void test_save(void) {
+  beflux *b = test_new(test_saves[0]), *full;
+  size_t i, row, col;
+  int ok = 1;
+
+  bfx_save(b, 0, "libbeflux_test_a");
+  for (i = 1; i < sizeof(test_saves) / sizeof(test_saves[0]); ++i) {
+    full = test_new(test_saves[i]);
+    for (row = 0; row < 8; ++row) {
+      for (col = 0; col < 16; ++col) {
+        bfx_word c = bfx_program_get(full, 0, row, col);
+        if (bfx_program_get(b, 0, row, col) != c)
+          bfx_program_set(b, 0, row, col, c);
+      }
+    }
+    if (i == 4)
+      test_write("libbeflux_test_a.bfx", "0500\n  v  \n abcdefgh\n\n");
+    bfx_save(b, 0, "libbeflux_test_a");
+    bfx_save(full, 0, "libbeflux_test_b");
+    ok &= test_same_file("libbeflux_test_a.bfx", "libbeflux_test_b.bfx");
+    test_del(full);
+  }
+  test_del(b);
+  remove("libbeflux_test_a.bfx");
+  remove("libbeflux_test_b.bfx");
+  test_expect("incremental saves match full saves", ok);
+}
+
+/* Branches South at 'w' on a zero it just pushed, so that only the walk,
+ * which follows both sides, reaches the '>' row. Row 2 never runs. */
+static const char *test_analyze_program =
+  "00w  q\n"
+  "  >  ^\n"
+  "xyz\n";
+
+static void test_analyze(void) {
+  beflux *b = test_new(test_analyze_program);
+  bfx_analysis *a = bfx_analyze(b, 0);
+  bfx_reach s;
+  long i;
+  int ok = a != NULL;
+
+  if (ok) {
+    ok &= bfx_analysis_dirs(a, 0, 2) == 1 << (BFX_IP_E >> 6);
+    ok &= bfx_analysis_dirs(a, 1, 2) == 1 << (BFX_IP_S >> 6);
+    ok &= bfx_analysis_dirs(a, 1, 5) == 1 << (BFX_IP_E >> 6);
+    ok &= bfx_analysis_dirs(a, 0, 5) == (1 << (BFX_IP_E >> 6) | 1 << (BFX_IP_N >> 6));
+    ok &= bfx_analysis_dirs(a, 0, 6) == 0;
+    ok &= bfx_analysis_dirs(a, 2, 0) == 0 && bfx_analysis_dirs(a, 2, 2) == 0;
+
+    memset(&s, 0, sizeof(s));
+    s.row = 0;
+    s.col = 2;
+    s.dir = BFX_IP_E;
+    s.mode = BFX_MODE_NORMAL;
+    i = bfx_analysis_find(a, &s);
+    ok &= i >= 0 && a->states[i].depth == 1;
+    s.row = 1;
+    s.col = 5;
+    i = bfx_analysis_find(a, &s);
+    ok &= i >= 0 && a->states[i].depth == 0;
+    s.dir = BFX_IP_W;
+    ok &= bfx_analysis_find(a, &s) == -1;
+    ok &= !a->self_modifies && !a->truncated && a->dynamic == 0;
+  }
+  bfx_analysis_del(a);
+  test_del(b);
+  test_expect("analysis reaches both sides of a branch and no more", ok);
+}
+
+/* Samples taken during a busy loop all land on its row, and only one
+ * interpreter is profiled at a time. */
+static void test_profile(void) {
+  beflux *b = test_new("\x7f\x7f\x7f:$@");
+  bfx_profile *p = bfx_profile_start(b, 1000);
+#ifndef __linux__
+  test_expect("profiling needs a CPU clock timer", p == NULL);
+#else
+  size_t i, samples = 0;
+  int ok = p != NULL;
+
+  if (ok) {
+    ok &= bfx_profile_start(b, 1000) == NULL;
+    b->fuel = 20000000;
+    bfx_run(b);
+    bfx_profile_stop(p);
+    for (i = 0; i < p->capacity; ++i) {
+      const bfx_profile_site *s = p->sites + i;
+      if (s->samples) {
+        samples += s->samples;
+        ok &= s->prog == 0 && s->row == 0 && s->col <= 5 && s->depth == 0;
+      }
+    }
+    ok &= p->samples > 0 && samples + p->dropped == p->samples;
+    bfx_profile_del(p);
+    p = bfx_profile_start(b, 1000);
+    ok &= p != NULL;
+    if (p != NULL) {
+      bfx_profile_stop(p);
+      bfx_profile_del(p);
+    }
+  }
+  test_expect("profile samples land in a busy loop", ok);
+#endif
+  test_del(b);
+}
+
+/* Counters count the run between begin and end where the kernel allows
+ * them, and are reported as unavailable where it does not. */
+static void test_perf(void) {
+  beflux *b = test_new("\x7f\x7f\x7f:$@");
+  FILE *report = tmpfile();
+  char line[128] = "";
+  bfx_perf perf;
+  int i, opened, valid = 0, unavailable = 0, ok = 1;
+
+  opened = bfx_perf_begin(b, &perf);
+  b->fuel = 1000000;
+  bfx_run(b);
+  bfx_perf_end(b, &perf);
+  for (i = 0; i < BFX_PERF_COUNTERS; ++i) {
+    ok &= perf.fds[i] == -1;
+    valid += perf.valid[i];
+  }
+  ok &= valid <= opened && perf.ticks == b->tick && perf.seconds >= 0;
+  if (perf.valid[BFX_PERF_INSTRUCTIONS])
+    ok &= perf.counts[BFX_PERF_INSTRUCTIONS] >= perf.ticks;
+
+  if (report != NULL) {
+    bfx_perf_print(&perf, report);
+    rewind(report);
+    while (fgets(line, sizeof(line), report) != NULL)
+      unavailable |= strstr(line, "not available") != NULL;
+    fclose(report);
+    ok &= unavailable == !valid;
+  }
+  test_del(b);
+  test_expect(valid ? "perf counters count a run" : "perf counters fail gracefully", ok);
+}
+
+/* Counts bytes through a run whose input is mostly read from the buffer,
+ * and keeps the time spent reading within the time spent running. */
+static void test_stats(void) {
+  beflux *b = test_new(test_pipe_program);
+  FILE *in = tmpfile(), *out = tmpfile();
+  bfx_stats stats;
+  int i, ok = in != NULL && out != NULL;
+
+  if (ok) {
+    for (i = 0; i < 10000; ++i)
+      fputc('a' + i % 26, in);
+    rewind(in);
+    b->in = in;
+    b->out = out;
+    ok = bfx_run(b) == 0;
+    bfx_stats_get(b, &stats);
+    ok &= stats.bytes_in == 10000 && stats.bytes_out == 10000;
+    ok &= stats.ticks == b->tick;
+    ok &= stats.reading >= 0 && stats.reading <= stats.running;
+    b->in = stdin;
+    b->out = stdout;
+  }
+  if (in != NULL)
+    fclose(in);
+  if (out != NULL)
+    fclose(out);
+  test_del(b);
+  test_expect("stats count input and output", ok);
+}
+
+#ifdef TEST_EMIT
+/* Counts down, printing each number, then exits with 7. */
+static const char *test_emit_loop =
+  ":: loop ::\n"
+  "0a>:.01-:v\n"
+  "  ^      _07q\n";
+
+/* Writes 'q' over the ':' it would otherwise reach, and exits with 5. The
+ * translation must see the write; compiled as written, it exits with 10. */
+static const char *test_emit_written =
+  ":: written ::\n"
+  "0571000010S     :+q\n";
+
+/**
+ * \brief Runs a program here and as an --emit-c translation built with
+ *        $CC $CFLAGS, or cc -O2 -Isrc, against lib.
+ * \return Whether both wrote the same output and exited the same way.
+ */
+static int test_emit_run(const char *beflux_exe, const char *lib, const char *src) {
+  char command[1024];
+  const char *cc = getenv("CC") != NULL ? getenv("CC") : "cc";
+  const char *cflags = getenv("CFLAGS") != NULL ? getenv("CFLAGS") : "-O2 -Isrc";
+  beflux *b = bfx_new();
+  FILE *out = tmpfile(), *compiled = NULL;
+  bfx_word status;
+  int code, c, ok = out != NULL;
+
+  test_write("libbeflux_test_emit.bfx", src);
+  b->err = tmpfile();
+  b->out = out != NULL ? out : stdout;
+  bfx_load(b, 0, "libbeflux_test_emit");
+  status = bfx_run(b);
+  b->out = stdout;
+  test_del(b);
+
+  sprintf(
+    command,
+    "%s --emit-c libbeflux_test_emit.bfx > libbeflux_test_emit.c && "
+    "%s %s libbeflux_test_emit.c %s -lpthread -lm -o libbeflux_test_emit",
+    beflux_exe, cc, cflags, lib
+  );
+  ok &= system(command) == 0;
+  if (ok) {
+    code = system("./libbeflux_test_emit > libbeflux_test_emit.out 2> /dev/null");
+    ok = WIFEXITED(code) && WEXITSTATUS(code) == (status & 0xff);
+    compiled = fopen("libbeflux_test_emit.out", "r");
+    ok &= compiled != NULL;
+    rewind(out);
+    do {
+      c = fgetc(out);
+      ok = c == fgetc(compiled);
+    } while (ok && c != EOF);
+  }
+  if (compiled != NULL)
+    fclose(compiled);
+  if (out != NULL)
+    fclose(out);
+  remove("libbeflux_test_emit.bfx");
+  remove("libbeflux_test_emit.c");
+  remove("libbeflux_test_emit.out");
+  remove("libbeflux_test_emit");
+  return ok;
+}
+
+static void test_emit(const char *beflux_exe, const char *lib) {
+  test_expect(
+    "--emit-c matches the interpreter",
+    test_emit_run(beflux_exe, lib, test_emit_loop)
+  );
+  test_expect(
+    "--emit-c falls back once program 0 is written",
+    test_emit_run(beflux_exe, lib, test_emit_written)
+  );
+}
+#endif
+#endif
+
+static int test_main(const char *beflux_exe, const char *lib) {
+#if BFX_WORD_BITS == 8
+  test_split();
+#ifdef TEST_WORKERS
+  test_park();
+#endif
+  test_iterate_fuel();
+  test_trace_fuel();
+  test_checked();
+  test_flight();
+  test_span();
+  test_arena();
+  test_pipeline();
+  test_reload();
+  test_save();
+  test_analyze();
+  test_profile();
+  test_perf();
+  test_stats();
+#ifdef TEST_EMIT
+  if (beflux_exe != NULL && lib != NULL)
+    test_emit(beflux_exe, lib);
+#endif
+  printf("%d failed\n", test_failures);
+  return test_failures != 0;
+#else
+  (void) beflux_exe;
+  (void) lib;
+  printf("Checks need an 8-bit build.\n");
+  return 0;
+#endif
+}
+
 int main(int argc, char **argv) {
   int status = 0;
   if (argc == 1) {
-    fprintf(stderr, ":: LIBBEFLUX_TEST ::\nUsage: libbeflux_test [program.bfx]\n");
+    fprintf(
+      stderr,
+      ":: LIBBEFLUX_TEST ::\nUsage: libbeflux_test [program.bfx]\n"
+      "       libbeflux_test --check [beflux libbeflux.a]\n"
+    );
+  }
+  else if (strcmp(argv[1], "--check") == 0) {
+    status = test_main(argc > 3 ? argv[2] : NULL, argc > 3 ? argv[3] : NULL);
   }
   else {
     beflux *b = bfx_new();